@@ -376,6 +376,8 @@ bool OBSApp::InitGlobalConfigDefaults()
 				  "Normal");
 	config_set_default_bool(globalConfig, "General", "EnableAutoUpdates",
 				true);
+	config_set_default_bool(globalConfig, "General",
+				"BinarySceneCollectionCache", false);
 
 #if _WIN32
 	config_set_default_string(globalConfig, "Video", "Renderer",
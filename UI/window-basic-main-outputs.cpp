@@ -782,6 +782,8 @@ bool SimpleOutput::StartStreaming(obs_service_t *service)
 						   "NewSocketLoopEnable");
 	bool enableLowLatencyMode =
 		config_get_bool(main->Config(), "Output", "LowLatencyEnable");
+	bool enableDynBitrate =
+		config_get_bool(main->Config(), "Output", "DynamicBitrate");
 
 	obs_data_t *settings = obs_data_create();
 	obs_data_set_string(settings, "bind_ip", bindIP);
@@ -789,6 +791,7 @@ bool SimpleOutput::StartStreaming(obs_service_t *service)
 			  enableNewSocketLoop);
 	obs_data_set_bool(settings, "low_latency_mode_enabled",
 			  enableLowLatencyMode);
+	obs_data_set_bool(settings, "dyn_bitrate", enableDynBitrate);
 	obs_output_update(streamOutput, settings);
 	obs_data_release(settings);
 
@@ -890,6 +893,12 @@ bool SimpleOutput::ConfigureRecording(bool updateReplayBuffer)
 		config_get_int(main->Config(), "SimpleOutput", "RecRBTime");
 	int rbSize =
 		config_get_int(main->Config(), "SimpleOutput", "RecRBSize");
+	int rbRAMTime =
+		config_get_int(main->Config(), "Output", "ReplayBufferRAMTime");
+	int splitTime =
+		config_get_int(main->Config(), "Output", "RecSplitFileTime");
+	int splitSize =
+		config_get_int(main->Config(), "Output", "RecSplitFileSize");
 
 	os_dir_t *dir = path && path[0] ? os_opendir(path) : nullptr;
 
@@ -946,9 +955,12 @@ bool SimpleOutput::ConfigureRecording(bool updateReplayBuffer)
 		obs_data_set_int(settings, "max_time_sec", rbTime);
 		obs_data_set_int(settings, "max_size_mb",
 				 usingRecordingPreset ? rbSize : 0);
+		obs_data_set_int(settings, "max_ram_time_sec", rbRAMTime);
 	} else {
 		obs_data_set_string(settings, ffmpegOutput ? "url" : "path",
 				    strPath.c_str());
+		obs_data_set_int(settings, "max_time_sec", splitTime);
+		obs_data_set_int(settings, "max_size_mb", splitSize);
 	}
 
 	obs_data_set_string(settings, "muxer_settings", mux);
@@ -1583,6 +1595,8 @@ bool AdvancedOutput::StartStreaming(obs_service_t *service)
 						   "NewSocketLoopEnable");
 	bool enableLowLatencyMode =
 		config_get_bool(main->Config(), "Output", "LowLatencyEnable");
+	bool enableDynBitrate =
+		config_get_bool(main->Config(), "Output", "DynamicBitrate");
 
 	obs_data_t *settings = obs_data_create();
 	obs_data_set_string(settings, "bind_ip", bindIP);
@@ -1590,6 +1604,7 @@ bool AdvancedOutput::StartStreaming(obs_service_t *service)
 			  enableNewSocketLoop);
 	obs_data_set_bool(settings, "low_latency_mode_enabled",
 			  enableLowLatencyMode);
+	obs_data_set_bool(settings, "dyn_bitrate", enableDynBitrate);
 	obs_output_update(streamOutput, settings);
 	obs_data_release(settings);
 
@@ -1686,6 +1701,12 @@ bool AdvancedOutput::StartRecording()
 		obs_data_t *settings = obs_data_create();
 		obs_data_set_string(settings, ffmpegRecording ? "url" : "path",
 				    strPath.c_str());
+		obs_data_set_int(settings, "max_time_sec",
+				 config_get_int(main->Config(), "Output",
+						"RecSplitFileTime"));
+		obs_data_set_int(settings, "max_size_mb",
+				 config_get_int(main->Config(), "Output",
+						"RecSplitFileSize"));
 
 		obs_output_update(fileOutput, settings);
 
@@ -1719,6 +1740,7 @@ bool AdvancedOutput::StartReplayBuffer()
 	const char *rbSuffix;
 	int rbTime;
 	int rbSize;
+	int rbRAMTime;
 
 	if (!useStreamEncoder) {
 		if (!ffmpegOutput)
@@ -1753,6 +1775,8 @@ bool AdvancedOutput::StartReplayBuffer()
 					     "RecRBSuffix");
 		rbTime = config_get_int(main->Config(), "AdvOut", "RecRBTime");
 		rbSize = config_get_int(main->Config(), "AdvOut", "RecRBSize");
+		rbRAMTime = config_get_int(main->Config(), "Output",
+					   "ReplayBufferRAMTime");
 
 		os_dir_t *dir = path && path[0] ? os_opendir(path) : nullptr;
 
@@ -1809,6 +1833,7 @@ bool AdvancedOutput::StartReplayBuffer()
 		obs_data_set_int(settings, "max_time_sec", rbTime);
 		obs_data_set_int(settings, "max_size_mb",
 				 usesBitrate ? 0 : rbSize);
+		obs_data_set_int(settings, "max_ram_time_sec", rbRAMTime);
 
 		obs_output_update(replayBuffer, settings);
 
@@ -17,6 +17,8 @@
 
 #include <obs.hpp>
 #include <util/util.hpp>
+#include <util/platform.h>
+#include <sys/stat.h>
 #include <QMessageBox>
 #include <QVariant>
 #include <QFileDialog>
@@ -28,6 +30,58 @@
 
 using namespace std;
 
+/* an optional binary copy of each scene collection is kept next to it.  it is
+ * only used while it's at least as new as the json file, so editing or
+ * replacing the json file by hand still works */
+static bool UseSceneCollectionCache()
+{
+	return config_get_bool(App()->GlobalConfig(), "General",
+			       "BinarySceneCollectionCache");
+}
+
+static time_t FileModifiedTime(const char *file)
+{
+	struct stat st;
+	return os_stat(file, &st) == 0 ? st.st_mtime : 0;
+}
+
+obs_data_t *LoadSceneCollectionFile(const char *file)
+{
+	string cacheFile = string(file) + ".bin";
+	obs_data_t *data = nullptr;
+
+	if (!UseSceneCollectionCache())
+		return obs_data_create_from_json_file_safe(file, "bak");
+
+	time_t cacheTime = FileModifiedTime(cacheFile.c_str());
+	if (cacheTime && cacheTime >= FileModifiedTime(file))
+		data = obs_data_create_from_binary_file(cacheFile.c_str());
+
+	if (!data) {
+		data = obs_data_create_from_json_file_safe(file, "bak");
+		if (data)
+			obs_data_save_binary_safe(data, cacheFile.c_str(),
+						  "tmp", nullptr);
+	}
+
+	return data;
+}
+
+bool SaveSceneCollectionFile(obs_data_t *data, const char *file)
+{
+	string cacheFile = string(file) + ".bin";
+
+	if (!obs_data_save_json_safe(data, file, "tmp", "bak"))
+		return false;
+
+	if (UseSceneCollectionCache())
+		obs_data_save_binary_safe(data, cacheFile.c_str(), "tmp",
+					  nullptr);
+	else
+		os_unlink(cacheFile.c_str());
+	return true;
+}
+
 void EnumSceneCollections(std::function<bool(const char *, const char *)> &&cb)
 {
 	char path[512];
@@ -52,8 +106,7 @@ void EnumSceneCollections(std::function<bool(const char *, const char *)> &&cb)
 		if (glob->gl_pathv[i].directory)
 			continue;
 
-		obs_data_t *data =
-			obs_data_create_from_json_file_safe(filePath, "bak");
+		obs_data_t *data = LoadSceneCollectionFile(filePath);
 		std::string name = obs_data_get_string(data, "name");
 
 		/* if no name found, use the file name as the name
@@ -288,6 +341,7 @@ void OBSBasic::on_actionRenameSceneCollection_triggered()
 	oldFile.insert(0, path);
 	oldFile += ".json";
 	os_unlink(oldFile.c_str());
+	os_unlink((oldFile + ".bin").c_str());
 	oldFile += ".bak";
 	os_unlink(oldFile.c_str());
 
@@ -349,6 +403,7 @@ void OBSBasic::on_actionRemoveSceneCollection_triggered()
 	oldFile.insert(0, path);
 	oldFile += ".json";
 	os_unlink(oldFile.c_str());
+	os_unlink((oldFile + ".bin").c_str());
 	oldFile += ".bak";
 	os_unlink(oldFile.c_str());
 
@@ -151,6 +151,9 @@ static void AddExtraModulePaths()
 
 extern obs_frontend_callbacks *InitializeAPIInterface(OBSBasic *main);
 
+extern obs_data_t *LoadSceneCollectionFile(const char *file);
+extern bool SaveSceneCollectionFile(obs_data_t *data, const char *file);
+
 static int CountVideoSources()
 {
 	int count = 0;
@@ -625,7 +628,7 @@ void OBSBasic::Save(const char *file)
 		obs_data_release(moduleObj);
 	}
 
-	if (!obs_data_save_json_safe(saveData, file, "tmp", "bak"))
+	if (!SaveSceneCollectionFile(saveData, file))
 		blog(LOG_ERROR, "Could not save scene data to %s", file);
 
 	obs_data_release(saveData);
@@ -839,7 +842,7 @@ void OBSBasic::Load(const char *file)
 {
 	disableSaving++;
 
-	obs_data_t *data = obs_data_create_from_json_file_safe(file, "bak");
+	obs_data_t *data = LoadSceneCollectionFile(file);
 	if (!data) {
 		disableSaving--;
 		blog(LOG_INFO, "No scene file found, creating default scene");
@@ -1276,6 +1279,11 @@ bool OBSBasic::InitBasicConfigDefaults()
 				false);
 	config_set_default_bool(basicConfig, "Output", "LowLatencyEnable",
 				false);
+	config_set_default_bool(basicConfig, "Output", "DynamicBitrate",
+				false);
+	config_set_default_int(basicConfig, "Output", "ReplayBufferRAMTime", 0);
+	config_set_default_int(basicConfig, "Output", "RecSplitFileTime", 0);
+	config_set_default_int(basicConfig, "Output", "RecSplitFileSize", 0);
 
 	int i = 0;
 	uint32_t scale_cx = cx;
@@ -3491,6 +3499,11 @@ int OBSBasic::ResetVideo()
 		config_get_uint(App()->GlobalConfig(), "Video", "AdapterIdx");
 	ovi.gpu_conversion = true;
 	ovi.scale_type = GetScaleType(basicConfig);
+	ovi.conversion_threads = 0;
+	ovi.threaded_video_inputs = false;
+	ovi.cache_size = 0;
+	ovi.staging_surfaces = 0;
+	ovi.adaptive_staging = false;
 
 	if (ovi.base_width == 0 || ovi.base_height == 0) {
 		ovi.base_width = 1920;
@@ -3547,6 +3560,7 @@ bool OBSBasic::ResetAudio()
 	struct obs_audio_info ai;
 	ai.samples_per_sec =
 		config_get_uint(basicConfig, "Audio", "SampleRate");
+	ai.render_threads = 0;
 
 	const char *channelSetupStr =
 		config_get_string(basicConfig, "Audio", "ChannelSetup");
@@ -123,6 +123,7 @@ OBSBasicStats::OBSBasicStats(QWidget *parent, bool closeable)
 
 	AddOutputLabels(QTStr("Basic.Stats.Output.Stream"));
 	AddOutputLabels(QTStr("Basic.Stats.Output.Recording"));
+	AddOutputLabels(QTStr("Basic.Stats.Output.ReplayBuffer"));
 
 	/* --------------------------------------------- */
 
@@ -422,6 +423,10 @@ void OBSBasicStats::Update()
 	outputLabels[0].Update(strOutput, false);
 	outputLabels[1].Update(recOutput, true);
 
+	OBSOutput rbOutput = obs_frontend_get_replay_buffer_output();
+	obs_output_release(rbOutput);
+	outputLabels[2].UpdateReplayBuffer(rbOutput);
+
 	if (obs_output_active(recOutput)) {
 		long double kbps = outputLabels[1].kbps;
 		bitrates.push_back(kbps);
@@ -565,6 +570,35 @@ void OBSBasicStats::OutputLabels::Update(obs_output_t *output, bool rec)
 	lastBytesSentTime = curTime;
 }
 
+void OBSBasicStats::OutputLabels::UpdateReplayBuffer(obs_output_t *output)
+{
+	bool active = output ? obs_output_active(output) : false;
+	long long ramBytes = 0;
+	long long diskBytes = 0;
+
+	if (active) {
+		proc_handler_t *ph = obs_output_get_proc_handler(output);
+		calldata_t cd = {0};
+
+		if (proc_handler_call(ph, "get_buffer_usage", &cd)) {
+			ramBytes = calldata_int(&cd, "ram_bytes");
+			diskBytes = calldata_int(&cd, "disk_bytes");
+		}
+
+		calldata_free(&cd);
+	}
+
+	status->setText(QTStr(active ? "Basic.Stats.Status.Buffering"
+				     : "Basic.Stats.Status.Inactive"));
+
+	long double ramMB = (long double)ramBytes / (1024.0l * 1024.0l);
+	long double diskMB = (long double)diskBytes / (1024.0l * 1024.0l);
+
+	megabytesSent->setText(QTStr("Basic.Stats.ReplayBufferUsage")
+				       .arg(QString::number(ramMB, 'f', 1),
+					    QString::number(diskMB, 'f', 1)));
+}
+
 void OBSBasicStats::OutputLabels::Reset(obs_output_t *output)
 {
 	if (!output)
@@ -47,6 +47,7 @@ class OBSBasicStats : public QWidget {
 		int first_dropped = 0;
 
 		void Update(obs_output_t *output, bool rec);
+		void UpdateReplayBuffer(obs_output_t *output);
 		void Reset(obs_output_t *output);
 
 		long double kbps = 0.0l;
@@ -16,26 +16,117 @@
 
 #include "../util/darray.h"
 #include "../util/threading.h"
+#include "../util/platform.h"
+#include "../util/fnv1a.h"
 
 #include "decl.h"
 #include "signal.h"
 
+/*
+ * Signals are emitted far more often than callbacks are connected, so
+ * emitting a signal doesn't lock anything:
+ *
+ * - signals are looked up in a hash table that is only ever added to, and
+ *   replaced when it grows
+ * - the callbacks of a signal are kept in an immutable list.  connecting or
+ *   disconnecting builds a new list and swaps it in, and emitting only has
+ *   to take a reference to the current list
+ */
+
 struct signal_callback {
+	volatile long refs;
 	signal_callback_t callback;
 	void *data;
-	bool remove;
 	bool keep_ref;
+
+	/* set once, when disconnected.  lists that still contain the callback
+	 * skip it from then on */
+	volatile long remove;
+
+	/* emissions that are calling the callback, or about to.  emitting
+	 * increments it before checking remove, and disconnecting sets remove
+	 * before checking it, so once it's down to the calls further up the
+	 * disconnecting thread's stack no other call can start */
+	volatile long running;
+};
+
+struct callback_list {
+	volatile long refs;
+	size_t num;
+	struct signal_callback **array;
+
+	/* next list replaced before this one that may still be loaded */
+	struct callback_list *next;
 };
 
 struct signal_info {
 	struct decl_info func;
-	DARRAY(struct signal_callback) callbacks;
+	uint32_t hash;
+
+	/* NULL if nothing is connected.  only replaced while holding mutex */
+	struct callback_list *volatile callbacks;
 	pthread_mutex_t mutex;
-	bool signalling;
 
-	struct signal_info *next;
+	/* emitters that may have loaded the list but not referenced it yet,
+	 * and the replaced lists they may have loaded */
+	volatile long loading;
+	struct callback_list *retired;
+};
+
+struct signal_table {
+	size_t size;
+	struct signal_info **slots;
+	struct signal_table *prev;
 };
 
+static inline void signal_callback_addref(struct signal_callback *cb)
+{
+	os_atomic_inc_long(&cb->refs);
+}
+
+static inline void signal_callback_release(struct signal_callback *cb)
+{
+	if (os_atomic_dec_long(&cb->refs) == 0)
+		bfree(cb);
+}
+
+static inline bool signal_callback_removed(struct signal_callback *cb)
+{
+	return os_atomic_load_long(&cb->remove) != 0;
+}
+
+static struct callback_list *callback_list_create(size_t num)
+{
+	struct callback_list *list;
+
+	if (!num)
+		return NULL;
+
+	list = bmalloc(sizeof(*list) + num * sizeof(struct signal_callback *));
+	list->refs = 1;
+	list->num = 0;
+	list->array = (struct signal_callback **)(list + 1);
+	return list;
+}
+
+static void callback_list_release(struct callback_list *list)
+{
+	if (list && os_atomic_dec_long(&list->refs) == 0) {
+		for (size_t i = 0; i < list->num; i++)
+			signal_callback_release(list->array[i]);
+		bfree(list);
+	}
+}
+
+static void callback_list_release_all(struct callback_list *list)
+{
+	while (list) {
+		struct callback_list *next = list->next;
+		callback_list_release(list);
+		list = next;
+	}
+}
+
 static inline struct signal_info *signal_info_create(struct decl_info *info)
 {
 	pthread_mutexattr_t attr;
@@ -46,12 +137,10 @@ static inline struct signal_info *signal_info_create(struct decl_info *info)
 	if (pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE) != 0)
 		return NULL;
 
-	si = bmalloc(sizeof(struct signal_info));
+	si = bzalloc(sizeof(struct signal_info));
 
 	si->func = *info;
-	si->next = NULL;
-	si->signalling = false;
-	da_init(si->callbacks);
+	si->hash = calc_fnv1a(info->name);
 
 	if (pthread_mutex_init(&si->mutex, &attr) != 0) {
 		blog(LOG_ERROR, "Could not create signal");
@@ -69,23 +158,105 @@ static inline void signal_info_destroy(struct signal_info *si)
 	if (si) {
 		pthread_mutex_destroy(&si->mutex);
 		decl_info_free(&si->func);
-		da_free(si->callbacks);
+		callback_list_release(si->callbacks);
+		callback_list_release_all(si->retired);
 		bfree(si);
 	}
 }
 
-static inline size_t signal_get_callback_idx(struct signal_info *si,
-					     signal_callback_t callback,
-					     void *data)
+/* takes a reference to the current callbacks of a signal */
+static struct callback_list *signal_get_callbacks(struct signal_info *si)
 {
-	for (size_t i = 0; i < si->callbacks.num; i++) {
-		struct signal_callback *sc = si->callbacks.array + i;
+	struct callback_list *list;
 
-		if (sc->callback == callback && sc->data == data)
-			return i;
+	os_atomic_inc_long(&si->loading);
+
+	list = os_atomic_load_ptr((void *const volatile *)&si->callbacks);
+	if (list)
+		os_atomic_inc_long(&list->refs);
+
+	os_atomic_dec_long(&si->loading);
+	return list;
+}
+
+/* must be called with the signal mutex held.  the old list can only be
+ * released once no emitter can be about to reference it.  rather than wait
+ * for that, which could mean waiting on a thread that is itself connecting
+ * or disconnecting from inside an emission, replaced lists are kept until
+ * no emitter is loading the list when it's next replaced */
+static void signal_set_callbacks(struct signal_info *si,
+				 struct callback_list *list)
+{
+	struct callback_list *old =
+		os_atomic_set_ptr((void *volatile *)&si->callbacks, list);
+
+	if (old) {
+		old->next = si->retired;
+		si->retired = old;
 	}
 
-	return DARRAY_INVALID;
+	if (!os_atomic_load_long(&si->loading)) {
+		callback_list_release_all(si->retired);
+		si->retired = NULL;
+	}
+}
+
+/* must be called with the signal mutex held.  copies the current callbacks
+ * without the removed ones, returns how many handler references they held */
+static long signal_update_callbacks(struct signal_info *si,
+				    struct signal_callback *add)
+{
+	struct callback_list *cur = si->callbacks;
+	struct callback_list *list;
+	size_t num = add ? 1 : 0;
+	long removed_refs = 0;
+
+	for (size_t i = 0; cur && i < cur->num; i++) {
+		if (!signal_callback_removed(cur->array[i]))
+			num++;
+	}
+
+	if (!add && (!cur || num == cur->num))
+		return 0;
+
+	list = callback_list_create(num);
+
+	for (size_t i = 0; cur && i < cur->num; i++) {
+		struct signal_callback *cb = cur->array[i];
+
+		if (signal_callback_removed(cb)) {
+			if (cb->keep_ref)
+				removed_refs++;
+		} else {
+			signal_callback_addref(cb);
+			list->array[list->num++] = cb;
+		}
+	}
+
+	if (add) {
+		signal_callback_addref(add);
+		list->array[list->num++] = add;
+	}
+
+	signal_set_callbacks(si, list);
+	return removed_refs;
+}
+
+static struct signal_callback *signal_find_callback(struct signal_info *si,
+						    signal_callback_t callback,
+						    void *data)
+{
+	struct callback_list *list = si->callbacks;
+
+	for (size_t i = 0; list && i < list->num; i++) {
+		struct signal_callback *cb = list->array[i];
+
+		if (cb->callback == callback && cb->data == data &&
+		    !signal_callback_removed(cb))
+			return cb;
+	}
+
+	return NULL;
 }
 
 struct global_callback_info {
@@ -96,32 +267,86 @@ struct global_callback_info {
 };
 
 struct signal_handler {
-	struct signal_info *first;
+	struct signal_table *volatile signals;
+	size_t num_signals;
 	pthread_mutex_t mutex;
 	volatile long refs;
 
 	DARRAY(struct global_callback_info) global_callbacks;
 	pthread_mutex_t global_callbacks_mutex;
+	volatile long num_global_callbacks;
 };
 
 static struct signal_info *getsignal(signal_handler_t *handler,
-				     const char *name,
-				     struct signal_info **p_last)
+				     const char *name)
 {
-	struct signal_info *signal, *last = NULL;
+	struct signal_table *table;
+	uint32_t hash;
+	size_t mask;
+
+	if (!handler)
+		return NULL;
+
+	table = os_atomic_load_ptr((void *const volatile *)&handler->signals);
+	if (!table)
+		return NULL;
+
+	hash = calc_fnv1a(name);
+	mask = table->size - 1;
 
-	signal = handler->first;
-	while (signal != NULL) {
-		if (strcmp(signal->func.name, name) == 0)
-			break;
+	for (size_t i = hash & mask;; i = (i + 1) & mask) {
+		struct signal_info *si = os_atomic_load_ptr(
+			(void *const volatile *)&table->slots[i]);
 
-		last = signal;
-		signal = signal->next;
+		if (!si)
+			return NULL;
+		if (si->hash == hash && strcmp(si->func.name, name) == 0)
+			return si;
 	}
+}
+
+static inline void signal_table_insert(struct signal_table *table,
+				       struct signal_info *si)
+{
+	size_t mask = table->size - 1;
+	size_t i = si->hash & mask;
 
-	if (p_last)
-		*p_last = last;
-	return signal;
+	while (table->slots[i])
+		i = (i + 1) & mask;
+
+	os_atomic_set_ptr((void *volatile *)&table->slots[i], si);
+}
+
+/* must be called with the handler mutex held.  tables are never modified
+ * other than filling empty slots, and replaced tables are kept until the
+ * handler is destroyed because lookups don't lock */
+static void signal_table_add(signal_handler_t *handler, struct signal_info *si)
+{
+	struct signal_table *old = handler->signals;
+	struct signal_table *table;
+	size_t size;
+
+	if (old && (handler->num_signals + 1) * 2 <= old->size) {
+		signal_table_insert(old, si);
+		handler->num_signals++;
+		return;
+	}
+
+	size = old ? old->size * 2 : 16;
+	table = bzalloc(sizeof(*table) + size * sizeof(struct signal_info *));
+	table->size = size;
+	table->slots = (struct signal_info **)(table + 1);
+	table->prev = old;
+
+	for (size_t i = 0; old && i < old->size; i++) {
+		if (old->slots[i])
+			signal_table_insert(table, old->slots[i]);
+	}
+
+	signal_table_insert(table, si);
+	handler->num_signals++;
+
+	os_atomic_set_ptr((void *volatile *)&handler->signals, table);
 }
 
 /* ------------------------------------------------------------------------- */
@@ -129,7 +354,6 @@ static struct signal_info *getsignal(signal_handler_t *handler,
 signal_handler_t *signal_handler_create(void)
 {
 	struct signal_handler *handler = bzalloc(sizeof(struct signal_handler));
-	handler->first = NULL;
 	handler->refs = 1;
 
 	pthread_mutexattr_t attr;
@@ -156,11 +380,15 @@ signal_handler_t *signal_handler_create(void)
 
 static void signal_handler_actually_destroy(signal_handler_t *handler)
 {
-	struct signal_info *sig = handler->first;
-	while (sig != NULL) {
-		struct signal_info *next = sig->next;
-		signal_info_destroy(sig);
-		sig = next;
+	struct signal_table *table = handler->signals;
+
+	for (size_t i = 0; table && i < table->size; i++)
+		signal_info_destroy(table->slots[i]);
+
+	while (table) {
+		struct signal_table *prev = table->prev;
+		bfree(table);
+		table = prev;
 	}
 
 	da_free(handler->global_callbacks);
@@ -176,10 +404,17 @@ void signal_handler_destroy(signal_handler_t *handler)
 	}
 }
 
+static inline void signal_handler_release_refs(signal_handler_t *handler,
+					       long refs)
+{
+	if (refs && os_atomic_add_long(&handler->refs, -refs) == 0)
+		signal_handler_actually_destroy(handler);
+}
+
 bool signal_handler_add(signal_handler_t *handler, const char *signal_decl)
 {
 	struct decl_info func = {0};
-	struct signal_info *sig, *last;
+	struct signal_info *sig;
 	bool success = true;
 
 	if (!parse_decl_string(&func, signal_decl)) {
@@ -189,17 +424,17 @@ bool signal_handler_add(signal_handler_t *handler, const char *signal_decl)
 
 	pthread_mutex_lock(&handler->mutex);
 
-	sig = getsignal(handler, func.name, &last);
+	sig = getsignal(handler, func.name);
 	if (sig) {
 		blog(LOG_WARNING, "Signal declaration '%s' exists", func.name);
 		decl_info_free(&func);
 		success = false;
 	} else {
 		sig = signal_info_create(&func);
-		if (!last)
-			handler->first = sig;
+		if (sig)
+			signal_table_add(handler, sig);
 		else
-			last->next = sig;
+			success = false;
 	}
 
 	pthread_mutex_unlock(&handler->mutex);
@@ -212,17 +447,13 @@ static void signal_handler_connect_internal(signal_handler_t *handler,
 					    signal_callback_t callback,
 					    void *data, bool keep_ref)
 {
-	struct signal_info *sig, *last;
-	struct signal_callback cb_data = {callback, data, false, keep_ref};
-	size_t idx;
+	struct signal_info *sig;
+	long removed_refs = 0;
 
 	if (!handler)
 		return;
 
-	pthread_mutex_lock(&handler->mutex);
-	sig = getsignal(handler, signal, &last);
-	pthread_mutex_unlock(&handler->mutex);
-
+	sig = getsignal(handler, signal);
 	if (!sig) {
 		blog(LOG_WARNING,
 		     "signal_handler_connect: "
@@ -238,11 +469,20 @@ static void signal_handler_connect_internal(signal_handler_t *handler,
 	if (keep_ref)
 		os_atomic_inc_long(&handler->refs);
 
-	idx = signal_get_callback_idx(sig, callback, data);
-	if (keep_ref || idx == DARRAY_INVALID)
-		da_push_back(sig->callbacks, &cb_data);
+	if (keep_ref || !signal_find_callback(sig, callback, data)) {
+		struct signal_callback *cb = bzalloc(sizeof(*cb));
+		cb->refs = 1;
+		cb->callback = callback;
+		cb->data = data;
+		cb->keep_ref = keep_ref;
+
+		removed_refs = signal_update_callbacks(sig, cb);
+		signal_callback_release(cb);
+	}
 
 	pthread_mutex_unlock(&sig->mutex);
+
+	signal_handler_release_refs(handler, removed_refs);
 }
 
 void signal_handler_connect(signal_handler_t *handler, const char *signal,
@@ -257,57 +497,88 @@ void signal_handler_connect_ref(signal_handler_t *handler, const char *signal,
 	signal_handler_connect_internal(handler, signal, callback, data, true);
 }
 
-static inline struct signal_info *getsignal_locked(signal_handler_t *handler,
-						   const char *name)
-{
+struct signal_frame {
 	struct signal_info *sig;
+	struct callback_list *list;
+	struct signal_callback *cb;
+	struct signal_frame *prev;
+};
 
-	if (!handler)
-		return NULL;
+static THREAD_LOCAL struct signal_frame *current_signal_frame = NULL;
+static THREAD_LOCAL struct global_callback_info *current_global_cb = NULL;
 
-	pthread_mutex_lock(&handler->mutex);
-	sig = getsignal(handler, name, NULL);
-	pthread_mutex_unlock(&handler->mutex);
+/* calls of the callback further up the stack of this thread, which can't
+ * finish before disconnecting returns */
+static inline long own_calls(struct signal_callback *cb)
+{
+	long calls = 0;
+
+	for (struct signal_frame *frame = current_signal_frame; frame;
+	     frame = frame->prev) {
+		if (frame->cb == cb)
+			calls++;
+	}
+
+	return calls;
+}
 
-	return sig;
+static inline bool emitting(struct signal_info *sig)
+{
+	for (struct signal_frame *frame = current_signal_frame; frame;
+	     frame = frame->prev) {
+		if (frame->sig == sig)
+			return true;
+	}
+
+	return false;
 }
 
 void signal_handler_disconnect(signal_handler_t *handler, const char *signal,
 			       signal_callback_t callback, void *data)
 {
-	struct signal_info *sig = getsignal_locked(handler, signal);
-	bool keep_ref = false;
-	size_t idx;
+	struct signal_info *sig = getsignal(handler, signal);
+	struct signal_callback *cb;
+	long removed_refs = 0;
 
 	if (!sig)
 		return;
 
 	pthread_mutex_lock(&sig->mutex);
 
-	idx = signal_get_callback_idx(sig, callback, data);
-	if (idx != DARRAY_INVALID) {
-		if (sig->signalling) {
-			sig->callbacks.array[idx].remove = true;
-		} else {
-			keep_ref = sig->callbacks.array[idx].keep_ref;
-			da_erase(sig->callbacks, idx);
-		}
+	cb = signal_find_callback(sig, callback, data);
+	if (cb) {
+		os_atomic_compare_swap_long(&cb->remove, 0, 1);
+		signal_callback_addref(cb);
+		removed_refs = signal_update_callbacks(sig, NULL);
 	}
 
 	pthread_mutex_unlock(&sig->mutex);
 
-	if (keep_ref && os_atomic_dec_long(&handler->refs) == 0) {
-		signal_handler_actually_destroy(handler);
+	/* like before signals could be emitted without locking, the
+	 * callback is guaranteed not to be running on another thread once
+	 * this returns.  emissions of a signal used to be serialized though,
+	 * so a callback of the signal couldn't be running anywhere else while
+	 * it was disconnected from inside an emission.  now the other thread
+	 * could be disconnecting a callback this thread is in the middle of,
+	 * and neither would return, so that case doesn't wait */
+	if (cb) {
+		long calls = own_calls(cb);
+
+		if (!emitting(sig)) {
+			while (os_atomic_load_long(&cb->running) > calls)
+				os_sleep_ms(0);
+		}
+		signal_callback_release(cb);
 	}
-}
 
-static THREAD_LOCAL struct signal_callback *current_signal_cb = NULL;
-static THREAD_LOCAL struct global_callback_info *current_global_cb = NULL;
+	signal_handler_release_refs(handler, removed_refs);
+}
 
 void signal_handler_remove_current(void)
 {
-	if (current_signal_cb)
-		current_signal_cb->remove = true;
+	if (current_signal_frame && current_signal_frame->cb)
+		os_atomic_compare_swap_long(&current_signal_frame->cb->remove,
+					    0, 1);
 	else if (current_global_cb)
 		current_global_cb->remove = true;
 }
@@ -315,40 +586,47 @@ void signal_handler_remove_current(void)
 void signal_handler_signal(signal_handler_t *handler, const char *signal,
 			   calldata_t *params)
 {
-	struct signal_info *sig = getsignal_locked(handler, signal);
+	struct signal_info *sig = getsignal(handler, signal);
+	struct signal_frame frame = {sig, NULL, NULL, current_signal_frame};
 	long remove_refs = 0;
+	bool removed = false;
 
 	if (!sig)
 		return;
 
-	pthread_mutex_lock(&sig->mutex);
-	sig->signalling = true;
-
-	for (size_t i = 0; i < sig->callbacks.num; i++) {
-		struct signal_callback *cb = sig->callbacks.array + i;
-		if (!cb->remove) {
-			current_signal_cb = cb;
-			cb->callback(cb->data, params);
-			current_signal_cb = NULL;
-		}
-	}
+	frame.list = signal_get_callbacks(sig);
+	if (frame.list) {
+		current_signal_frame = &frame;
 
-	for (size_t i = sig->callbacks.num; i > 0; i--) {
-		struct signal_callback *cb = sig->callbacks.array + i - 1;
-		if (cb->remove) {
-			if (cb->keep_ref)
-				remove_refs++;
+		for (size_t i = 0; i < frame.list->num; i++) {
+			struct signal_callback *cb = frame.list->array[i];
+
+			frame.cb = cb;
+			os_atomic_inc_long(&cb->running);
+
+			if (!signal_callback_removed(cb))
+				cb->callback(cb->data, params);
+
+			os_atomic_dec_long(&cb->running);
+			frame.cb = NULL;
 
-			da_erase(sig->callbacks, i - 1);
+			if (signal_callback_removed(cb))
+				removed = true;
 		}
+
+		current_signal_frame = frame.prev;
+		callback_list_release(frame.list);
 	}
 
-	sig->signalling = false;
-	pthread_mutex_unlock(&sig->mutex);
+	if (removed) {
+		pthread_mutex_lock(&sig->mutex);
+		remove_refs = signal_update_callbacks(sig, NULL);
+		pthread_mutex_unlock(&sig->mutex);
+	}
 
-	pthread_mutex_lock(&handler->global_callbacks_mutex);
+	if (os_atomic_load_long(&handler->num_global_callbacks)) {
+		pthread_mutex_lock(&handler->global_callbacks_mutex);
 
-	if (handler->global_callbacks.num) {
 		for (size_t i = 0; i < handler->global_callbacks.num; i++) {
 			struct global_callback_info *cb =
 				handler->global_callbacks.array + i;
@@ -369,15 +647,30 @@ void signal_handler_signal(signal_handler_t *handler, const char *signal,
 			if (cb->remove && !cb->signaling)
 				da_erase(handler->global_callbacks, i - 1);
 		}
+
+		os_atomic_set_long(&handler->num_global_callbacks,
+				   (long)handler->global_callbacks.num);
+		pthread_mutex_unlock(&handler->global_callbacks_mutex);
 	}
 
-	pthread_mutex_unlock(&handler->global_callbacks_mutex);
+	if (remove_refs)
+		os_atomic_add_long(&handler->refs, -remove_refs);
+}
 
-	if (remove_refs) {
-		os_atomic_set_long(&handler->refs,
-				   os_atomic_load_long(&handler->refs) -
-					   remove_refs);
+/* compares the fields rather than using da_find, which would also compare
+ * the padding */
+static size_t global_callback_idx(signal_handler_t *handler,
+				  global_signal_callback_t callback, void *data)
+{
+	for (size_t i = 0; i < handler->global_callbacks.num; i++) {
+		struct global_callback_info *cb =
+			handler->global_callbacks.array + i;
+
+		if (cb->callback == callback && cb->data == data)
+			return i;
 	}
+
+	return DARRAY_INVALID;
 }
 
 void signal_handler_connect_global(signal_handler_t *handler,
@@ -392,10 +685,12 @@ void signal_handler_connect_global(signal_handler_t *handler,
 
 	pthread_mutex_lock(&handler->global_callbacks_mutex);
 
-	idx = da_find(handler->global_callbacks, &cb_data, 0);
+	idx = global_callback_idx(handler, callback, data);
 	if (idx == DARRAY_INVALID)
 		da_push_back(handler->global_callbacks, &cb_data);
 
+	os_atomic_set_long(&handler->num_global_callbacks,
+			   (long)handler->global_callbacks.num);
 	pthread_mutex_unlock(&handler->global_callbacks_mutex);
 }
 
@@ -403,7 +698,6 @@ void signal_handler_disconnect_global(signal_handler_t *handler,
 				      global_signal_callback_t callback,
 				      void *data)
 {
-	struct global_callback_info cb_data = {callback, data, false};
 	size_t idx;
 
 	if (!handler || !callback)
@@ -411,7 +705,7 @@ void signal_handler_disconnect_global(signal_handler_t *handler,
 
 	pthread_mutex_lock(&handler->global_callbacks_mutex);
 
-	idx = da_find(handler->global_callbacks, &cb_data, 0);
+	idx = global_callback_idx(handler, callback, data);
 	if (idx != DARRAY_INVALID) {
 		struct global_callback_info *cb =
 			handler->global_callbacks.array + idx;
@@ -422,5 +716,7 @@ void signal_handler_disconnect_global(signal_handler_t *handler,
 			da_erase(handler->global_callbacks, idx);
 	}
 
+	os_atomic_set_long(&handler->num_global_callbacks,
+			   (long)handler->global_callbacks.num);
 	pthread_mutex_unlock(&handler->global_callbacks_mutex);
 }
@@ -0,0 +1,332 @@
+/******************************************************************************
+    Copyright (C) 2019 by Hugh Bailey <obs.jim@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#include "audio-mix.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || \
+	defined(__i386__)
+#define AUDIO_MIX_X86 1
+#define AUDIO_MIX_NEON 0
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__) || defined(_M_ARM64)
+#define AUDIO_MIX_X86 0
+#define AUDIO_MIX_NEON 1
+#else
+#define AUDIO_MIX_X86 0
+#define AUDIO_MIX_NEON 0
+#endif
+
+#if AUDIO_MIX_X86
+#include <immintrin.h>
+#include "../util/platform.h"
+#elif AUDIO_MIX_NEON
+#include <arm_neon.h>
+#endif
+
+/* each of the vectorized loops below returns the number of floats it
+ * processed, the public functions finish off the remainder */
+
+/* ------------------------------------------------------------------------- */
+/* SSE/AVX                                                                   */
+
+#if AUDIO_MIX_X86
+
+/* the rest of libobs is built for SSE2, so only the functions in this file
+ * are allowed to use AVX instructions */
+#ifdef _MSC_VER
+#define AVX_FUNC
+#else
+#define AVX_FUNC __attribute__((target("avx")))
+#endif
+
+static size_t mix_add_sse(float *dst, const float *src, size_t count)
+{
+	size_t i = 0;
+
+	for (; i + 8 <= count; i += 8) {
+		__m128 a0 = _mm_loadu_ps(dst + i);
+		__m128 a1 = _mm_loadu_ps(dst + i + 4);
+		a0 = _mm_add_ps(a0, _mm_loadu_ps(src + i));
+		a1 = _mm_add_ps(a1, _mm_loadu_ps(src + i + 4));
+		_mm_storeu_ps(dst + i, a0);
+		_mm_storeu_ps(dst + i + 4, a1);
+	}
+
+	return i;
+}
+
+static size_t mix_gain_sse(float *data, float gain, size_t count)
+{
+	__m128 g = _mm_set1_ps(gain);
+	size_t i = 0;
+
+	for (; i + 8 <= count; i += 8) {
+		__m128 a0 = _mm_mul_ps(_mm_loadu_ps(data + i), g);
+		__m128 a1 = _mm_mul_ps(_mm_loadu_ps(data + i + 4), g);
+		_mm_storeu_ps(data + i, a0);
+		_mm_storeu_ps(data + i + 4, a1);
+	}
+
+	return i;
+}
+
+static size_t mix_mul_sse(float *data, const float *gains, size_t count)
+{
+	size_t i = 0;
+
+	for (; i + 8 <= count; i += 8) {
+		__m128 a0 = _mm_loadu_ps(data + i);
+		__m128 a1 = _mm_loadu_ps(data + i + 4);
+		a0 = _mm_mul_ps(a0, _mm_loadu_ps(gains + i));
+		a1 = _mm_mul_ps(a1, _mm_loadu_ps(gains + i + 4));
+		_mm_storeu_ps(data + i, a0);
+		_mm_storeu_ps(data + i + 4, a1);
+	}
+
+	return i;
+}
+
+/* min/max return their second operand if either one is NaN, so the samples
+ * go second to pass NaN through the same way the scalar clamp does */
+static size_t mix_clamp_sse(float *data, size_t count)
+{
+	__m128 max_val = _mm_set1_ps(1.0f);
+	__m128 min_val = _mm_set1_ps(-1.0f);
+	size_t i = 0;
+
+	for (; i + 8 <= count; i += 8) {
+		__m128 a0 = _mm_loadu_ps(data + i);
+		__m128 a1 = _mm_loadu_ps(data + i + 4);
+		a0 = _mm_max_ps(min_val, _mm_min_ps(max_val, a0));
+		a1 = _mm_max_ps(min_val, _mm_min_ps(max_val, a1));
+		_mm_storeu_ps(data + i, a0);
+		_mm_storeu_ps(data + i + 4, a1);
+	}
+
+	return i;
+}
+
+AVX_FUNC static size_t mix_add_avx(float *dst, const float *src, size_t count)
+{
+	size_t i = 0;
+
+	for (; i + 16 <= count; i += 16) {
+		__m256 a0 = _mm256_loadu_ps(dst + i);
+		__m256 a1 = _mm256_loadu_ps(dst + i + 8);
+		a0 = _mm256_add_ps(a0, _mm256_loadu_ps(src + i));
+		a1 = _mm256_add_ps(a1, _mm256_loadu_ps(src + i + 8));
+		_mm256_storeu_ps(dst + i, a0);
+		_mm256_storeu_ps(dst + i + 8, a1);
+	}
+
+	_mm256_zeroupper();
+	return i;
+}
+
+AVX_FUNC static size_t mix_gain_avx(float *data, float gain, size_t count)
+{
+	__m256 g = _mm256_set1_ps(gain);
+	size_t i = 0;
+
+	for (; i + 16 <= count; i += 16) {
+		__m256 a0 = _mm256_mul_ps(_mm256_loadu_ps(data + i), g);
+		__m256 a1 = _mm256_mul_ps(_mm256_loadu_ps(data + i + 8), g);
+		_mm256_storeu_ps(data + i, a0);
+		_mm256_storeu_ps(data + i + 8, a1);
+	}
+
+	_mm256_zeroupper();
+	return i;
+}
+
+AVX_FUNC static size_t mix_mul_avx(float *data, const float *gains,
+				   size_t count)
+{
+	size_t i = 0;
+
+	for (; i + 16 <= count; i += 16) {
+		__m256 a0 = _mm256_loadu_ps(data + i);
+		__m256 a1 = _mm256_loadu_ps(data + i + 8);
+		a0 = _mm256_mul_ps(a0, _mm256_loadu_ps(gains + i));
+		a1 = _mm256_mul_ps(a1, _mm256_loadu_ps(gains + i + 8));
+		_mm256_storeu_ps(data + i, a0);
+		_mm256_storeu_ps(data + i + 8, a1);
+	}
+
+	_mm256_zeroupper();
+	return i;
+}
+
+AVX_FUNC static size_t mix_clamp_avx(float *data, size_t count)
+{
+	__m256 max_val = _mm256_set1_ps(1.0f);
+	__m256 min_val = _mm256_set1_ps(-1.0f);
+	size_t i = 0;
+
+	for (; i + 16 <= count; i += 16) {
+		__m256 a0 = _mm256_loadu_ps(data + i);
+		__m256 a1 = _mm256_loadu_ps(data + i + 8);
+		a0 = _mm256_max_ps(min_val, _mm256_min_ps(max_val, a0));
+		a1 = _mm256_max_ps(min_val, _mm256_min_ps(max_val, a1));
+		_mm256_storeu_ps(data + i, a0);
+		_mm256_storeu_ps(data + i + 8, a1);
+	}
+
+	_mm256_zeroupper();
+	return i;
+}
+
+static inline bool use_avx(void)
+{
+	return os_cpu_has_avx();
+}
+
+static inline size_t mix_add_simd(float *dst, const float *src, size_t count)
+{
+	return use_avx() ? mix_add_avx(dst, src, count)
+			 : mix_add_sse(dst, src, count);
+}
+
+static inline size_t mix_gain_simd(float *data, float gain, size_t count)
+{
+	return use_avx() ? mix_gain_avx(data, gain, count)
+			 : mix_gain_sse(data, gain, count);
+}
+
+static inline size_t mix_mul_simd(float *data, const float *gains,
+				  size_t count)
+{
+	return use_avx() ? mix_mul_avx(data, gains, count)
+			 : mix_mul_sse(data, gains, count);
+}
+
+static inline size_t mix_clamp_simd(float *data, size_t count)
+{
+	return use_avx() ? mix_clamp_avx(data, count)
+			 : mix_clamp_sse(data, count);
+}
+
+/* ------------------------------------------------------------------------- */
+/* NEON                                                                      */
+
+#elif AUDIO_MIX_NEON
+
+static size_t mix_add_simd(float *dst, const float *src, size_t count)
+{
+	size_t i = 0;
+
+	for (; i + 8 <= count; i += 8) {
+		float32x4_t a0 = vld1q_f32(dst + i);
+		float32x4_t a1 = vld1q_f32(dst + i + 4);
+		a0 = vaddq_f32(a0, vld1q_f32(src + i));
+		a1 = vaddq_f32(a1, vld1q_f32(src + i + 4));
+		vst1q_f32(dst + i, a0);
+		vst1q_f32(dst + i + 4, a1);
+	}
+
+	return i;
+}
+
+static size_t mix_gain_simd(float *data, float gain, size_t count)
+{
+	float32x4_t g = vdupq_n_f32(gain);
+	size_t i = 0;
+
+	for (; i + 8 <= count; i += 8) {
+		float32x4_t a0 = vmulq_f32(vld1q_f32(data + i), g);
+		float32x4_t a1 = vmulq_f32(vld1q_f32(data + i + 4), g);
+		vst1q_f32(data + i, a0);
+		vst1q_f32(data + i + 4, a1);
+	}
+
+	return i;
+}
+
+static size_t mix_mul_simd(float *data, const float *gains, size_t count)
+{
+	size_t i = 0;
+
+	for (; i + 8 <= count; i += 8) {
+		float32x4_t a0 = vld1q_f32(data + i);
+		float32x4_t a1 = vld1q_f32(data + i + 4);
+		a0 = vmulq_f32(a0, vld1q_f32(gains + i));
+		a1 = vmulq_f32(a1, vld1q_f32(gains + i + 4));
+		vst1q_f32(data + i, a0);
+		vst1q_f32(data + i + 4, a1);
+	}
+
+	return i;
+}
+
+static size_t mix_clamp_simd(float *data, size_t count)
+{
+	float32x4_t max_val = vdupq_n_f32(1.0f);
+	float32x4_t min_val = vdupq_n_f32(-1.0f);
+	size_t i = 0;
+
+	for (; i + 8 <= count; i += 8) {
+		float32x4_t a0 = vld1q_f32(data + i);
+		float32x4_t a1 = vld1q_f32(data + i + 4);
+		a0 = vmaxq_f32(vminq_f32(a0, max_val), min_val);
+		a1 = vmaxq_f32(vminq_f32(a1, max_val), min_val);
+		vst1q_f32(data + i, a0);
+		vst1q_f32(data + i + 4, a1);
+	}
+
+	return i;
+}
+
+/* ------------------------------------------------------------------------- */
+/* everything else                                                           */
+
+#else
+
+#define mix_add_simd(dst, src, count) ((size_t)0)
+#define mix_gain_simd(data, gain, count) ((size_t)0)
+#define mix_mul_simd(data, gains, count) ((size_t)0)
+#define mix_clamp_simd(data, count) ((size_t)0)
+
+#endif
+
+/* ------------------------------------------------------------------------- */
+
+void audio_mix_add(float *dst, const float *src, size_t count)
+{
+	for (size_t i = mix_add_simd(dst, src, count); i < count; i++)
+		dst[i] += src[i];
+}
+
+void audio_mix_gain(float *data, float gain, size_t count)
+{
+	for (size_t i = mix_gain_simd(data, gain, count); i < count; i++)
+		data[i] *= gain;
+}
+
+void audio_mix_mul(float *data, const float *gains, size_t count)
+{
+	for (size_t i = mix_mul_simd(data, gains, count); i < count; i++)
+		data[i] *= gains[i];
+}
+
+void audio_mix_clamp(float *data, size_t count)
+{
+	for (size_t i = mix_clamp_simd(data, count); i < count; i++) {
+		float val = data[i];
+		val = (val > 1.0f) ? 1.0f : val;
+		val = (val < -1.0f) ? -1.0f : val;
+		data[i] = val;
+	}
+}
@@ -0,0 +1,526 @@
+/******************************************************************************
+    Copyright (C) 2013 by Hugh Bailey <obs.jim@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#include "format-conversion-avx2.h"
+
+#if FORMAT_CONVERSION_HAS_AVX2
+
+#include <immintrin.h>
+
+/* the rest of libobs is built for SSE2, so only the functions in this file
+ * are allowed to use AVX2 instructions */
+#ifdef _MSC_VER
+#define AVX2_FUNC
+#else
+#define AVX2_FUNC __attribute__((target("avx2")))
+#endif
+
+static inline uint32_t min_uint32(uint32_t a, uint32_t b)
+{
+	return a < b ? a : b;
+}
+
+/* ------------------------------------------------------------------------- */
+/* packed UYVX -> planar                                                     */
+
+/* byte shuffles that gather one component out of each 32bit UYVX pixel into
+ * the low dword of each 128bit lane, or the second dword for the second
+ * line.  -1 zeroes the byte. */
+#define SHUF_COMPONENT(c, pos)                                                 \
+	_mm256_setr_epi8(pos == 0 ? c : -1, pos == 0 ? c + 4 : -1,             \
+			 pos == 0 ? c + 8 : -1, pos == 0 ? c + 12 : -1,        \
+			 pos == 1 ? c : -1, pos == 1 ? c + 4 : -1,             \
+			 pos == 1 ? c + 8 : -1, pos == 1 ? c + 12 : -1, -1,    \
+			 -1, -1, -1, -1, -1, -1, -1, pos == 0 ? c : -1,        \
+			 pos == 0 ? c + 4 : -1, pos == 0 ? c + 8 : -1,         \
+			 pos == 0 ? c + 12 : -1, pos == 1 ? c : -1,            \
+			 pos == 1 ? c + 4 : -1, pos == 1 ? c + 8 : -1,         \
+			 pos == 1 ? c + 12 : -1, -1, -1, -1, -1, -1, -1, -1,   \
+			 -1)
+
+/* takes eight pixels from each of two lines and writes the selected
+ * component of each to the two output lines */
+static AVX2_FUNC inline void pack_component(uint8_t *out0, uint8_t *out1,
+					    __m256i line1, __m256i line2,
+					    __m256i shuf1, __m256i shuf2)
+{
+	__m256i val = _mm256_or_si256(_mm256_shuffle_epi8(line1, shuf1),
+				      _mm256_shuffle_epi8(line2, shuf2));
+	__m128i packed;
+
+	/* [l1 0-3, l2 0-3, -, - | l1 4-7, l2 4-7, -, -] ->
+	 * [l1 0-3, l1 4-7, l2 0-3, l2 4-7] */
+	val = _mm256_permutevar8x32_epi32(val,
+					  _mm256_setr_epi32(0, 4, 1, 5, 0, 0,
+							    0, 0));
+	packed = _mm256_castsi256_si128(val);
+
+	_mm_storel_epi64((__m128i *)out0, packed);
+	_mm_storel_epi64((__m128i *)out1, _mm_srli_si128(packed, 8));
+}
+
+/* averages the U and V of each 2x2 block of eight pixels across two lines,
+ * returning 8 bytes packed as U V U V U V U V (low qword) */
+static AVX2_FUNC inline uint64_t avg_chroma(__m256i line1, __m256i line2)
+{
+	const __m256i uv_mask = _mm256_set1_epi16(0x00FF);
+	const __m256i shuf = _mm256_setr_epi8(
+		0, 2, 8, 10, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0,
+		2, 8, 10, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+
+	uint64_t uv;
+
+	__m256i add_val = _mm256_add_epi16(_mm256_and_si256(line1, uv_mask),
+					   _mm256_and_si256(line2, uv_mask));
+	__m256i avg_val = _mm256_add_epi16(
+		add_val,
+		_mm256_shuffle_epi32(add_val, _MM_SHUFFLE(2, 3, 0, 1)));
+	avg_val = _mm256_srli_epi16(avg_val, 2);
+	avg_val = _mm256_shuffle_epi8(avg_val, shuf);
+	avg_val = _mm256_permutevar8x32_epi32(
+		avg_val, _mm256_setr_epi32(0, 4, 0, 0, 0, 0, 0, 0));
+
+	_mm_storel_epi64((__m128i *)&uv, _mm256_castsi256_si128(avg_val));
+	return uv;
+}
+
+/* scalar versions of the above for the last few pixels of a line, which
+ * match the SSE2 versions in format-conversion.c exactly (including that
+ * they always process four pixels) */
+static inline void pack_component_4px(uint8_t *out0, uint8_t *out1,
+				      const uint8_t *img1, const uint8_t *img2,
+				      int c)
+{
+	for (int i = 0; i < 4; i++) {
+		out0[i] = img1[i * 4 + c];
+		out1[i] = img2[i * 4 + c];
+	}
+}
+
+static inline void avg_chroma_4px(uint8_t *uv, const uint8_t *img1,
+				  const uint8_t *img2)
+{
+	for (int i = 0; i < 2; i++) {
+		const uint8_t *p1 = img1 + i * 8;
+		const uint8_t *p2 = img2 + i * 8;
+
+		uv[i * 2] = (uint8_t)((p1[0] + p1[4] + p2[0] + p2[4]) >> 2);
+		uv[i * 2 + 1] = (uint8_t)((p1[2] + p1[6] + p2[2] + p2[6]) >> 2);
+	}
+}
+
+AVX2_FUNC void compress_uyvx_to_i420_avx2(const uint8_t *input,
+					  uint32_t in_linesize,
+					  uint32_t start_y, uint32_t end_y,
+					  uint8_t *output[],
+					  const uint32_t out_linesize[])
+{
+	uint8_t *lum_plane = output[0];
+	uint8_t *u_plane = output[1];
+	uint8_t *v_plane = output[2];
+	uint32_t width = min_uint32(in_linesize, out_linesize[0]);
+	uint32_t y;
+
+	const __m256i lum_shuf1 = SHUF_COMPONENT(1, 0);
+	const __m256i lum_shuf2 = SHUF_COMPONENT(1, 1);
+
+	for (y = start_y; y < end_y; y += 2) {
+		uint32_t y_pos = y * in_linesize;
+		uint32_t chroma_y_pos = (y >> 1) * out_linesize[1];
+		uint32_t lum_y_pos = y * out_linesize[0];
+		uint32_t x;
+
+		for (x = 0; x + 8 <= width; x += 8) {
+			const uint8_t *img = input + y_pos + x * 4;
+			uint32_t lum_pos0 = lum_y_pos + x;
+			uint32_t lum_pos1 = lum_pos0 + out_linesize[0];
+			uint32_t chroma_pos = chroma_y_pos + (x >> 1);
+			uint64_t uv;
+
+			__m256i line1 =
+				_mm256_loadu_si256((const __m256i *)img);
+			__m256i line2 = _mm256_loadu_si256(
+				(const __m256i *)(img + in_linesize));
+
+			pack_component(lum_plane + lum_pos0,
+				       lum_plane + lum_pos1, line1, line2,
+				       lum_shuf1, lum_shuf2);
+
+			uv = avg_chroma(line1, line2);
+			*(uint32_t *)(u_plane + chroma_pos) =
+				(uint32_t)(uv & 0xFF) |
+				(uint32_t)((uv >> 8) & 0xFF00) |
+				(uint32_t)((uv >> 16) & 0xFF0000) |
+				(uint32_t)((uv >> 24) & 0xFF000000);
+			*(uint32_t *)(v_plane + chroma_pos) =
+				(uint32_t)((uv >> 8) & 0xFF) |
+				(uint32_t)((uv >> 16) & 0xFF00) |
+				(uint32_t)((uv >> 24) & 0xFF0000) |
+				(uint32_t)((uv >> 32) & 0xFF000000);
+		}
+
+		for (; x < width; x += 4) {
+			const uint8_t *img = input + y_pos + x * 4;
+			uint32_t lum_pos0 = lum_y_pos + x;
+			uint32_t lum_pos1 = lum_pos0 + out_linesize[0];
+			uint32_t chroma_pos = chroma_y_pos + (x >> 1);
+			uint8_t uv[4];
+
+			pack_component_4px(lum_plane + lum_pos0,
+					   lum_plane + lum_pos1, img,
+					   img + in_linesize, 1);
+
+			avg_chroma_4px(uv, img, img + in_linesize);
+			u_plane[chroma_pos] = uv[0];
+			u_plane[chroma_pos + 1] = uv[2];
+			v_plane[chroma_pos] = uv[1];
+			v_plane[chroma_pos + 1] = uv[3];
+		}
+	}
+}
+
+AVX2_FUNC void compress_uyvx_to_nv12_avx2(const uint8_t *input,
+					  uint32_t in_linesize,
+					  uint32_t start_y, uint32_t end_y,
+					  uint8_t *output[],
+					  const uint32_t out_linesize[])
+{
+	uint8_t *lum_plane = output[0];
+	uint8_t *chroma_plane = output[1];
+	uint32_t width = min_uint32(in_linesize, out_linesize[0]);
+	uint32_t y;
+
+	const __m256i lum_shuf1 = SHUF_COMPONENT(1, 0);
+	const __m256i lum_shuf2 = SHUF_COMPONENT(1, 1);
+
+	for (y = start_y; y < end_y; y += 2) {
+		uint32_t y_pos = y * in_linesize;
+		uint32_t chroma_y_pos = (y >> 1) * out_linesize[1];
+		uint32_t lum_y_pos = y * out_linesize[0];
+		uint32_t x;
+
+		for (x = 0; x + 8 <= width; x += 8) {
+			const uint8_t *img = input + y_pos + x * 4;
+			uint32_t lum_pos0 = lum_y_pos + x;
+			uint32_t lum_pos1 = lum_pos0 + out_linesize[0];
+
+			__m256i line1 =
+				_mm256_loadu_si256((const __m256i *)img);
+			__m256i line2 = _mm256_loadu_si256(
+				(const __m256i *)(img + in_linesize));
+
+			pack_component(lum_plane + lum_pos0,
+				       lum_plane + lum_pos1, line1, line2,
+				       lum_shuf1, lum_shuf2);
+
+			*(uint64_t *)(chroma_plane + chroma_y_pos + x) =
+				avg_chroma(line1, line2);
+		}
+
+		for (; x < width; x += 4) {
+			const uint8_t *img = input + y_pos + x * 4;
+			uint32_t lum_pos0 = lum_y_pos + x;
+			uint32_t lum_pos1 = lum_pos0 + out_linesize[0];
+
+			pack_component_4px(lum_plane + lum_pos0,
+					   lum_plane + lum_pos1, img,
+					   img + in_linesize, 1);
+			avg_chroma_4px(chroma_plane + chroma_y_pos + x, img,
+				       img + in_linesize);
+		}
+	}
+}
+
+AVX2_FUNC void convert_uyvx_to_i444_avx2(const uint8_t *input,
+					 uint32_t in_linesize,
+					 uint32_t start_y, uint32_t end_y,
+					 uint8_t *output[],
+					 const uint32_t out_linesize[])
+{
+	uint8_t *lum_plane = output[0];
+	uint8_t *u_plane = output[1];
+	uint8_t *v_plane = output[2];
+	uint32_t width = min_uint32(in_linesize, out_linesize[0]);
+	uint32_t y;
+
+	const __m256i lum_shuf1 = SHUF_COMPONENT(1, 0);
+	const __m256i lum_shuf2 = SHUF_COMPONENT(1, 1);
+	const __m256i u_shuf1 = SHUF_COMPONENT(0, 0);
+	const __m256i u_shuf2 = SHUF_COMPONENT(0, 1);
+	const __m256i v_shuf1 = SHUF_COMPONENT(2, 0);
+	const __m256i v_shuf2 = SHUF_COMPONENT(2, 1);
+
+	for (y = start_y; y < end_y; y += 2) {
+		uint32_t y_pos = y * in_linesize;
+		uint32_t lum_y_pos = y * out_linesize[0];
+		uint32_t x;
+
+		for (x = 0; x + 8 <= width; x += 8) {
+			const uint8_t *img = input + y_pos + x * 4;
+			uint32_t lum_pos0 = lum_y_pos + x;
+			uint32_t lum_pos1 = lum_pos0 + out_linesize[0];
+
+			__m256i line1 =
+				_mm256_loadu_si256((const __m256i *)img);
+			__m256i line2 = _mm256_loadu_si256(
+				(const __m256i *)(img + in_linesize));
+
+			pack_component(lum_plane + lum_pos0,
+				       lum_plane + lum_pos1, line1, line2,
+				       lum_shuf1, lum_shuf2);
+			pack_component(u_plane + lum_pos0, u_plane + lum_pos1,
+				       line1, line2, u_shuf1, u_shuf2);
+			pack_component(v_plane + lum_pos0, v_plane + lum_pos1,
+				       line1, line2, v_shuf1, v_shuf2);
+		}
+
+		for (; x < width; x += 4) {
+			const uint8_t *img = input + y_pos + x * 4;
+			uint32_t lum_pos0 = lum_y_pos + x;
+			uint32_t lum_pos1 = lum_pos0 + out_linesize[0];
+
+			pack_component_4px(lum_plane + lum_pos0,
+					   lum_plane + lum_pos1, img,
+					   img + in_linesize, 1);
+			pack_component_4px(u_plane + lum_pos0,
+					   u_plane + lum_pos1, img,
+					   img + in_linesize, 0);
+			pack_component_4px(v_plane + lum_pos0,
+					   v_plane + lum_pos1, img,
+					   img + in_linesize, 2);
+		}
+	}
+}
+
+/* ------------------------------------------------------------------------- */
+/* planar -> packed UYVX                                                     */
+
+AVX2_FUNC void decompress_420_avx2(const uint8_t *const input[],
+				   const uint32_t in_linesize[],
+				   uint32_t start_y, uint32_t end_y,
+				   uint8_t *output, uint32_t out_linesize)
+{
+	uint32_t start_y_d2 = start_y / 2;
+	uint32_t width_d2 = in_linesize[0] / 2;
+	uint32_t height_d2 = end_y / 2;
+	uint32_t y;
+
+	for (y = start_y_d2; y < height_d2; y++) {
+		const uint8_t *chroma0 = input[1] + y * in_linesize[1];
+		const uint8_t *chroma1 = input[2] + y * in_linesize[2];
+		const uint8_t *lum0, *lum1;
+		uint32_t *output0, *output1;
+		uint32_t x;
+
+		lum0 = input[0] + y * 2 * in_linesize[0];
+		lum1 = lum0 + in_linesize[0];
+		output0 = (uint32_t *)(output + y * 2 * out_linesize);
+		output1 = (uint32_t *)((uint8_t *)output0 + out_linesize);
+
+		for (x = 0; x + 8 <= width_d2; x += 8) {
+			__m128i u = _mm_loadl_epi64((const __m128i *)chroma0);
+			__m128i v = _mm_loadl_epi64((const __m128i *)chroma1);
+			__m128i uv = _mm_unpacklo_epi8(v, u);
+			__m256i uv_lo =
+				_mm256_cvtepu16_epi32(_mm_unpacklo_epi16(uv, uv));
+			__m256i uv_hi =
+				_mm256_cvtepu16_epi32(_mm_unpackhi_epi16(uv, uv));
+			__m128i l0 = _mm_loadu_si128((const __m128i *)lum0);
+			__m128i l1 = _mm_loadu_si128((const __m128i *)lum1);
+
+			_mm256_storeu_si256(
+				(__m256i *)output0,
+				_mm256_or_si256(
+					uv_lo,
+					_mm256_slli_epi32(
+						_mm256_cvtepu8_epi32(l0), 16)));
+			_mm256_storeu_si256(
+				(__m256i *)(output0 + 8),
+				_mm256_or_si256(
+					uv_hi,
+					_mm256_slli_epi32(
+						_mm256_cvtepu8_epi32(
+							_mm_srli_si128(l0, 8)),
+						16)));
+			_mm256_storeu_si256(
+				(__m256i *)output1,
+				_mm256_or_si256(
+					uv_lo,
+					_mm256_slli_epi32(
+						_mm256_cvtepu8_epi32(l1), 16)));
+			_mm256_storeu_si256(
+				(__m256i *)(output1 + 8),
+				_mm256_or_si256(
+					uv_hi,
+					_mm256_slli_epi32(
+						_mm256_cvtepu8_epi32(
+							_mm_srli_si128(l1, 8)),
+						16)));
+
+			chroma0 += 8;
+			chroma1 += 8;
+			lum0 += 16;
+			lum1 += 16;
+			output0 += 16;
+			output1 += 16;
+		}
+
+		for (; x < width_d2; x++) {
+			uint32_t out;
+			out = (*(chroma0++) << 8) | *(chroma1++);
+
+			*(output0++) = (*(lum0++) << 16) | out;
+			*(output0++) = (*(lum0++) << 16) | out;
+
+			*(output1++) = (*(lum1++) << 16) | out;
+			*(output1++) = (*(lum1++) << 16) | out;
+		}
+	}
+}
+
+AVX2_FUNC void decompress_nv12_avx2(const uint8_t *const input[],
+				    const uint32_t in_linesize[],
+				    uint32_t start_y, uint32_t end_y,
+				    uint8_t *output, uint32_t out_linesize)
+{
+	uint32_t start_y_d2 = start_y / 2;
+	uint32_t width_d2 = min_uint32(in_linesize[0], out_linesize) / 2;
+	uint32_t height_d2 = end_y / 2;
+	uint32_t y;
+
+	for (y = start_y_d2; y < height_d2; y++) {
+		const uint16_t *chroma;
+		const uint8_t *lum0, *lum1;
+		uint32_t *output0, *output1;
+		uint32_t x;
+
+		chroma = (const uint16_t *)(input[1] + y * in_linesize[1]);
+		lum0 = input[0] + y * 2 * in_linesize[0];
+		lum1 = lum0 + in_linesize[0];
+		output0 = (uint32_t *)(output + y * 2 * out_linesize);
+		output1 = (uint32_t *)((uint8_t *)output0 + out_linesize);
+
+		for (x = 0; x + 8 <= width_d2; x += 8) {
+			__m128i uv = _mm_loadu_si128((const __m128i *)chroma);
+			__m256i uv_lo = _mm256_slli_epi32(
+				_mm256_cvtepu16_epi32(_mm_unpacklo_epi16(uv, uv)),
+				8);
+			__m256i uv_hi = _mm256_slli_epi32(
+				_mm256_cvtepu16_epi32(_mm_unpackhi_epi16(uv, uv)),
+				8);
+			__m128i l0 = _mm_loadu_si128((const __m128i *)lum0);
+			__m128i l1 = _mm_loadu_si128((const __m128i *)lum1);
+
+			_mm256_storeu_si256(
+				(__m256i *)output0,
+				_mm256_or_si256(uv_lo,
+						_mm256_cvtepu8_epi32(l0)));
+			_mm256_storeu_si256(
+				(__m256i *)(output0 + 8),
+				_mm256_or_si256(uv_hi,
+						_mm256_cvtepu8_epi32(
+							_mm_srli_si128(l0, 8))));
+			_mm256_storeu_si256(
+				(__m256i *)output1,
+				_mm256_or_si256(uv_lo,
+						_mm256_cvtepu8_epi32(l1)));
+			_mm256_storeu_si256(
+				(__m256i *)(output1 + 8),
+				_mm256_or_si256(uv_hi,
+						_mm256_cvtepu8_epi32(
+							_mm_srli_si128(l1, 8))));
+
+			chroma += 8;
+			lum0 += 16;
+			lum1 += 16;
+			output0 += 16;
+			output1 += 16;
+		}
+
+		for (; x < width_d2; x++) {
+			uint32_t out = *(chroma++) << 8;
+
+			*(output0++) = *(lum0++) | out;
+			*(output0++) = *(lum0++) | out;
+
+			*(output1++) = *(lum1++) | out;
+			*(output1++) = *(lum1++) | out;
+		}
+	}
+}
+
+AVX2_FUNC void decompress_422_avx2(const uint8_t *input, uint32_t in_linesize,
+				   uint32_t start_y, uint32_t end_y,
+				   uint8_t *output, uint32_t out_linesize,
+				   bool leading_lum)
+{
+	uint32_t width_d2 = min_uint32(in_linesize, out_linesize) / 2;
+	uint32_t y;
+
+	/* leading_lum: second pixel takes its luma from byte 2, otherwise
+	 * from byte 3 into byte 1 */
+	const __m256i keep_mask = _mm256_set1_epi32(
+		leading_lum ? (int)0xFFFFFF00 : (int)0xFFFF00FF);
+	const __m256i lum_mask =
+		_mm256_set1_epi32(leading_lum ? 0x000000FF : 0x0000FF00);
+
+	for (y = start_y; y < end_y; y++) {
+		const uint32_t *input32 =
+			(const uint32_t *)(input + y * in_linesize);
+		const uint32_t *input32_end = input32 + width_d2;
+		uint32_t *output32 = (uint32_t *)(output + y * out_linesize);
+
+		while (input32 + 8 <= input32_end) {
+			__m256i dw = _mm256_loadu_si256((const __m256i *)input32);
+			__m256i dw2 = _mm256_or_si256(
+				_mm256_and_si256(dw, keep_mask),
+				_mm256_and_si256(_mm256_srli_epi32(dw, 16),
+						 lum_mask));
+			__m256i lo = _mm256_unpacklo_epi32(dw, dw2);
+			__m256i hi = _mm256_unpackhi_epi32(dw, dw2);
+
+			_mm256_storeu_si256(
+				(__m256i *)output32,
+				_mm256_permute2x128_si256(lo, hi, 0x20));
+			_mm256_storeu_si256(
+				(__m256i *)(output32 + 8),
+				_mm256_permute2x128_si256(lo, hi, 0x31));
+
+			output32 += 16;
+			input32 += 8;
+		}
+
+		while (input32 < input32_end) {
+			uint32_t dw = *input32;
+
+			output32[0] = dw;
+			if (leading_lum) {
+				dw &= 0xFFFFFF00;
+				dw |= (uint8_t)(dw >> 16);
+			} else {
+				dw &= 0xFFFF00FF;
+				dw |= (dw >> 16) & 0xFF00;
+			}
+			output32[1] = dw;
+
+			output32 += 2;
+			input32++;
+		}
+	}
+}
+
+#endif
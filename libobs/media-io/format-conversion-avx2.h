@@ -0,0 +1,75 @@
+/******************************************************************************
+    Copyright (C) 2013 by Hugh Bailey <obs.jim@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#pragma once
+
+#include "../util/c99defs.h"
+
+/*
+ * AVX2 variants of the format conversion functions.  These are selected at
+ * runtime by format-conversion.c and must never be called directly unless the
+ * CPU has been confirmed to support AVX2.  Output is byte-identical to the
+ * SSE2 versions.
+ */
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || \
+	defined(__i386__)
+#define FORMAT_CONVERSION_HAS_AVX2 1
+#else
+#define FORMAT_CONVERSION_HAS_AVX2 0
+#endif
+
+#if FORMAT_CONVERSION_HAS_AVX2
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void compress_uyvx_to_i420_avx2(const uint8_t *input, uint32_t in_linesize,
+				uint32_t start_y, uint32_t end_y,
+				uint8_t *output[],
+				const uint32_t out_linesize[]);
+
+void compress_uyvx_to_nv12_avx2(const uint8_t *input, uint32_t in_linesize,
+				uint32_t start_y, uint32_t end_y,
+				uint8_t *output[],
+				const uint32_t out_linesize[]);
+
+void convert_uyvx_to_i444_avx2(const uint8_t *input, uint32_t in_linesize,
+			       uint32_t start_y, uint32_t end_y,
+			       uint8_t *output[],
+			       const uint32_t out_linesize[]);
+
+void decompress_nv12_avx2(const uint8_t *const input[],
+			  const uint32_t in_linesize[], uint32_t start_y,
+			  uint32_t end_y, uint8_t *output,
+			  uint32_t out_linesize);
+
+void decompress_420_avx2(const uint8_t *const input[],
+			 const uint32_t in_linesize[], uint32_t start_y,
+			 uint32_t end_y, uint8_t *output,
+			 uint32_t out_linesize);
+
+void decompress_422_avx2(const uint8_t *input, uint32_t in_linesize,
+			 uint32_t start_y, uint32_t end_y, uint8_t *output,
+			 uint32_t out_linesize, bool leading_lum);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -16,6 +16,8 @@
 ******************************************************************************/
 
 #include "format-conversion.h"
+#include "format-conversion-avx2.h"
+#include "../util/platform.h"
 #include <xmmintrin.h>
 #include <emmintrin.h>
 
@@ -90,9 +92,10 @@ static FORCE_INLINE uint32_t min_uint32(uint32_t a, uint32_t b)
 	return a < b ? a : b;
 }
 
-void compress_uyvx_to_i420(const uint8_t *input, uint32_t in_linesize,
-			   uint32_t start_y, uint32_t end_y, uint8_t *output[],
-			   const uint32_t out_linesize[])
+static void compress_uyvx_to_i420_sse2(const uint8_t *input,
+				       uint32_t in_linesize, uint32_t start_y,
+				       uint32_t end_y, uint8_t *output[],
+				       const uint32_t out_linesize[])
 {
 	uint8_t *lum_plane = output[0];
 	uint8_t *u_plane = output[1];
@@ -127,9 +130,10 @@ void compress_uyvx_to_i420(const uint8_t *input, uint32_t in_linesize,
 	}
 }
 
-void compress_uyvx_to_nv12(const uint8_t *input, uint32_t in_linesize,
-			   uint32_t start_y, uint32_t end_y, uint8_t *output[],
-			   const uint32_t out_linesize[])
+static void compress_uyvx_to_nv12_sse2(const uint8_t *input,
+				       uint32_t in_linesize, uint32_t start_y,
+				       uint32_t end_y, uint8_t *output[],
+				       const uint32_t out_linesize[])
 {
 	uint8_t *lum_plane = output[0];
 	uint8_t *chroma_plane = output[1];
@@ -162,9 +166,10 @@ void compress_uyvx_to_nv12(const uint8_t *input, uint32_t in_linesize,
 	}
 }
 
-void convert_uyvx_to_i444(const uint8_t *input, uint32_t in_linesize,
-			  uint32_t start_y, uint32_t end_y, uint8_t *output[],
-			  const uint32_t out_linesize[])
+static void convert_uyvx_to_i444_sse2(const uint8_t *input,
+				      uint32_t in_linesize, uint32_t start_y,
+				      uint32_t end_y, uint8_t *output[],
+				      const uint32_t out_linesize[])
 {
 	uint8_t *lum_plane = output[0];
 	uint8_t *u_plane = output[1];
@@ -200,9 +205,10 @@ void convert_uyvx_to_i444(const uint8_t *input, uint32_t in_linesize,
 	}
 }
 
-void decompress_420(const uint8_t *const input[], const uint32_t in_linesize[],
-		    uint32_t start_y, uint32_t end_y, uint8_t *output,
-		    uint32_t out_linesize)
+static void decompress_420_c(const uint8_t *const input[],
+			     const uint32_t in_linesize[],
+			     uint32_t start_y, uint32_t end_y, uint8_t *output,
+			     uint32_t out_linesize)
 {
 	uint32_t start_y_d2 = start_y / 2;
 	uint32_t width_d2 = in_linesize[0] / 2;
@@ -234,9 +240,10 @@ void decompress_420(const uint8_t *const input[], const uint32_t in_linesize[],
 	}
 }
 
-void decompress_nv12(const uint8_t *const input[], const uint32_t in_linesize[],
-		     uint32_t start_y, uint32_t end_y, uint8_t *output,
-		     uint32_t out_linesize)
+static void decompress_nv12_c(const uint8_t *const input[],
+			      const uint32_t in_linesize[],
+			      uint32_t start_y, uint32_t end_y, uint8_t *output,
+			      uint32_t out_linesize)
 {
 	uint32_t start_y_d2 = start_y / 2;
 	uint32_t width_d2 = min_uint32(in_linesize[0], out_linesize) / 2;
@@ -267,9 +274,10 @@ void decompress_nv12(const uint8_t *const input[], const uint32_t in_linesize[],
 	}
 }
 
-void decompress_422(const uint8_t *input, uint32_t in_linesize,
-		    uint32_t start_y, uint32_t end_y, uint8_t *output,
-		    uint32_t out_linesize, bool leading_lum)
+static void decompress_422_c(const uint8_t *input, uint32_t in_linesize,
+			     uint32_t start_y, uint32_t end_y,
+			     uint8_t *output, uint32_t out_linesize,
+			     bool leading_lum)
 {
 	uint32_t width_d2 = min_uint32(in_linesize, out_linesize) / 2;
 	uint32_t y;
@@ -316,3 +324,102 @@ void decompress_422(const uint8_t *input, uint32_t in_linesize,
 		}
 	}
 }
+
+/* ------------------------------------------------------------------------- */
+/* runtime dispatch                                                          */
+
+#if FORMAT_CONVERSION_HAS_AVX2
+#define use_avx2() os_cpu_has_avx2()
+#else
+#define use_avx2() false
+#endif
+
+void compress_uyvx_to_i420(const uint8_t *input, uint32_t in_linesize,
+			   uint32_t start_y, uint32_t end_y, uint8_t *output[],
+			   const uint32_t out_linesize[])
+{
+#if FORMAT_CONVERSION_HAS_AVX2
+	if (use_avx2()) {
+		compress_uyvx_to_i420_avx2(input, in_linesize, start_y, end_y,
+					   output, out_linesize);
+		return;
+	}
+#endif
+	compress_uyvx_to_i420_sse2(input, in_linesize, start_y, end_y, output,
+				   out_linesize);
+}
+
+void compress_uyvx_to_nv12(const uint8_t *input, uint32_t in_linesize,
+			   uint32_t start_y, uint32_t end_y, uint8_t *output[],
+			   const uint32_t out_linesize[])
+{
+#if FORMAT_CONVERSION_HAS_AVX2
+	if (use_avx2()) {
+		compress_uyvx_to_nv12_avx2(input, in_linesize, start_y, end_y,
+					   output, out_linesize);
+		return;
+	}
+#endif
+	compress_uyvx_to_nv12_sse2(input, in_linesize, start_y, end_y, output,
+				   out_linesize);
+}
+
+void convert_uyvx_to_i444(const uint8_t *input, uint32_t in_linesize,
+			  uint32_t start_y, uint32_t end_y, uint8_t *output[],
+			  const uint32_t out_linesize[])
+{
+#if FORMAT_CONVERSION_HAS_AVX2
+	if (use_avx2()) {
+		convert_uyvx_to_i444_avx2(input, in_linesize, start_y, end_y,
+					  output, out_linesize);
+		return;
+	}
+#endif
+	convert_uyvx_to_i444_sse2(input, in_linesize, start_y, end_y, output,
+				  out_linesize);
+}
+
+void decompress_420(const uint8_t *const input[], const uint32_t in_linesize[],
+		    uint32_t start_y, uint32_t end_y, uint8_t *output,
+		    uint32_t out_linesize)
+{
+#if FORMAT_CONVERSION_HAS_AVX2
+	if (use_avx2()) {
+		decompress_420_avx2(input, in_linesize, start_y, end_y, output,
+				    out_linesize);
+		return;
+	}
+#endif
+	decompress_420_c(input, in_linesize, start_y, end_y, output,
+			 out_linesize);
+}
+
+void decompress_nv12(const uint8_t *const input[], const uint32_t in_linesize[],
+		     uint32_t start_y, uint32_t end_y, uint8_t *output,
+		     uint32_t out_linesize)
+{
+#if FORMAT_CONVERSION_HAS_AVX2
+	if (use_avx2()) {
+		decompress_nv12_avx2(input, in_linesize, start_y, end_y, output,
+				     out_linesize);
+		return;
+	}
+#endif
+	decompress_nv12_c(input, in_linesize, start_y, end_y, output,
+			  out_linesize);
+}
+
+void decompress_422(const uint8_t *input, uint32_t in_linesize,
+		    uint32_t start_y, uint32_t end_y, uint8_t *output,
+		    uint32_t out_linesize, bool leading_lum)
+{
+#if FORMAT_CONVERSION_HAS_AVX2
+	if (use_avx2()) {
+		decompress_422_avx2(input, in_linesize, start_y, end_y, output,
+				    out_linesize, leading_lum);
+		return;
+	}
+#endif
+	decompress_422_c(input, in_linesize, start_y, end_y, output,
+			 out_linesize, leading_lum);
+}
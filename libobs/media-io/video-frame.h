@@ -25,6 +25,15 @@ struct video_frame {
 	uint32_t linesize[MAX_AV_PLANES];
 };
 
+/**
+ * Gets the plane offsets and line sizes video_frame_init uses for a format,
+ * and returns the total size of the frame in bytes (0 if unsupported)
+ */
+EXPORT size_t video_frame_get_layout(enum video_format format, uint32_t width,
+				     uint32_t height,
+				     size_t offsets[MAX_AV_PLANES],
+				     uint32_t linesize[MAX_AV_PLANES]);
+
 EXPORT void video_frame_init(struct video_frame *frame,
 			     enum video_format format, uint32_t width,
 			     uint32_t height);
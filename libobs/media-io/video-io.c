@@ -22,6 +22,8 @@
 #include "../util/profiler.h"
 #include "../util/threading.h"
 #include "../util/darray.h"
+#include "../util/circlebuf.h"
+#include "../util/task-pool.h"
 
 #include "format-conversion.h"
 #include "video-io.h"
@@ -31,12 +33,33 @@
 extern profiler_name_store_t *obs_get_profiler_name_store(void);
 
 #define MAX_CONVERT_BUFFERS 3
-#define MAX_CACHE_SIZE 16
+#define MAX_INPUT_QUEUE 2
+#define MAX_SPARE_FRAMES 6
 
+struct frame_buffer {
+	struct video_frame frame;
+
+	/* number of input threads the frame is queued to or being output by */
+	volatile long refs;
+
+	/* only touched by the producer */
+	bool cached;
+};
+
+/* frames are handed from the graphics thread (the only producer) to the
+ * video thread (the only consumer) through a ring of these without taking any
+ * locks.  count is the number of times the frame still has to be output; the
+ * producer may only raise it while it is still above zero. */
 struct cached_frame_info {
 	struct video_data frame;
-	int skipped;
-	int count;
+	volatile long count;
+	struct frame_buffer *buffer;
+};
+
+struct queued_frame {
+	struct video_data frame;
+	struct frame_buffer *buffer;
+	long count;
 };
 
 struct video_input {
@@ -45,22 +68,32 @@ struct video_input {
 	struct video_frame frame[MAX_CONVERT_BUFFERS];
 	int cur_frame;
 
+	/* used instead of scaler when converting in slices */
+	video_scaler_t *slice_scalers[MAX_CONVERSION_THREADS];
+	size_t num_slices;
+
 	void (*callback)(void *param, struct video_data *frame);
 	void *param;
-};
 
-static inline void video_input_free(struct video_input *input)
-{
-	for (size_t i = 0; i < MAX_CONVERT_BUFFERS; i++)
-		video_frame_free(&input->frame[i]);
-	video_scaler_destroy(input->scaler);
-}
+	/* only used when each input is output on its own thread */
+	struct video_output *video;
+	bool thread_active;
+	pthread_t thread;
+	os_sem_t *queue_semaphore;
+	pthread_mutex_t queue_mutex;
+	struct circlebuf queue;
+	volatile bool stop;
+	volatile bool busy;
+
+	volatile long total_frames;
+	volatile long dropped_frames;
+	volatile long lagged_frames;
+};
 
 struct video_output {
 	struct video_output_info info;
 
 	pthread_t thread;
-	pthread_mutex_t data_mutex;
 	bool stop;
 
 	os_sem_t *update_semaphore;
@@ -71,25 +104,109 @@ struct video_output {
 	bool initialized;
 
 	pthread_mutex_t input_mutex;
-	DARRAY(struct video_input) inputs;
+	DARRAY(struct video_input *) inputs;
+
+	/* inputs that were disconnected from their own callback.  their
+	 * threads can't join themselves, so they are joined on close */
+	DARRAY(struct video_input *) retired_inputs;
 
-	size_t available_frames;
-	size_t first_added;
-	size_t last_added;
-	struct cached_frame_info cache[MAX_CACHE_SIZE];
+	/* write_idx is only touched by the producer and read_idx only by
+	 * the consumer, queued_frames is shared between them */
+	size_t write_idx;
+	size_t read_idx;
+	volatile long queued_frames;
+	struct cached_frame_info cache[MAX_VIDEO_CACHE_SIZE];
+
+	/* frame buffers for the cache, plus spares to swap in while input
+	 * threads are still using a buffer */
+	struct frame_buffer *buffers[MAX_VIDEO_CACHE_SIZE + MAX_SPARE_FRAMES];
+	size_t num_buffers;
 
 	volatile bool raw_active;
 	volatile long gpu_refs;
+
+	os_task_pool_t *conversion_pool;
+	const char *slice_names[MAX_CONVERSION_THREADS];
 };
 
 /* ------------------------------------------------------------------------- */
 
-static inline bool scale_video_output(struct video_input *input,
+static inline uint32_t get_plane_row(enum video_format format, size_t plane,
+				     uint32_t y)
+{
+	if (plane > 0 &&
+	    (format == VIDEO_FORMAT_I420 || format == VIDEO_FORMAT_NV12))
+		return y / 2;
+	return y;
+}
+
+struct scale_slice_job {
+	struct video_output *video;
+	struct video_input *input;
+	const struct video_data *src;
+	struct video_frame *dst;
+	volatile bool failed;
+};
+
+static void scale_video_slice(void *param, size_t idx)
+{
+	struct scale_slice_job *job = param;
+	struct video_output *video = job->video;
+	struct video_input *input = job->input;
+	enum video_format src_format = video->info.format;
+	enum video_format dst_format = input->conversion.format;
+	const uint8_t *in[MAX_AV_PLANES] = {0};
+	uint8_t *out[MAX_AV_PLANES] = {0};
+	uint32_t start_y, end_y;
+
+	if (!input->slice_scalers[idx])
+		return;
+
+	video_get_slice_rows(video->info.height, input->num_slices, idx,
+			     &start_y, &end_y);
+
+	for (size_t i = 0; i < MAX_AV_PLANES; i++) {
+		if (job->src->data[i])
+			in[i] = job->src->data[i] +
+				get_plane_row(src_format, i, start_y) *
+					job->src->linesize[i];
+		if (job->dst->data[i])
+			out[i] = job->dst->data[i] +
+				 get_plane_row(dst_format, i, start_y) *
+					 job->dst->linesize[i];
+	}
+
+	profile_start(video->slice_names[idx]);
+	if (!video_scaler_scale(input->slice_scalers[idx], out,
+				job->dst->linesize, in, job->src->linesize))
+		os_atomic_set_bool(&job->failed, true);
+	profile_end(video->slice_names[idx]);
+}
+
+static inline bool scale_video_slices(struct video_output *video,
+				      struct video_input *input,
+				      const struct video_data *data,
+				      struct video_frame *frame)
+{
+	struct scale_slice_job job = {
+		.video = video,
+		.input = input,
+		.src = data,
+		.dst = frame,
+	};
+
+	os_task_pool_run(video->conversion_pool, input->num_slices,
+			 scale_video_slice, &job);
+	return !job.failed;
+}
+
+static inline bool scale_video_output(struct video_output *video,
+				      struct video_input *input,
 				      struct video_data *data)
 {
 	bool success = true;
 
-	if (input->scaler) {
+	if (input->scaler || input->num_slices) {
 		struct video_frame *frame;
 
 		if (++input->cur_frame == MAX_CONVERT_BUFFERS)
@@ -97,10 +214,13 @@ static inline bool scale_video_output(struct video_input *input,
 
 		frame = &input->frame[input->cur_frame];
 
-		success = video_scaler_scale(input->scaler, frame->data,
-					     frame->linesize,
-					     (const uint8_t *const *)data->data,
-					     data->linesize);
+		if (input->num_slices)
+			success = scale_video_slices(video, input, data, frame);
+		else
+			success = video_scaler_scale(
+				input->scaler, frame->data, frame->linesize,
+				(const uint8_t *const *)data->data,
+				data->linesize);
 
 		if (success) {
 			for (size_t i = 0; i < MAX_AV_PLANES; i++) {
@@ -115,29 +235,81 @@ static inline bool scale_video_output(struct video_input *input,
 	return success;
 }
 
-static inline bool video_output_cur_frame(struct video_output *video)
+static inline void release_queued_frame(struct queued_frame *queued)
 {
-	struct cached_frame_info *frame_info;
-	bool complete;
-	bool skipped;
+	os_atomic_dec_long(&queued->buffer->refs);
+}
 
-	/* -------------------------------- */
+/* hands a frame to an input thread.  repeats of the same cached frame are
+ * merged into one queue entry.  if the input is still busy with older frames,
+ * its oldest pending frame is dropped in favor of the new one, so a slow input
+ * never holds more than MAX_INPUT_QUEUE + 1 frame buffers and only that input
+ * loses frames. */
+static inline void queue_input_frame(struct video_input *input,
+				     struct cached_frame_info *frame_info)
+{
+	struct queued_frame queued = {frame_info->frame, frame_info->buffer, 1};
+	struct queued_frame dropped;
+	bool drop = false;
+
+	os_atomic_inc_long(&input->total_frames);
+	if (os_atomic_load_bool(&input->busy))
+		os_atomic_inc_long(&input->lagged_frames);
+
+	pthread_mutex_lock(&input->queue_mutex);
+
+	if (input->queue.size) {
+		struct queued_frame last;
+		circlebuf_peek_back(&input->queue, &last, sizeof(last));
+
+		if (last.buffer == frame_info->buffer) {
+			circlebuf_pop_back(&input->queue, NULL, sizeof(last));
+			last.count++;
+			circlebuf_push_back(&input->queue, &last, sizeof(last));
+			pthread_mutex_unlock(&input->queue_mutex);
+			return;
+		}
+	}
+
+	if (input->queue.size / sizeof(queued) >= MAX_INPUT_QUEUE) {
+		circlebuf_pop_front(&input->queue, &dropped, sizeof(dropped));
+		drop = true;
+	}
 
-	pthread_mutex_lock(&video->data_mutex);
+	os_atomic_inc_long(&frame_info->buffer->refs);
+	circlebuf_push_back(&input->queue, &queued, sizeof(queued));
+	pthread_mutex_unlock(&input->queue_mutex);
+
+	if (drop) {
+		release_queued_frame(&dropped);
+		os_atomic_add_long(&input->dropped_frames, dropped.count);
+	} else {
+		os_sem_post(input->queue_semaphore);
+	}
+}
 
-	frame_info = &video->cache[video->first_added];
+static inline bool video_output_cur_frame(struct video_output *video)
+{
+	struct cached_frame_info *frame_info;
+	bool complete;
 
-	pthread_mutex_unlock(&video->data_mutex);
+	frame_info = &video->cache[video->read_idx];
 
 	/* -------------------------------- */
 
 	pthread_mutex_lock(&video->input_mutex);
 
 	for (size_t i = 0; i < video->inputs.num; i++) {
-		struct video_input *input = video->inputs.array + i;
+		struct video_input *input = video->inputs.array[i];
 		struct video_data frame = frame_info->frame;
 
-		if (scale_video_output(input, &frame))
+		if (input->thread_active) {
+			queue_input_frame(input, frame_info);
+			continue;
+		}
+
+		os_atomic_inc_long(&input->total_frames);
+		if (scale_video_output(video, input, &frame))
 			input->callback(input->param, &frame);
 	}
 
@@ -145,26 +317,15 @@ static inline bool video_output_cur_frame(struct video_output *video)
 
 	/* -------------------------------- */
 
-	pthread_mutex_lock(&video->data_mutex);
-
 	frame_info->frame.timestamp += video->frame_time;
-	complete = --frame_info->count == 0;
-	skipped = frame_info->skipped > 0;
+	complete = os_atomic_dec_long(&frame_info->count) == 0;
 
 	if (complete) {
-		if (++video->first_added == video->info.cache_size)
-			video->first_added = 0;
-
-		if (++video->available_frames == video->info.cache_size)
-			video->last_added = video->first_added;
-	} else if (skipped) {
-		--frame_info->skipped;
-		os_atomic_inc_long(&video->skipped_frames);
-	}
-
-	pthread_mutex_unlock(&video->data_mutex);
+		if (++video->read_idx == video->info.cache_size)
+			video->read_idx = 0;
 
-	/* -------------------------------- */
+		os_atomic_dec_long(&video->queued_frames);
+	}
 
 	return complete;
 }
@@ -199,26 +360,205 @@ static void *video_thread(void *param)
 
 /* ------------------------------------------------------------------------- */
 
+static void video_input_destroy(struct video_input *input)
+{
+	struct queued_frame queued;
+
+	while (input->queue.size) {
+		circlebuf_pop_front(&input->queue, &queued, sizeof(queued));
+		release_queued_frame(&queued);
+	}
+
+	for (size_t i = 0; i < MAX_CONVERT_BUFFERS; i++)
+		video_frame_free(&input->frame[i]);
+	for (size_t i = 0; i < input->num_slices; i++)
+		video_scaler_destroy(input->slice_scalers[i]);
+	video_scaler_destroy(input->scaler);
+
+	if (input->thread_active) {
+		circlebuf_free(&input->queue);
+		os_sem_destroy(input->queue_semaphore);
+		pthread_mutex_destroy(&input->queue_mutex);
+	}
+
+	bfree(input);
+}
+
+static void *video_input_thread(void *param)
+{
+	struct video_input *input = param;
+	struct video_output *video = input->video;
+	struct queued_frame queued;
+
+	os_set_thread_name("video-io: video input thread");
+
+	const char *input_thread_name =
+		profile_store_name(obs_get_profiler_name_store(),
+				   "video_input_thread(%s)", video->info.name);
+
+	while (os_sem_wait(input->queue_semaphore) == 0) {
+		if (os_atomic_load_bool(&input->stop))
+			break;
+
+		pthread_mutex_lock(&input->queue_mutex);
+		circlebuf_pop_front(&input->queue, &queued, sizeof(queued));
+		os_atomic_set_bool(&input->busy, true);
+		pthread_mutex_unlock(&input->queue_mutex);
+
+		profile_start(input_thread_name);
+		for (long i = 0; i < queued.count; i++) {
+			if (os_atomic_load_bool(&input->stop))
+				break;
+
+			struct video_data frame = queued.frame;
+			frame.timestamp += video->frame_time * (uint64_t)i;
+
+			if (scale_video_output(video, input, &frame))
+				input->callback(input->param, &frame);
+		}
+		profile_end(input_thread_name);
+
+		release_queued_frame(&queued);
+		os_atomic_set_bool(&input->busy, false);
+
+		/* the callback disconnected this input */
+		if (os_atomic_load_bool(&input->stop))
+			break;
+
+		profile_reenable_thread();
+	}
+
+	return NULL;
+}
+
+static bool video_input_start_thread(struct video_input *input)
+{
+	pthread_mutex_init_value(&input->queue_mutex);
+
+	if (pthread_mutex_init(&input->queue_mutex, NULL) != 0)
+		return false;
+	if (os_sem_init(&input->queue_semaphore, 0) != 0) {
+		pthread_mutex_destroy(&input->queue_mutex);
+		return false;
+	}
+	if (pthread_create(&input->thread, NULL, video_input_thread, input) !=
+	    0) {
+		os_sem_destroy(input->queue_semaphore);
+		pthread_mutex_destroy(&input->queue_mutex);
+		return false;
+	}
+
+	input->thread_active = true;
+	return true;
+}
+
+static void video_input_free(struct video_input *input)
+{
+	if (input->thread_active) {
+		os_atomic_set_bool(&input->stop, true);
+
+		/* an input can be disconnected from its own callback, in
+		 * which case the thread exits once the callback returns and
+		 * is joined when the output is closed */
+		if (pthread_equal(pthread_self(), input->thread)) {
+			da_push_back(input->video->retired_inputs, &input);
+			return;
+		}
+
+		os_sem_post(input->queue_semaphore);
+		pthread_join(input->thread, NULL);
+	}
+
+	video_input_destroy(input);
+}
+
+/* ------------------------------------------------------------------------- */
+
 static inline bool valid_video_params(const struct video_output_info *info)
 {
 	return info->height != 0 && info->width != 0 && info->fps_den != 0 &&
 	       info->fps_num != 0;
 }
 
-static inline void init_cache(struct video_output *video)
+static struct frame_buffer *create_frame_buffer(struct video_output *video)
 {
-	if (video->info.cache_size > MAX_CACHE_SIZE)
-		video->info.cache_size = MAX_CACHE_SIZE;
+	struct frame_buffer *buffer = bzalloc(sizeof(*buffer));
+	video_frame_init(&buffer->frame, video->info.format, video->info.width,
+			 video->info.height);
 
-	for (size_t i = 0; i < video->info.cache_size; i++) {
-		struct video_frame *frame;
-		frame = (struct video_frame *)&video->cache[i];
+	video->buffers[video->num_buffers++] = buffer;
+	return buffer;
+}
 
-		video_frame_init(frame, video->info.format, video->info.width,
-				 video->info.height);
+static inline void set_cache_buffer(struct cached_frame_info *cfi,
+				    struct frame_buffer *buffer)
+{
+	if (cfi->buffer)
+		cfi->buffer->cached = false;
+
+	memcpy(cfi->frame.data, buffer->frame.data, sizeof(cfi->frame.data));
+	memcpy(cfi->frame.linesize, buffer->frame.linesize,
+	       sizeof(cfi->frame.linesize));
+	cfi->buffer = buffer;
+	buffer->cached = true;
+}
+
+/* gives a cache slot a buffer no input thread is using.  spare buffers are
+ * allocated on demand, and are only needed if an input is falling behind. */
+static bool swap_cache_buffer(struct video_output *video,
+			      struct cached_frame_info *cfi)
+{
+	for (size_t i = 0; i < video->num_buffers; i++) {
+		struct frame_buffer *buffer = video->buffers[i];
+
+		if (!buffer->cached && !os_atomic_load_long(&buffer->refs)) {
+			set_cache_buffer(cfi, buffer);
+			return true;
+		}
 	}
 
-	video->available_frames = video->info.cache_size;
+	if (video->num_buffers == video->info.cache_size + MAX_SPARE_FRAMES)
+		return false;
+
+	set_cache_buffer(cfi, create_frame_buffer(video));
+	return true;
+}
+
+static inline void init_cache(struct video_output *video)
+{
+	if (video->info.cache_size > MAX_VIDEO_CACHE_SIZE)
+		video->info.cache_size = MAX_VIDEO_CACHE_SIZE;
+
+	for (size_t i = 0; i < video->info.cache_size; i++)
+		set_cache_buffer(&video->cache[i], create_frame_buffer(video));
+
+	video->write_idx = 0;
+	video->read_idx = 0;
+	video->queued_frames = 0;
+}
+
+static bool init_conversion_pool(struct video_output *video)
+{
+	uint32_t threads = video->info.conversion_threads;
+
+	if (threads > MAX_CONVERSION_THREADS)
+		threads = MAX_CONVERSION_THREADS;
+	if (threads < 1)
+		threads = 1;
+
+	video->info.conversion_threads = threads;
+	if (threads == 1)
+		return true;
+
+	for (uint32_t i = 0; i < threads; i++)
+		video->slice_names[i] = profile_store_name(
+			obs_get_profiler_name_store(),
+			"scale_video_output_slice(%s, %u)", video->info.name,
+			i);
+
+	video->conversion_pool =
+		os_task_pool_create("video-io: conversion thread", threads - 1);
+	return video->conversion_pool != NULL;
 }
 
 int video_output_open(video_t **video, struct video_output_info *info)
@@ -242,12 +582,12 @@ int video_output_open(video_t **video, struct video_output_info *info)
 		goto fail;
 	if (pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE) != 0)
 		goto fail;
-	if (pthread_mutex_init(&out->data_mutex, &attr) != 0)
-		goto fail;
 	if (pthread_mutex_init(&out->input_mutex, &attr) != 0)
 		goto fail;
 	if (os_sem_init(&out->update_semaphore, 0) != 0)
 		goto fail;
+	if (!init_conversion_pool(out))
+		goto fail;
 	if (pthread_create(&out->thread, NULL, video_thread, out) != 0)
 		goto fail;
 
@@ -270,14 +610,24 @@ void video_output_close(video_t *video)
 	video_output_stop(video);
 
 	for (size_t i = 0; i < video->inputs.num; i++)
-		video_input_free(&video->inputs.array[i]);
+		video_input_free(video->inputs.array[i]);
 	da_free(video->inputs);
 
-	for (size_t i = 0; i < video->info.cache_size; i++)
-		video_frame_free((struct video_frame *)&video->cache[i]);
+	/* these threads still reference the frame buffers until they exit */
+	for (size_t i = 0; i < video->retired_inputs.num; i++) {
+		struct video_input *input = video->retired_inputs.array[i];
+		pthread_join(input->thread, NULL);
+		video_input_destroy(input);
+	}
+	da_free(video->retired_inputs);
+
+	for (size_t i = 0; i < video->num_buffers; i++) {
+		video_frame_free(&video->buffers[i]->frame);
+		bfree(video->buffers[i]);
+	}
 
+	os_task_pool_destroy(video->conversion_pool);
 	os_sem_destroy(video->update_semaphore);
-	pthread_mutex_destroy(&video->data_mutex);
 	pthread_mutex_destroy(&video->input_mutex);
 	bfree(video);
 }
@@ -288,7 +638,7 @@ static size_t video_get_input_idx(const video_t *video,
 				  void *param)
 {
 	for (size_t i = 0; i < video->inputs.num; i++) {
-		struct video_input *input = video->inputs.array + i;
+		struct video_input *input = video->inputs.array[i];
 		if (input->callback == callback && input->param == param)
 			return i;
 	}
@@ -296,6 +646,43 @@ static size_t video_get_input_idx(const video_t *video,
 	return DARRAY_INVALID;
 }
 
+/* format-only conversions have no vertical filtering between bands, so they
+ * can be split into one scaler per slice */
+static inline int video_input_init_slices(struct video_input *input,
+					  struct video_output *video,
+					  const struct video_scale_info *from)
+{
+	size_t num_slices = video->info.conversion_threads;
+
+	for (size_t i = 0; i < num_slices; i++) {
+		struct video_scale_info slice_from = *from;
+		struct video_scale_info slice_to = input->conversion;
+		uint32_t start_y, end_y;
+		int ret;
+
+		video_get_slice_rows(video->info.height, num_slices, i,
+				     &start_y, &end_y);
+		if (start_y == end_y)
+			continue;
+
+		slice_from.height = slice_to.height = end_y - start_y;
+
+		ret = video_scaler_create(&input->slice_scalers[i], &slice_to,
+					  &slice_from,
+					  VIDEO_SCALE_FAST_BILINEAR);
+		if (ret != VIDEO_SCALER_SUCCESS) {
+			for (size_t j = 0; j < i; j++) {
+				video_scaler_destroy(input->slice_scalers[j]);
+				input->slice_scalers[j] = NULL;
+			}
+			return ret;
+		}
+	}
+
+	input->num_slices = num_slices;
+	return VIDEO_SCALER_SUCCESS;
+}
+
 static inline bool video_input_init(struct video_input *input,
 				    struct video_output *video)
 {
@@ -308,10 +695,17 @@ static inline bool video_input_init(struct video_input *input,
 						.range = video->info.range,
 						.colorspace =
 							video->info.colorspace};
-
-		int ret = video_scaler_create(&input->scaler,
-					      &input->conversion, &from,
-					      VIDEO_SCALE_FAST_BILINEAR);
+		bool sliced = video->conversion_pool &&
+			      input->conversion.width == video->info.width &&
+			      input->conversion.height == video->info.height;
+		int ret;
+
+		if (sliced)
+			ret = video_input_init_slices(input, video, &from);
+		else
+			ret = video_scaler_create(&input->scaler,
+						  &input->conversion, &from,
+						  VIDEO_SCALE_FAST_BILINEAR);
 		if (ret != VIDEO_SCALER_SUCCESS) {
 			if (ret == VIDEO_SCALER_BAD_CONVERSION)
 				blog(LOG_ERROR, "video_input_init: Bad "
@@ -351,26 +745,29 @@ bool video_output_connect(
 	pthread_mutex_lock(&video->input_mutex);
 
 	if (video_get_input_idx(video, callback, param) == DARRAY_INVALID) {
-		struct video_input input;
-		memset(&input, 0, sizeof(input));
+		struct video_input *input = bzalloc(sizeof(*input));
 
-		input.callback = callback;
-		input.param = param;
+		input->callback = callback;
+		input->param = param;
+		input->video = video;
 
 		if (conversion) {
-			input.conversion = *conversion;
+			input->conversion = *conversion;
 		} else {
-			input.conversion.format = video->info.format;
-			input.conversion.width = video->info.width;
-			input.conversion.height = video->info.height;
+			input->conversion.format = video->info.format;
+			input->conversion.width = video->info.width;
+			input->conversion.height = video->info.height;
 		}
 
-		if (input.conversion.width == 0)
-			input.conversion.width = video->info.width;
-		if (input.conversion.height == 0)
-			input.conversion.height = video->info.height;
+		if (input->conversion.width == 0)
+			input->conversion.width = video->info.width;
+		if (input->conversion.height == 0)
+			input->conversion.height = video->info.height;
+
+		success = video_input_init(input, video);
+		if (success && video->info.threaded_inputs)
+			success = video_input_start_thread(input);
 
-		success = video_input_init(&input, video);
 		if (success) {
 			if (video->inputs.num == 0) {
 				if (!os_atomic_load_long(&video->gpu_refs)) {
@@ -379,6 +776,8 @@ bool video_output_connect(
 				os_atomic_set_bool(&video->raw_active, true);
 			}
 			da_push_back(video->inputs, &input);
+		} else {
+			video_input_destroy(input);
 		}
 	}
 
@@ -404,6 +803,19 @@ static void log_skipped(video_t *video)
 		     percentage_skipped);
 }
 
+static void log_input_dropped(video_t *video, struct video_input *input)
+{
+	long dropped = os_atomic_load_long(&input->dropped_frames);
+	long total = os_atomic_load_long(&input->total_frames);
+
+	if (dropped)
+		blog(LOG_INFO,
+		     "Video input of '%s' disconnected, number of frames "
+		     "dropped due to input lag: %ld/%ld (%0.1f%%)",
+		     video->info.name, dropped, total,
+		     (double)dropped / (double)total * 100.0);
+}
+
 void video_output_disconnect(video_t *video,
 			     void (*callback)(void *param,
 					      struct video_data *frame),
@@ -416,9 +828,12 @@ void video_output_disconnect(video_t *video,
 
 	size_t idx = video_get_input_idx(video, callback, param);
 	if (idx != DARRAY_INVALID) {
-		video_input_free(video->inputs.array + idx);
+		struct video_input *input = video->inputs.array[idx];
 		da_erase(video->inputs, idx);
 
+		log_input_dropped(video, input);
+		video_input_free(input);
+
 		if (video->inputs.num == 0) {
 			os_atomic_set_bool(&video->raw_active, false);
 			if (!os_atomic_load_long(&video->gpu_refs)) {
@@ -442,41 +857,61 @@ const struct video_output_info *video_output_get_info(const video_t *video)
 	return video ? &video->info : NULL;
 }
 
+static inline bool add_to_last_frame(struct video_output *video, int count)
+{
+	size_t last_idx = video->write_idx == 0 ? video->info.cache_size - 1
+						: video->write_idx - 1;
+	struct cached_frame_info *cfi = &video->cache[last_idx];
+	long cur_count = os_atomic_load_long(&cfi->count);
+
+	while (cur_count > 0) {
+		if (os_atomic_compare_swap_long(&cfi->count, cur_count,
+						cur_count + count))
+			return true;
+
+		cur_count = os_atomic_load_long(&cfi->count);
+	}
+
+	/* the video thread finished with the frame in the meantime */
+	return false;
+}
+
+/* the frames can't be cached without waiting for the video thread or an input
+ * thread, which the graphics thread must never do.  the last frame is output
+ * again instead if the video thread hasn't finished with it yet, otherwise the
+ * frames are lost.  either way they count as skipped. */
+static inline bool skip_frames(struct video_output *video, int count)
+{
+	add_to_last_frame(video, count);
+	os_atomic_add_long(&video->skipped_frames, count);
+	return false;
+}
+
 bool video_output_lock_frame(video_t *video, struct video_frame *frame,
 			     int count, uint64_t timestamp)
 {
 	struct cached_frame_info *cfi;
-	bool locked;
 
 	if (!video)
 		return false;
 
-	pthread_mutex_lock(&video->data_mutex);
+	if ((size_t)os_atomic_load_long(&video->queued_frames) ==
+	    video->info.cache_size)
+		return skip_frames(video, count);
 
-	if (video->available_frames == 0) {
-		video->cache[video->last_added].count += count;
-		video->cache[video->last_added].skipped += count;
-		locked = false;
+	cfi = &video->cache[video->write_idx];
 
-	} else {
-		if (video->available_frames != video->info.cache_size) {
-			if (++video->last_added == video->info.cache_size)
-				video->last_added = 0;
-		}
-
-		cfi = &video->cache[video->last_added];
-		cfi->frame.timestamp = timestamp;
-		cfi->count = count;
-		cfi->skipped = 0;
-
-		memcpy(frame, &cfi->frame, sizeof(*frame));
-
-		locked = true;
-	}
+	/* an input thread is still outputting this buffer, use a spare buffer
+	 * instead if there are any left */
+	if (os_atomic_load_long(&cfi->buffer->refs) > 0 &&
+	    !swap_cache_buffer(video, cfi))
+		return skip_frames(video, count);
 
-	pthread_mutex_unlock(&video->data_mutex);
+	cfi->frame.timestamp = timestamp;
+	cfi->count = count;
 
-	return locked;
+	memcpy(frame, &cfi->frame, sizeof(*frame));
+	return true;
 }
 
 void video_output_unlock_frame(video_t *video)
@@ -484,12 +919,11 @@ void video_output_unlock_frame(video_t *video)
 	if (!video)
 		return;
 
-	pthread_mutex_lock(&video->data_mutex);
+	if (++video->write_idx == video->info.cache_size)
+		video->write_idx = 0;
 
-	video->available_frames--;
+	os_atomic_inc_long(&video->queued_frames);
 	os_sem_post(video->update_semaphore);
-
-	pthread_mutex_unlock(&video->data_mutex);
 }
 
 uint64_t video_output_get_frame_time(const video_t *video)
@@ -553,6 +987,35 @@ uint32_t video_output_get_total_frames(const video_t *video)
 	return (uint32_t)os_atomic_load_long(&video->total_frames);
 }
 
+bool video_output_get_input_stats(
+	const video_t *video,
+	void (*callback)(void *param, struct video_data *frame), void *param,
+	struct video_input_stats *stats)
+{
+	struct video_output *out = (struct video_output *)video;
+	bool found = false;
+
+	if (!video || !stats)
+		return false;
+
+	pthread_mutex_lock(&out->input_mutex);
+
+	size_t idx = video_get_input_idx(out, callback, param);
+	if (idx != DARRAY_INVALID) {
+		struct video_input *input = out->inputs.array[idx];
+		stats->total_frames =
+			(uint32_t)os_atomic_load_long(&input->total_frames);
+		stats->dropped_frames =
+			(uint32_t)os_atomic_load_long(&input->dropped_frames);
+		stats->lagged_frames =
+			(uint32_t)os_atomic_load_long(&input->lagged_frames);
+		found = true;
+	}
+
+	pthread_mutex_unlock(&out->input_mutex);
+	return found;
+}
+
 /* Note: These four functions below are a very slight bit of a hack.  If the
  * texture encoder thread is active while the raw encoder thread is active, the
  * total frame count will just be doubled while they're both active.  Which is
@@ -85,8 +85,25 @@ struct video_output_info {
 
 	enum video_colorspace colorspace;
 	enum video_range_type range;
+
+	/* number of threads used for CPU format conversion, 0 or 1 converts
+	 * on the video thread only */
+	uint32_t conversion_threads;
+
+	/* outputs each connected input on its own thread so that a slow
+	 * input only drops its own frames instead of stalling the others */
+	bool threaded_inputs;
 };
 
+struct video_input_stats {
+	uint32_t total_frames;
+	uint32_t dropped_frames;
+	uint32_t lagged_frames;
+};
+
+#define MAX_CONVERSION_THREADS 16
+#define MAX_VIDEO_CACHE_SIZE 32
+
 static inline bool format_is_yuv(enum video_format format)
 {
 	switch (format) {
@@ -170,6 +187,28 @@ static inline const char *get_video_range_name(enum video_format format,
 	return range == VIDEO_RANGE_FULL ? "Full" : "Partial";
 }
 
+/**
+ * Gets the rows of a frame that slice idx of num_slices covers when a frame
+ * is split into horizontal bands for multithreaded conversion.  Bands always
+ * start on an even row so that 4:2:0 chroma rows are never split.
+ */
+static inline void video_get_slice_rows(uint32_t height, size_t num_slices,
+					size_t idx, uint32_t *start_y,
+					uint32_t *end_y)
+{
+	uint32_t rows = (uint32_t)(((height + 1) / 2 + num_slices - 1) /
+				   num_slices) *
+			2;
+
+	*start_y = rows * (uint32_t)idx;
+	*end_y = *start_y + rows;
+
+	if (*start_y > height)
+		*start_y = height;
+	if (*end_y > height)
+		*end_y = height;
+}
+
 enum video_scale_type {
 	VIDEO_SCALE_DEFAULT,
 	VIDEO_SCALE_POINT,
@@ -227,6 +266,10 @@ EXPORT double video_output_get_frame_rate(const video_t *video);
 
 EXPORT uint32_t video_output_get_skipped_frames(const video_t *video);
 EXPORT uint32_t video_output_get_total_frames(const video_t *video);
+EXPORT bool video_output_get_input_stats(
+	const video_t *video,
+	void (*callback)(void *param, struct video_data *frame), void *param,
+	struct video_input_stats *stats);
 
 extern void video_output_inc_texture_encoders(video_t *video);
 extern void video_output_dec_texture_encoders(video_t *video);
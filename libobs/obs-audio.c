@@ -16,6 +16,7 @@
 ******************************************************************************/
 
 #include <inttypes.h>
+#include "media-io/audio-mix.h"
 #include "obs-internal.h"
 
 struct ts_info {
@@ -65,20 +66,66 @@ static inline void mix_audio(struct audio_output_data *mixes,
 
 	for (size_t mix_idx = 0; mix_idx < MAX_AUDIO_MIXES; mix_idx++) {
 		for (size_t ch = 0; ch < channels; ch++) {
-			register float *mix = mixes[mix_idx].data[ch];
-			register float *aud =
-				source->audio_output_buf[mix_idx][ch];
-			register float *end;
+			float *mix = mixes[mix_idx].data[ch];
+			float *aud = source->audio_output_buf[mix_idx][ch];
 
-			mix += start_point;
-			end = aud + total_floats;
-
-			while (aud < end)
-				*(mix++) += *(aud++);
+			audio_mix_add(mix + start_point, aud, total_floats);
 		}
 	}
 }
 
+struct render_audio_job {
+	struct obs_core_audio *audio;
+	uint32_t mixers;
+	size_t channels;
+	size_t sample_rate;
+	size_t size;
+};
+
+static void render_audio_source(void *param, size_t idx)
+{
+	struct render_audio_job *job = param;
+	obs_source_t *source = job->audio->parallel_sources.array[idx];
+
+	obs_source_audio_render(source, job->mixers, job->channels,
+				job->sample_rate, job->size);
+}
+
+/* sources without a custom audio_render callback only read their own input
+ * buffers, so they can be rendered in any order on any thread.  composite
+ * sources (scenes, transitions) read the output of the sources below them,
+ * so they are rendered afterward on this thread in the original order, which
+ * keeps the output identical to rendering everything serially. */
+static void render_audio_parallel(struct obs_core_audio *audio,
+				  uint32_t mixers, size_t channels,
+				  size_t sample_rate, size_t size)
+{
+	struct render_audio_job job = {audio, mixers, channels, sample_rate,
+				       size};
+
+	da_resize(audio->parallel_sources, 0);
+
+	for (size_t i = 0; i < audio->render_order.num; i++) {
+		obs_source_t *source = audio->render_order.array[i];
+		if (!source->info.audio_render)
+			da_push_back(audio->parallel_sources, &source);
+	}
+
+	if (audio->parallel_sources.num > 1)
+		os_task_pool_run(audio->render_pool,
+				 audio->parallel_sources.num,
+				 render_audio_source, &job);
+	else if (audio->parallel_sources.num == 1)
+		render_audio_source(&job, 0);
+
+	for (size_t i = 0; i < audio->render_order.num; i++) {
+		obs_source_t *source = audio->render_order.array[i];
+		if (source->info.audio_render)
+			obs_source_audio_render(source, mixers, channels,
+						sample_rate, size);
+	}
+}
+
 static void ignore_audio(obs_source_t *source, size_t channels,
 			 size_t sample_rate)
 {
@@ -430,10 +477,15 @@ bool audio_callback(void *param, uint64_t start_ts_in, uint64_t end_ts_in,
 
 	/* ------------------------------------------------ */
 	/* render audio data */
-	for (size_t i = 0; i < audio->render_order.num; i++) {
-		obs_source_t *source = audio->render_order.array[i];
-		obs_source_audio_render(source, mixers, channels, sample_rate,
-					audio_size);
+	if (audio->render_pool) {
+		render_audio_parallel(audio, mixers, channels, sample_rate,
+				      audio_size);
+	} else {
+		for (size_t i = 0; i < audio->render_order.num; i++) {
+			obs_source_t *source = audio->render_order.array[i];
+			obs_source_audio_render(source, mixers, channels,
+						sample_rate, audio_size);
+		}
 	}
 
 	/* ------------------------------------------------ */
@@ -20,18 +20,22 @@
 #include "util/dstr.h"
 #include "util/darray.h"
 #include "util/platform.h"
+#include "util/fnv1a.h"
 #include "graphics/vec2.h"
 #include "graphics/vec3.h"
 #include "graphics/vec4.h"
 #include "graphics/quat.h"
 #include "obs-data.h"
 
-#include <jansson.h>
+#include <errno.h>
+#include <math.h>
 
 struct obs_data_item {
 	volatile long ref;
 	struct obs_data *parent;
+	struct obs_data_item *prev;
 	struct obs_data_item *next;
+	uint32_t hash;
 	enum obs_data_type type;
 	size_t name_len;
 	size_t data_len;
@@ -42,10 +46,26 @@ struct obs_data_item {
 	size_t capacity;
 };
 
+/* objects with more items than this get a hash index for name lookups */
+#define INDEX_MIN_ITEMS 16
+
 struct obs_data {
 	volatile long ref;
 	char *json;
 	struct obs_data_item *first_item;
+	struct obs_data_item *last_item;
+	size_t num_items;
+
+	/* open addressing (linear probing) table of the items, size is a power
+	 * of two and is kept at least twice the number of items */
+	struct obs_data_item **index;
+	size_t index_size;
+
+	/* objects loaded from a binary file decode their items from the
+	 * mapping the first time they are needed */
+	struct binary_map *map;
+	const uint8_t *map_items;
+	volatile long lazy;
 };
 
 struct obs_data_array {
@@ -61,6 +81,14 @@ struct obs_data_number {
 	};
 };
 
+static void decode_items(struct obs_data *data);
+
+static inline void obs_data_load_items(struct obs_data *data)
+{
+	if (data && os_atomic_load_long(&data->lazy))
+		decode_items(data);
+}
+
 /* ------------------------------------------------------------------------- */
 /* Item structure, designed to be one allocation only */
 
@@ -281,6 +309,7 @@ static struct obs_data_item *obs_data_item_create(const char *name,
 	item->capacity = total_size;
 	item->type = type;
 	item->name_len = name_size;
+	item->hash = calc_fnv1a(name);
 	item->ref = 1;
 
 	if (default_data) {
@@ -302,45 +331,170 @@ static struct obs_data_item *obs_data_item_create(const char *name,
 	return item;
 }
 
-static struct obs_data_item **get_item_prev_next(struct obs_data *data,
-						 struct obs_data_item *current)
+/* ------------------------------------------------------------------------- */
+/* Name index */
+
+static inline size_t index_slot(struct obs_data *data,
+				const struct obs_data_item *item, uint32_t hash)
 {
-	if (!current || !data)
-		return NULL;
+	size_t mask = data->index_size - 1;
+	size_t i = hash & mask;
 
-	struct obs_data_item **prev_next = &data->first_item;
-	struct obs_data_item *item = data->first_item;
+	while (data->index[i] != item)
+		i = (i + 1) & mask;
 
-	while (item) {
-		if (item == current)
-			return prev_next;
+	return i;
+}
 
-		prev_next = &item->next;
-		item = item->next;
+static inline void index_add(struct obs_data *data, struct obs_data_item *item)
+{
+	size_t mask = data->index_size - 1;
+	size_t i = item->hash & mask;
+
+	while (data->index[i])
+		i = (i + 1) & mask;
+
+	data->index[i] = item;
+}
+
+static void index_rebuild(struct obs_data *data)
+{
+	size_t size = data->index_size ? data->index_size : INDEX_MIN_ITEMS;
+
+	while (size < data->num_items * 2)
+		size *= 2;
+
+	bfree(data->index);
+	data->index = bzalloc(size * sizeof(struct obs_data_item *));
+	data->index_size = size;
+
+	for (struct obs_data_item *item = data->first_item; item;
+	     item = item->next)
+		index_add(data, item);
+}
+
+/* called after the item has been counted in num_items */
+static inline void index_insert(struct obs_data *data,
+				struct obs_data_item *item)
+{
+	if (data->index && data->num_items * 2 <= data->index_size)
+		index_add(data, item);
+	else if (data->index || data->num_items > INDEX_MIN_ITEMS)
+		index_rebuild(data);
+}
+
+/* backward shift deletion, so lookups never need tombstones */
+static void index_remove(struct obs_data *data, struct obs_data_item *item)
+{
+	size_t mask = data->index_size - 1;
+	size_t i = index_slot(data, item, item->hash);
+	size_t j = i;
+
+	for (;;) {
+		j = (j + 1) & mask;
+		if (!data->index[j])
+			break;
+
+		size_t home = data->index[j]->hash & mask;
+		bool can_move = i <= j ? (home <= i || home > j)
+				       : (home <= i && home > j);
+
+		if (can_move) {
+			data->index[i] = data->index[j];
+			i = j;
+		}
 	}
 
-	return NULL;
+	data->index[i] = NULL;
 }
 
-static inline void obs_data_item_detach(struct obs_data_item *item)
+/* ------------------------------------------------------------------------- */
+
+/* keeps the items sorted by name.  items are usually added in order (when
+ * loading saved json or copying another object), so the end is checked
+ * first */
+static void obs_data_item_attach(struct obs_data *data,
+				 struct obs_data_item *item)
 {
-	struct obs_data_item **prev_next =
-		get_item_prev_next(item->parent, item);
+	const char *name = get_item_name(item);
+	struct obs_data_item *prev = data->last_item;
 
-	if (prev_next) {
-		*prev_next = item->next;
-		item->next = NULL;
+	if (prev && strcmp(get_item_name(prev), name) > 0) {
+		prev = NULL;
+
+		for (struct obs_data_item *cur = data->first_item; cur;
+		     cur = cur->next) {
+			if (strcmp(get_item_name(cur), name) > 0)
+				break;
+			prev = cur;
+		}
 	}
+
+	item->parent = data;
+	item->prev = prev;
+	item->next = prev ? prev->next : data->first_item;
+
+	if (item->prev)
+		item->prev->next = item;
+	else
+		data->first_item = item;
+
+	if (item->next)
+		item->next->prev = item;
+	else
+		data->last_item = item;
+
+	data->num_items++;
+	index_insert(data, item);
+}
+
+static inline void obs_data_item_detach(struct obs_data_item *item)
+{
+	struct obs_data *data = item->parent;
+
+	if (!data)
+		return;
+
+	if (item->prev)
+		item->prev->next = item->next;
+	else
+		data->first_item = item->next;
+
+	if (item->next)
+		item->next->prev = item->prev;
+	else
+		data->last_item = item->prev;
+
+	if (data->index)
+		index_remove(data, item);
+	data->num_items--;
+
+	item->parent = NULL;
+	item->prev = NULL;
+	item->next = NULL;
 }
 
+/* old_ptr has been reallocated and must not be dereferenced */
 static inline void obs_data_item_reattach(struct obs_data_item *old_ptr,
 					  struct obs_data_item *new_ptr)
 {
-	struct obs_data_item **prev_next =
-		get_item_prev_next(new_ptr->parent, old_ptr);
+	struct obs_data *data = new_ptr->parent;
+
+	if (!data)
+		return;
+
+	if (new_ptr->prev)
+		new_ptr->prev->next = new_ptr;
+	else
+		data->first_item = new_ptr;
+
+	if (new_ptr->next)
+		new_ptr->next->prev = new_ptr;
+	else
+		data->last_item = new_ptr;
 
-	if (prev_next)
-		*prev_next = new_ptr;
+	if (data->index)
+		data->index[index_slot(data, old_ptr, new_ptr->hash)] = new_ptr;
 }
 
 static struct obs_data_item *
@@ -470,154 +624,1335 @@ obs_data_item_set_autoselect_data(struct obs_data_item **p_item,
 
 /* ------------------------------------------------------------------------- */
 
-static void obs_data_add_json_item(obs_data_t *data, const char *key,
-				   json_t *json);
+/* JSON reading and writing
+ *
+ * Objects are read from and written to JSON text directly, rather than going
+ * through a jansson tree, which for large scene collections took more memory
+ * and time than the obs_data itself.  The output is the same as what jansson
+ * produced with JSON_PRESERVE_ORDER | JSON_INDENT(4), and the same input is
+ * accepted as with JSON_REJECT_DUPLICATES. */
+
+#define JSON_MAX_DEPTH 2048
+
+static struct obs_data_item *get_item(struct obs_data *data, const char *name);
+
+/* returns the length of the valid UTF-8 sequence at str, or 0 if invalid
+ * (overlong, surrogate halves and code points past U+10FFFF included) */
+static size_t utf8_seq_len(const char *str)
+{
+	const uint8_t *s = (const uint8_t *)str;
+	uint32_t val;
+	size_t len;
+
+	if (s[0] < 0x80)
+		return 1;
+	else if (s[0] >= 0xC2 && s[0] <= 0xDF)
+		len = 2, val = s[0] & 0x1F;
+	else if (s[0] >= 0xE0 && s[0] <= 0xEF)
+		len = 3, val = s[0] & 0x0F;
+	else if (s[0] >= 0xF0 && s[0] <= 0xF4)
+		len = 4, val = s[0] & 0x07;
+	else
+		return 0;
 
-static inline void obs_data_add_json_object_data(obs_data_t *data, json_t *jobj)
-{
-	const char *item_key;
-	json_t *jitem;
+	for (size_t i = 1; i < len; i++) {
+		if (s[i] < 0x80 || s[i] > 0xBF)
+			return 0;
+		val = (val << 6) | (s[i] & 0x3F);
+	}
+
+	if (val > 0x10FFFF || (val >= 0xD800 && val <= 0xDFFF))
+		return 0;
+	if ((len == 3 && val < 0x800) || (len == 4 && val < 0x10000))
+		return 0;
+
+	return len;
+}
 
-	json_object_foreach (jobj, item_key, jitem) {
-		obs_data_add_json_item(data, item_key, jitem);
+static bool utf8_valid(const char *str)
+{
+	while (*str) {
+		size_t len = utf8_seq_len(str);
+		if (!len)
+			return false;
+		str += len;
 	}
+
+	return true;
+}
+
+/* ------------------------------------------------------------------------- */
+
+struct json_reader {
+	const char *pos;
+	int line;
+	int depth;
+	const char *error;
+
+	struct dstr str;
+	DARRAY(struct dstr) keys;
+};
+
+static bool json_read_object(struct json_reader *r, obs_data_t *data);
+static bool json_read_array(struct json_reader *r, obs_data_array_t *array);
+
+static inline bool json_fail(struct json_reader *r, const char *error)
+{
+	if (!r->error)
+		r->error = error;
+	return false;
 }
 
-static inline void obs_data_add_json_object(obs_data_t *data, const char *key,
-					    json_t *jobj)
+static inline void json_skip_ws(struct json_reader *r)
 {
-	obs_data_t *sub_obj = obs_data_create();
+	for (;;) {
+		char ch = *r->pos;
 
-	obs_data_add_json_object_data(sub_obj, jobj);
-	obs_data_set_obj(data, key, sub_obj);
-	obs_data_release(sub_obj);
+		if (ch == '\n')
+			r->line++;
+		else if (ch != ' ' && ch != '\t' && ch != '\r')
+			break;
+
+		r->pos++;
+	}
 }
 
-static void obs_data_add_json_array(obs_data_t *data, const char *key,
-				    json_t *jarray)
+static inline int json_read_hex4(const char *str)
 {
-	obs_data_array_t *array = obs_data_array_create();
-	size_t idx;
-	json_t *jitem;
+	int val = 0;
 
-	json_array_foreach (jarray, idx, jitem) {
-		obs_data_t *item;
+	for (int i = 0; i < 4; i++) {
+		char ch = str[i];
+		int digit;
 
-		if (!json_is_object(jitem))
-			continue;
+		if (ch >= '0' && ch <= '9')
+			digit = ch - '0';
+		else if (ch >= 'a' && ch <= 'f')
+			digit = ch - 'a' + 10;
+		else if (ch >= 'A' && ch <= 'F')
+			digit = ch - 'A' + 10;
+		else
+			return -1;
 
-		item = obs_data_create();
-		obs_data_add_json_object_data(item, jitem);
-		obs_data_array_push_back(array, item);
-		obs_data_release(item);
+		val = (val << 4) | digit;
 	}
 
-	obs_data_set_array(data, key, array);
-	obs_data_array_release(array);
+	return val;
 }
 
-static void obs_data_add_json_item(obs_data_t *data, const char *key,
-				   json_t *json)
+static void json_cat_utf8(struct dstr *str, uint32_t cp)
 {
-	if (json_is_object(json))
-		obs_data_add_json_object(data, key, json);
-	else if (json_is_array(json))
-		obs_data_add_json_array(data, key, json);
-	else if (json_is_string(json))
-		obs_data_set_string(data, key, json_string_value(json));
-	else if (json_is_integer(json))
-		obs_data_set_int(data, key, json_integer_value(json));
-	else if (json_is_real(json))
-		obs_data_set_double(data, key, json_real_value(json));
-	else if (json_is_true(json))
-		obs_data_set_bool(data, key, true);
-	else if (json_is_false(json))
-		obs_data_set_bool(data, key, false);
+	char buf[4];
+	size_t len;
+
+	if (cp < 0x80) {
+		buf[0] = (char)cp;
+		len = 1;
+	} else if (cp < 0x800) {
+		buf[0] = (char)(0xC0 | (cp >> 6));
+		buf[1] = (char)(0x80 | (cp & 0x3F));
+		len = 2;
+	} else if (cp < 0x10000) {
+		buf[0] = (char)(0xE0 | (cp >> 12));
+		buf[1] = (char)(0x80 | ((cp >> 6) & 0x3F));
+		buf[2] = (char)(0x80 | (cp & 0x3F));
+		len = 3;
+	} else {
+		buf[0] = (char)(0xF0 | (cp >> 18));
+		buf[1] = (char)(0x80 | ((cp >> 12) & 0x3F));
+		buf[2] = (char)(0x80 | ((cp >> 6) & 0x3F));
+		buf[3] = (char)(0x80 | (cp & 0x3F));
+		len = 4;
+	}
+
+	dstr_ncat(str, buf, len);
+}
+
+static bool json_read_escape(struct json_reader *r, struct dstr *str)
+{
+	const char *p = r->pos;
+	int cp;
+
+	switch (*p) {
+	case '"':
+	case '\\':
+	case '/':
+		dstr_cat_ch(str, *p);
+		break;
+	case 'b':
+		dstr_cat_ch(str, '\b');
+		break;
+	case 'f':
+		dstr_cat_ch(str, '\f');
+		break;
+	case 'n':
+		dstr_cat_ch(str, '\n');
+		break;
+	case 'r':
+		dstr_cat_ch(str, '\r');
+		break;
+	case 't':
+		dstr_cat_ch(str, '\t');
+		break;
+	case 'u':
+		cp = json_read_hex4(p + 1);
+		if (cp < 0)
+			return json_fail(r, "invalid \\u escape");
+		p += 4;
+
+		if (cp >= 0xD800 && cp <= 0xDBFF) {
+			int low = p[1] == '\\' && p[2] == 'u'
+					  ? json_read_hex4(p + 3)
+					  : -1;
+			if (low < 0xDC00 || low > 0xDFFF)
+				return json_fail(r, "invalid UTF-16 surrogate");
+
+			cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+			p += 6;
+
+		} else if (cp >= 0xDC00 && cp <= 0xDFFF) {
+			return json_fail(r, "invalid UTF-16 surrogate");
+
+		} else if (cp == 0) {
+			return json_fail(r, "\\u0000 is not allowed");
+		}
+
+		json_cat_utf8(str, (uint32_t)cp);
+		break;
+	default:
+		return json_fail(r, "invalid escape");
+	}
+
+	r->pos = p + 1;
+	return true;
 }
 
-/* ------------------------------------------------------------------------- */
+/* reads the string at the current position into str, which is left with an
+ * allocated (possibly empty) array */
+static bool json_read_string(struct json_reader *r, struct dstr *str)
+{
+	const char *p = ++r->pos;
+
+	dstr_ensure_capacity(str, 1);
+	str->len = 0;
+	str->array[0] = 0;
+
+	for (;;) {
+		const char *run = p;
+
+		while ((uint8_t)*p >= 0x20 && *p != '"' && *p != '\\') {
+			if ((uint8_t)*p < 0x80) {
+				p++;
+				continue;
+			}
 
-static inline void set_json_string(json_t *json, const char *name,
-				   obs_data_item_t *item)
+			size_t len = utf8_seq_len(p);
+			if (!len) {
+				r->pos = p;
+				return json_fail(r, "invalid UTF-8");
+			}
+			p += len;
+		}
+
+		dstr_ncat(str, run, p - run);
+		r->pos = p;
+
+		if (*p == '"') {
+			r->pos++;
+			return true;
+		} else if (*p == '\\') {
+			r->pos++;
+			if (!json_read_escape(r, str))
+				return false;
+			p = r->pos;
+		} else if (!*p) {
+			return json_fail(r, "premature end of input");
+		} else {
+			return json_fail(r, "control character in string");
+		}
+	}
+}
+
+static inline bool is_digit(char ch)
 {
-	const char *val = obs_data_item_get_string(item);
-	json_object_set_new(json, name, json_string(val));
+	return ch >= '0' && ch <= '9';
 }
 
-static inline void set_json_number(json_t *json, const char *name,
-				   obs_data_item_t *item)
+static bool json_read_number(struct json_reader *r, obs_data_t *data,
+			     const char *key)
 {
-	enum obs_data_number_type type = obs_data_item_numtype(item);
+	const char *start = r->pos;
+	const char *p = start;
+	bool real = false;
+	char buf[64];
+	size_t len;
+
+	if (*p == '-')
+		p++;
+	if (*p == '0')
+		p++;
+	else if (is_digit(*p))
+		while (is_digit(*p))
+			p++;
+	else
+		return json_fail(r, "invalid token");
+
+	if (*p == '.') {
+		real = true;
+		if (!is_digit(*++p))
+			return json_fail(r, "invalid token");
+		while (is_digit(*p))
+			p++;
+	}
+
+	if (*p == 'e' || *p == 'E') {
+		real = true;
+		p++;
+		if (*p == '+' || *p == '-')
+			p++;
+		if (!is_digit(*p))
+			return json_fail(r, "invalid token");
+		while (is_digit(*p))
+			p++;
+	}
+
+	len = p - start;
+	if (len >= sizeof(buf))
+		return json_fail(r, "number too long");
+
+	memcpy(buf, start, len);
+	buf[len] = 0;
+	r->pos = p;
+
+	if (real) {
+		double val = os_strtod(buf);
+		if (isinf(val))
+			return json_fail(r, "real number overflow");
+		if (data)
+			obs_data_set_double(data, key, val);
 
-	if (type == OBS_DATA_NUM_INT) {
-		long long val = obs_data_item_get_int(item);
-		json_object_set_new(json, name, json_integer(val));
 	} else {
-		double val = obs_data_item_get_double(item);
-		json_object_set_new(json, name, json_real(val));
+		long long val;
+
+		errno = 0;
+		val = strtoll(buf, NULL, 10);
+		if (errno == ERANGE)
+			return json_fail(r, "integer overflow");
+		if (data)
+			obs_data_set_int(data, key, val);
+	}
+
+	return true;
+}
+
+static inline bool json_read_literal(struct json_reader *r, const char *lit)
+{
+	size_t len = strlen(lit);
+
+	if (strncmp(r->pos, lit, len) != 0)
+		return json_fail(r, "invalid token");
+
+	r->pos += len;
+	return true;
+}
+
+/* values with a NULL data are only validated.  objects are still read into a
+ * temporary object, so duplicate keys are rejected everywhere */
+static bool json_read_value(struct json_reader *r, obs_data_t *data,
+			    const char *key)
+{
+	obs_data_array_t *array;
+	obs_data_t *obj;
+	bool success;
+
+	switch (*r->pos) {
+	case '{':
+		obj = obs_data_create();
+		success = json_read_object(r, obj);
+		if (success && data)
+			obs_data_set_obj(data, key, obj);
+		obs_data_release(obj);
+		return success;
+
+	case '[':
+		array = data ? obs_data_array_create() : NULL;
+		success = json_read_array(r, array);
+		if (success && data)
+			obs_data_set_array(data, key, array);
+		obs_data_array_release(array);
+		return success;
+
+	case '"':
+		if (!json_read_string(r, &r->str))
+			return false;
+		if (data)
+			obs_data_set_string(data, key, r->str.array);
+		return true;
+
+	case 't':
+		if (!json_read_literal(r, "true"))
+			return false;
+		if (data)
+			obs_data_set_bool(data, key, true);
+		return true;
+
+	case 'f':
+		if (!json_read_literal(r, "false"))
+			return false;
+		if (data)
+			obs_data_set_bool(data, key, false);
+		return true;
+
+	case 'n':
+		return json_read_literal(r, "null");
+
+	case '\0':
+		return json_fail(r, "premature end of input");
+
+	default:
+		return json_read_number(r, data, key);
 	}
 }
 
-static inline void set_json_bool(json_t *json, const char *name,
-				 obs_data_item_t *item)
+static bool json_read_object(struct json_reader *r, obs_data_t *data)
 {
-	bool val = obs_data_item_get_bool(item);
-	json_object_set_new(json, name, val ? json_true() : json_false());
+	size_t key_idx = (size_t)r->depth;
+	bool success = false;
+
+	if (++r->depth > JSON_MAX_DEPTH)
+		return json_fail(r, "maximum parsing depth reached");
+
+	/* the key is kept while its value is read, so each depth has one.  the
+	 * array can move while reading nested objects, the strings don't */
+	if (r->keys.num <= key_idx)
+		da_resize(r->keys, key_idx + 1);
+
+	r->pos++;
+	json_skip_ws(r);
+
+	if (*r->pos == '}') {
+		r->pos++;
+		success = true;
+		goto done;
+	}
+
+	for (;;) {
+		struct dstr *key = &r->keys.array[key_idx];
+
+		if (*r->pos != '"') {
+			json_fail(r, "string or '}' expected");
+			goto done;
+		}
+		if (!json_read_string(r, key))
+			goto done;
+		if (get_item(data, key->array)) {
+			json_fail(r, "duplicate object key");
+			goto done;
+		}
+
+		json_skip_ws(r);
+		if (*r->pos != ':') {
+			json_fail(r, "':' expected");
+			goto done;
+		}
+		r->pos++;
+		json_skip_ws(r);
+
+		if (!json_read_value(r, data, key->array))
+			goto done;
+
+		json_skip_ws(r);
+		if (*r->pos == '}') {
+			r->pos++;
+			success = true;
+			goto done;
+		}
+		if (*r->pos != ',') {
+			json_fail(r, "'}' expected");
+			goto done;
+		}
+		r->pos++;
+		json_skip_ws(r);
+	}
+
+done:
+	r->depth--;
+	return success;
 }
 
-static json_t *obs_data_to_json(obs_data_t *data);
+/* obs_data arrays only hold objects, anything else in the array is skipped */
+static bool json_read_array(struct json_reader *r, obs_data_array_t *array)
+{
+	bool success = false;
+
+	if (++r->depth > JSON_MAX_DEPTH)
+		return json_fail(r, "maximum parsing depth reached");
+
+	r->pos++;
+	json_skip_ws(r);
+
+	if (*r->pos == ']') {
+		r->pos++;
+		success = true;
+		goto done;
+	}
+
+	for (;;) {
+		if (*r->pos == '{') {
+			obs_data_t *obj = obs_data_create();
+			bool read = json_read_object(r, obj);
+
+			if (read)
+				obs_data_array_push_back(array, obj);
+			obs_data_release(obj);
+			if (!read)
+				goto done;
 
-static inline void set_json_obj(json_t *json, const char *name,
-				obs_data_item_t *item)
+		} else if (!json_read_value(r, NULL, NULL)) {
+			goto done;
+		}
+
+		json_skip_ws(r);
+		if (*r->pos == ']') {
+			r->pos++;
+			success = true;
+			goto done;
+		}
+		if (*r->pos != ',') {
+			json_fail(r, "']' expected");
+			goto done;
+		}
+		r->pos++;
+		json_skip_ws(r);
+	}
+
+done:
+	r->depth--;
+	return success;
+}
+
+/* a root array is accepted but leaves the object empty, like before */
+static bool json_read(obs_data_t *data, const char *json,
+		      struct json_reader *r)
 {
-	obs_data_t *obj = obs_data_item_get_obj(item);
-	json_object_set_new(json, name, obs_data_to_json(obj));
-	obs_data_release(obj);
+	bool success;
+
+	r->pos = json;
+	r->line = 1;
+	json_skip_ws(r);
+
+	if (*r->pos == '{')
+		success = json_read_object(r, data);
+	else if (*r->pos == '[')
+		success = json_read_array(r, NULL);
+	else
+		return json_fail(r, "'[' or '{' expected");
+
+	if (!success)
+		return false;
+
+	json_skip_ws(r);
+	if (*r->pos)
+		return json_fail(r, "end of file expected");
+
+	return true;
 }
 
-static inline void set_json_array(json_t *json, const char *name,
-				  obs_data_item_t *item)
+/* ------------------------------------------------------------------------- */
+
+static void json_write_indent(struct dstr *out, int depth)
+{
+	static const char spaces[] = "                                ";
+	size_t count = (size_t)depth * 4;
+
+	dstr_cat_ch(out, '\n');
+
+	while (count) {
+		size_t len = count < sizeof(spaces) - 1 ? count
+							: sizeof(spaces) - 1;
+		dstr_ncat(out, spaces, len);
+		count -= len;
+	}
+}
+
+static void json_write_string(struct dstr *out, const char *str)
+{
+	dstr_cat_ch(out, '"');
+
+	for (;;) {
+		const char *run = str;
+		char esc[8];
+
+		while ((uint8_t)*str >= 0x20 && *str != '"' && *str != '\\')
+			str++;
+
+		dstr_ncat(out, run, str - run);
+
+		switch (*str) {
+		case '\0':
+			dstr_cat_ch(out, '"');
+			return;
+		case '"':
+			dstr_cat(out, "\\\"");
+			break;
+		case '\\':
+			dstr_cat(out, "\\\\");
+			break;
+		case '\b':
+			dstr_cat(out, "\\b");
+			break;
+		case '\f':
+			dstr_cat(out, "\\f");
+			break;
+		case '\n':
+			dstr_cat(out, "\\n");
+			break;
+		case '\r':
+			dstr_cat(out, "\\r");
+			break;
+		case '\t':
+			dstr_cat(out, "\\t");
+			break;
+		default:
+			snprintf(esc, sizeof(esc), "\\u%04X", (uint8_t)*str);
+			dstr_cat(out, esc);
+		}
+
+		str++;
+	}
+}
+
+static void json_write_object(struct dstr *out, obs_data_t *data, int depth);
+
+static void json_write_array(struct dstr *out, obs_data_array_t *array,
+			     int depth)
 {
-	json_t *jarray = json_array();
-	obs_data_array_t *array = obs_data_item_get_array(item);
-	size_t count = obs_data_array_count(array);
+	size_t count = array ? array->objects.num : 0;
 
-	for (size_t idx = 0; idx < count; idx++) {
-		obs_data_t *sub_item = obs_data_array_item(array, idx);
-		json_t *jitem = obs_data_to_json(sub_item);
-		json_array_append_new(jarray, jitem);
-		obs_data_release(sub_item);
+	if (!count) {
+		dstr_cat(out, "[]");
+		return;
+	}
+
+	dstr_cat_ch(out, '[');
+
+	for (size_t i = 0; i < count; i++) {
+		if (i)
+			dstr_cat_ch(out, ',');
+		json_write_indent(out, depth + 1);
+		json_write_object(out, array->objects.array[i], depth + 1);
 	}
 
-	json_object_set_new(json, name, jarray);
-	obs_data_array_release(array);
+	json_write_indent(out, depth);
+	dstr_cat_ch(out, ']');
 }
 
-static json_t *obs_data_to_json(obs_data_t *data)
+/* returns false for values jansson can't represent, which were left out */
+static bool json_write_value(struct dstr *out, struct obs_data_item *item,
+			     int depth)
 {
-	json_t *json = json_object();
-	obs_data_item_t *item = NULL;
+	struct obs_data_number *num;
+	char buf[64];
+	int len;
+
+	switch (item->type) {
+	case OBS_DATA_STRING:
+		if (!utf8_valid(obs_data_item_get_string(item)))
+			return false;
+		json_write_string(out, obs_data_item_get_string(item));
+		return true;
 
-	for (item = obs_data_first(data); item; obs_data_item_next(&item)) {
-		enum obs_data_type type = obs_data_item_gettype(item);
+	case OBS_DATA_NUMBER:
+		num = get_item_data(item);
+		if (num->type == OBS_DATA_NUM_INT) {
+			len = snprintf(buf, sizeof(buf), "%lld", num->int_val);
+		} else {
+			if (!isfinite(num->double_val))
+				return false;
+			len = os_dtostr(num->double_val, buf, sizeof(buf));
+		}
+		if (len <= 0)
+			return false;
+		dstr_ncat(out, buf, len);
+		return true;
+
+	case OBS_DATA_BOOLEAN:
+		dstr_cat(out, obs_data_item_get_bool(item) ? "true" : "false");
+		return true;
+
+	case OBS_DATA_OBJECT:
+		json_write_object(out, get_item_obj(item), depth);
+		return true;
+
+	case OBS_DATA_ARRAY:
+		json_write_array(out, get_item_array(item), depth);
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+/* only user values are written.  items are written as they go, and removed
+ * again if their value turns out not to be representable */
+static void json_write_object(struct dstr *out, obs_data_t *data, int depth)
+{
+	struct obs_data_item *item;
+	bool empty = true;
+
+	obs_data_load_items(data);
+	item = data ? data->first_item : NULL;
+
+	dstr_cat_ch(out, '{');
+
+	for (; item; item = item->next) {
 		const char *name = get_item_name(item);
+		size_t start = out->len;
 
-		if (!obs_data_item_has_user_value(item))
+		if (!item->data_size || !utf8_valid(name))
 			continue;
 
-		if (type == OBS_DATA_STRING)
-			set_json_string(json, name, item);
-		else if (type == OBS_DATA_NUMBER)
-			set_json_number(json, name, item);
-		else if (type == OBS_DATA_BOOLEAN)
-			set_json_bool(json, name, item);
-		else if (type == OBS_DATA_OBJECT)
-			set_json_obj(json, name, item);
-		else if (type == OBS_DATA_ARRAY)
-			set_json_array(json, name, item);
+		if (!empty)
+			dstr_cat_ch(out, ',');
+		json_write_indent(out, depth + 1);
+		json_write_string(out, name);
+		dstr_cat(out, ": ");
+
+		if (json_write_value(out, item, depth + 1)) {
+			empty = false;
+		} else {
+			out->len = start;
+			out->array[start] = 0;
+		}
 	}
 
-	return json;
+	if (!empty)
+		json_write_indent(out, depth);
+	dstr_cat_ch(out, '}');
+}
+
+/* ------------------------------------------------------------------------- */
+/* Binary reading and writing
+ *
+ * A compact alternative to JSON for large data such as scene collections.
+ * The file is memory-mapped and validated once, after which each object
+ * only decodes its own items the first time they are needed, so parts that
+ * are never looked at are never allocated.
+ *
+ * Layout (native byte order, which the magic number checks):
+ *
+ *   header:  uint32 magic, uint32 version, uint32 string count, uint32 0,
+ *            uint64 string table offset, uint64 root object offset
+ *   object:  uint32 size of the rest, uint32 item count, items sorted by
+ *            name
+ *   item:    uint8 type, uint32 name string, value
+ *   array:   uint32 size of the rest, uint32 object count, objects
+ *   strings: NUL terminated, followed by a table of uint32 offset and
+ *            uint32 length pairs.  every name and string value is stored
+ *            once and referred to by index
+ *
+ * Only user values are stored, and values JSON can't hold are left out, so
+ * loading a binary file gives the same data as loading the equivalent JSON.
+ */
+
+#define BINARY_MAGIC 0x4453424F /* "OBSD" */
+#define BINARY_VERSION 1
+#define BINARY_HEADER_SIZE 32
+
+enum binary_type {
+	BINARY_STRING = 1,
+	BINARY_INT,
+	BINARY_DOUBLE,
+	BINARY_BOOL,
+	BINARY_OBJECT,
+	BINARY_ARRAY,
+};
+
+struct binary_map {
+	volatile long refs;
+	uint8_t *data;
+	size_t size;
+	bool mapped;
+
+	const uint8_t *strings;
+	uint32_t string_count;
+};
+
+/* objects are decoded under this lock, which is only taken while an object
+ * still has undecoded items */
+static pthread_mutex_t lazy_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static inline uint32_t read_u32(const uint8_t *pos)
+{
+	uint32_t val;
+	memcpy(&val, pos, sizeof(val));
+	return val;
+}
+
+static inline uint64_t read_u64(const uint8_t *pos)
+{
+	uint64_t val;
+	memcpy(&val, pos, sizeof(val));
+	return val;
+}
+
+static inline const char *map_string(const struct binary_map *map,
+				     uint32_t idx)
+{
+	return (const char *)map->data + read_u32(map->strings + idx * 8);
+}
+
+static void binary_map_release(struct binary_map *map)
+{
+	if (map && os_atomic_dec_long(&map->refs) == 0) {
+		if (map->mapped)
+			os_unmap_file(map->data, map->size);
+		else
+			bfree(map->data);
+		bfree(map);
+	}
+}
+
+/* ------------------------------------------------------------------------- */
+
+static obs_data_t *lazy_object_create(struct binary_map *map,
+				      const uint8_t *record)
+{
+	obs_data_t *data = obs_data_create();
+
+	os_atomic_inc_long(&map->refs);
+	data->map = map;
+	data->map_items = record + 4;
+	data->lazy = 1;
+	return data;
+}
+
+static inline void add_decoded_item(obs_data_t *data, const char *name,
+				    const void *ptr, size_t size,
+				    enum obs_data_type type)
+{
+	struct obs_data_item *item =
+		obs_data_item_create(name, ptr, size, type, false, false);
+	obs_data_item_attach(data, item);
+}
+
+static const uint8_t *decode_item(obs_data_t *data, struct binary_map *map,
+				  const uint8_t *pos)
+{
+	uint8_t type = *pos;
+	const char *name = map_string(map, read_u32(pos + 1));
+	struct obs_data_number num;
+	const char *str;
+	bool val;
+
+	pos += 5;
+
+	switch (type) {
+	case BINARY_STRING:
+		str = map_string(map, read_u32(pos));
+		add_decoded_item(data, name, str, strlen(str) + 1,
+				 OBS_DATA_STRING);
+		return pos + 4;
+
+	case BINARY_INT:
+		num.type = OBS_DATA_NUM_INT;
+		num.int_val = (long long)read_u64(pos);
+		add_decoded_item(data, name, &num, sizeof(num),
+				 OBS_DATA_NUMBER);
+		return pos + 8;
+
+	case BINARY_DOUBLE:
+		num.type = OBS_DATA_NUM_DOUBLE;
+		memcpy(&num.double_val, pos, sizeof(double));
+		add_decoded_item(data, name, &num, sizeof(num),
+				 OBS_DATA_NUMBER);
+		return pos + 8;
+
+	case BINARY_BOOL:
+		val = *pos != 0;
+		add_decoded_item(data, name, &val, sizeof(val),
+				 OBS_DATA_BOOLEAN);
+		return pos + 1;
+
+	case BINARY_OBJECT: {
+		obs_data_t *obj = lazy_object_create(map, pos);
+
+		add_decoded_item(data, name, &obj, sizeof(obj),
+				 OBS_DATA_OBJECT);
+		obs_data_release(obj);
+		return pos + 4 + read_u32(pos);
+	}
+
+	default: {
+		obs_data_array_t *array = obs_data_array_create();
+		uint32_t count = read_u32(pos + 4);
+		const uint8_t *end = pos + 4 + read_u32(pos);
+
+		da_reserve(array->objects, count);
+		for (const uint8_t *obj_pos = pos + 8; obj_pos < end;
+		     obj_pos += 4 + read_u32(obj_pos)) {
+			obs_data_t *obj = lazy_object_create(map, obj_pos);
+			da_push_back(array->objects, &obj);
+		}
+
+		add_decoded_item(data, name, &array, sizeof(array),
+				 OBS_DATA_ARRAY);
+		obs_data_array_release(array);
+		return end;
+	}
+	}
+}
+
+static void decode_items(obs_data_t *data)
+{
+	pthread_mutex_lock(&lazy_mutex);
+
+	if (data->lazy) {
+		struct binary_map *map = data->map;
+		const uint8_t *pos = data->map_items;
+		uint32_t count = read_u32(pos);
+
+		pos += 4;
+		for (uint32_t i = 0; i < count; i++)
+			pos = decode_item(data, map, pos);
+
+		data->map = NULL;
+		data->map_items = NULL;
+		/* full barrier, the items have to be visible first */
+		os_atomic_dec_long(&data->lazy);
+		binary_map_release(map);
+	}
+
+	pthread_mutex_unlock(&lazy_mutex);
+}
+
+/* ------------------------------------------------------------------------- */
+
+struct binary_check {
+	const struct binary_map *map;
+	const uint8_t *end;
+	int depth;
+};
+
+static bool check_object(struct binary_check *check, const uint8_t **p_pos);
+
+static inline bool check_size(struct binary_check *check, const uint8_t *pos,
+			      size_t size)
+{
+	return (size_t)(check->end - pos) >= size;
+}
+
+static inline bool check_string(struct binary_check *check, const uint8_t *pos)
+{
+	return check_size(check, pos, 4) &&
+	       read_u32(pos) < check->map->string_count;
+}
+
+static bool check_array(struct binary_check *check, const uint8_t **p_pos)
+{
+	const uint8_t *pos = *p_pos;
+	const uint8_t *prev_end = check->end;
+	uint32_t count;
+	bool success = true;
+
+	if (!check_size(check, pos, 8) ||
+	    !check_size(check, pos + 4, read_u32(pos)) || read_u32(pos) < 4)
+		return false;
+
+	check->end = pos + 4 + read_u32(pos);
+	count = read_u32(pos + 4);
+	pos += 8;
+
+	for (uint32_t i = 0; success && i < count; i++)
+		success = check_object(check, &pos);
+
+	success = success && pos == check->end;
+	check->end = prev_end;
+	*p_pos = pos;
+	return success;
+}
+
+static bool check_item(struct binary_check *check, const uint8_t **p_pos)
+{
+	const uint8_t *pos = *p_pos;
+	uint8_t type;
+
+	if (!check_size(check, pos, 1) || !check_string(check, pos + 1))
+		return false;
+
+	type = *pos;
+	pos += 5;
+
+	switch (type) {
+	case BINARY_STRING:
+		if (!check_string(check, pos))
+			return false;
+		pos += 4;
+		break;
+	case BINARY_INT:
+	case BINARY_DOUBLE:
+		if (!check_size(check, pos, 8))
+			return false;
+		pos += 8;
+		break;
+	case BINARY_BOOL:
+		if (!check_size(check, pos, 1))
+			return false;
+		pos += 1;
+		break;
+	case BINARY_OBJECT:
+		if (!check_object(check, &pos))
+			return false;
+		break;
+	case BINARY_ARRAY:
+		if (!check_array(check, &pos))
+			return false;
+		break;
+	default:
+		return false;
+	}
+
+	*p_pos = pos;
+	return true;
+}
+
+/* names have to be in order, which also rules out duplicates, since decoded
+ * items are appended without looking them up */
+static bool check_object(struct binary_check *check, const uint8_t **p_pos)
+{
+	const uint8_t *pos = *p_pos;
+	const uint8_t *prev_end = check->end;
+	const char *prev_name = NULL;
+	uint32_t count;
+	bool success = true;
+
+	if (check->depth >= JSON_MAX_DEPTH || !check_size(check, pos, 8) ||
+	    read_u32(pos) < 4 || !check_size(check, pos + 4, read_u32(pos)))
+		return false;
+
+	check->depth++;
+	check->end = pos + 4 + read_u32(pos);
+	count = read_u32(pos + 4);
+	pos += 8;
+
+	for (uint32_t i = 0; success && i < count; i++) {
+		const uint8_t *item_pos = pos;
+		const char *name;
+
+		success = check_item(check, &pos);
+		if (success) {
+			name = map_string(check->map, read_u32(item_pos + 1));
+			success = !prev_name || strcmp(prev_name, name) < 0;
+			prev_name = name;
+		}
+	}
+
+	success = success && pos == check->end;
+	check->end = prev_end;
+	check->depth--;
+	*p_pos = pos;
+	return success;
+}
+
+static bool check_strings(const struct binary_map *map, size_t strings_end)
+{
+	for (uint32_t i = 0; i < map->string_count; i++) {
+		size_t offset = read_u32(map->strings + i * 8);
+		size_t len = read_u32(map->strings + i * 8 + 4);
+
+		if (offset + len >= strings_end || map->data[offset + len] ||
+		    memchr(map->data + offset, 0, len))
+			return false;
+	}
+
+	return true;
+}
+
+static bool check_binary(struct binary_map *map)
+{
+	struct binary_check check = {map};
+	uint64_t table_offset, root_offset;
+	const uint8_t *pos;
+
+	if (map->size < BINARY_HEADER_SIZE ||
+	    read_u32(map->data) != BINARY_MAGIC ||
+	    read_u32(map->data + 4) != BINARY_VERSION)
+		return false;
+
+	map->string_count = read_u32(map->data + 8);
+	table_offset = read_u64(map->data + 16);
+	root_offset = read_u64(map->data + 24);
+
+	if (table_offset > map->size ||
+	    (map->size - table_offset) / 8 < map->string_count ||
+	    root_offset < BINARY_HEADER_SIZE || root_offset >= table_offset)
+		return false;
+
+	map->strings = map->data + table_offset;
+	if (!check_strings(map, (size_t)table_offset))
+		return false;
+
+	pos = map->data + root_offset;
+	check.end = map->data + table_offset;
+	return check_object(&check, &pos);
+}
+
+static struct binary_map *binary_map_open(const char *file)
+{
+	struct binary_map *map = bzalloc(sizeof(*map));
+	map->refs = 1;
+
+	map->data = os_map_file(file, &map->size);
+	if (!map->data) {
+		bfree(map);
+		return NULL;
+	}
+
+#ifdef _WIN32
+	/* windows won't replace a file while it's mapped, and undecoded
+	 * objects can be kept around for as long as the program runs */
+	uint8_t *copy = bmemdup(map->data, map->size);
+	os_unmap_file(map->data, map->size);
+	map->data = copy;
+#else
+	map->mapped = true;
+#endif
+
+	if (!check_binary(map)) {
+		blog(LOG_WARNING,
+		     "obs-data.c: [obs_data_create_from_binary_file] "
+		     "'%s' is not a valid binary data file",
+		     file);
+		binary_map_release(map);
+		return NULL;
+	}
+
+	return map;
+}
+
+/* ------------------------------------------------------------------------- */
+
+struct binary_string {
+	const char *str;
+	uint32_t len;
+	uint32_t hash;
+	uint32_t offset;
+};
+
+struct binary_writer {
+	DARRAY(uint8_t) buf;
+	DARRAY(struct binary_string) strings;
+
+	/* string indices + 1, open addressing like the item index */
+	uint32_t *table;
+	size_t table_size;
+};
+
+static void rebuild_string_table(struct binary_writer *w)
+{
+	size_t size = w->table_size ? w->table_size * 2 : 1024;
+	size_t mask = size - 1;
+
+	bfree(w->table);
+	w->table = bzalloc(size * sizeof(uint32_t));
+	w->table_size = size;
+
+	for (size_t i = 0; i < w->strings.num; i++) {
+		size_t slot = w->strings.array[i].hash & mask;
+		while (w->table[slot])
+			slot = (slot + 1) & mask;
+		w->table[slot] = (uint32_t)i + 1;
+	}
+}
+
+static uint32_t intern_string(struct binary_writer *w, const char *str)
+{
+	uint32_t hash = calc_fnv1a(str);
+	struct binary_string *entry;
+	size_t mask, slot;
+
+	if ((w->strings.num + 1) * 2 > w->table_size)
+		rebuild_string_table(w);
+
+	mask = w->table_size - 1;
+	for (slot = hash & mask; w->table[slot]; slot = (slot + 1) & mask) {
+		entry = &w->strings.array[w->table[slot] - 1];
+		if (entry->hash == hash && strcmp(entry->str, str) == 0)
+			return w->table[slot] - 1;
+	}
+
+	entry = da_push_back_new(w->strings);
+	entry->str = str;
+	entry->len = (uint32_t)strlen(str);
+	entry->hash = hash;
+
+	w->table[slot] = (uint32_t)w->strings.num;
+	return (uint32_t)w->strings.num - 1;
+}
+
+static inline void write_bytes(struct binary_writer *w, const void *data,
+			       size_t size)
+{
+	da_push_back_array(w->buf, (const uint8_t *)data, size);
+}
+
+static inline void write_u32(struct binary_writer *w, uint32_t val)
+{
+	write_bytes(w, &val, sizeof(val));
+}
+
+static inline void patch_u32(struct binary_writer *w, size_t pos, uint32_t val)
+{
+	memcpy(w->buf.array + pos, &val, sizeof(val));
+}
+
+static void write_binary_object(struct binary_writer *w, obs_data_t *data);
+
+static void write_binary_array(struct binary_writer *w,
+			       obs_data_array_t *array)
+{
+	size_t start = w->buf.num;
+	size_t count = array ? array->objects.num : 0;
+
+	write_u32(w, 0);
+	write_u32(w, (uint32_t)count);
+
+	for (size_t i = 0; i < count; i++)
+		write_binary_object(w, array->objects.array[i]);
+
+	patch_u32(w, start, (uint32_t)(w->buf.num - start - 4));
+}
+
+/* mirrors json_write_value */
+static bool write_binary_item(struct binary_writer *w,
+			      struct obs_data_item *item)
+{
+	const char *name = get_item_name(item);
+	struct obs_data_number *num;
+	const char *str = NULL;
+	uint8_t type, val;
+
+	if (!item->data_size || !utf8_valid(name))
+		return false;
+
+	switch (item->type) {
+	case OBS_DATA_STRING:
+		str = obs_data_item_get_string(item);
+		if (!utf8_valid(str))
+			return false;
+		type = BINARY_STRING;
+		break;
+	case OBS_DATA_NUMBER:
+		num = get_item_data(item);
+		if (num->type != OBS_DATA_NUM_INT && !isfinite(num->double_val))
+			return false;
+		type = num->type == OBS_DATA_NUM_INT ? BINARY_INT
+						     : BINARY_DOUBLE;
+		break;
+	case OBS_DATA_BOOLEAN:
+		type = BINARY_BOOL;
+		break;
+	case OBS_DATA_OBJECT:
+		type = BINARY_OBJECT;
+		break;
+	case OBS_DATA_ARRAY:
+		type = BINARY_ARRAY;
+		break;
+	default:
+		return false;
+	}
+
+	write_bytes(w, &type, 1);
+	write_u32(w, intern_string(w, name));
+
+	switch (type) {
+	case BINARY_STRING:
+		write_u32(w, intern_string(w, str));
+		break;
+	case BINARY_INT:
+		write_bytes(w, &num->int_val, 8);
+		break;
+	case BINARY_DOUBLE:
+		write_bytes(w, &num->double_val, 8);
+		break;
+	case BINARY_BOOL:
+		val = obs_data_item_get_bool(item) ? 1 : 0;
+		write_bytes(w, &val, 1);
+		break;
+	case BINARY_OBJECT:
+		write_binary_object(w, get_item_obj(item));
+		break;
+	default:
+		write_binary_array(w, get_item_array(item));
+	}
+
+	return true;
+}
+
+static void write_binary_object(struct binary_writer *w, obs_data_t *data)
+{
+	size_t start = w->buf.num;
+	uint32_t count = 0;
+
+	obs_data_load_items(data);
+
+	write_u32(w, 0);
+	write_u32(w, 0);
+
+	for (struct obs_data_item *item = data ? data->first_item : NULL; item;
+	     item = item->next) {
+		if (write_binary_item(w, item))
+			count++;
+	}
+
+	patch_u32(w, start, (uint32_t)(w->buf.num - start - 4));
+	patch_u32(w, start + 4, count);
+}
+
+static bool write_binary(obs_data_t *data, struct binary_writer *w)
+{
+	uint8_t header[BINARY_HEADER_SIZE] = {0};
+	uint32_t magic = BINARY_MAGIC;
+	uint32_t version = BINARY_VERSION;
+	uint64_t root_offset = BINARY_HEADER_SIZE;
+	uint64_t table_offset;
+	uint32_t string_count;
+
+	write_bytes(w, header, sizeof(header));
+	write_binary_object(w, data);
+
+	/* string offsets are 32 bit, which is plenty for settings */
+	for (size_t i = 0; i < w->strings.num; i++) {
+		struct binary_string *entry = &w->strings.array[i];
+		uint64_t offset = w->buf.num;
+
+		if (offset > UINT32_MAX)
+			return false;
+
+		entry->offset = (uint32_t)offset;
+		write_bytes(w, entry->str, entry->len + 1);
+	}
+
+	table_offset = w->buf.num;
+	for (size_t i = 0; i < w->strings.num; i++) {
+		write_u32(w, w->strings.array[i].offset);
+		write_u32(w, w->strings.array[i].len);
+	}
+
+	string_count = (uint32_t)w->strings.num;
+	memcpy(w->buf.array, &magic, 4);
+	memcpy(w->buf.array + 4, &version, 4);
+	memcpy(w->buf.array + 8, &string_count, 4);
+	memcpy(w->buf.array + 16, &table_offset, 8);
+	memcpy(w->buf.array + 24, &root_offset, 8);
+	return true;
+}
+
+static inline void binary_writer_free(struct binary_writer *w)
+{
+	da_free(w->buf);
+	da_free(w->strings);
+	bfree(w->table);
 }
 
 /* ------------------------------------------------------------------------- */
@@ -633,22 +1968,22 @@ obs_data_t *obs_data_create()
 obs_data_t *obs_data_create_from_json(const char *json_string)
 {
 	obs_data_t *data = obs_data_create();
+	struct json_reader reader = {0};
 
-	json_error_t error;
-	json_t *root = json_loads(json_string, JSON_REJECT_DUPLICATES, &error);
-
-	if (root) {
-		obs_data_add_json_object_data(data, root);
-		json_decref(root);
-	} else {
+	if (!json_string || !json_read(data, json_string, &reader)) {
 		blog(LOG_ERROR,
 		     "obs-data.c: [obs_data_create_from_json] "
 		     "Failed reading json string (%d): %s",
-		     error.line, error.text);
+		     reader.line,
+		     reader.error ? reader.error : "no json string");
 		obs_data_release(data);
 		data = NULL;
 	}
 
+	for (size_t i = 0; i < reader.keys.num; i++)
+		dstr_free(&reader.keys.array[i]);
+	da_free(reader.keys);
+	dstr_free(&reader.str);
 	return data;
 }
 
@@ -708,12 +2043,18 @@ static inline void obs_data_destroy(struct obs_data *data)
 
 	while (item) {
 		struct obs_data_item *next = item->next;
+
+		/* items may be referenced past the lifetime of the object */
+		item->parent = NULL;
+		item->prev = NULL;
+		item->next = NULL;
 		obs_data_item_release(&item);
 		item = next;
 	}
 
-	/* NOTE: don't use bfree for json text, allocated by json */
-	free(data->json);
+	binary_map_release(data->map);
+	bfree(data->index);
+	bfree(data->json);
 	bfree(data);
 }
 
@@ -728,43 +2069,103 @@ void obs_data_release(obs_data_t *data)
 
 const char *obs_data_get_json(obs_data_t *data)
 {
+	struct dstr json = {0};
+
 	if (!data)
 		return NULL;
 
-	/* NOTE: don't use libobs bfree for json text */
-	free(data->json);
-	data->json = NULL;
-
-	json_t *root = obs_data_to_json(data);
-	data->json = json_dumps(root, JSON_PRESERVE_ORDER | JSON_INDENT(4));
-	json_decref(root);
+	json_write_object(&json, data, 0);
 
+	bfree(data->json);
+	data->json = json.array;
 	return data->json;
 }
 
 bool obs_data_save_json(obs_data_t *data, const char *file)
 {
-	const char *json = obs_data_get_json(data);
+	struct dstr json = {0};
+	bool success;
 
-	if (json && *json) {
-		return os_quick_write_utf8_file(file, json, strlen(json),
-						false);
-	}
+	if (!data)
+		return false;
 
-	return false;
+	json_write_object(&json, data, 0);
+	success = json.array && *json.array &&
+		  os_quick_write_utf8_file(file, json.array, json.len, false);
+	dstr_free(&json);
+	return success;
 }
 
 bool obs_data_save_json_safe(obs_data_t *data, const char *file,
 			     const char *temp_ext, const char *backup_ext)
 {
-	const char *json = obs_data_get_json(data);
+	struct dstr json = {0};
+	bool success;
+
+	if (!data)
+		return false;
+
+	json_write_object(&json, data, 0);
+	success = json.array && *json.array &&
+		  os_quick_write_utf8_file_safe(file, json.array, json.len,
+						false, temp_ext, backup_ext);
+	dstr_free(&json);
+	return success;
+}
+
+obs_data_t *obs_data_create_from_binary_file(const char *file)
+{
+	struct binary_map *map = binary_map_open(file);
+	obs_data_t *data;
+
+	if (!map)
+		return NULL;
+
+	data = lazy_object_create(map, map->data + read_u64(map->data + 24));
+	binary_map_release(map);
+	return data;
+}
+
+static bool save_binary(obs_data_t *data, const char *file,
+			const char *temp_ext, const char *backup_ext)
+{
+	struct binary_writer w = {0};
+	bool success = false;
+
+	if (!data)
+		return false;
+
+	if (write_binary(data, &w)) {
+		const char *buf = (const char *)w.buf.array;
 
-	if (json && *json) {
-		return os_quick_write_utf8_file_safe(
-			file, json, strlen(json), false, temp_ext, backup_ext);
+		if (temp_ext) {
+			success = os_quick_write_utf8_file_safe(
+				file, buf, w.buf.num, false, temp_ext,
+				backup_ext);
+		} else {
+			/* never rewrite a file in place, it may be mapped */
+			os_unlink(file);
+			success = os_quick_write_utf8_file(file, buf, w.buf.num,
+							   false);
+		}
 	}
 
-	return false;
+	binary_writer_free(&w);
+	return success;
+}
+
+bool obs_data_save_binary(obs_data_t *data, const char *file)
+{
+	return save_binary(data, file, NULL, NULL);
+}
+
+bool obs_data_save_binary_safe(obs_data_t *data, const char *file,
+			       const char *temp_ext, const char *backup_ext)
+{
+	if (!temp_ext || !*temp_ext)
+		return false;
+
+	return save_binary(data, file, temp_ext, backup_ext);
 }
 
 static struct obs_data_item *get_item(struct obs_data *data, const char *name)
@@ -772,7 +2173,25 @@ static struct obs_data_item *get_item(struct obs_data *data, const char *name)
 	if (!data)
 		return NULL;
 
-	struct obs_data_item *item = data->first_item;
+	struct obs_data_item *item;
+
+	obs_data_load_items(data);
+
+	if (data->index) {
+		uint32_t hash = calc_fnv1a(name);
+		size_t mask = data->index_size - 1;
+
+		for (size_t i = hash & mask;; i = (i + 1) & mask) {
+			item = data->index[i];
+			if (!item)
+				return NULL;
+			if (item->hash == hash &&
+			    strcmp(get_item_name(item), name) == 0)
+				return item;
+		}
+	}
+
+	item = data->first_item;
 
 	while (item) {
 		if (strcmp(get_item_name(item), name) == 0)
@@ -794,31 +2213,8 @@ static void set_item_data(struct obs_data *data, struct obs_data_item **item,
 	if ((!item || (item && !*item)) && data) {
 		new_item = obs_data_item_create(name, ptr, size, type,
 						default_data, autoselect_data);
-
-		obs_data_item_t *prev = obs_data_first(data);
-		obs_data_item_t *next = obs_data_first(data);
-		obs_data_item_next(&next);
-		for (; prev && next;
-		     obs_data_item_next(&prev), obs_data_item_next(&next)) {
-			if (strcmp(get_item_name(next), name) > 0)
-				break;
-		}
-
-		new_item->parent = data;
-		if (prev && strcmp(get_item_name(prev), name) < 0) {
-			prev->next = new_item;
-			new_item->next = next;
-
-		} else {
-			data->first_item = new_item;
-			new_item->next = prev;
-		}
-
-		if (!prev)
-			data->first_item = new_item;
-
-		obs_data_item_release(&prev);
-		obs_data_item_release(&next);
+		if (new_item)
+			obs_data_item_attach(data, new_item);
 
 	} else if (default_data) {
 		obs_data_item_set_default_data(item, ptr, size, type);
@@ -950,6 +2346,7 @@ void obs_data_apply(obs_data_t *target, obs_data_t *apply_data)
 	if (!target || !apply_data || target == apply_data)
 		return;
 
+	obs_data_load_items(apply_data);
 	item = apply_data->first_item;
 
 	while (item) {
@@ -1003,6 +2400,7 @@ void obs_data_clear(obs_data_t *target)
 	if (!target)
 		return;
 
+	obs_data_load_items(target);
 	item = target->first_item;
 
 	while (item) {
@@ -1452,6 +2850,8 @@ obs_data_item_t *obs_data_first(obs_data_t *data)
 	if (!data)
 		return NULL;
 
+	obs_data_load_items(data);
+
 	if (data->first_item)
 		os_atomic_inc_long(&data->first_item->ref);
 	return data->first_item;
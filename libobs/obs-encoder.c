@@ -106,7 +106,8 @@ create_encoder(const char *id, enum obs_encoder_type type, const char *name,
 	encoder->control->encoder = encoder;
 
 	obs_context_data_insert(&encoder->context, &obs->data.encoders_mutex,
-				&obs->data.first_encoder);
+				&obs->data.first_encoder,
+				&obs->data.encoder_index);
 
 	blog(LOG_DEBUG, "encoder '%s' (%s) created", name, id);
 	return encoder;
@@ -242,6 +243,8 @@ static inline void free_audio_buffers(struct obs_encoder *encoder)
 	}
 }
 
+static void free_packet_bus(struct obs_encoder *encoder);
+
 static void obs_encoder_actually_destroy(obs_encoder_t *encoder)
 {
 	if (encoder) {
@@ -261,6 +264,7 @@ static void obs_encoder_actually_destroy(obs_encoder_t *encoder)
 		if (encoder->context.data)
 			encoder->info.destroy(encoder->context.data);
 		da_free(encoder->callbacks);
+		free_packet_bus(encoder);
 		pthread_mutex_destroy(&encoder->init_mutex);
 		pthread_mutex_destroy(&encoder->callbacks_mutex);
 		pthread_mutex_destroy(&encoder->outputs_mutex);
@@ -384,9 +388,20 @@ void obs_encoder_update(obs_encoder_t *encoder, obs_data_t *settings)
 
 	obs_data_apply(encoder->context.settings, settings);
 
-	if (encoder->info.update && encoder->context.data)
-		encoder->info.update(encoder->context.data,
-				     encoder->context.settings);
+	/* an active encoder is only ever updated from the thread that encodes
+	 * with it, between frames */
+	pthread_mutex_lock(&encoder->init_mutex);
+
+	if (encoder->info.update && encoder->context.data) {
+		if (encoder_active(encoder))
+			os_atomic_set_bool(&encoder->reconfigure_requested,
+					   true);
+		else
+			encoder->info.update(encoder->context.data,
+					     encoder->context.settings);
+	}
+
+	pthread_mutex_unlock(&encoder->init_mutex);
 }
 
 bool obs_encoder_get_extra_data(const obs_encoder_t *encoder,
@@ -506,6 +521,7 @@ void obs_encoder_shutdown(obs_encoder_t *encoder)
 	if (encoder->context.data) {
 		encoder->info.destroy(encoder->context.data);
 		encoder->context.data = NULL;
+		encoder->reconfigure_requested = false;
 		encoder->paired_encoder = NULL;
 		encoder->first_received = false;
 		encoder->offset_usec = 0;
@@ -514,13 +530,284 @@ void obs_encoder_shutdown(obs_encoder_t *encoder)
 	pthread_mutex_unlock(&encoder->init_mutex);
 }
 
+/* ------------------------------------------------------------------------- */
+/* packet bus                                                                */
+
+/* packets a callback can fall behind before its backlog is dropped */
+#define MAX_BUS_BACKLOG 1024
+
+static inline void send_packet(struct obs_encoder *encoder,
+			       struct encoder_callback *cb,
+			       struct encoder_packet *packet);
+
+static inline struct encoder_packet *
+get_bus_packet(struct obs_encoder *encoder, uint64_t seq)
+{
+	size_t idx = (size_t)(seq - encoder->bus_front_seq);
+	return circlebuf_data(&encoder->bus_packets,
+			      idx * sizeof(struct encoder_packet));
+}
+
+/* releases the packets that every callback has moved past */
+static void trim_packet_bus(struct obs_encoder *encoder)
+{
+	uint64_t min_seq = encoder->bus_end_seq;
+
+	for (size_t i = 0; i < encoder->callbacks.num; i++) {
+		struct encoder_callback *cb = encoder->callbacks.array[i];
+		if (cb->cursor < min_seq)
+			min_seq = cb->cursor;
+	}
+
+	while (encoder->bus_front_seq < min_seq) {
+		struct encoder_packet pkt;
+
+		circlebuf_pop_front(&encoder->bus_packets, &pkt, sizeof(pkt));
+		obs_encoder_packet_release(&pkt);
+		encoder->bus_front_seq++;
+	}
+}
+
+static void free_packet_bus(struct obs_encoder *encoder)
+{
+	while (encoder->bus_packets.size) {
+		struct encoder_packet pkt;
+
+		circlebuf_pop_front(&encoder->bus_packets, &pkt, sizeof(pkt));
+		obs_encoder_packet_release(&pkt);
+	}
+
+	circlebuf_free(&encoder->bus_packets);
+	encoder->bus_front_seq = encoder->bus_end_seq;
+}
+
+/* skips everything a callback hasn't read yet, its thread reports the
+ * packets to the output.  must be called with callbacks_mutex locked */
+static void drop_bus_backlog(struct obs_encoder *encoder,
+			     struct encoder_callback *cb)
+{
+	blog(LOG_WARNING,
+	     "encoder '%s': callback fell %llu packets behind, "
+	     "dropping them",
+	     encoder->context.name,
+	     (unsigned long long)(encoder->bus_end_seq - cb->cursor));
+
+	cb->dropped_packets += encoder->bus_end_seq - cb->cursor;
+
+	for (; cb->cursor < encoder->bus_end_seq; cb->cursor++)
+		cb->cursor_bytes += get_bus_packet(encoder, cb->cursor)->size;
+
+	/* the next video packet it gets must not depend on dropped ones */
+	if (encoder->info.type == OBS_ENCODER_VIDEO)
+		cb->wait_for_keyframe = true;
+}
+
+static void push_bus_packet(struct obs_encoder *encoder,
+			    struct encoder_packet *pkt)
+{
+	struct encoder_packet bus_pkt;
+	bool pushed = false;
+
+	obs_encoder_packet_create_instance(&bus_pkt, pkt);
+
+	pthread_mutex_lock(&encoder->callbacks_mutex);
+
+	if (encoder->callbacks.num) {
+		bool dropped = false;
+
+		circlebuf_push_back(&encoder->bus_packets, &bus_pkt,
+				    sizeof(bus_pkt));
+		encoder->bus_end_seq++;
+		encoder->bus_total_bytes += bus_pkt.size;
+		pushed = true;
+
+		for (size_t i = 0; i < encoder->callbacks.num; i++) {
+			struct encoder_callback *cb =
+				encoder->callbacks.array[i];
+
+			if (encoder->bus_end_seq - cb->cursor >
+			    MAX_BUS_BACKLOG) {
+				drop_bus_backlog(encoder, cb);
+				dropped = true;
+			}
+
+			os_sem_post(cb->packet_sem);
+		}
+
+		if (dropped)
+			trim_packet_bus(encoder);
+	}
+
+	pthread_mutex_unlock(&encoder->callbacks_mutex);
+
+	if (!pushed)
+		obs_encoder_packet_release(&bus_pkt);
+}
+
+static void *encoder_callback_thread(void *data)
+{
+	struct encoder_callback *cb = data;
+	struct obs_encoder *encoder = cb->encoder;
+
+	os_set_thread_name("obs-encoder: callback thread");
+
+	while (os_sem_wait(cb->packet_sem) == 0) {
+		struct encoder_packet pkt;
+		uint64_t dropped;
+		bool have_packet;
+		bool skip = false;
+
+		pthread_mutex_lock(&encoder->callbacks_mutex);
+
+		/* stop is set before the bus is trimmed or freed without this
+		 * callback, after which its cursor may be past the front */
+		if (os_atomic_load_bool(&cb->stop)) {
+			pthread_mutex_unlock(&encoder->callbacks_mutex);
+			break;
+		}
+
+		dropped = cb->dropped_packets;
+		cb->dropped_packets = 0;
+
+		/* nothing left to read if its backlog was dropped */
+		have_packet = cb->cursor >= encoder->bus_front_seq &&
+			      cb->cursor < encoder->bus_end_seq;
+
+		if (have_packet) {
+			/* take a reference so the bus slot can be released
+			 * before the callback is done with the packet */
+			obs_encoder_packet_ref(
+				&pkt, get_bus_packet(encoder, cb->cursor));
+			cb->cursor++;
+			cb->cursor_bytes += pkt.size;
+			trim_packet_bus(encoder);
+
+			skip = cb->wait_for_keyframe && !pkt.keyframe;
+			if (!skip)
+				cb->wait_for_keyframe = false;
+		}
+
+		pthread_mutex_unlock(&encoder->callbacks_mutex);
+
+		/* packets skipped to get to a keyframe are lost as well */
+		if (skip)
+			dropped++;
+		if (dropped)
+			obs_output_packets_dropped(cb->param, encoder, dropped);
+
+		if (!have_packet)
+			continue;
+
+		if (!skip)
+			send_packet(encoder, cb, &pkt);
+		obs_encoder_packet_release(&pkt);
+
+		if (os_atomic_load_bool(&cb->stop))
+			break;
+	}
+
+	if (cb->detached) {
+		os_sem_destroy(cb->packet_sem);
+		bfree(cb);
+	}
+
+	return NULL;
+}
+
+/* must be called with callbacks_mutex locked */
+static struct encoder_callback *create_encoder_callback(
+	struct obs_encoder *encoder,
+	void (*new_packet)(void *param, struct encoder_packet *packet),
+	void *param)
+{
+	struct encoder_callback *cb = bzalloc(sizeof(*cb));
+	cb->new_packet = new_packet;
+	cb->param = param;
+	cb->encoder = encoder;
+	cb->cursor = encoder->bus_end_seq;
+	cb->cursor_bytes = encoder->bus_total_bytes;
+
+	if (os_sem_init(&cb->packet_sem, 0) != 0)
+		goto fail;
+	if (pthread_create(&cb->thread, NULL, encoder_callback_thread, cb) != 0)
+		goto fail;
+
+	return cb;
+
+fail:
+	blog(LOG_ERROR, "Failed to create callback thread for encoder '%s'",
+	     encoder->context.name);
+	os_sem_destroy(cb->packet_sem);
+	bfree(cb);
+	return NULL;
+}
+
+/* the callback must already be removed from the callback list, with stop
+ * set.  packets it has not read yet are dropped.  its thread can be waiting
+ * on init_mutex, so this must not be called with it locked */
+static void destroy_encoder_callback(struct encoder_callback *cb)
+{
+	/* stopped from within the callback itself, the thread cleans up
+	 * after itself once the callback returns */
+	if (pthread_equal(pthread_self(), cb->thread)) {
+		cb->detached = true;
+		pthread_detach(cb->thread);
+		return;
+	}
+
+	os_sem_post(cb->packet_sem);
+	pthread_join(cb->thread, NULL);
+	os_sem_destroy(cb->packet_sem);
+	bfree(cb);
+}
+
+static void destroy_encoder_callbacks(struct obs_encoder *encoder)
+{
+	DARRAY(struct encoder_callback *) callbacks;
+
+	pthread_mutex_lock(&encoder->callbacks_mutex);
+	callbacks.da = encoder->callbacks.da;
+	da_init(encoder->callbacks);
+	for (size_t i = 0; i < callbacks.num; i++)
+		os_atomic_set_bool(&callbacks.array[i]->stop, true);
+	free_packet_bus(encoder);
+	pthread_mutex_unlock(&encoder->callbacks_mutex);
+
+	for (size_t i = 0; i < callbacks.num; i++)
+		destroy_encoder_callback(callbacks.array[i]);
+
+	da_free(callbacks);
+}
+
+void obs_encoder_get_backlog(struct obs_encoder *encoder, void *param,
+			     uint64_t *packets, uint64_t *bytes)
+{
+	if (!encoder)
+		return;
+
+	pthread_mutex_lock(&encoder->callbacks_mutex);
+
+	for (size_t i = 0; i < encoder->callbacks.num; i++) {
+		struct encoder_callback *cb = encoder->callbacks.array[i];
+
+		if (cb->param == param) {
+			*packets += encoder->bus_end_seq - cb->cursor;
+			*bytes += encoder->bus_total_bytes - cb->cursor_bytes;
+		}
+	}
+
+	pthread_mutex_unlock(&encoder->callbacks_mutex);
+}
+
+/* ------------------------------------------------------------------------- */
+
 static inline size_t
 get_callback_idx(const struct obs_encoder *encoder,
 		 void (*new_packet)(void *param, struct encoder_packet *packet),
 		 void *param)
 {
 	for (size_t i = 0; i < encoder->callbacks.num; i++) {
-		struct encoder_callback *cb = encoder->callbacks.array + i;
+		struct encoder_callback *cb = encoder->callbacks.array[i];
 
 		if (cb->new_packet == new_packet && cb->param == param)
 			return i;
@@ -534,7 +821,7 @@ static inline void obs_encoder_start_internal(
 	void (*new_packet)(void *param, struct encoder_packet *packet),
 	void *param)
 {
-	struct encoder_callback cb = {false, new_packet, param};
+	struct encoder_callback *cb;
 	bool first = false;
 
 	if (!encoder->context.data)
@@ -545,8 +832,11 @@ static inline void obs_encoder_start_internal(
 	first = (encoder->callbacks.num == 0);
 
 	size_t idx = get_callback_idx(encoder, new_packet, param);
-	if (idx == DARRAY_INVALID)
-		da_push_back(encoder->callbacks, &cb);
+	if (idx == DARRAY_INVALID) {
+		cb = create_encoder_callback(encoder, new_packet, param);
+		if (cb)
+			da_push_back(encoder->callbacks, &cb);
+	}
 
 	pthread_mutex_unlock(&encoder->callbacks_mutex);
 
@@ -571,11 +861,14 @@ void obs_encoder_start(obs_encoder_t *encoder,
 	pthread_mutex_unlock(&encoder->init_mutex);
 }
 
+/* the stopped callback is returned in *stopped, to be destroyed once
+ * init_mutex is unlocked */
 static inline bool obs_encoder_stop_internal(
 	obs_encoder_t *encoder,
 	void (*new_packet)(void *param, struct encoder_packet *packet),
-	void *param)
+	void *param, struct encoder_callback **stopped)
 {
+	struct encoder_callback *cb = NULL;
 	bool last = false;
 	size_t idx;
 
@@ -583,18 +876,25 @@ static inline bool obs_encoder_stop_internal(
 
 	idx = get_callback_idx(encoder, new_packet, param);
 	if (idx != DARRAY_INVALID) {
+		cb = encoder->callbacks.array[idx];
+		os_atomic_set_bool(&cb->stop, true);
 		da_erase(encoder->callbacks, idx);
 		last = (encoder->callbacks.num == 0);
+		trim_packet_bus(encoder);
 	}
 
 	pthread_mutex_unlock(&encoder->callbacks_mutex);
 
+	*stopped = cb;
+
 	if (last) {
 		remove_connection(encoder, true);
 		encoder->initialized = false;
 
 		if (encoder->destroy_on_stop) {
 			pthread_mutex_unlock(&encoder->init_mutex);
+			if (cb)
+				destroy_encoder_callback(cb);
 			obs_encoder_actually_destroy(encoder);
 			return true;
 		}
@@ -608,6 +908,7 @@ void obs_encoder_stop(obs_encoder_t *encoder,
 					 struct encoder_packet *packet),
 		      void *param)
 {
+	struct encoder_callback *cb;
 	bool destroyed;
 
 	if (!obs_encoder_valid(encoder, "obs_encoder_stop"))
@@ -616,9 +917,13 @@ void obs_encoder_stop(obs_encoder_t *encoder,
 		return;
 
 	pthread_mutex_lock(&encoder->init_mutex);
-	destroyed = obs_encoder_stop_internal(encoder, new_packet, param);
-	if (!destroyed)
+	destroyed = obs_encoder_stop_internal(encoder, new_packet, param, &cb);
+	if (!destroyed) {
 		pthread_mutex_unlock(&encoder->init_mutex);
+
+		if (cb)
+			destroy_encoder_callback(cb);
+	}
 }
 
 const char *obs_encoder_get_codec(const obs_encoder_t *encoder)
@@ -821,6 +1126,7 @@ static void send_first_video_packet(struct obs_encoder *encoder,
 				    struct encoder_packet *packet)
 {
 	struct encoder_packet first_packet;
+	struct encoder_packet instance;
 	DARRAY(uint8_t) data;
 	uint8_t *sei;
 	size_t size;
@@ -831,23 +1137,34 @@ static void send_first_video_packet(struct obs_encoder *encoder,
 
 	da_init(data);
 
-	if (!get_sei(encoder, &sei, &size) || !sei || !size) {
+	/* this runs on the callback's thread, which obs_encoder_stop can shut
+	 * the encoder down underneath */
+	pthread_mutex_lock(&encoder->init_mutex);
+	if (encoder->context.data && get_sei(encoder, &sei, &size) && sei &&
+	    size)
+		da_push_back_array(data, sei, size);
+	pthread_mutex_unlock(&encoder->init_mutex);
+
+	if (!data.num) {
 		cb->new_packet(cb->param, packet);
 		cb->sent_first_packet = true;
 		return;
 	}
 
-	da_push_back_array(data, sei, size);
 	da_push_back_array(data, packet->data, packet->size);
 
 	first_packet = *packet;
 	first_packet.data = data.array;
 	first_packet.size = data.num;
 
-	cb->new_packet(cb->param, &first_packet);
+	/* callbacks reference packets rather than copying them */
+	obs_encoder_packet_create_instance(&instance, &first_packet);
+	da_free(data);
+
+	cb->new_packet(cb->param, &instance);
 	cb->sent_first_packet = true;
 
-	da_free(data);
+	obs_encoder_packet_release(&instance);
 }
 
 static inline void send_packet(struct obs_encoder *encoder,
@@ -864,6 +1181,8 @@ static inline void send_packet(struct obs_encoder *encoder,
 void full_stop(struct obs_encoder *encoder)
 {
 	if (encoder) {
+		destroy_encoder_callbacks(encoder);
+
 		pthread_mutex_lock(&encoder->outputs_mutex);
 		for (size_t i = 0; i < encoder->outputs.num; i++) {
 			struct obs_output *output = encoder->outputs.array[i];
@@ -875,10 +1194,6 @@ void full_stop(struct obs_encoder *encoder)
 		}
 		pthread_mutex_unlock(&encoder->outputs_mutex);
 
-		pthread_mutex_lock(&encoder->callbacks_mutex);
-		da_free(encoder->callbacks);
-		pthread_mutex_unlock(&encoder->callbacks_mutex);
-
 		remove_connection(encoder, false);
 		encoder->initialized = false;
 	}
@@ -906,15 +1221,17 @@ void send_off_encoder_packet(obs_encoder_t *encoder, bool success,
 				packet_dts_usec(pkt) - encoder->offset_usec;
 		pkt->sys_dts_usec = pkt->dts_usec;
 
-		pthread_mutex_lock(&encoder->callbacks_mutex);
-
-		for (size_t i = encoder->callbacks.num; i > 0; i--) {
-			struct encoder_callback *cb;
-			cb = encoder->callbacks.array + (i - 1);
-			send_packet(encoder, cb, pkt);
-		}
+		push_bus_packet(encoder, pkt);
+	}
+}
 
-		pthread_mutex_unlock(&encoder->callbacks_mutex);
+/* called by the encoding thread before each frame */
+void apply_encoder_update(struct obs_encoder *encoder)
+{
+	if (os_atomic_load_bool(&encoder->reconfigure_requested)) {
+		os_atomic_set_bool(&encoder->reconfigure_requested, false);
+		encoder->info.update(encoder->context.data,
+				     encoder->context.settings);
 	}
 }
 
@@ -935,6 +1252,8 @@ bool do_encode(struct obs_encoder *encoder, struct encoder_frame *frame)
 	pkt.timebase_den = encoder->timebase_den;
 	pkt.encoder = encoder;
 
+	apply_encoder_update(encoder);
+
 	profile_start(encoder->profile_encoder_encode_name);
 	success = encoder->info.encode(encoder->context.data, frame, &pkt,
 				       &received);
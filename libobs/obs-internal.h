@@ -24,6 +24,7 @@
 #include "util/threading.h"
 #include "util/platform.h"
 #include "util/profiler.h"
+#include "util/task-pool.h"
 #include "callback/signal.h"
 #include "callback/proc.h"
 
@@ -235,13 +236,13 @@ struct obs_tex_frame {
 
 struct obs_core_video {
 	graphics_t *graphics;
-	gs_stagesurf_t *copy_surfaces[NUM_TEXTURES];
+	gs_stagesurf_t *copy_surfaces[MAX_STAGING_SURFACES];
 	gs_texture_t *render_texture;
 	gs_texture_t *output_texture;
 	gs_texture_t *convert_texture;
 	gs_texture_t *convert_uv_texture;
 	bool texture_rendered;
-	bool textures_copied[NUM_TEXTURES];
+	bool textures_copied[MAX_STAGING_SURFACES];
 	bool texture_converted;
 	bool using_nv12_tex;
 	struct circlebuf vframe_info_buffer;
@@ -260,6 +261,10 @@ struct obs_core_video {
 	gs_samplerstate_t *point_sampler;
 	gs_stagesurf_t *mapped_surface;
 	int cur_texture;
+	int num_textures;
+	bool adaptive_staging;
+	uint32_t download_frames;
+	uint32_t download_stalls;
 	long raw_active;
 	long gpu_encoder_active;
 	pthread_mutex_t gpu_encoder_mutex;
@@ -282,6 +287,9 @@ struct obs_core_video {
 	bool thread_initialized;
 
 	bool gpu_conversion;
+	os_task_pool_t *conversion_pool;
+	uint32_t conversion_threads;
+	const char *conversion_slice_names[MAX_CONVERSION_THREADS];
 	const char *conversion_tech;
 	uint32_t conversion_height;
 	uint32_t plane_offsets[3];
@@ -317,6 +325,10 @@ struct obs_core_audio {
 	DARRAY(struct obs_source *) render_order;
 	DARRAY(struct obs_source *) root_nodes;
 
+	os_task_pool_t *render_pool;
+	uint32_t render_threads;
+	DARRAY(struct obs_source *) parallel_sources;
+
 	uint64_t buffered_ts;
 	struct circlebuf buffered_timestamps;
 	int buffering_wait_ticks;
@@ -330,6 +342,15 @@ struct obs_core_audio {
 	char *monitoring_device_id;
 };
 
+/* hash table of the non-private contexts of one type, keyed by name and
+ * protected by the same mutex as the list of contexts */
+struct obs_context_index {
+	struct obs_context_data **first;
+	struct obs_context_data **buckets;
+	size_t num_buckets;
+	size_t count;
+};
+
 /* user sources, output channels, and displays */
 struct obs_core_data {
 	struct obs_source *first_source;
@@ -339,6 +360,11 @@ struct obs_core_data {
 	struct obs_encoder *first_encoder;
 	struct obs_service *first_service;
 
+	struct obs_context_index source_index;
+	struct obs_context_index output_index;
+	struct obs_context_index encoder_index;
+	struct obs_context_index service_index;
+
 	pthread_mutex_t sources_mutex;
 	pthread_mutex_t displays_mutex;
 	pthread_mutex_t outputs_mutex;
@@ -355,6 +381,7 @@ struct obs_core_data {
 
 	obs_data_t *private_data;
 
+	volatile bool source_perf_stats;
 	volatile bool valid;
 };
 
@@ -464,6 +491,11 @@ struct obs_context_data {
 	struct obs_context_data *next;
 	struct obs_context_data **prev_next;
 
+	struct obs_context_index *index;
+	struct obs_context_data *hash_next;
+	struct obs_context_data **hash_prev_next;
+	uint32_t name_hash;
+
 	bool private;
 };
 
@@ -474,7 +506,8 @@ extern bool obs_context_data_init(struct obs_context_data *context,
 extern void obs_context_data_free(struct obs_context_data *context);
 
 extern void obs_context_data_insert(struct obs_context_data *context,
-				    pthread_mutex_t *mutex, void *first);
+				    pthread_mutex_t *mutex, void *first,
+				    struct obs_context_index *index);
 extern void obs_context_data_remove(struct obs_context_data *context);
 
 extern void obs_context_data_setname(struct obs_context_data *context,
@@ -524,10 +557,30 @@ static inline bool obs_weak_ref_get_ref(struct obs_weak_ref *ref)
 /* ------------------------------------------------------------------------- */
 /* sources  */
 
+#define MAX_ASYNC_FRAMES 30
+
+/* queued frames plus the current and previous (deinterlaced) frame */
+#define ASYNC_POOL_SIZE (MAX_ASYNC_FRAMES + 2)
+
+/* frames allocated by libobs for the async queue.  the frame must be the first
+ * member so a frame found in the source's async_frames can be converted back
+ * to its entry.  external frames wrap the caller's planes and hand them back
+ * with release instead of freeing them */
 struct async_frame {
-	struct obs_source_frame *frame;
-	long unused_count;
+	struct obs_source_frame frame;
 	bool used;
+	bool in_pool;
+	void (*release)(void *param);
+	void *release_param;
+};
+
+enum source_perf_type {
+	SOURCE_PERF_VIDEO_TICK,
+	SOURCE_PERF_VIDEO_RENDER,
+	SOURCE_PERF_FILTER_VIDEO,
+	SOURCE_PERF_FILTER_AUDIO,
+	SOURCE_PERF_ASYNC_UPLOAD,
+	SOURCE_PERF_COUNT,
 };
 
 enum audio_action_type {
@@ -645,8 +698,6 @@ struct obs_source {
 	bool async_unbuffered;
 	bool async_decoupled;
 	struct obs_source_frame *async_preload_frame;
-	DARRAY(struct async_frame) async_cache;
-	DARRAY(struct obs_source_frame *) async_frames;
 	pthread_mutex_t async_mutex;
 	uint32_t async_width;
 	uint32_t async_height;
@@ -655,6 +706,33 @@ struct obs_source {
 	uint32_t async_convert_width;
 	uint32_t async_convert_height;
 
+	/* async frame pool and queue, frames are only allocated when the pool
+	 * is empty, and the pool is only flushed when the format changes */
+	struct async_frame *async_pool[ASYNC_POOL_SIZE];
+	struct async_frame *async_free[ASYNC_POOL_SIZE];
+	size_t async_pool_size;
+	size_t async_free_num;
+	struct obs_source_frame *async_queue[MAX_ASYNC_FRAMES];
+	size_t async_queue_start;
+	size_t async_queue_num;
+	DARRAY(struct obs_source_frame *) async_retired;
+
+	/* every async_frame the source has allocated and not freed yet.
+	 * filters can pass on frames they allocated themselves, so a frame is
+	 * only treated as an async_frame if it's in this list */
+	DARRAY(struct async_frame *) async_frames;
+	struct obs_source_async_stats async_stats;
+
+	/* per-source timing, only collected while enabled with
+	 * obs_enable_source_perf_stats */
+	struct obs_source_perf_counter perf[SOURCE_PERF_COUNT];
+	const char *perf_names[SOURCE_PERF_COUNT];
+
+	/* incremented on rename, each perf name is rebuilt by the thread that
+	 * times it once it no longer matches the name it was built from */
+	volatile long name_gen;
+	long perf_names_gen[SOURCE_PERF_COUNT];
+
 	/* async video deinterlacing */
 	uint64_t deinterlace_offset;
 	uint64_t deinterlace_frame_ts;
@@ -803,6 +881,35 @@ extern bool set_async_texture_size(struct obs_source *source,
 extern void remove_async_frame(obs_source_t *source,
 			       struct obs_source_frame *frame);
 
+/* the async queue functions must be called with async_mutex held */
+static inline struct obs_source_frame *
+async_queue_peek(const struct obs_source *source, size_t idx)
+{
+	idx = (source->async_queue_start + idx) % MAX_ASYNC_FRAMES;
+	return source->async_queue[idx];
+}
+
+static inline struct obs_source_frame *
+async_queue_pop(struct obs_source *source)
+{
+	struct obs_source_frame *frame = async_queue_peek(source, 0);
+
+	source->async_queue_start =
+		(source->async_queue_start + 1) % MAX_ASYNC_FRAMES;
+	source->async_queue_num--;
+	return frame;
+}
+
+static inline void async_queue_push(struct obs_source *source,
+				    struct obs_source_frame *frame)
+{
+	size_t idx = (source->async_queue_start + source->async_queue_num) %
+		     MAX_ASYNC_FRAMES;
+
+	source->async_queue[idx] = frame;
+	source->async_queue_num++;
+}
+
 extern void set_deinterlace_texture_size(obs_source_t *source);
 extern void deinterlace_process_last_frame(obs_source_t *source,
 					   uint64_t sys_time);
@@ -839,6 +946,14 @@ struct caption_text {
 	struct caption_text *next;
 };
 
+/* packets waiting to be interleaved.  ties in dts are broken by type and
+ * then by order: video goes before audio, newer video before older video,
+ * and older audio before newer audio */
+struct interleaved_packet {
+	struct encoder_packet packet;
+	int64_t order;
+};
+
 struct obs_output {
 	struct obs_context_data context;
 	struct obs_output_info info;
@@ -858,7 +973,11 @@ struct obs_output {
 	pthread_t end_data_capture_thread;
 	os_event_t *stopping_event;
 	pthread_mutex_t interleaved_mutex;
-	DARRAY(struct encoder_packet) interleaved_packets;
+	/* binary min-heap, kept fully sorted (which is also a valid heap)
+	 * until packets start being sent, as starting up needs to look at
+	 * them in order */
+	DARRAY(struct interleaved_packet) interleaved_packets;
+	int64_t interleaved_seq;
 	int stop_code;
 
 	int reconnect_retry_sec;
@@ -876,6 +995,11 @@ struct obs_output {
 
 	int total_frames;
 
+	/* video frames the encoder dropped because the output fell too far
+	 * behind it, and whether the output was stopped for that */
+	volatile long bus_dropped_frames;
+	volatile bool bus_overflow_stopped;
+
 	volatile bool active;
 	video_t *video;
 	audio_t *audio;
@@ -934,6 +1058,9 @@ extern const struct obs_output_info *find_output(const char *id);
 
 extern void obs_output_remove_encoder(struct obs_output *output,
 				      struct obs_encoder *encoder);
+extern void obs_output_packets_dropped(struct obs_output *output,
+				       struct obs_encoder *encoder,
+				       uint64_t packets);
 
 extern void
 obs_encoder_packet_create_instance(struct encoder_packet *dst,
@@ -948,10 +1075,26 @@ struct obs_weak_encoder {
 	struct obs_encoder *encoder;
 };
 
+/* each callback reads the encoder's packet bus through its own cursor on its
+ * own thread, so a slow callback can't stall the encoder */
 struct encoder_callback {
 	bool sent_first_packet;
 	void (*new_packet)(void *param, struct encoder_packet *packet);
 	void *param;
+
+	struct obs_encoder *encoder;
+	uint64_t cursor;
+	uint64_t cursor_bytes;
+	pthread_t thread;
+	os_sem_t *packet_sem;
+	volatile bool stop;
+	bool detached;
+
+	/* set when its backlog was dropped, skips to the next keyframe.  the
+	 * packets dropped are reported to the output (param) by the callback
+	 * thread */
+	bool wait_for_keyframe;
+	uint64_t dropped_packets;
 };
 
 struct obs_encoder {
@@ -979,6 +1122,10 @@ struct obs_encoder {
 	volatile bool active;
 	bool initialized;
 
+	/* settings changed while active, applied by the encoding thread
+	 * before the next frame */
+	volatile bool reconfigure_requested;
+
 	/* indicates ownership of the info.id buffer */
 	bool owns_info_id;
 
@@ -1010,7 +1157,16 @@ struct obs_encoder {
 	void *media;
 
 	pthread_mutex_t callbacks_mutex;
-	DARRAY(struct encoder_callback) callbacks;
+	DARRAY(struct encoder_callback *) callbacks;
+
+	/* packet bus, each encoded packet is stored once and released when
+	 * every callback's cursor has moved past it.  bus_front_seq is the
+	 * sequence number of the first packet in bus_packets.  protected by
+	 * callbacks_mutex */
+	struct circlebuf bus_packets;
+	uint64_t bus_front_seq;
+	uint64_t bus_end_seq;
+	uint64_t bus_total_bytes;
 
 	const char *profile_encoder_encode_name;
 };
@@ -1033,10 +1189,13 @@ extern void obs_encoder_add_output(struct obs_encoder *encoder,
 				   struct obs_output *output);
 extern void obs_encoder_remove_output(struct obs_encoder *encoder,
 				      struct obs_output *output);
+extern void obs_encoder_get_backlog(struct obs_encoder *encoder, void *param,
+				    uint64_t *packets, uint64_t *bytes);
 
 extern bool start_gpu_encode(obs_encoder_t *encoder);
 extern void stop_gpu_encode(obs_encoder_t *encoder);
 
+extern void apply_encoder_update(struct obs_encoder *encoder);
 extern bool do_encode(struct obs_encoder *encoder, struct encoder_frame *frame);
 extern void send_off_encoder_packet(obs_encoder_t *encoder, bool success,
 				    bool received, struct encoder_packet *pkt);
@@ -145,7 +145,8 @@ obs_output_t *obs_output_create(const char *id, const char *name,
 	output->control->output = output;
 
 	obs_context_data_insert(&output->context, &obs->data.outputs_mutex,
-				&obs->data.first_output);
+				&obs->data.first_output,
+				&obs->data.output_index);
 
 	if (info)
 		output->context.data =
@@ -164,8 +165,8 @@ fail:
 static inline void free_packets(struct obs_output *output)
 {
 	for (size_t i = 0; i < output->interleaved_packets.num; i++)
-		obs_encoder_packet_release(output->interleaved_packets.array +
-					   i);
+		obs_encoder_packet_release(
+			&output->interleaved_packets.array[i].packet);
 	da_free(output->interleaved_packets);
 }
 
@@ -613,6 +614,29 @@ void obs_output_remove_encoder(struct obs_output *output,
 	}
 }
 
+/* called on the encoder's callback thread for the output after packets were
+ * dropped because the output fell too far behind.  streams drop frames when
+ * they fall behind anyway, anything else (like a recording) would be missing
+ * data, so it's stopped */
+void obs_output_packets_dropped(struct obs_output *output,
+				struct obs_encoder *encoder, uint64_t packets)
+{
+	if (encoder->info.type == OBS_ENCODER_VIDEO)
+		os_atomic_add_long(&output->bus_dropped_frames, (long)packets);
+
+	if ((output->info.flags & OBS_OUTPUT_SERVICE) != 0 ||
+	    !data_active(output) ||
+	    os_atomic_set_bool(&output->bus_overflow_stopped, true))
+		return;
+
+	blog(LOG_ERROR,
+	     "Output '%s': %llu packets from encoder '%s' were dropped, "
+	     "stopping",
+	     output->context.name, (unsigned long long)packets,
+	     encoder->context.name);
+	obs_output_signal_stop(output, OBS_OUTPUT_ERROR);
+}
+
 void obs_output_set_video_encoder(obs_output_t *output, obs_encoder_t *encoder)
 {
 	if (!obs_output_valid(output, "obs_output_set_video_encoder"))
@@ -738,12 +762,17 @@ uint64_t obs_output_get_total_bytes(const obs_output_t *output)
 
 int obs_output_get_frames_dropped(const obs_output_t *output)
 {
+	int dropped;
+
 	if (!obs_output_valid(output, "obs_output_get_frames_dropped"))
 		return 0;
-	if (!output->info.get_dropped_frames)
-		return 0;
 
-	return output->info.get_dropped_frames(output->context.data);
+	dropped = (int)os_atomic_load_long(&output->bus_dropped_frames);
+	if (output->info.get_dropped_frames)
+		dropped +=
+			output->info.get_dropped_frames(output->context.data);
+
+	return dropped;
 }
 
 int obs_output_get_total_frames(const obs_output_t *output)
@@ -1069,9 +1098,83 @@ static bool add_caption(struct obs_output *output, struct encoder_packet *out)
 }
 #endif
 
+static inline bool interleaved_before(const struct interleaved_packet *a,
+				      const struct interleaved_packet *b)
+{
+	if (a->packet.dts_usec != b->packet.dts_usec)
+		return a->packet.dts_usec < b->packet.dts_usec;
+	if (a->packet.type != b->packet.type)
+		return a->packet.type == OBS_ENCODER_VIDEO;
+	return a->order < b->order;
+}
+
+static int interleaved_compare(const void *a, const void *b)
+{
+	return interleaved_before(a, b) ? -1 : 1;
+}
+
+static inline void set_interleaved_order(struct obs_output *output,
+					 struct interleaved_packet *ip)
+{
+	int64_t seq = ++output->interleaved_seq;
+	ip->order = ip->packet.type == OBS_ENCODER_VIDEO ? -seq : seq;
+}
+
+static void interleaved_sift_up(struct obs_output *output, size_t idx)
+{
+	struct interleaved_packet *array = output->interleaved_packets.array;
+	struct interleaved_packet ip = array[idx];
+
+	while (idx) {
+		size_t parent = (idx - 1) / 2;
+		if (!interleaved_before(&ip, &array[parent]))
+			break;
+
+		array[idx] = array[parent];
+		idx = parent;
+	}
+
+	array[idx] = ip;
+}
+
+static void interleaved_sift_down(struct obs_output *output, size_t idx)
+{
+	struct interleaved_packet *array = output->interleaved_packets.array;
+	size_t num = output->interleaved_packets.num;
+	struct interleaved_packet ip = array[idx];
+
+	for (;;) {
+		size_t child = idx * 2 + 1;
+		if (child >= num)
+			break;
+		if (child + 1 < num &&
+		    interleaved_before(&array[child + 1], &array[child]))
+			child++;
+		if (!interleaved_before(&array[child], &ip))
+			break;
+
+		array[idx] = array[child];
+		idx = child;
+	}
+
+	array[idx] = ip;
+}
+
+static void pop_interleaved_packet(struct obs_output *output)
+{
+	size_t last = output->interleaved_packets.num - 1;
+
+	output->interleaved_packets.array[0] =
+		output->interleaved_packets.array[last];
+	da_pop_back(output->interleaved_packets);
+
+	if (output->interleaved_packets.num)
+		interleaved_sift_down(output, 0);
+}
+
 static inline void send_interleaved(struct obs_output *output)
 {
-	struct encoder_packet out = output->interleaved_packets.array[0];
+	struct encoder_packet out = output->interleaved_packets.array[0].packet;
 
 	/* do not send an interleaved packet if there's no packet of the
 	 * opposing type of a higher timestamp in the interleave buffer.
@@ -1079,7 +1182,7 @@ static inline void send_interleaved(struct obs_output *output)
 	if (!has_higher_opposing_ts(output, &out))
 		return;
 
-	da_erase(output->interleaved_packets, 0);
+	pop_interleaved_packet(output);
 
 	if (out.type == OBS_ENCODER_VIDEO) {
 		output->total_frames++;
@@ -1142,7 +1245,7 @@ static size_t get_interleaved_start_idx(struct obs_output *output)
 
 	for (size_t i = 0; i < output->interleaved_packets.num; i++) {
 		struct encoder_packet *packet =
-			&output->interleaved_packets.array[i];
+			&output->interleaved_packets.array[i].packet;
 		int64_t diff;
 
 		if (packet->type != OBS_ENCODER_AUDIO) {
@@ -1178,7 +1281,7 @@ static int prune_premature_packets(struct obs_output *output)
 	}
 
 	max_idx = video_idx;
-	video = &output->interleaved_packets.array[video_idx];
+	video = &output->interleaved_packets.array[video_idx].packet;
 	duration_usec = video->timebase_num * 1000000LL / video->timebase_den;
 
 	for (size_t i = 0; i < audio_mixes; i++) {
@@ -1192,7 +1295,7 @@ static int prune_premature_packets(struct obs_output *output)
 			return -1;
 		}
 
-		audio = &output->interleaved_packets.array[audio_idx];
+		audio = &output->interleaved_packets.array[audio_idx].packet;
 		if (audio_idx > max_idx)
 			max_idx = audio_idx;
 
@@ -1208,7 +1311,7 @@ static void discard_to_idx(struct obs_output *output, size_t idx)
 {
 	for (size_t i = 0; i < idx; i++) {
 		struct encoder_packet *packet =
-			&output->interleaved_packets.array[i];
+			&output->interleaved_packets.array[i].packet;
 		obs_encoder_packet_release(packet);
 	}
 
@@ -1226,7 +1329,7 @@ static bool prune_interleaved_packets(struct obs_output *output)
 	blog(LOG_DEBUG, "--------- Pruning! %d ---------", prune_start);
 	for (size_t i = 0; i < output->interleaved_packets.num; i++) {
 		struct encoder_packet *packet =
-			&output->interleaved_packets.array[i];
+			&output->interleaved_packets.array[i].packet;
 		blog(LOG_DEBUG, "packet: %s %d, ts: %lld, pruned = %s",
 		     packet->type == OBS_ENCODER_AUDIO ? "audio" : "video",
 		     (int)packet->track_idx, packet->dts_usec,
@@ -1254,7 +1357,7 @@ static int find_first_packet_type_idx(struct obs_output *output,
 {
 	for (size_t i = 0; i < output->interleaved_packets.num; i++) {
 		struct encoder_packet *packet =
-			&output->interleaved_packets.array[i];
+			&output->interleaved_packets.array[i].packet;
 
 		if (packet->type == type) {
 			if (type == OBS_ENCODER_AUDIO &&
@@ -1275,7 +1378,7 @@ static int find_last_packet_type_idx(struct obs_output *output,
 {
 	for (size_t i = output->interleaved_packets.num; i > 0; i--) {
 		struct encoder_packet *packet =
-			&output->interleaved_packets.array[i - 1];
+			&output->interleaved_packets.array[i - 1].packet;
 
 		if (packet->type == type) {
 			if (type == OBS_ENCODER_AUDIO &&
@@ -1295,7 +1398,8 @@ find_first_packet_type(struct obs_output *output, enum obs_encoder_type type,
 		       size_t audio_idx)
 {
 	int idx = find_first_packet_type_idx(output, type, audio_idx);
-	return (idx != -1) ? &output->interleaved_packets.array[idx] : NULL;
+	return (idx != -1) ? &output->interleaved_packets.array[idx].packet
+			   : NULL;
 }
 
 static inline struct encoder_packet *
@@ -1303,7 +1407,8 @@ find_last_packet_type(struct obs_output *output, enum obs_encoder_type type,
 		      size_t audio_idx)
 {
 	int idx = find_last_packet_type_idx(output, type, audio_idx);
-	return (idx != -1) ? &output->interleaved_packets.array[idx] : NULL;
+	return (idx != -1) ? &output->interleaved_packets.array[idx].packet
+			   : NULL;
 }
 
 static bool get_audio_and_video_packets(struct obs_output *output,
@@ -1385,7 +1490,7 @@ static bool initialize_interleaved_packets(struct obs_output *output)
 	/* apply new offsets to all existing packet DTS/PTS values */
 	for (size_t i = 0; i < output->interleaved_packets.num; i++) {
 		struct encoder_packet *packet =
-			&output->interleaved_packets.array[i];
+			&output->interleaved_packets.array[i].packet;
 		apply_interleaved_packet_offset(output, packet);
 	}
 
@@ -1393,36 +1498,47 @@ static bool initialize_interleaved_packets(struct obs_output *output)
 }
 
 static inline void insert_interleaved_packet(struct obs_output *output,
-					     struct encoder_packet *out)
+					     struct encoder_packet *out,
+					     bool started)
 {
-	size_t idx;
-	for (idx = 0; idx < output->interleaved_packets.num; idx++) {
-		struct encoder_packet *cur_packet;
-		cur_packet = output->interleaved_packets.array + idx;
+	struct interleaved_packet ip = {*out};
 
-		if (out->dts_usec == cur_packet->dts_usec &&
-		    out->type == OBS_ENCODER_VIDEO) {
-			break;
-		} else if (out->dts_usec < cur_packet->dts_usec) {
-			break;
-		}
+	set_interleaved_order(output, &ip);
+
+	if (started) {
+		da_push_back(output->interleaved_packets, &ip);
+		interleaved_sift_up(output,
+				    output->interleaved_packets.num - 1);
+		return;
+	}
+
+	/* keep the array sorted until started */
+	size_t lo = 0;
+	size_t hi = output->interleaved_packets.num;
+
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (interleaved_before(&ip,
+				       &output->interleaved_packets.array[mid]))
+			hi = mid;
+		else
+			lo = mid + 1;
 	}
 
-	da_insert(output->interleaved_packets, idx, out);
+	da_insert(output->interleaved_packets, lo, &ip);
 }
 
+/* the offsets applied on start change the order, so sort again as if the
+ * packets were all reinserted in their current order */
 static void resort_interleaved_packets(struct obs_output *output)
 {
-	DARRAY(struct encoder_packet) old_array;
-
-	old_array.da = output->interleaved_packets.da;
-	memset(&output->interleaved_packets, 0,
-	       sizeof(output->interleaved_packets));
-
-	for (size_t i = 0; i < old_array.num; i++)
-		insert_interleaved_packet(output, &old_array.array[i]);
+	for (size_t i = 0; i < output->interleaved_packets.num; i++)
+		set_interleaved_order(output,
+				      &output->interleaved_packets.array[i]);
 
-	da_free(old_array);
+	qsort(output->interleaved_packets.array,
+	      output->interleaved_packets.num,
+	      sizeof(struct interleaved_packet), interleaved_compare);
 }
 
 static void discard_unused_audio_packets(struct obs_output *output,
@@ -1432,7 +1548,7 @@ static void discard_unused_audio_packets(struct obs_output *output,
 
 	for (; idx < output->interleaved_packets.num; idx++) {
 		struct encoder_packet *p =
-			&output->interleaved_packets.array[idx];
+			&output->interleaved_packets.array[idx].packet;
 
 		if (p->dts_usec >= dts_usec)
 			break;
@@ -1472,14 +1588,14 @@ static void interleave_packets(void *data, struct encoder_packet *packet)
 	if (output->active_delay_ns)
 		out = *packet;
 	else
-		obs_encoder_packet_create_instance(&out, packet);
+		obs_encoder_packet_ref(&out, packet);
 
 	if (was_started)
 		apply_interleaved_packet_offset(output, &out);
 	else
 		check_received(output, packet);
 
-	insert_interleaved_packet(output, &out);
+	insert_interleaved_packet(output, &out, was_started);
 	set_higher_ts(output, &out);
 
 	/* when both video and audio have been received, we're ready
@@ -1811,6 +1927,8 @@ bool obs_output_begin_data_capture(obs_output_t *output, uint32_t flags)
 		return false;
 
 	output->total_frames = 0;
+	os_atomic_set_long(&output->bus_dropped_frames, 0);
+	os_atomic_set_bool(&output->bus_overflow_stopped, false);
 
 	convert_flags(output, flags, &encoded, &has_video, &has_audio,
 		      &has_service);
@@ -2221,6 +2339,46 @@ float obs_output_get_congestion(obs_output_t *output)
 	return 0;
 }
 
+bool obs_output_get_dyn_bitrate(obs_output_t *output,
+				struct obs_output_dyn_bitrate *state)
+{
+	if (!obs_output_valid(output, "obs_output_get_dyn_bitrate"))
+		return false;
+	if (!obs_ptr_valid(state, "obs_output_get_dyn_bitrate"))
+		return false;
+
+	memset(state, 0, sizeof(*state));
+
+	if (output->info.get_dyn_bitrate)
+		return output->info.get_dyn_bitrate(output->context.data,
+						    state);
+	return false;
+}
+
+void obs_output_get_packet_backlog(const obs_output_t *output,
+				   uint64_t *packets, uint64_t *bytes)
+{
+	uint64_t total_packets = 0;
+	uint64_t total_bytes = 0;
+
+	if (obs_output_valid(output, "obs_output_get_packet_backlog")) {
+		void *param = (void *)output;
+
+		obs_encoder_get_backlog(output->video_encoder, param,
+					&total_packets, &total_bytes);
+
+		for (size_t i = 0; i < MAX_AUDIO_MIXES; i++)
+			obs_encoder_get_backlog(output->audio_encoders[i],
+						param, &total_packets,
+						&total_bytes);
+	}
+
+	if (packets)
+		*packets = total_packets;
+	if (bytes)
+		*bytes = total_bytes;
+}
+
 int obs_output_get_connect_time_ms(obs_output_t *output)
 {
 	if (!obs_output_valid(output, "obs_output_get_connect_time_ms"))
@@ -30,6 +30,19 @@ extern "C" {
 
 struct encoder_packet;
 
+/** Dynamic bitrate state of an output, see obs_output_get_dyn_bitrate */
+struct obs_output_dyn_bitrate {
+	/** Original video bitrate, in kbps */
+	long orig_bitrate;
+	/** Current video bitrate, in kbps */
+	long cur_bitrate;
+	/** Most recently measured send rate of audio and video, in kbps */
+	long est_bitrate;
+	/** Number of times the bitrate was lowered/raised */
+	uint32_t num_lowered;
+	uint32_t num_raised;
+};
+
 struct obs_output_info {
 	/* required */
 	const char *id;
@@ -74,6 +87,10 @@ struct obs_output_info {
 
 	/* raw audio callback for multi track outputs */
 	void (*raw_audio2)(void *data, size_t idx, struct audio_data *frames);
+
+	/* for outputs that adjust the video bitrate to the connection */
+	bool (*get_dyn_bitrate)(void *data,
+				struct obs_output_dyn_bitrate *state);
 };
 
 EXPORT void obs_register_output_s(const struct obs_output_info *info,
@@ -65,7 +65,8 @@ static obs_service_t *obs_service_create_internal(const char *id,
 	service->control->service = service;
 
 	obs_context_data_insert(&service->context, &obs->data.services_mutex,
-				&obs->data.first_service);
+				&obs->data.first_service,
+				&obs->data.service_index);
 
 	blog(LOG_DEBUG, "service '%s' (%s) created", name, id);
 	return service;
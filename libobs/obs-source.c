@@ -21,6 +21,7 @@
 #include "media-io/format-conversion.h"
 #include "media-io/video-frame.h"
 #include "media-io/audio-io.h"
+#include "media-io/audio-mix.h"
 #include "util/threading.h"
 #include "util/platform.h"
 #include "callback/calldata.h"
@@ -194,7 +195,8 @@ bool obs_source_init(struct obs_source *source)
 	source->private_settings = obs_data_create();
 
 	obs_context_data_insert(&source->context, &obs->data.sources_mutex,
-				&obs->data.first_source);
+				&obs->data.first_source,
+				&obs->data.source_index);
 	return true;
 }
 
@@ -516,10 +518,87 @@ void obs_source_frame_init(struct obs_source_frame *frame,
 	}
 }
 
-static inline void obs_source_frame_decref(struct obs_source_frame *frame)
+/* must be called with async_mutex held */
+static struct async_frame *find_async_frame(obs_source_t *source,
+					    const struct obs_source_frame *frame)
 {
-	if (os_atomic_dec_long(&frame->refs) == 0)
+	for (size_t i = source->async_frames.num; i > 0; i--) {
+		struct async_frame *af = source->async_frames.array[i - 1];
+		if (&af->frame == frame)
+			return af;
+	}
+
+	return NULL;
+}
+
+/* must be called with async_mutex held */
+static void async_frame_destroy(obs_source_t *source,
+				struct obs_source_frame *frame)
+{
+	struct async_frame *af = find_async_frame(source, frame);
+
+	if (!af) {
 		obs_source_frame_destroy(frame);
+		return;
+	}
+
+	da_erase_item(source->async_frames, &af);
+
+	if (af->release)
+		af->release(af->release_param);
+	else
+		bfree(frame->data[0]);
+	bfree(af);
+}
+
+static inline void obs_source_frame_decref(obs_source_t *source,
+					   struct obs_source_frame *frame)
+{
+	if (os_atomic_dec_long(&frame->refs) == 0)
+		async_frame_destroy(source, frame);
+}
+
+/* frames that are no longer in the pool (external frames, frames allocated
+ * while the pool was full, and frames from before a format change) are
+ * retired by remove_async_frame and only freed here, because the frame
+ * selection code may still touch a frame after removing it.  must be called
+ * with async_mutex held */
+static void release_retired_frames(obs_source_t *source)
+{
+	for (size_t i = 0; i < source->async_retired.num; i++)
+		obs_source_frame_decref(source,
+					source->async_retired.array[i]);
+
+	da_resize(source->async_retired, 0);
+}
+
+/* must be called with async_mutex held */
+static void clear_async_queue(obs_source_t *source)
+{
+	while (source->async_queue_num)
+		remove_async_frame(source, async_queue_pop(source));
+}
+
+/* drops all queued frames and frees the pool.  frames that are still in use
+ * are freed once they're released.  must be called with async_mutex held */
+static void free_async_cache(struct obs_source *source)
+{
+	clear_async_queue(source);
+
+	remove_async_frame(source, source->cur_async_frame);
+	remove_async_frame(source, source->prev_async_frame);
+	source->cur_async_frame = NULL;
+	source->prev_async_frame = NULL;
+
+	for (size_t i = 0; i < source->async_pool_size; i++)
+		source->async_pool[i]->in_pool = false;
+	for (size_t i = 0; i < source->async_free_num; i++)
+		obs_source_frame_decref(source, &source->async_free[i]->frame);
+
+	source->async_pool_size = 0;
+	source->async_free_num = 0;
+
+	release_retired_frames(source);
 }
 
 static bool obs_source_filter_remove_refless(obs_source_t *source,
@@ -557,6 +636,11 @@ void obs_source_destroy(struct obs_source *source)
 
 	obs_source_dosignal(source, "source_destroy", "destroy");
 
+	/* hand external frames back before the source's data goes away */
+	pthread_mutex_lock(&source->async_mutex);
+	free_async_cache(source);
+	pthread_mutex_unlock(&source->async_mutex);
+
 	if (source->context.data) {
 		source->info.destroy(source->context.data);
 		source->context.data = NULL;
@@ -568,9 +652,6 @@ void obs_source_destroy(struct obs_source *source)
 	obs_hotkey_unregister(source->push_to_mute_key);
 	obs_hotkey_pair_unregister(source->mute_unmute_key);
 
-	for (i = 0; i < source->async_cache.num; i++)
-		obs_source_frame_decref(source->async_cache.array[i].frame);
-
 	gs_enter_context(obs->video.graphics);
 	if (source->async_texrender)
 		gs_texrender_destroy(source->async_texrender);
@@ -598,7 +679,7 @@ void obs_source_destroy(struct obs_source *source)
 
 	da_free(source->audio_actions);
 	da_free(source->audio_cb_list);
-	da_free(source->async_cache);
+	da_free(source->async_retired);
 	da_free(source->async_frames);
 	da_free(source->filters);
 	pthread_mutex_destroy(&source->filter_mutex);
@@ -1004,6 +1085,53 @@ static inline struct obs_source_frame *get_closest_frame(obs_source_t *source,
 bool set_async_texture_size(struct obs_source *source,
 			    const struct obs_source_frame *frame);
 
+static const char *source_perf_names[SOURCE_PERF_COUNT] = {
+	"video_tick", "video_render", "filter_video",
+	"filter_audio", "async_upload",
+};
+
+static uint64_t source_perf_begin_internal(obs_source_t *source,
+					   enum source_perf_type type)
+{
+	const char *name = source->perf_names[type];
+	long gen = os_atomic_load_long(&source->name_gen);
+
+	/* old names stay allocated in the context's rename cache, so reading
+	 * the name while the source is being renamed is safe */
+	if (!name || source->perf_names_gen[type] != gen) {
+		name = profile_store_name(obs_get_profiler_name_store(),
+					  "%s: %s", source->context.name,
+					  source_perf_names[type]);
+		source->perf_names[type] = name;
+		source->perf_names_gen[type] = gen;
+	}
+
+	profile_start(name);
+	return os_gettime_ns();
+}
+
+/* returns 0 if timing is disabled */
+static inline uint64_t source_perf_begin(obs_source_t *source,
+					 enum source_perf_type type)
+{
+	if (!os_atomic_load_bool(&obs->data.source_perf_stats))
+		return 0;
+
+	return source_perf_begin_internal(source, type);
+}
+
+static inline void source_perf_end(obs_source_t *source,
+				   enum source_perf_type type, uint64_t start)
+{
+	if (start) {
+		struct obs_source_perf_counter *counter = &source->perf[type];
+
+		counter->total_ns += os_gettime_ns() - start;
+		counter->count++;
+		profile_end(source->perf_names[type]);
+	}
+}
+
 static void async_tick(obs_source_t *source)
 {
 	uint64_t sys_time = obs->video.video_time;
@@ -1022,6 +1150,7 @@ static void async_tick(obs_source_t *source)
 	}
 
 	source->last_sys_timestamp = sys_time;
+	release_retired_frames(source);
 	pthread_mutex_unlock(&source->async_mutex);
 
 	if (source->cur_async_frame)
@@ -1073,8 +1202,12 @@ void obs_source_video_tick(obs_source_t *source, float seconds)
 		source->active = now_active;
 	}
 
-	if (source->context.data && source->info.video_tick)
+	if (source->context.data && source->info.video_tick) {
+		uint64_t start = source_perf_begin(source,
+						   SOURCE_PERF_VIDEO_TICK);
 		source->info.video_tick(source->context.data, seconds);
+		source_perf_end(source, SOURCE_PERF_VIDEO_TICK, start);
+	}
 
 	source->async_rendered = false;
 	source->deinterlace_rendered = false;
@@ -1691,20 +1824,26 @@ bool update_async_texture(struct obs_source *source,
 			  gs_texture_t *tex, gs_texrender_t *texrender)
 {
 	enum convert_type type;
+	uint64_t start;
+	bool success = false;
 
 	source->async_flip = frame->flip;
+	start = source_perf_begin(source, SOURCE_PERF_ASYNC_UPLOAD);
 
-	if (source->async_gpu_conversion && texrender)
-		return update_async_texrender(source, frame, tex, texrender);
+	if (source->async_gpu_conversion && texrender) {
+		success = update_async_texrender(source, frame, tex, texrender);
 
-	type = get_convert_type(frame->format, frame->full_range);
-	if (type == CONVERT_NONE) {
-		gs_texture_set_image(tex, frame->data[0], frame->linesize[0],
-				     false);
-		return true;
+	} else {
+		type = get_convert_type(frame->format, frame->full_range);
+		if (type == CONVERT_NONE) {
+			gs_texture_set_image(tex, frame->data[0],
+					     frame->linesize[0], false);
+			success = true;
+		}
 	}
 
-	return false;
+	source_perf_end(source, SOURCE_PERF_ASYNC_UPLOAD, start);
+	return success;
 }
 
 static inline void obs_source_draw_texture(struct obs_source *source,
@@ -1816,12 +1955,15 @@ static inline void obs_source_main_render(obs_source_t *source)
 	bool custom_draw = (flags & OBS_SOURCE_CUSTOM_DRAW) != 0;
 	bool default_effect = !source->filter_parent &&
 			      source->filters.num == 0 && !custom_draw;
+	uint64_t start = source_perf_begin(source, SOURCE_PERF_VIDEO_RENDER);
 
 	if (default_effect)
 		obs_source_default_render(source);
 	else if (source->context.data)
 		source->info.video_render(source->context.data,
 					  custom_draw ? NULL : gs_get_effect());
+
+	source_perf_end(source, SOURCE_PERF_VIDEO_RENDER, start);
 }
 
 static bool ready_async_frame(obs_source_t *source, uint64_t sys_time);
@@ -2248,8 +2390,12 @@ struct obs_source_frame *filter_async_video(obs_source_t *source,
 			continue;
 
 		if (filter->context.data && filter->info.filter_video) {
+			uint64_t start = source_perf_begin(
+				filter, SOURCE_PERF_FILTER_VIDEO);
 			in = filter->info.filter_video(filter->context.data,
 						       in);
+			source_perf_end(filter, SOURCE_PERF_FILTER_VIDEO,
+					start);
 			if (!in)
 				break;
 		}
@@ -2348,50 +2494,10 @@ static inline bool async_texture_changed(struct obs_source *source,
 	       source->async_cache_height != frame->height || prev != cur;
 }
 
-static inline void free_async_cache(struct obs_source *source)
-{
-	for (size_t i = 0; i < source->async_cache.num; i++)
-		obs_source_frame_decref(source->async_cache.array[i].frame);
-
-	da_resize(source->async_cache, 0);
-	da_resize(source->async_frames, 0);
-	source->cur_async_frame = NULL;
-	source->prev_async_frame = NULL;
-}
-
-#define MAX_UNUSED_FRAME_DURATION 5
-
-/* frees frame allocations if they haven't been used for a specific period
- * of time */
-static void clean_cache(obs_source_t *source)
+/* must be called with async_mutex held */
+static inline void check_async_format(struct obs_source *source,
+				      const struct obs_source_frame *frame)
 {
-	for (size_t i = source->async_cache.num; i > 0; i--) {
-		struct async_frame *af = &source->async_cache.array[i - 1];
-		if (!af->used) {
-			if (++af->unused_count == MAX_UNUSED_FRAME_DURATION) {
-				obs_source_frame_destroy(af->frame);
-				da_erase(source->async_cache, i - 1);
-			}
-		}
-	}
-}
-
-#define MAX_ASYNC_FRAMES 30
-//if return value is not null then do (os_atomic_dec_long(&output->refs) == 0) && obs_source_frame_destroy(output)
-static inline struct obs_source_frame *
-cache_video(struct obs_source *source, const struct obs_source_frame *frame)
-{
-	struct obs_source_frame *new_frame = NULL;
-
-	pthread_mutex_lock(&source->async_mutex);
-
-	if (source->async_frames.num >= MAX_ASYNC_FRAMES) {
-		free_async_cache(source);
-		source->last_frame_ts = 0;
-		pthread_mutex_unlock(&source->async_mutex);
-		return NULL;
-	}
-
 	if (async_texture_changed(source, frame)) {
 		free_async_cache(source);
 		source->async_cache_width = frame->width;
@@ -2399,46 +2505,69 @@ cache_video(struct obs_source *source, const struct obs_source_frame *frame)
 		source->async_cache_format = frame->format;
 		source->async_cache_full_range = frame->full_range;
 	}
+}
 
-	for (size_t i = 0; i < source->async_cache.num; i++) {
-		struct async_frame *af = &source->async_cache.array[i];
-		if (!af->used) {
-			new_frame = af->frame;
-			af->used = true;
-			af->unused_count = 0;
-			break;
-		}
-	}
+/* must be called with async_mutex held */
+static struct async_frame *create_async_frame(struct obs_source *source,
+					      enum video_format format,
+					      uint32_t width, uint32_t height)
+{
+	struct async_frame *af = bzalloc(sizeof(struct async_frame));
 
-	clean_cache(source);
+	obs_source_frame_init(&af->frame, format, width, height);
+	af->frame.refs = 1;
+	da_push_back(source->async_frames, &af);
+	return af;
+}
 
-	if (!new_frame) {
-		struct async_frame new_af;
-		enum video_format format = frame->format;
+/* takes a frame from the pool, or allocates one if the pool is empty.  if
+ * the pool is already full, the frame is freed again once it's no longer
+ * used.  must be called with async_mutex held */
+static struct async_frame *get_async_frame(struct obs_source *source,
+					   const struct obs_source_frame *frame)
+{
+	struct async_frame *af;
 
-		new_frame = obs_source_frame_create(format, frame->width,
-						    frame->height);
-		new_af.frame = new_frame;
-		new_af.used = true;
-		new_af.unused_count = 0;
-		new_frame->refs = 1;
+	if (source->async_free_num) {
+		af = source->async_free[--source->async_free_num];
+		source->async_stats.pool_hits++;
+	} else {
+		af = create_async_frame(source, frame->format, frame->width,
+					frame->height);
+		source->async_stats.pool_misses++;
 
-		da_push_back(source->async_cache, &new_af);
+		if (source->async_pool_size < ASYNC_POOL_SIZE) {
+			source->async_pool[source->async_pool_size++] = af;
+			af->in_pool = true;
+		}
 	}
 
-	os_atomic_inc_long(&new_frame->refs);
-
-	pthread_mutex_unlock(&source->async_mutex);
+	af->used = true;
+	return af;
+}
 
-	copy_frame_data(new_frame, frame);
+/* if too many frames are queued, the timestamps have most likely gone wrong,
+ * so drop the queue and start over.  must be called with async_mutex held */
+static void queue_async_frame(struct obs_source *source,
+			      struct obs_source_frame *frame)
+{
+	if (source->async_queue_num == MAX_ASYNC_FRAMES) {
+		clear_async_queue(source);
+		source->last_frame_ts = 0;
+		source->async_stats.queue_overflows++;
+	}
 
-	return new_frame;
+	async_queue_push(source, frame);
+	source->async_active = true;
 }
 
 static void
 obs_source_output_video_internal(obs_source_t *source,
 				 const struct obs_source_frame *frame)
 {
+	struct async_frame *af;
+	bool in_pool;
+
 	if (!obs_source_valid(source, "obs_source_output_video"))
 		return;
 
@@ -2447,20 +2576,25 @@ obs_source_output_video_internal(obs_source_t *source,
 		return;
 	}
 
-	struct obs_source_frame *output = !!frame ? cache_video(source, frame)
-						  : NULL;
+	pthread_mutex_lock(&source->async_mutex);
+	check_async_format(source, frame);
+	af = get_async_frame(source, frame);
+	in_pool = af->in_pool;
+	pthread_mutex_unlock(&source->async_mutex);
+
+	copy_frame_data(&af->frame, frame);
 
 	/* ------------------------------------------- */
 	pthread_mutex_lock(&source->async_mutex);
-	if (output) {
-		if (os_atomic_dec_long(&output->refs) == 0) {
-			obs_source_frame_destroy(output);
-			output = NULL;
-		} else {
-			da_push_back(source->async_frames, &output);
-			source->async_active = true;
-		}
+
+	/* the pool was flushed while copying */
+	if (in_pool && !af->in_pool) {
+		remove_async_frame(source, &af->frame);
+		release_retired_frames(source);
+	} else {
+		queue_async_frame(source, &af->frame);
 	}
+
 	pthread_mutex_unlock(&source->async_mutex);
 }
 
@@ -2513,6 +2647,76 @@ void obs_source_output_video2(obs_source_t *source,
 	obs_source_output_video_internal(source, &new_frame);
 }
 
+/* the conversion shaders only get the plane offsets when the async texture
+ * changes, so external frames must be laid out exactly like cached frames */
+static bool external_layout_matches(const struct obs_source_frame *frame)
+{
+	size_t offsets[MAX_AV_PLANES];
+	uint32_t linesize[MAX_AV_PLANES];
+
+	if (!video_frame_get_layout(frame->format, frame->width, frame->height,
+				    offsets, linesize))
+		return false;
+
+	for (size_t i = 0; i < MAX_AV_PLANES; i++) {
+		if (frame->linesize[i] != linesize[i])
+			return false;
+		if (linesize[i] && frame->data[i] != frame->data[0] + offsets[i])
+			return false;
+	}
+
+	return true;
+}
+
+static void cache_external_video(struct obs_source *source,
+				 const struct obs_source_frame *frame,
+				 void (*release)(void *param), void *param)
+{
+	struct async_frame *af = bmalloc(sizeof(struct async_frame));
+
+	af->frame = *frame;
+	af->frame.refs = 1;
+	af->frame.prev_frame = false;
+	af->used = true;
+	af->in_pool = false;
+	af->release = release;
+	af->release_param = param;
+
+	pthread_mutex_lock(&source->async_mutex);
+	da_push_back(source->async_frames, &af);
+	check_async_format(source, frame);
+	queue_async_frame(source, &af->frame);
+	release_retired_frames(source);
+	pthread_mutex_unlock(&source->async_mutex);
+}
+
+void obs_source_output_video_external(obs_source_t *source,
+				      const struct obs_source_frame *frame,
+				      void (*release)(void *param), void *param)
+{
+	if (!obs_source_valid(source, "obs_source_output_video_external") ||
+	    !obs_ptr_valid(frame, "obs_source_output_video_external")) {
+		if (release)
+			release(param);
+		return;
+	}
+
+	struct obs_source_frame new_frame = *frame;
+	new_frame.full_range =
+		format_is_yuv(frame->format) ? new_frame.full_range : true;
+
+	if (!release) {
+		obs_source_output_video_internal(source, &new_frame);
+
+	} else if (external_layout_matches(&new_frame)) {
+		cache_external_video(source, &new_frame, release, param);
+
+	} else {
+		obs_source_output_video_internal(source, &new_frame);
+		release(param);
+	}
+}
+
 static inline bool preload_frame_changed(obs_source_t *source,
 					 const struct obs_source_frame *in)
 {
@@ -2629,8 +2833,12 @@ filter_async_audio(obs_source_t *source, struct obs_audio_data *in)
 			continue;
 
 		if (filter->context.data && filter->info.filter_audio) {
+			uint64_t start = source_perf_begin(
+				filter, SOURCE_PERF_FILTER_AUDIO);
 			in = filter->info.filter_audio(filter->context.data,
 						       in);
+			source_perf_end(filter, SOURCE_PERF_FILTER_AUDIO,
+					start);
 			if (!in)
 				return NULL;
 		}
@@ -2828,34 +3036,39 @@ void obs_source_output_audio(obs_source_t *source,
 
 void remove_async_frame(obs_source_t *source, struct obs_source_frame *frame)
 {
-	if (frame)
-		frame->prev_frame = false;
+	struct async_frame *af;
 
-	for (size_t i = 0; i < source->async_cache.num; i++) {
-		struct async_frame *f = &source->async_cache.array[i];
+	if (!frame)
+		return;
 
-		if (f->frame == frame) {
-			f->used = false;
-			break;
-		}
-	}
+	af = find_async_frame(source, frame);
+	if (!af || !af->used)
+		return;
+
+	frame->prev_frame = false;
+	af->used = false;
+
+	if (af->in_pool)
+		source->async_free[source->async_free_num++] = af;
+	else
+		da_push_back(source->async_retired, &frame);
 }
 
 /* #define DEBUG_ASYNC_FRAMES 1 */
 
 static bool ready_async_frame(obs_source_t *source, uint64_t sys_time)
 {
-	struct obs_source_frame *next_frame = source->async_frames.array[0];
+	struct obs_source_frame *next_frame = async_queue_peek(source, 0);
 	struct obs_source_frame *frame = NULL;
 	uint64_t sys_offset = sys_time - source->last_sys_timestamp;
 	uint64_t frame_time = next_frame->timestamp;
 	uint64_t frame_offset = 0;
 
 	if (source->async_unbuffered) {
-		while (source->async_frames.num > 1) {
-			da_erase(source->async_frames, 0);
+		while (source->async_queue_num > 1) {
+			async_queue_pop(source);
 			remove_async_frame(source, next_frame);
-			next_frame = source->async_frames.array[0];
+			next_frame = async_queue_peek(source, 0);
 		}
 
 		source->last_frame_ts = next_frame->timestamp;
@@ -2869,7 +3082,7 @@ static bool ready_async_frame(obs_source_t *source, uint64_t sys_time)
 	     "number of frames: %lu",
 	     source->last_frame_ts, frame_time, sys_offset,
 	     frame_time - source->last_frame_ts,
-	     (unsigned long)source->async_frames.num);
+	     (unsigned long)source->async_queue_num);
 #endif
 
 	/* account for timestamp invalidation */
@@ -2894,7 +3107,7 @@ static bool ready_async_frame(obs_source_t *source, uint64_t sys_time)
 			break;
 
 		if (frame)
-			da_erase(source->async_frames, 0);
+			async_queue_pop(source);
 
 #if DEBUG_ASYNC_FRAMES
 		blog(LOG_DEBUG,
@@ -2906,11 +3119,11 @@ static bool ready_async_frame(obs_source_t *source, uint64_t sys_time)
 
 		remove_async_frame(source, frame);
 
-		if (source->async_frames.num == 1)
+		if (source->async_queue_num == 1)
 			return true;
 
 		frame = next_frame;
-		next_frame = source->async_frames.array[1];
+		next_frame = async_queue_peek(source, 1);
 
 		/* more timestamp checking and compensating */
 		if ((next_frame->timestamp - frame_time) > MAX_TS_VAR) {
@@ -2936,12 +3149,11 @@ static bool ready_async_frame(obs_source_t *source, uint64_t sys_time)
 static inline struct obs_source_frame *get_closest_frame(obs_source_t *source,
 							 uint64_t sys_time)
 {
-	if (!source->async_frames.num)
+	if (!source->async_queue_num)
 		return NULL;
 
 	if (!source->last_frame_ts || ready_async_frame(source, sys_time)) {
-		struct obs_source_frame *frame = source->async_frames.array[0];
-		da_erase(source->async_frames, 0);
+		struct obs_source_frame *frame = async_queue_pop(source);
 
 		if (!source->last_frame_ts)
 			source->last_frame_ts = frame->timestamp;
@@ -2985,20 +3197,54 @@ void obs_source_release_frame(obs_source_t *source,
 	if (!frame)
 		return;
 
+	/* without the source there's no telling whether this is one of its
+	 * async frames, so it can only be freed as a plain frame */
 	if (!source) {
 		obs_source_frame_destroy(frame);
 	} else {
 		pthread_mutex_lock(&source->async_mutex);
 
-		if (os_atomic_dec_long(&frame->refs) == 0)
-			obs_source_frame_destroy(frame);
-		else
+		if (os_atomic_dec_long(&frame->refs) == 0) {
+			async_frame_destroy(source, frame);
+		} else {
 			remove_async_frame(source, frame);
+			release_retired_frames(source);
+		}
 
 		pthread_mutex_unlock(&source->async_mutex);
 	}
 }
 
+bool obs_source_get_async_stats(obs_source_t *source,
+				struct obs_source_async_stats *stats)
+{
+	if (!obs_source_valid(source, "obs_source_get_async_stats") ||
+	    !obs_ptr_valid(stats, "obs_source_get_async_stats"))
+		return false;
+
+	pthread_mutex_lock(&source->async_mutex);
+	*stats = source->async_stats;
+	stats->pool_size = (uint32_t)source->async_pool_size;
+	stats->queued_frames = (uint32_t)source->async_queue_num;
+	pthread_mutex_unlock(&source->async_mutex);
+	return true;
+}
+
+bool obs_source_get_perf_stats(const obs_source_t *source,
+			       struct obs_source_perf_stats *stats)
+{
+	if (!obs_source_valid(source, "obs_source_get_perf_stats") ||
+	    !obs_ptr_valid(stats, "obs_source_get_perf_stats"))
+		return false;
+
+	stats->video_tick = source->perf[SOURCE_PERF_VIDEO_TICK];
+	stats->video_render = source->perf[SOURCE_PERF_VIDEO_RENDER];
+	stats->filter_video = source->perf[SOURCE_PERF_FILTER_VIDEO];
+	stats->filter_audio = source->perf[SOURCE_PERF_FILTER_AUDIO];
+	stats->async_upload = source->perf[SOURCE_PERF_ASYNC_UPLOAD];
+	return true;
+}
+
 const char *obs_source_get_name(const obs_source_t *source)
 {
 	return obs_source_valid(source, "obs_source_get_name")
@@ -3016,6 +3262,7 @@ void obs_source_set_name(obs_source_t *source, const char *name)
 		struct calldata data;
 		char *prev_name = bstrdup(source->context.name);
 		obs_context_data_setname(&source->context, name);
+		os_atomic_inc_long(&source->name_gen);
 
 		calldata_init(&data);
 		calldata_set_ptr(&data, "source", source);
@@ -3981,24 +4228,16 @@ static float get_source_volume(obs_source_t *source, uint64_t os_time)
 static inline void multiply_output_audio(obs_source_t *source, size_t mix,
 					 size_t channels, float vol)
 {
-	register float *out = source->audio_output_buf[mix][0];
-	register float *end = out + AUDIO_OUTPUT_FRAMES * channels;
-
-	while (out < end)
-		*(out++) *= vol;
+	audio_mix_gain(source->audio_output_buf[mix][0], vol,
+		       AUDIO_OUTPUT_FRAMES * channels);
 }
 
 static inline void multiply_vol_data(obs_source_t *source, size_t mix,
-				     size_t channels, float *vol_data)
+				     size_t channels, const float *vol_data)
 {
-	for (size_t ch = 0; ch < channels; ch++) {
-		register float *out = source->audio_output_buf[mix][ch];
-		register float *end = out + AUDIO_OUTPUT_FRAMES;
-		register float *vol = vol_data;
-
-		while (out < end)
-			*(out++) *= *(vol++);
-	}
+	for (size_t ch = 0; ch < channels; ch++)
+		audio_mix_mul(source->audio_output_buf[mix][ch], vol_data,
+			      AUDIO_OUTPUT_FRAMES);
 }
 
 static inline void apply_audio_action(obs_source_t *source,
@@ -4023,7 +4262,7 @@ static inline void apply_audio_action(obs_source_t *source,
 static void apply_audio_actions(obs_source_t *source, size_t channels,
 				size_t sample_rate)
 {
-	float *vol_data = malloc(sizeof(float) * AUDIO_OUTPUT_FRAMES);
+	float vol_data[AUDIO_OUTPUT_FRAMES];
 	float cur_vol = get_source_volume(source, source->audio_ts);
 	size_t frame_num = 0;
 
@@ -4064,8 +4303,6 @@ static void apply_audio_actions(obs_source_t *source, size_t channels,
 		if ((source->audio_mixers & (1 << mix)) != 0)
 			multiply_vol_data(source, mix, channels, vol_data);
 	}
-
-	free(vol_data);
 }
 
 static void apply_audio_volume(obs_source_t *source, uint32_t mixers,
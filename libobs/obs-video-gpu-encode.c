@@ -94,6 +94,8 @@ static void *gpu_encode_thread(void *unused)
 			else
 				next_key++;
 
+			apply_encoder_update(encoder);
+
 			success = encoder->info.encode_texture(
 				encoder->context.data, tf.handle,
 				encoder->cur_pts, lock_key, &next_key, &pkt,
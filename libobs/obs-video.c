@@ -512,21 +512,98 @@ static inline void render_video(struct obs_core_video *video, bool raw_active,
 	gs_end_scene();
 }
 
+#define STAGING_STALL_WINDOW 120
+#define STAGING_STALL_LIMIT 3
+
+/* a map that blocks for more than a quarter of a frame means the GPU had
+ * not finished copying to the surface yet */
+static inline void check_download_stall(struct obs_core_video *video,
+					uint64_t map_time_ns, bool mapped)
+{
+	uint64_t interval = video_output_get_frame_time(video->video);
+
+	if (!mapped || map_time_ns > interval / 4)
+		video->download_stalls++;
+
+	if (++video->download_frames == STAGING_STALL_WINDOW) {
+		video->download_frames = 0;
+		video->download_stalls = 0;
+	}
+}
+
 static inline bool download_frame(struct obs_core_video *video,
-				  int prev_texture, struct video_data *frame)
+				  int download_texture,
+				  struct video_data *frame)
 {
-	gs_stagesurf_t *surface = video->copy_surfaces[prev_texture];
+	gs_stagesurf_t *surface = video->copy_surfaces[download_texture];
+	uint64_t map_start;
+	bool mapped;
 
-	if (!video->textures_copied[prev_texture])
+	if (!video->textures_copied[download_texture])
 		return false;
 
-	if (!gs_stagesurface_map(surface, &frame->data[0], &frame->linesize[0]))
+	map_start = os_gettime_ns();
+	mapped = gs_stagesurface_map(surface, &frame->data[0],
+				     &frame->linesize[0]);
+
+	if (video->adaptive_staging &&
+	    video->num_textures < MAX_STAGING_SURFACES)
+		check_download_stall(video, os_gettime_ns() - map_start,
+				     mapped);
+
+	if (!mapped)
 		return false;
 
 	video->mapped_surface = surface;
 	return true;
 }
 
+/* inserts a new staging surface in front of the oldest one, so it is the next
+ * surface staged to and every frame after it is downloaded one frame later */
+static void add_staging_surface(struct obs_core_video *video)
+{
+	uint32_t output_height = video->gpu_conversion
+					 ? video->conversion_height
+					 : video->output_height;
+	int idx = video->cur_texture;
+	gs_stagesurf_t *surface;
+
+#ifdef _WIN32
+	if (video->using_nv12_tex)
+		surface = gs_stagesurface_create_nv12(video->output_width,
+						      video->output_height);
+	else
+#endif
+		surface = gs_stagesurface_create(video->output_width,
+						 output_height, GS_RGBA);
+
+	if (!surface) {
+		video->adaptive_staging = false;
+		return;
+	}
+
+	for (int i = video->num_textures; i > idx; i--) {
+		video->copy_surfaces[i] = video->copy_surfaces[i - 1];
+		video->textures_copied[i] = video->textures_copied[i - 1];
+	}
+
+	/* the surface after the new one was just downloaded, so the next
+	 * frame has nothing to download yet */
+	video->copy_surfaces[idx] = surface;
+	video->textures_copied[idx] = false;
+	video->textures_copied[idx + 1] = false;
+	video->num_textures++;
+
+	video->download_frames = 0;
+	video->download_stalls = 0;
+
+	blog(LOG_INFO,
+	     "Staging surface downloads are stalling, increased "
+	     "staging surfaces to %d (%g ms of latency)",
+	     video->num_textures,
+	     (double)obs_get_staging_latency_ns() / 1000000.0);
+}
+
 static inline uint32_t calc_linesize(uint32_t pos, uint32_t linesize)
 {
 	uint32_t size = pos % linesize;
@@ -629,21 +706,22 @@ static void set_gpu_converted_data(struct obs_core_video *video,
 
 static void convert_frame(struct video_frame *output,
 			  const struct video_data *input,
-			  const struct video_output_info *info)
+			  const struct video_output_info *info,
+			  uint32_t start_y, uint32_t end_y)
 {
 	if (info->format == VIDEO_FORMAT_I420) {
-		compress_uyvx_to_i420(input->data[0], input->linesize[0], 0,
-				      info->height, output->data,
+		compress_uyvx_to_i420(input->data[0], input->linesize[0],
+				      start_y, end_y, output->data,
 				      output->linesize);
 
 	} else if (info->format == VIDEO_FORMAT_NV12) {
-		compress_uyvx_to_nv12(input->data[0], input->linesize[0], 0,
-				      info->height, output->data,
+		compress_uyvx_to_nv12(input->data[0], input->linesize[0],
+				      start_y, end_y, output->data,
 				      output->linesize);
 
 	} else if (info->format == VIDEO_FORMAT_I444) {
-		convert_uyvx_to_i444(input->data[0], input->linesize[0], 0,
-				     info->height, output->data,
+		convert_uyvx_to_i444(input->data[0], input->linesize[0],
+				     start_y, end_y, output->data,
 				     output->linesize);
 
 	} else {
@@ -653,16 +731,18 @@ static void convert_frame(struct video_frame *output,
 
 static inline void copy_rgbx_frame(struct video_frame *output,
 				   const struct video_data *input,
-				   const struct video_output_info *info)
+				   const struct video_output_info *info,
+				   uint32_t start_y, uint32_t end_y)
 {
-	uint8_t *in_ptr = input->data[0];
-	uint8_t *out_ptr = output->data[0];
+	uint8_t *in_ptr = input->data[0] + start_y * input->linesize[0];
+	uint8_t *out_ptr = output->data[0] + start_y * output->linesize[0];
 
 	/* if the line sizes match, do a single copy */
 	if (input->linesize[0] == output->linesize[0]) {
-		memcpy(out_ptr, in_ptr, input->linesize[0] * info->height);
+		memcpy(out_ptr, in_ptr,
+		       input->linesize[0] * (end_y - start_y));
 	} else {
-		for (size_t y = 0; y < info->height; y++) {
+		for (size_t y = start_y; y < end_y; y++) {
 			memcpy(out_ptr, in_ptr, info->width * 4);
 			in_ptr += input->linesize[0];
 			out_ptr += output->linesize[0];
@@ -670,6 +750,50 @@ static inline void copy_rgbx_frame(struct video_frame *output,
 	}
 }
 
+struct convert_slice_job {
+	struct obs_core_video *video;
+	struct video_frame *output;
+	const struct video_data *input;
+	const struct video_output_info *info;
+};
+
+static void convert_frame_slice(void *param, size_t idx)
+{
+	struct convert_slice_job *job = param;
+	const char *name = job->video->conversion_slice_names[idx];
+	uint32_t start_y, end_y;
+
+	video_get_slice_rows(job->info->height, job->video->conversion_threads,
+			     idx, &start_y, &end_y);
+	if (start_y == end_y)
+		return;
+
+	profile_start(name);
+	if (format_is_yuv(job->info->format))
+		convert_frame(job->output, job->input, job->info, start_y,
+			      end_y);
+	else
+		copy_rgbx_frame(job->output, job->input, job->info, start_y,
+				end_y);
+	profile_end(name);
+}
+
+static inline void convert_frame_slices(struct obs_core_video *video,
+					struct video_frame *output,
+					const struct video_data *input,
+					const struct video_output_info *info)
+{
+	struct convert_slice_job job = {
+		.video = video,
+		.output = output,
+		.input = input,
+		.info = info,
+	};
+
+	os_task_pool_run(video->conversion_pool, video->conversion_threads,
+			 convert_frame_slice, &job);
+}
+
 static inline void output_video_data(struct obs_core_video *video,
 				     struct video_data *input_frame, int count)
 {
@@ -686,10 +810,15 @@ static inline void output_video_data(struct obs_core_video *video,
 			set_gpu_converted_data(video, &output_frame,
 					       input_frame, info);
 
+		} else if (video->conversion_pool) {
+			convert_frame_slices(video, &output_frame, input_frame,
+					     info);
 		} else if (format_is_yuv(info->format)) {
-			convert_frame(&output_frame, input_frame, info);
+			convert_frame(&output_frame, input_frame, info, 0,
+				      info->height);
 		} else {
-			copy_rgbx_frame(&output_frame, input_frame, info);
+			copy_rgbx_frame(&output_frame, input_frame, info, 0,
+					info->height);
 		}
 
 		video_output_unlock_frame(video->video);
@@ -736,8 +865,7 @@ static inline void output_frame(bool raw_active, const bool gpu_active)
 {
 	struct obs_core_video *video = &obs->video;
 	int cur_texture = video->cur_texture;
-	int prev_texture = cur_texture == 0 ? NUM_TEXTURES - 1
-					    : cur_texture - 1;
+	int download_texture = (cur_texture + 1) % video->num_textures;
 	struct video_data frame;
 	bool frame_ready = 0;
 
@@ -755,7 +883,7 @@ static inline void output_frame(bool raw_active, const bool gpu_active)
 
 	if (raw_active) {
 		profile_start(output_frame_download_frame_name);
-		frame_ready = download_frame(video, prev_texture, &frame);
+		frame_ready = download_frame(video, download_texture, &frame);
 		profile_end(output_frame_download_frame_name);
 	}
 
@@ -777,8 +905,16 @@ static inline void output_frame(bool raw_active, const bool gpu_active)
 		profile_end(output_frame_output_video_data_name);
 	}
 
-	if (++video->cur_texture == NUM_TEXTURES)
+	if (++video->cur_texture == video->num_textures)
 		video->cur_texture = 0;
+
+	if (video->adaptive_staging &&
+	    video->num_textures < MAX_STAGING_SURFACES &&
+	    video->download_stalls >= STAGING_STALL_LIMIT) {
+		gs_enter_context(video->graphics);
+		add_staging_surface(video);
+		gs_leave_context();
+	}
 }
 
 #define NBSP "\xC2\xA0"
@@ -19,6 +19,7 @@
 
 #include "graphics/matrix4.h"
 #include "callback/calldata.h"
+#include "util/fnv1a.h"
 
 #include "obs.h"
 #include "obs-internal.h"
@@ -39,7 +40,9 @@ static inline void make_video_info(struct video_output_info *vi,
 	vi->height = ovi->output_height;
 	vi->range = ovi->range;
 	vi->colorspace = ovi->colorspace;
-	vi->cache_size = 6;
+	vi->cache_size = ovi->cache_size;
+	vi->conversion_threads = ovi->conversion_threads;
+	vi->threaded_inputs = ovi->threaded_video_inputs;
 }
 
 #define PIXEL_SIZE 4
@@ -212,7 +215,7 @@ static bool obs_init_textures(struct obs_video_info *ovi)
 					 : ovi->output_height;
 	size_t i;
 
-	for (i = 0; i < NUM_TEXTURES; i++) {
+	for (i = 0; i < (size_t)video->num_textures; i++) {
 #ifdef _WIN32
 		if (video->using_nv12_tex) {
 			video->copy_surfaces[i] = gs_stagesurface_create_nv12(
@@ -383,6 +386,65 @@ static inline void set_video_matrix(struct obs_core_video *video,
 	memcpy(video->color_matrix, &mat, sizeof(float) * 16);
 }
 
+static bool obs_init_conversion_pool(struct obs_video_info *ovi)
+{
+	struct obs_core_video *video = &obs->video;
+	uint32_t threads = ovi->conversion_threads;
+	uint32_t cores = (uint32_t)os_get_logical_cores();
+
+	if (threads > cores)
+		threads = cores;
+	if (threads > MAX_CONVERSION_THREADS)
+		threads = MAX_CONVERSION_THREADS;
+	if (threads < 1)
+		threads = 1;
+
+	/* the video output also uses this for its own conversions */
+	ovi->conversion_threads = threads;
+
+	if (ovi->gpu_conversion)
+		threads = 1;
+
+	video->conversion_threads = threads;
+	if (threads == 1)
+		return true;
+
+	for (uint32_t i = 0; i < threads; i++)
+		video->conversion_slice_names[i] =
+			profile_store_name(obs_get_profiler_name_store(),
+					   "convert_frame_slice(%u)", i);
+
+	video->conversion_pool = os_task_pool_create(
+		"libobs: frame conversion thread", threads - 1);
+	if (!video->conversion_pool)
+		return false;
+
+	blog(LOG_INFO, "Using %u threads for CPU frame conversion", threads);
+	return true;
+}
+
+#define DEFAULT_CACHE_SIZE 6
+
+static void obs_init_pipeline_depth(struct obs_video_info *ovi)
+{
+	struct obs_core_video *video = &obs->video;
+
+	if (!ovi->cache_size)
+		ovi->cache_size = DEFAULT_CACHE_SIZE;
+	if (ovi->cache_size > MAX_VIDEO_CACHE_SIZE)
+		ovi->cache_size = MAX_VIDEO_CACHE_SIZE;
+
+	if (ovi->staging_surfaces < NUM_TEXTURES)
+		ovi->staging_surfaces = NUM_TEXTURES;
+	if (ovi->staging_surfaces > MAX_STAGING_SURFACES)
+		ovi->staging_surfaces = MAX_STAGING_SURFACES;
+
+	video->num_textures = (int)ovi->staging_surfaces;
+	video->adaptive_staging = ovi->adaptive_staging;
+	video->download_frames = 0;
+	video->download_stalls = 0;
+}
+
 static int obs_init_video(struct obs_video_info *ovi)
 {
 	struct obs_core_video *video = &obs->video;
@@ -390,6 +452,10 @@ static int obs_init_video(struct obs_video_info *ovi)
 	pthread_mutexattr_t attr;
 	int errorcode;
 
+	if (!obs_init_conversion_pool(ovi))
+		return OBS_VIDEO_FAIL;
+
+	obs_init_pipeline_depth(ovi);
 	make_video_info(&vi, ovi);
 	video->base_width = ovi->base_width;
 	video->base_height = ovi->base_height;
@@ -470,7 +536,7 @@ static void obs_free_video(void)
 			video->mapped_surface = NULL;
 		}
 
-		for (size_t i = 0; i < NUM_TEXTURES; i++) {
+		for (size_t i = 0; i < MAX_STAGING_SURFACES; i++) {
 			gs_stagesurface_destroy(video->copy_surfaces[i]);
 			video->copy_surfaces[i] = NULL;
 		}
@@ -503,6 +569,10 @@ static void obs_free_video(void)
 		video->gpu_encoder_active = 0;
 		video->cur_texture = 0;
 	}
+
+	os_task_pool_destroy(video->conversion_pool);
+	video->conversion_pool = NULL;
+	video->conversion_threads = 0;
 }
 
 static void obs_free_graphics(void)
@@ -535,7 +605,33 @@ static void obs_free_graphics(void)
 	}
 }
 
-static bool obs_init_audio(struct audio_output_info *ai)
+static bool obs_init_audio_render_pool(uint32_t threads)
+{
+	struct obs_core_audio *audio = &obs->audio;
+	uint32_t cores = (uint32_t)os_get_logical_cores();
+
+	if (threads > cores)
+		threads = cores;
+	if (threads > MAX_AUDIO_RENDER_THREADS)
+		threads = MAX_AUDIO_RENDER_THREADS;
+	if (threads < 1)
+		threads = 1;
+
+	audio->render_threads = threads;
+	if (threads == 1)
+		return true;
+
+	audio->render_pool = os_task_pool_create(
+		"libobs: audio render thread", threads - 1);
+	if (!audio->render_pool)
+		return false;
+
+	blog(LOG_INFO, "Using %u threads to render audio sources", threads);
+	return true;
+}
+
+static bool obs_init_audio(struct audio_output_info *ai,
+			   uint32_t render_threads)
 {
 	struct obs_core_audio *audio = &obs->audio;
 	int errorcode;
@@ -556,6 +652,9 @@ static bool obs_init_audio(struct audio_output_info *ai)
 	audio->monitoring_device_name = bstrdup("Default");
 	audio->monitoring_device_id = bstrdup("default");
 
+	if (!obs_init_audio_render_pool(render_threads))
+		return false;
+
 	errorcode = audio_output_open(&audio->audio, ai);
 	if (errorcode == AUDIO_OUTPUT_SUCCESS)
 		return true;
@@ -576,6 +675,8 @@ static void obs_free_audio(void)
 	circlebuf_free(&audio->buffered_timestamps);
 	da_free(audio->render_order);
 	da_free(audio->root_nodes);
+	da_free(audio->parallel_sources);
+	os_task_pool_destroy(audio->render_pool);
 
 	da_free(audio->monitors);
 	bfree(audio->monitoring_device_name);
@@ -664,6 +765,11 @@ static void obs_free_data(void)
 	FREE_OBS_LINKED_LIST(display);
 	FREE_OBS_LINKED_LIST(service);
 
+	bfree(data->source_index.buckets);
+	bfree(data->output_index.buckets);
+	bfree(data->encoder_index.buckets);
+	bfree(data->service_index.buckets);
+
 	pthread_mutex_destroy(&data->sources_mutex);
 	pthread_mutex_destroy(&data->audio_sources_mutex);
 	pthread_mutex_destroy(&data->displays_mutex);
@@ -1164,7 +1270,7 @@ bool obs_reset_audio(const struct obs_audio_info *oai)
 	     "\tspeakers:        %d",
 	     (int)ai.samples_per_sec, (int)ai.speakers);
 
-	return obs_init_audio(&ai);
+	return obs_init_audio(&ai, oai->render_threads);
 }
 
 bool obs_get_video_info(struct obs_video_info *ovi)
@@ -1190,6 +1296,7 @@ bool obs_get_audio_info(struct obs_audio_info *oai)
 
 	oai->samples_per_sec = info->samples_per_sec;
 	oai->speakers = info->speakers;
+	oai->render_threads = audio->render_threads;
 	return true;
 }
 
@@ -1502,22 +1609,26 @@ void obs_enum_services(bool (*enum_proc)(void *, obs_service_t *), void *param)
 		 param);
 }
 
-static inline void *get_context_by_name(void *vfirst, const char *name,
+static inline void *get_context_by_name(struct obs_context_index *index,
+					const char *name,
 					pthread_mutex_t *mutex,
 					void *(*addref)(void *))
 {
-	struct obs_context_data **first = vfirst;
-	struct obs_context_data *context;
+	struct obs_context_data *context = NULL;
+	uint32_t hash = calc_fnv1a(name);
 
 	pthread_mutex_lock(mutex);
 
-	context = *first;
+	if (index->num_buckets)
+		context = index->buckets[hash & (index->num_buckets - 1)];
+
 	while (context) {
-		if (!context->private && strcmp(context->name, name) == 0) {
+		if (context->name_hash == hash &&
+		    strcmp(context->name, name) == 0) {
 			context = addref(context);
 			break;
 		}
-		context = context->next;
+		context = context->hash_next;
 	}
 
 	pthread_mutex_unlock(mutex);
@@ -1553,7 +1664,7 @@ obs_source_t *obs_get_source_by_name(const char *name)
 {
 	if (!obs)
 		return NULL;
-	return get_context_by_name(&obs->data.first_source, name,
+	return get_context_by_name(&obs->data.source_index, name,
 				   &obs->data.sources_mutex,
 				   obs_source_addref_safe_);
 }
@@ -1562,7 +1673,7 @@ obs_output_t *obs_get_output_by_name(const char *name)
 {
 	if (!obs)
 		return NULL;
-	return get_context_by_name(&obs->data.first_output, name,
+	return get_context_by_name(&obs->data.output_index, name,
 				   &obs->data.outputs_mutex,
 				   obs_output_addref_safe_);
 }
@@ -1571,7 +1682,7 @@ obs_encoder_t *obs_get_encoder_by_name(const char *name)
 {
 	if (!obs)
 		return NULL;
-	return get_context_by_name(&obs->data.first_encoder, name,
+	return get_context_by_name(&obs->data.encoder_index, name,
 				   &obs->data.encoders_mutex,
 				   obs_encoder_addref_safe_);
 }
@@ -1580,7 +1691,7 @@ obs_service_t *obs_get_service_by_name(const char *name)
 {
 	if (!obs)
 		return NULL;
-	return get_context_by_name(&obs->data.first_service, name,
+	return get_context_by_name(&obs->data.service_index, name,
 				   &obs->data.services_mutex,
 				   obs_service_addref_safe_);
 }
@@ -2075,50 +2186,193 @@ void obs_context_data_free(struct obs_context_data *context)
 	memset(context, 0, sizeof(*context));
 }
 
+/* if several contexts have the same name, the one that comes first in the
+ * list is found, like when contexts were looked up by walking the list.  so
+ * contexts with the same name are kept in list order in their bucket */
+
+static inline void context_index_link_at(struct obs_context_data **prev_next,
+					 struct obs_context_data *context)
+{
+	context->hash_prev_next = prev_next;
+	context->hash_next = *prev_next;
+	*prev_next = context;
+	if (context->hash_next)
+		context->hash_next->hash_prev_next = &context->hash_next;
+}
+
+static inline bool same_name(struct obs_context_data *a,
+			     struct obs_context_data *b)
+{
+	return a->name_hash == b->name_hash && strcmp(a->name, b->name) == 0;
+}
+
+/* links the context in front of the first context with the same name that
+ * comes after it in the list, or behind the last one if none does.  the
+ * list only has to be walked if the name is already taken */
+static void context_index_link(struct obs_context_index *index,
+			       struct obs_context_data *context)
+{
+	struct obs_context_data **bucket =
+		&index->buckets[context->name_hash & (index->num_buckets - 1)];
+	struct obs_context_data *last = NULL;
+
+	for (struct obs_context_data *c = *bucket; c; c = c->hash_next) {
+		if (same_name(c, context))
+			last = c;
+	}
+
+	if (!last) {
+		context_index_link_at(bucket, context);
+		return;
+	}
+
+	for (struct obs_context_data *c = context->next; c; c = c->next) {
+		if (c->hash_prev_next && same_name(c, context)) {
+			context_index_link_at(c->hash_prev_next, context);
+			return;
+		}
+	}
+
+	context_index_link_at(&last->hash_next, context);
+}
+
+/* contexts are relinked in reverse list order, so that each one is put in
+ * front of the ones that come after it without walking the list */
+static void context_index_grow(struct obs_context_index *index)
+{
+	DARRAY(struct obs_context_data *) contexts;
+
+	da_init(contexts);
+	for (struct obs_context_data *context = *index->first; context;
+	     context = context->next) {
+		if (context->hash_prev_next)
+			da_push_back(contexts, &context);
+	}
+
+	bfree(index->buckets);
+	index->num_buckets = index->num_buckets ? index->num_buckets * 2 : 64;
+	index->buckets = bzalloc(index->num_buckets *
+				 sizeof(struct obs_context_data *));
+
+	for (size_t i = contexts.num; i > 0; i--) {
+		struct obs_context_data *context = contexts.array[i - 1];
+		size_t bucket = context->name_hash & (index->num_buckets - 1);
+
+		context_index_link_at(&index->buckets[bucket], context);
+	}
+
+	da_free(contexts);
+}
+
+/* the mutex of the list the context is in must be held */
+static void context_index_add(struct obs_context_data *context)
+{
+	struct obs_context_index *index = context->index;
+
+	if (!index || context->private || !context->name)
+		return;
+
+	if (index->count >= index->num_buckets)
+		context_index_grow(index);
+
+	context->name_hash = calc_fnv1a(context->name);
+	context_index_link(index, context);
+	index->count++;
+}
+
+static void context_index_remove(struct obs_context_data *context)
+{
+	if (!context->hash_prev_next)
+		return;
+
+	*context->hash_prev_next = context->hash_next;
+	if (context->hash_next)
+		context->hash_next->hash_prev_next = context->hash_prev_next;
+
+	context->hash_next = NULL;
+	context->hash_prev_next = NULL;
+	context->index->count--;
+}
+
 void obs_context_data_insert(struct obs_context_data *context,
-			     pthread_mutex_t *mutex, void *pfirst)
+			     pthread_mutex_t *mutex, void *pfirst,
+			     struct obs_context_index *index)
 {
 	struct obs_context_data **first = pfirst;
 
 	assert(context);
 	assert(mutex);
 	assert(first);
+	assert(index);
 
 	context->mutex = mutex;
+	context->index = index;
 
 	pthread_mutex_lock(mutex);
+	index->first = first;
 	context->prev_next = first;
 	context->next = *first;
 	*first = context;
 	if (context->next)
 		context->next->prev_next = &context->next;
+	context_index_add(context);
 	pthread_mutex_unlock(mutex);
 }
 
 void obs_context_data_remove(struct obs_context_data *context)
 {
 	if (context && context->mutex) {
-		pthread_mutex_lock(context->mutex);
+		pthread_mutex_t *mutex = context->mutex;
+
+		pthread_mutex_lock(mutex);
 		if (context->prev_next)
 			*context->prev_next = context->next;
 		if (context->next)
 			context->next->prev_next = context->prev_next;
-		pthread_mutex_unlock(context->mutex);
+		context->prev_next = NULL;
+		context_index_remove(context);
+		pthread_mutex_unlock(mutex);
 
-		context->mutex = NULL;
+		os_atomic_set_ptr((void *volatile *)&context->mutex, NULL);
 	}
 }
 
+/* the list mutex is locked first, since enumeration callbacks may rename
+ * contexts while it's held.  the context may be removed from its list
+ * before the mutex is locked, in which case it's no longer indexed */
 void obs_context_data_setname(struct obs_context_data *context,
 			      const char *name)
 {
+	pthread_mutex_t *mutex = os_atomic_load_ptr(
+		(void *const volatile *)&context->mutex);
+	bool indexed = false;
+
+	if (mutex) {
+		pthread_mutex_lock(mutex);
+
+		if (context->mutex != mutex || !context->prev_next) {
+			pthread_mutex_unlock(mutex);
+			mutex = NULL;
+		}
+	}
+
 	pthread_mutex_lock(&context->rename_cache_mutex);
 
+	if (mutex && context->hash_prev_next) {
+		context_index_remove(context);
+		indexed = true;
+	}
+
 	if (context->name)
 		da_push_back(context->rename_cache, &context->name);
 	context->name = dup_name(name, context->private);
 
+	if (indexed)
+		context_index_add(context);
+
 	pthread_mutex_unlock(&context->rename_cache_mutex);
+	if (mutex)
+		pthread_mutex_unlock(mutex);
 }
 
 profiler_name_store_t *obs_get_profiler_name_store(void)
@@ -2129,6 +2383,19 @@ profiler_name_store_t *obs_get_profiler_name_store(void)
 	return obs->name_store;
 }
 
+void obs_enable_source_perf_stats(bool enable)
+{
+	if (!obs)
+		return;
+
+	os_atomic_set_bool(&obs->data.source_perf_stats, enable);
+}
+
+bool obs_source_perf_stats_enabled(void)
+{
+	return obs ? os_atomic_load_bool(&obs->data.source_perf_stats) : false;
+}
+
 uint64_t obs_get_video_frame_time(void)
 {
 	return obs ? obs->video.video_time : 0;
@@ -2297,6 +2564,20 @@ uint32_t obs_get_lagged_frames(void)
 	return obs ? obs->video.lagged_frames : 0;
 }
 
+uint32_t obs_get_staging_surface_count(void)
+{
+	return obs ? (uint32_t)obs->video.num_textures : 0;
+}
+
+uint64_t obs_get_staging_latency_ns(void)
+{
+	if (!obs || !obs->video.video)
+		return 0;
+
+	return (uint64_t)(obs->video.num_textures - 1) *
+	       video_output_get_frame_time(obs->video.video);
+}
+
 void start_raw_video(video_t *v, const struct video_scale_info *conversion,
 		     void (*callback)(void *param, struct video_data *frame),
 		     void *param)
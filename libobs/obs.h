@@ -177,16 +177,59 @@ struct obs_video_info {
 	enum video_range_type range;      /**< YUV range (if YUV) */
 
 	enum obs_scale_type scale_type; /**< How to scale if scaling */
+
+	/**
+	 * Number of threads to use for CPU color conversion when
+	 * gpu_conversion is disabled (0 or 1 to convert on the graphics
+	 * thread only)
+	 */
+	uint32_t conversion_threads;
+
+	/**
+	 * Outputs raw video to each connected encoder/output on its own
+	 * thread, so that a slow consumer only drops its own frames
+	 */
+	bool threaded_video_inputs;
+
+	/**
+	 * Number of frames the video output can queue for encoders (0 for
+	 * the default of 6, at most MAX_VIDEO_CACHE_SIZE)
+	 */
+	uint32_t cache_size;
+
+	/**
+	 * Number of staging surfaces frames are downloaded through (0 for
+	 * the default of 2, at most MAX_STAGING_SURFACES).  Each additional
+	 * surface adds one frame of latency to raw outputs, but gives the GPU
+	 * more time to finish copying before a surface is mapped.
+	 */
+	uint32_t staging_surfaces;
+
+	/**
+	 * Adds staging surfaces at runtime (up to MAX_STAGING_SURFACES) when
+	 * mapping a staging surface keeps stalling the graphics thread
+	 */
+	bool adaptive_staging;
 };
 
+#define MAX_STAGING_SURFACES 8
+
 /**
  * Audio initialization structure
  */
 struct obs_audio_info {
 	uint32_t samples_per_sec;
 	enum speaker_layout speakers;
+
+	/**
+	 * Number of threads to render audio sources with (0 or 1 to render
+	 * on the audio thread only).  Output is identical either way.
+	 */
+	uint32_t render_threads;
 };
 
+#define MAX_AUDIO_RENDER_THREADS 8
+
 /**
  * Sent to source filters via the filter_audio callback to allow filtering of
  * audio data
@@ -731,6 +774,12 @@ EXPORT uint64_t obs_get_average_frame_time_ns(void);
 EXPORT uint32_t obs_get_total_frames(void);
 EXPORT uint32_t obs_get_lagged_frames(void);
 
+/** Gets the current number of staging surfaces used to download frames */
+EXPORT uint32_t obs_get_staging_surface_count(void);
+
+/** Gets the latency the staging surfaces add to raw video outputs */
+EXPORT uint64_t obs_get_staging_latency_ns(void);
+
 EXPORT bool obs_nv12_tex_active(void);
 
 EXPORT void obs_apply_private_data(obs_data_t *settings);
@@ -1171,6 +1220,21 @@ EXPORT void obs_source_output_video(obs_source_t *source,
 EXPORT void obs_source_output_video2(obs_source_t *source,
 				     const struct obs_source_frame2 *frame);
 
+/**
+ * Outputs asynchronous video data without copying it.  libobs takes ownership
+ * of the frame's data and calls release(param) once it's done with it, which
+ * may happen on any thread and while the source's frame lock is held, so the
+ * callback must not call back in to the source.  Every frame is released
+ * before the source's destroy callback is called.
+ *
+ * The planes must use the same line sizes and plane offsets that
+ * obs_source_frame_create would give the frame.  If they do not, the data is
+ * copied as with obs_source_output_video and released immediately.
+ */
+EXPORT void obs_source_output_video_external(
+	obs_source_t *source, const struct obs_source_frame *frame,
+	void (*release)(void *param), void *param);
+
 /**
  * Preloads asynchronous video data to allow instantaneous playback
  *
@@ -1200,6 +1264,55 @@ EXPORT struct obs_source_frame *obs_source_get_frame(obs_source_t *source);
 EXPORT void obs_source_release_frame(obs_source_t *source,
 				     struct obs_source_frame *frame);
 
+struct obs_source_async_stats {
+	/** Frames taken from the source's frame pool */
+	uint64_t pool_hits;
+	/** Frames that had to be allocated because the pool was empty */
+	uint64_t pool_misses;
+	/** Number of times the frame queue filled up and was dropped */
+	uint64_t queue_overflows;
+
+	uint32_t pool_size;
+	uint32_t queued_frames;
+};
+
+/** Gets the async frame pool and queue statistics of a source */
+EXPORT bool obs_source_get_async_stats(obs_source_t *source,
+				       struct obs_source_async_stats *stats);
+
+struct obs_source_perf_counter {
+	uint64_t total_ns;
+	uint64_t count;
+};
+
+struct obs_source_perf_stats {
+	/** The source's video_tick callback */
+	struct obs_source_perf_counter video_tick;
+	/** The source's video_render callback, including anything it renders */
+	struct obs_source_perf_counter video_render;
+	/** The filter's filter_video callback */
+	struct obs_source_perf_counter filter_video;
+	/** The filter's filter_audio callback */
+	struct obs_source_perf_counter filter_audio;
+	/** Uploading async frames to the source's texture */
+	struct obs_source_perf_counter async_upload;
+};
+
+/**
+ * Enables or disables per-source timing.  While enabled, each timed call is
+ * also recorded in the profiler as "<source name>: <callback>".
+ */
+EXPORT void obs_enable_source_perf_stats(bool enable);
+EXPORT bool obs_source_perf_stats_enabled(void);
+
+/**
+ * Gets the time spent in the source's callbacks since timing was first
+ * enabled.  The values are updated from the graphics and audio threads
+ * without locking, so they are only approximate while timing is enabled.
+ */
+EXPORT bool obs_source_get_perf_stats(const obs_source_t *source,
+				      struct obs_source_perf_stats *stats);
+
 /**
  * Default RGB filter handler for generic effect filters.  Processes the
  * filter chain and renders them to texture if needed, then the filter is
@@ -1804,6 +1917,20 @@ EXPORT void obs_output_output_caption_text2(obs_output_t *output,
 #endif
 
 EXPORT float obs_output_get_congestion(obs_output_t *output);
+
+/**
+ * Gets the dynamic bitrate state of an output.  Returns false if the output
+ * does not adjust its bitrate, or dynamic bitrate is not currently active.
+ */
+EXPORT bool obs_output_get_dyn_bitrate(obs_output_t *output,
+				       struct obs_output_dyn_bitrate *state);
+
+/**
+ * Gets the number of encoded packets, and their total size in bytes, that
+ * the output's encoders have produced but not yet delivered to the output.
+ */
+EXPORT void obs_output_get_packet_backlog(const obs_output_t *output,
+					  uint64_t *packets, uint64_t *bytes);
 EXPORT int obs_output_get_connect_time_ms(obs_output_t *output);
 
 EXPORT bool obs_output_reconnecting(const obs_output_t *output);
@@ -14,15 +14,26 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
 #include <stdio.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <unistd.h>
 #include <sys/wait.h>
+#include <errno.h>
 
 #include "bmem.h"
 #include "pipe.h"
 
+extern char **environ;
+
 struct os_process_pipe {
 	bool read_pipe;
 	FILE *file;
+	pid_t pid;
 };
 
 os_process_pipe_t *os_process_pipe_create(const char *cmd_line,
@@ -47,12 +58,97 @@ os_process_pipe_t *os_process_pipe_create(const char *cmd_line,
 	return out;
 }
 
+static bool create_pipe(int fds[2])
+{
+#ifdef __linux__
+	return pipe2(fds, O_CLOEXEC) == 0;
+#else
+	if (pipe(fds) != 0)
+		return false;
+
+	fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+	fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+	return true;
+#endif
+}
+
+/* same as popen, except the given descriptors are inherited by the process
+ * even though they are close-on-exec, so that they can be created that way
+ * and never leak in to any other process */
+os_process_pipe_t *os_process_pipe_create_inherit(const char *cmd_line,
+						  const char *type,
+						  const int *fds,
+						  size_t num_fds)
+{
+	struct os_process_pipe pipe = {0};
+	struct os_process_pipe *out;
+	posix_spawn_file_actions_t actions;
+	char *argv[] = {"sh", "-c", (char *)cmd_line, NULL};
+	int pipe_fds[2];
+	int child_fd;
+	int parent_fd;
+	int ret;
+
+	if (!cmd_line || !type) {
+		return NULL;
+	}
+
+	pipe.read_pipe = *type == 'r';
+
+	if (!create_pipe(pipe_fds)) {
+		return NULL;
+	}
+
+	child_fd = pipe_fds[pipe.read_pipe ? 1 : 0];
+	parent_fd = pipe_fds[pipe.read_pipe ? 0 : 1];
+
+	posix_spawn_file_actions_init(&actions);
+	posix_spawn_file_actions_adddup2(&actions, child_fd,
+					 pipe.read_pipe ? STDOUT_FILENO
+							: STDIN_FILENO);
+
+	/* a dup2 on to the same descriptor clears close-on-exec */
+	for (size_t i = 0; i < num_fds; i++)
+		posix_spawn_file_actions_adddup2(&actions, fds[i], fds[i]);
+
+	ret = posix_spawn(&pipe.pid, "/bin/sh", &actions, NULL, argv,
+			  environ);
+	posix_spawn_file_actions_destroy(&actions);
+	close(child_fd);
+
+	if (ret != 0) {
+		close(parent_fd);
+		return NULL;
+	}
+
+	pipe.file = fdopen(parent_fd, pipe.read_pipe ? "r" : "w");
+	if (!pipe.file) {
+		close(parent_fd);
+		waitpid(pipe.pid, NULL, 0);
+		return NULL;
+	}
+
+	out = bmalloc(sizeof(pipe));
+	*out = pipe;
+	return out;
+}
+
 int os_process_pipe_destroy(os_process_pipe_t *pp)
 {
 	int ret = 0;
 
 	if (pp) {
-		int status = pclose(pp->file);
+		int status = 0;
+
+		if (pp->pid) {
+			fclose(pp->file);
+			while (waitpid(pp->pid, &status, 0) == -1 &&
+			       errno == EINTR)
+				;
+		} else {
+			status = pclose(pp->file);
+		}
+
 		if (WIFEXITED(status))
 			ret = (int)(char)WEXITSTATUS(status);
 		bfree(pp);
@@ -23,6 +23,14 @@ typedef struct os_process_pipe os_process_pipe_t;
 
 EXPORT os_process_pipe_t *os_process_pipe_create(const char *cmd_line,
 						 const char *type);
+#ifndef _WIN32
+/** Same as os_process_pipe_create, except the process also inherits the
+ * given descriptors, even if they are close-on-exec */
+EXPORT os_process_pipe_t *os_process_pipe_create_inherit(const char *cmd_line,
+							 const char *type,
+							 const int *fds,
+							 size_t num_fds);
+#endif
 EXPORT int os_process_pipe_destroy(os_process_pipe_t *pp);
 
 EXPORT size_t os_process_pipe_read(os_process_pipe_t *pp, uint8_t *data,
@@ -18,6 +18,8 @@
 #include <errno.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
 #include <sys/statvfs.h>
 #include <dirent.h>
 #include <stdlib.h>
@@ -407,6 +409,36 @@ int64_t os_get_free_space(const char *path)
 	return ret;
 }
 
+void *os_map_file(const char *path, size_t *size)
+{
+	struct stat st;
+	void *map = NULL;
+	int fd;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+		return NULL;
+
+	if (fstat(fd, &st) == 0 && st.st_size > 0 &&
+	    (uint64_t)st.st_size <= SIZE_MAX) {
+		map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd,
+			   0);
+		if (map == MAP_FAILED)
+			map = NULL;
+		else
+			*size = (size_t)st.st_size;
+	}
+
+	close(fd);
+	return map;
+}
+
+void os_unmap_file(void *map, size_t size)
+{
+	if (map)
+		munmap(map, size);
+}
+
 struct posix_glob_info {
 	struct os_glob_info base;
 	glob_t gl;
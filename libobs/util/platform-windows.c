@@ -452,6 +452,48 @@ int64_t os_get_free_space(const char *path)
 	return -1;
 }
 
+void *os_map_file(const char *path, size_t *size)
+{
+	wchar_t *wpath = NULL;
+	LARGE_INTEGER file_size;
+	HANDLE file, mapping;
+	void *map = NULL;
+
+	if (!os_utf8_to_wcs_ptr(path, 0, &wpath))
+		return NULL;
+
+	file = CreateFileW(wpath, GENERIC_READ, FILE_SHARE_READ, NULL,
+			   OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	bfree(wpath);
+
+	if (file == INVALID_HANDLE_VALUE)
+		return NULL;
+
+	if (GetFileSizeEx(file, &file_size) && file_size.QuadPart > 0 &&
+	    (uint64_t)file_size.QuadPart <= SIZE_MAX) {
+		mapping = CreateFileMappingW(file, NULL, PAGE_READONLY, 0, 0,
+					     NULL);
+		if (mapping) {
+			/* the view keeps the mapping alive */
+			map = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+			CloseHandle(mapping);
+		}
+		if (map)
+			*size = (size_t)file_size.QuadPart;
+	}
+
+	CloseHandle(file);
+	return map;
+}
+
+void os_unmap_file(void *map, size_t size)
+{
+	UNUSED_PARAMETER(size);
+
+	if (map)
+		UnmapViewOfFile(map);
+}
+
 static void make_globent(struct os_globent *ent, WIN32_FIND_DATA *wfd,
 			 const char *pattern)
 {
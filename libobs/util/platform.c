@@ -25,6 +25,17 @@
 #include "bmem.h"
 #include "utf8.h"
 #include "dstr.h"
+#include "threading.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || \
+	defined(__i386__)
+#define PLATFORM_X86 1
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#else
+#define PLATFORM_X86 0
+#endif
 
 FILE *os_wfopen(const wchar_t *path, const char *mode)
 {
@@ -769,3 +780,59 @@ char *os_generate_formatted_filename(const char *extension, bool space,
 
 	return sf.array;
 }
+
+#if PLATFORM_X86
+static bool cpu_avx = false;
+static bool cpu_avx2 = false;
+static pthread_once_t cpu_features_once = PTHREAD_ONCE_INIT;
+
+static void cpu_features_init(void)
+{
+#ifdef _MSC_VER
+	int info[4];
+
+	__cpuid(info, 0);
+	int max_leaf = info[0];
+
+	/* OSXSAVE and AVX, then make sure the OS saves the YMM registers */
+	__cpuid(info, 1);
+	if ((info[2] & 0x18000000) != 0x18000000)
+		return;
+	if ((_xgetbv(0) & 0x6) != 0x6)
+		return;
+
+	cpu_avx = true;
+
+	if (max_leaf >= 7) {
+		__cpuidex(info, 7, 0);
+		cpu_avx2 = (info[1] & (1 << 5)) != 0;
+	}
+#else
+	__builtin_cpu_init();
+	cpu_avx = __builtin_cpu_supports("avx");
+	cpu_avx2 = __builtin_cpu_supports("avx2");
+#endif
+}
+
+bool os_cpu_has_avx(void)
+{
+	pthread_once(&cpu_features_once, cpu_features_init);
+	return cpu_avx;
+}
+
+bool os_cpu_has_avx2(void)
+{
+	pthread_once(&cpu_features_once, cpu_features_init);
+	return cpu_avx2;
+}
+#else
+bool os_cpu_has_avx(void)
+{
+	return false;
+}
+
+bool os_cpu_has_avx2(void)
+{
+	return false;
+}
+#endif
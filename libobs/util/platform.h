@@ -61,6 +61,11 @@ EXPORT bool os_quick_write_mbs_file(const char *path, const char *str,
 EXPORT int64_t os_get_file_size(const char *path);
 EXPORT int64_t os_get_free_space(const char *path);
 
+/** Maps a whole file read-only, returns NULL if it can't be mapped or is
+ * empty.  The file should be replaced rather than rewritten while mapped */
+EXPORT void *os_map_file(const char *path, size_t *size);
+EXPORT void os_unmap_file(void *map, size_t size);
+
 EXPORT size_t os_mbs_to_wcs(const char *str, size_t str_len, wchar_t *dst,
 			    size_t dst_size);
 EXPORT size_t os_utf8_to_wcs(const char *str, size_t len, wchar_t *dst,
@@ -184,6 +189,12 @@ EXPORT void os_breakpoint(void);
 EXPORT int os_get_physical_cores(void);
 EXPORT int os_get_logical_cores(void);
 
+/* CPU instruction set checks, these always return false on CPUs that are not
+ * x86.  the CPU is only queried once, so they are cheap enough to call before
+ * every vectorized loop */
+EXPORT bool os_cpu_has_avx(void);
+EXPORT bool os_cpu_has_avx2(void);
+
 EXPORT uint64_t os_get_sys_free_size(void);
 
 struct os_proc_memory_usage {
@@ -0,0 +1,164 @@
+/*
+ * Copyright (c) 2019 Hugh Bailey <obs.jim@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#include "bmem.h"
+#include "base.h"
+#include "darray.h"
+#include "threading.h"
+#include "profiler.h"
+#include "task-pool.h"
+
+struct os_task_pool {
+	char *name;
+	DARRAY(pthread_t) threads;
+
+	pthread_mutex_t run_mutex;
+	os_sem_t *start_sem;
+	os_event_t *done_event;
+	volatile bool stop;
+
+	os_task_pool_func_t func;
+	void *param;
+	long num_tasks;
+	volatile long next_task;
+	volatile long active;
+};
+
+static inline void run_tasks(struct os_task_pool *pool)
+{
+	long idx;
+
+	while ((idx = os_atomic_inc_long(&pool->next_task) - 1) <
+	       pool->num_tasks)
+		pool->func(pool->param, (size_t)idx);
+}
+
+static void *task_pool_thread(void *param)
+{
+	struct os_task_pool *pool = param;
+
+	os_set_thread_name(pool->name);
+
+	while (os_sem_wait(pool->start_sem) == 0) {
+		if (os_atomic_load_bool(&pool->stop))
+			break;
+
+		run_tasks(pool);
+
+		if (os_atomic_dec_long(&pool->active) == 0)
+			os_event_signal(pool->done_event);
+
+		profile_reenable_thread();
+	}
+
+	return NULL;
+}
+
+os_task_pool_t *os_task_pool_create(const char *name, size_t num_threads)
+{
+	struct os_task_pool *pool = bzalloc(sizeof(struct os_task_pool));
+
+	pool->name = bstrdup(name ? name : "task pool");
+	pthread_mutex_init_value(&pool->run_mutex);
+
+	if (pthread_mutex_init(&pool->run_mutex, NULL) != 0)
+		goto fail;
+	if (os_sem_init(&pool->start_sem, 0) != 0)
+		goto fail;
+	if (os_event_init(&pool->done_event, OS_EVENT_TYPE_AUTO) != 0)
+		goto fail;
+
+	for (size_t i = 0; i < num_threads; i++) {
+		pthread_t thread;
+
+		if (pthread_create(&thread, NULL, task_pool_thread, pool) != 0)
+			goto fail;
+
+		da_push_back(pool->threads, &thread);
+	}
+
+	return pool;
+
+fail:
+	blog(LOG_ERROR, "os_task_pool_create: Failed to create pool '%s'",
+	     pool->name);
+	os_task_pool_destroy(pool);
+	return NULL;
+}
+
+void os_task_pool_destroy(os_task_pool_t *pool)
+{
+	if (!pool)
+		return;
+
+	os_atomic_set_bool(&pool->stop, true);
+	for (size_t i = 0; i < pool->threads.num; i++)
+		os_sem_post(pool->start_sem);
+	for (size_t i = 0; i < pool->threads.num; i++)
+		pthread_join(pool->threads.array[i], NULL);
+
+	da_free(pool->threads);
+	os_event_destroy(pool->done_event);
+	os_sem_destroy(pool->start_sem);
+	pthread_mutex_destroy(&pool->run_mutex);
+	bfree(pool->name);
+	bfree(pool);
+}
+
+size_t os_task_pool_num_threads(const os_task_pool_t *pool)
+{
+	return pool ? pool->threads.num : 0;
+}
+
+void os_task_pool_run(os_task_pool_t *pool, size_t num_tasks,
+		      os_task_pool_func_t func, void *param)
+{
+	size_t wake;
+
+	if (!func || !num_tasks)
+		return;
+
+	if (!pool || !pool->threads.num || num_tasks == 1) {
+		for (size_t i = 0; i < num_tasks; i++)
+			func(param, i);
+		return;
+	}
+
+	pthread_mutex_lock(&pool->run_mutex);
+
+	wake = num_tasks - 1;
+	if (wake > pool->threads.num)
+		wake = pool->threads.num;
+
+	pool->func = func;
+	pool->param = param;
+	pool->num_tasks = (long)num_tasks;
+	os_atomic_set_long(&pool->next_task, 0);
+	os_atomic_set_long(&pool->active, (long)wake + 1);
+	os_event_reset(pool->done_event);
+
+	for (size_t i = 0; i < wake; i++)
+		os_sem_post(pool->start_sem);
+
+	run_tasks(pool);
+
+	/* workers may still be running their last task */
+	if (os_atomic_dec_long(&pool->active) != 0)
+		os_event_wait(pool->done_event);
+
+	pthread_mutex_unlock(&pool->run_mutex);
+}
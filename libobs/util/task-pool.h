@@ -0,0 +1,53 @@
+/*
+ * Copyright (c) 2019 Hugh Bailey <obs.jim@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#pragma once
+
+#include "c99defs.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Task pool
+ *
+ *   A small persistent pool of worker threads used to split a single piece of
+ * work (for example converting the rows of a frame) across multiple cores.
+ * os_task_pool_run blocks until every task has been executed; the calling
+ * thread executes tasks as well, so a pool created with N threads runs up to
+ * N + 1 tasks concurrently.
+ */
+
+struct os_task_pool;
+typedef struct os_task_pool os_task_pool_t;
+
+typedef void (*os_task_pool_func_t)(void *param, size_t idx);
+
+EXPORT os_task_pool_t *os_task_pool_create(const char *name,
+					   size_t num_threads);
+EXPORT void os_task_pool_destroy(os_task_pool_t *pool);
+
+EXPORT size_t os_task_pool_num_threads(const os_task_pool_t *pool);
+
+/** Calls func(param, idx) for every idx in [0, num_tasks) */
+EXPORT void os_task_pool_run(os_task_pool_t *pool, size_t num_tasks,
+			     os_task_pool_func_t func, void *param);
+
+#ifdef __cplusplus
+}
+#endif
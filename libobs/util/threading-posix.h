@@ -26,6 +26,11 @@ static inline long os_atomic_dec_long(volatile long *val)
 	return __sync_sub_and_fetch(val, 1);
 }
 
+static inline long os_atomic_add_long(volatile long *val, long amount)
+{
+	return __sync_add_and_fetch(val, amount);
+}
+
 static inline long os_atomic_set_long(volatile long *ptr, long val)
 {
 	return __sync_lock_test_and_set(ptr, val);
@@ -51,3 +56,13 @@ static inline bool os_atomic_load_bool(const volatile bool *ptr)
 {
 	return __atomic_load_n(ptr, __ATOMIC_SEQ_CST);
 }
+
+static inline void *os_atomic_set_ptr(void *volatile *ptr, void *val)
+{
+	return __atomic_exchange_n(ptr, val, __ATOMIC_SEQ_CST);
+}
+
+static inline void *os_atomic_load_ptr(void *const volatile *ptr)
+{
+	return __atomic_load_n(ptr, __ATOMIC_SEQ_CST);
+}
@@ -28,6 +28,11 @@ static inline long os_atomic_dec_long(volatile long *val)
 	return _InterlockedDecrement(val);
 }
 
+static inline long os_atomic_add_long(volatile long *val, long amount)
+{
+	return _InterlockedExchangeAdd(val, amount) + amount;
+}
+
 static inline long os_atomic_set_long(volatile long *ptr, long val)
 {
 	return (long)_InterlockedExchange((volatile long *)ptr, (long)val);
@@ -53,3 +58,14 @@ static inline bool os_atomic_load_bool(const volatile bool *ptr)
 {
 	return !!_InterlockedOr8((volatile char *)ptr, 0);
 }
+
+static inline void *os_atomic_set_ptr(void *volatile *ptr, void *val)
+{
+	return _InterlockedExchangePointer(ptr, val);
+}
+
+static inline void *os_atomic_load_ptr(void *const volatile *ptr)
+{
+	return _InterlockedCompareExchangePointer((void *volatile *)ptr, NULL,
+						  NULL);
+}
@@ -22,9 +22,21 @@
 
 #endif
 
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <errno.h>
+#include <poll.h>
+#endif
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "ffmpeg-mux.h"
 
 #include <libavformat/avformat.h>
@@ -81,6 +93,8 @@ struct main_params {
 	int fps_den;
 	char *acodec;
 	char *muxer_settings;
+	char *transport;
+	char *status;
 };
 
 struct audio_params {
@@ -105,7 +119,15 @@ struct ffmpeg_mux {
 	struct header *audio_header;
 	int num_audio_streams;
 	bool initialized;
+	char *changed_file;
 	char error[4096];
+
+	/* after a change of file every stream is offset so that the new file
+	 * starts at the time of the keyframe that follows the change, in each
+	 * stream's time base */
+	int64_t *ts_offsets;
+	bool ts_offsets_pending;
+	int status_fd;
 };
 
 static void header_free(struct header *header)
@@ -154,6 +176,14 @@ static void ffmpeg_mux_free(struct ffmpeg_mux *ffm)
 		free(ffm->audio);
 	}
 
+	free(ffm->changed_file);
+	free(ffm->ts_offsets);
+
+#ifndef _WIN32
+	if (ffm->status_fd > 0)
+		close(ffm->status_fd);
+#endif
+
 	memset(ffm, 0, sizeof(*ffm));
 }
 
@@ -259,6 +289,17 @@ static bool init_params(int *argc, char ***argv, struct main_params *params,
 
 	get_opt_str(argc, argv, &params->muxer_settings, "muxer settings");
 
+	while (*argc) {
+		char *opt;
+		get_opt_str(argc, argv, &opt, "transport");
+
+		if (strncmp(opt, FFM_STATUS_PREFIX,
+			    strlen(FFM_STATUS_PREFIX)) == 0)
+			params->status = opt;
+		else
+			params->transport = opt;
+	}
+
 	return true;
 }
 
@@ -404,11 +445,169 @@ static void ffmpeg_mux_header(struct ffmpeg_mux *ffm, uint8_t *data,
 	}
 }
 
+#ifdef __linux__
+/* ------------------------------------------------------------------------- */
+/* shared memory transport, see ffmpeg-mux.h                                 */
+
+struct shm_reader {
+	struct ffm_shm_header *header;
+	uint8_t *ring;
+	size_t ring_size;
+	int data_fd;
+	int space_fd;
+	uint64_t read_pos;
+	bool parent_gone;
+};
+
+static struct shm_reader shm = {0};
+
+static bool shm_open_transport(const char *arg)
+{
+	size_t prefix_len = strlen(FFM_SHM_PREFIX);
+	int mem_fd, ret;
+	void *map;
+
+	if (strncmp(arg, FFM_SHM_PREFIX, prefix_len) != 0 ||
+	    sscanf(arg + prefix_len, "%d:%d:%d", &mem_fd, &shm.data_fd,
+		   &shm.space_fd) != 3) {
+		fprintf(stderr, "Unknown transport '%s'\n", arg);
+		return false;
+	}
+
+	map = mmap(NULL, FFM_SHM_DATA_OFFSET, PROT_READ | PROT_WRITE,
+		   MAP_SHARED, mem_fd, 0);
+	if (map == MAP_FAILED)
+		goto fail;
+
+	shm.ring_size = ((struct ffm_shm_header *)map)->size;
+	munmap(map, FFM_SHM_DATA_OFFSET);
+
+	map = mmap(NULL, FFM_SHM_DATA_OFFSET + shm.ring_size,
+		   PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, mem_fd, 0);
+	if (map == MAP_FAILED)
+		goto fail;
+
+	close(mem_fd);
+	shm.header = map;
+	shm.ring = (uint8_t *)map + FFM_SHM_DATA_OFFSET;
+
+	/* held until the process exits */
+	ret = pthread_mutex_lock(&shm.header->alive_mutex);
+	if (ret == EOWNERDEAD)
+		pthread_mutex_consistent(&shm.header->alive_mutex);
+	else if (ret != 0)
+		goto fail;
+
+	__atomic_store_n(&shm.header->reader_started, 1, __ATOMIC_RELEASE);
+	return true;
+
+fail:
+	fprintf(stderr, "Failed to map shared memory: %s\n", strerror(errno));
+	return false;
+}
+
+static inline size_t shm_available(void)
+{
+	uint64_t write_pos =
+		__atomic_load_n(&shm.header->write_pos, __ATOMIC_ACQUIRE);
+	return (size_t)(write_pos - shm.read_pos);
+}
+
+static void shm_advance(size_t size)
+{
+	shm.read_pos += size;
+	__atomic_store_n(&shm.header->read_pos, shm.read_pos, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&shm.header->writer_waiting, __ATOMIC_SEQ_CST))
+		eventfd_write(shm.space_fd, 1);
+}
+
+/* returns false once there is nothing left to read.  stdin is only watched
+ * for the parent going away without closing the transport */
+static bool shm_wait(void)
+{
+	struct pollfd fds[2] = {{.fd = shm.data_fd, .events = POLLIN},
+				{.fd = fileno(stdin), .events = POLLIN}};
+	struct ffm_shm_header *header = shm.header;
+	bool data = false;
+
+	while (!data) {
+		__atomic_store_n(&header->reader_waiting, 1, __ATOMIC_SEQ_CST);
+		if (shm_available())
+			break;
+		if (__atomic_load_n(&header->closed, __ATOMIC_ACQUIRE) ||
+		    shm.parent_gone)
+			break;
+
+		int ret = poll(fds, shm.parent_gone ? 1 : 2, -1);
+		if (ret < 0 && errno != EINTR)
+			break;
+
+		if (ret > 0 && (fds[0].revents & POLLIN)) {
+			eventfd_t val;
+			eventfd_read(shm.data_fd, &val);
+			data = true;
+		}
+		if (ret > 0 && fds[1].revents)
+			shm.parent_gone = true;
+	}
+
+	__atomic_store_n(&header->reader_waiting, 0, __ATOMIC_RELAXED);
+	return shm_available() > 0;
+}
+
+static size_t shm_read(uint8_t *data, size_t size)
+{
+	size_t total = size;
+
+	while (size > 0) {
+		size_t avail = shm_available();
+		size_t offset = (size_t)(shm.read_pos % shm.ring_size);
+		size_t chunk = size;
+
+		if (!avail) {
+			if (!shm_wait())
+				return 0;
+			continue;
+		}
+
+		if (chunk > avail)
+			chunk = avail;
+		if (chunk > shm.ring_size - offset)
+			chunk = shm.ring_size - offset;
+
+		memcpy(data, shm.ring + offset, chunk);
+		shm_advance(chunk);
+		data += chunk;
+		size -= chunk;
+	}
+
+	return total;
+}
+
+/* packet data that is already complete and doesn't wrap around the end of the
+ * ring is muxed straight from shared memory */
+static inline uint8_t *shm_peek(size_t size)
+{
+	size_t offset = (size_t)(shm.read_pos % shm.ring_size);
+
+	if (shm_available() < size || offset + size > shm.ring_size)
+		return NULL;
+	return shm.ring + offset;
+}
+#endif
+
+/* ------------------------------------------------------------------------- */
+
 static size_t safe_read(void *vdata, size_t size)
 {
 	uint8_t *data = vdata;
 	size_t total = size;
 
+#ifdef __linux__
+	if (shm.header)
+		return shm_read(data, size);
+#endif
+
 	while (size > 0) {
 		size_t in_size = fread(data, 1, size, stdin);
 		if (in_size == 0)
@@ -561,6 +760,17 @@ static int ffmpeg_mux_init_internal(struct ffmpeg_mux *ffm, int argc,
 	if (!init_params(&argc, &argv, &ffm->params, &ffm->audio))
 		return FFM_ERROR;
 
+#ifdef __linux__
+	if (ffm->params.transport && !shm_open_transport(ffm->params.transport))
+		return FFM_ERROR;
+#endif
+
+#ifndef _WIN32
+	if (ffm->params.status)
+		ffm->status_fd = atoi(ffm->params.status +
+				     strlen(FFM_STATUS_PREFIX));
+#endif
+
 	if (ffm->params.tracks) {
 		ffm->audio_header =
 			calloc(1, sizeof(struct header) * ffm->params.tracks);
@@ -612,18 +822,107 @@ static inline AVStream *get_stream(struct ffmpeg_mux *ffm, int idx)
 static inline int64_t rescale_ts(struct ffmpeg_mux *ffm, int64_t val, int idx)
 {
 	AVStream *stream = get_stream(ffm, idx);
+	int64_t offset = ffm->ts_offsets ? ffm->ts_offsets[idx] : 0;
 
 	return av_rescale_q_rnd(val / stream->codec->time_base.num,
 				stream->codec->time_base, stream->time_base,
-				AV_ROUND_NEAR_INF | AV_ROUND_PASS_MINMAX);
+				AV_ROUND_NEAR_INF | AV_ROUND_PASS_MINMAX) -
+	       offset;
+}
+
+/* obs sends the keyframe a new file starts with right after the change */
+static void set_ts_offsets(struct ffmpeg_mux *ffm,
+			   const struct ffm_packet_info *info)
+{
+	AVRational time_base = ffm->video_stream->codec->time_base;
+	int64_t ts = info->dts / time_base.num;
+
+	for (unsigned int i = 0; i < ffm->output->nb_streams; i++)
+		ffm->ts_offsets[i] = av_rescale_q_rnd(
+			ts, time_base, get_stream(ffm, (int)i)->time_base,
+			AV_ROUND_NEAR_INF | AV_ROUND_PASS_MINMAX);
+
+	ffm->ts_offsets_pending = false;
+}
+
+static void report_status(struct ffmpeg_mux *ffm, enum ffm_status status)
+{
+#ifndef _WIN32
+	uint8_t val = (uint8_t)status;
+
+	if (ffm->status_fd > 0 && write(ffm->status_fd, &val, 1) != 1)
+		fprintf(stderr, "Couldn't report status %d\n", (int)status);
+#else
+	(void)ffm;
+	(void)status;
+#endif
+}
+
+/* the next file is opened before the current one is finished, so if it can't
+ * be opened the current file is kept */
+static bool ffmpeg_mux_change_file(struct ffmpeg_mux *ffm, const uint8_t *buf,
+				   uint32_t size)
+{
+	struct ffmpeg_mux prev = *ffm;
+	char *file;
+	int ret;
+
+	if (!size || buf[size - 1] != 0)
+		return false;
+
+	file = malloc(size);
+	memcpy(file, buf, size);
+
+	ffm->output = NULL;
+	ffm->video_stream = NULL;
+	ffm->audio_streams = NULL;
+	ffm->num_audio_streams = 0;
+	ffm->params.file = file;
+
+	ret = ffmpeg_mux_init_context(ffm);
+	if (ret != FFM_SUCCESS) {
+		fprintf(stderr, "Couldn't change to file '%s'\n", file);
+
+		ffm->output = prev.output;
+		ffm->video_stream = prev.video_stream;
+		ffm->audio_streams = prev.audio_streams;
+		ffm->num_audio_streams = prev.num_audio_streams;
+		ffm->params.file = prev.params.file;
+		free(file);
+		return false;
+	}
+
+	av_write_trailer(prev.output);
+	free_avformat(&prev);
+
+	free(ffm->changed_file);
+	ffm->changed_file = file;
+
+	free(ffm->ts_offsets);
+	ffm->ts_offsets = calloc(ffm->output->nb_streams, sizeof(int64_t));
+	ffm->ts_offsets_pending = ffm->video_stream != NULL;
+	return true;
 }
 
 static inline bool ffmpeg_mux_packet(struct ffmpeg_mux *ffm, uint8_t *buf,
 				     struct ffm_packet_info *info)
 {
-	int idx = get_index(ffm, info);
+	int idx;
 	AVPacket packet = {0};
 
+	if (info->type == FFM_PACKET_CHANGE_FILE) {
+		bool success = ffmpeg_mux_change_file(ffm, buf, info->size);
+
+		report_status(ffm, success ? FFM_STATUS_FILE_CHANGED
+					   : FFM_STATUS_FILE_CHANGE_FAILED);
+		return success;
+	}
+
+	if (ffm->ts_offsets_pending && info->type == FFM_PACKET_VIDEO)
+		set_ts_offsets(ffm, info);
+
+	idx = get_index(ffm, info);
+
 	/* The muxer might not support video/audio, or multiple audio tracks */
 	if (idx == -1) {
 		return true;
@@ -686,6 +985,14 @@ int main(int argc, char *argv[])
 	}
 
 	while (!fail && safe_read(&info, sizeof(info)) == sizeof(info)) {
+#ifdef __linux__
+		uint8_t *data = shm.header ? shm_peek(info.size) : NULL;
+		if (data) {
+			ffmpeg_mux_packet(&ffm, data, &info);
+			shm_advance(info.size);
+			continue;
+		}
+#endif
 		resize_buf_resize(&rb, info.size);
 
 		if (safe_read(rb.buf, info.size) == info.size) {
@@ -18,9 +18,26 @@
 
 #include <stdint.h>
 
+#ifdef __linux__
+#include <pthread.h>
+#endif
+
 enum ffm_packet_type {
 	FFM_PACKET_VIDEO,
 	FFM_PACKET_AUDIO,
+	FFM_PACKET_CHANGE_FILE, /* data is the path of the next file */
+};
+
+/*
+ * If it is given a "status:<fd>" argument after the muxer settings, the muxer
+ * writes one of these bytes to that pipe for each FFM_PACKET_CHANGE_FILE,
+ * once it has opened the next file or failed to.  Not available on windows.
+ */
+#define FFM_STATUS_PREFIX "status:"
+
+enum ffm_status {
+	FFM_STATUS_FILE_CHANGED = 1,
+	FFM_STATUS_FILE_CHANGE_FAILED,
 };
 
 #define FFM_SUCCESS 0
@@ -35,3 +52,34 @@ struct ffm_packet_info {
 	enum ffm_packet_type type;
 	bool keyframe;
 };
+
+#ifdef __linux__
+/*
+ * Shared memory transport.  Instead of writing to the muxer's stdin, packets
+ * (the same ffm_packet_info + data stream) are written to a ring buffer in a
+ * memfd that follows this header.  Each side sets its *_waiting flag before
+ * blocking, and the other side only signals the matching eventfd when that
+ * flag is set.  The muxer holds alive_mutex while it runs, so the writer can
+ * tell if it has exited.
+ *
+ * The muxer is told to use it with a last argument of
+ * "shm:<memfd>:<data eventfd>:<space eventfd>".
+ */
+
+#define FFM_SHM_PREFIX "shm:"
+#define FFM_SHM_RING_SIZE (32 * 1024 * 1024)
+
+struct ffm_shm_header {
+	pthread_mutex_t alive_mutex;
+	uint64_t write_pos;
+	uint64_t read_pos;
+	uint32_t size;
+	uint32_t writer_waiting;
+	uint32_t reader_waiting;
+	uint32_t reader_started;
+	uint32_t closed;
+};
+
+#define FFM_SHM_DATA_OFFSET \
+	((sizeof(struct ffm_shm_header) + 63) & ~(size_t)63)
+#endif
@@ -0,0 +1,298 @@
+#ifdef __linux__
+#include <util/base.h>
+#include <util/bmem.h>
+#include <util/platform.h>
+#include "obs-ffmpeg-mux-shm.h"
+
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <poll.h>
+#include <unistd.h>
+#include <errno.h>
+
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC 0x0001U
+#endif
+
+/* how long ffmpeg-mux gets to start reading before it is considered dead */
+#define START_TIMEOUT_NS 10000000000ULL
+
+/* how often the process is checked while waiting for space in the ring, it
+ * is also checked before every packet */
+#define WAIT_TIMEOUT_MS 100
+
+/* ffmpeg-mux only writes to a file, so rather than waking it up for every
+ * packet it is left to sleep until this much data is pending */
+#define WAKE_THRESHOLD (FFM_SHM_RING_SIZE / 8)
+
+struct mux_shm {
+	struct ffm_shm_header *header;
+	uint8_t *ring;
+	size_t map_size;
+
+	int mem_fd;
+	int data_fd;
+	int space_fd;
+
+	uint64_t write_pos;
+	uint64_t start_time;
+	bool failed;
+};
+
+static int create_memfd(void)
+{
+#ifdef SYS_memfd_create
+	return (int)syscall(SYS_memfd_create, "obs-ffmpeg-mux", MFD_CLOEXEC);
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+static bool init_alive_mutex(struct ffm_shm_header *header)
+{
+	pthread_mutexattr_t attr;
+	int ret;
+
+	if (pthread_mutexattr_init(&attr) != 0)
+		return false;
+
+	pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+	pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+	ret = pthread_mutex_init(&header->alive_mutex, &attr);
+	pthread_mutexattr_destroy(&attr);
+	return ret == 0;
+}
+
+/* the descriptors are close-on-exec from the start, so that no other process
+ * started meanwhile can inherit them.  ffmpeg-mux is made to inherit them
+ * explicitly, see mux_shm_get_fds */
+struct mux_shm *mux_shm_create(void)
+{
+	struct mux_shm *shm = bzalloc(sizeof(*shm));
+	void *map;
+
+	shm->mem_fd = -1;
+	shm->data_fd = -1;
+	shm->space_fd = -1;
+	shm->map_size = FFM_SHM_DATA_OFFSET + FFM_SHM_RING_SIZE;
+
+	shm->mem_fd = create_memfd();
+	if (shm->mem_fd == -1)
+		goto fail;
+	if (ftruncate(shm->mem_fd, (off_t)shm->map_size) != 0)
+		goto fail;
+
+	shm->data_fd = eventfd(0, EFD_CLOEXEC);
+	shm->space_fd = eventfd(0, EFD_CLOEXEC);
+	if (shm->data_fd == -1 || shm->space_fd == -1)
+		goto fail;
+
+	map = mmap(NULL, shm->map_size, PROT_READ | PROT_WRITE,
+		   MAP_SHARED | MAP_POPULATE, shm->mem_fd, 0);
+	if (map == MAP_FAILED)
+		goto fail;
+
+	shm->header = map;
+	shm->ring = (uint8_t *)map + FFM_SHM_DATA_OFFSET;
+	shm->header->size = FFM_SHM_RING_SIZE;
+
+	if (!init_alive_mutex(shm->header))
+		goto fail;
+
+	return shm;
+
+fail:
+	blog(LOG_WARNING,
+	     "ffmpeg-mux: Failed to create shared memory (errno %d), "
+	     "falling back to a pipe",
+	     errno);
+	mux_shm_destroy(shm);
+	return NULL;
+}
+
+void mux_shm_destroy(struct mux_shm *shm)
+{
+	if (!shm)
+		return;
+
+	if (shm->header)
+		munmap(shm->header, shm->map_size);
+	if (shm->mem_fd != -1)
+		close(shm->mem_fd);
+	if (shm->data_fd != -1)
+		close(shm->data_fd);
+	if (shm->space_fd != -1)
+		close(shm->space_fd);
+	bfree(shm);
+}
+
+void mux_shm_add_arg(struct mux_shm *shm, struct dstr *cmd)
+{
+	dstr_catf(cmd, FFM_SHM_PREFIX "%d:%d:%d", shm->mem_fd, shm->data_fd,
+		  shm->space_fd);
+}
+
+void mux_shm_get_fds(struct mux_shm *shm, int *fds)
+{
+	fds[0] = shm->mem_fd;
+	fds[1] = shm->data_fd;
+	fds[2] = shm->space_fd;
+}
+
+void mux_shm_process_started(struct mux_shm *shm)
+{
+	shm->start_time = os_gettime_ns();
+}
+
+/* ------------------------------------------------------------------------ */
+
+/* ffmpeg-mux holds the alive mutex for as long as it runs, and the mutex is
+ * robust, so getting hold of it means the process has exited */
+static bool reader_alive(struct mux_shm *shm)
+{
+	struct ffm_shm_header *header = shm->header;
+	int ret;
+
+	if (!__atomic_load_n(&header->reader_started, __ATOMIC_ACQUIRE))
+		return os_gettime_ns() - shm->start_time < START_TIMEOUT_NS;
+
+	ret = pthread_mutex_trylock(&header->alive_mutex);
+	if (ret == EBUSY)
+		return true;
+
+	if (ret == EOWNERDEAD)
+		pthread_mutex_consistent(&header->alive_mutex);
+	if (ret == 0 || ret == EOWNERDEAD)
+		pthread_mutex_unlock(&header->alive_mutex);
+	return false;
+}
+
+static inline void warn_reader_gone(void)
+{
+	blog(LOG_WARNING, "ffmpeg-mux: Process is no longer reading from "
+			  "shared memory");
+}
+
+static inline size_t ring_space(struct mux_shm *shm)
+{
+	uint64_t read_pos =
+		__atomic_load_n(&shm->header->read_pos, __ATOMIC_ACQUIRE);
+	return FFM_SHM_RING_SIZE - (size_t)(shm->write_pos - read_pos);
+}
+
+/* makes written data visible to ffmpeg-mux, and wakes it up if it is waiting
+ * and enough data is pending.  the seq_cst pair on write_pos / reader_waiting
+ * ensures a wakeup can't be missed */
+static void publish(struct mux_shm *shm, bool force)
+{
+	struct ffm_shm_header *header = shm->header;
+
+	__atomic_store_n(&header->write_pos, shm->write_pos, __ATOMIC_SEQ_CST);
+	if (!__atomic_load_n(&header->reader_waiting, __ATOMIC_SEQ_CST))
+		return;
+
+	if (force || FFM_SHM_RING_SIZE - ring_space(shm) >= WAKE_THRESHOLD)
+		eventfd_write(shm->data_fd, 1);
+}
+
+static bool wait_for_space(struct mux_shm *shm)
+{
+	struct ffm_shm_header *header = shm->header;
+	struct pollfd pfd = {.fd = shm->space_fd, .events = POLLIN};
+	bool success = true;
+
+	publish(shm, true);
+
+	for (;;) {
+		__atomic_store_n(&header->writer_waiting, 1, __ATOMIC_SEQ_CST);
+		if (ring_space(shm))
+			break;
+
+		if (!reader_alive(shm)) {
+			warn_reader_gone();
+			success = false;
+			break;
+		}
+
+		int ret = poll(&pfd, 1, WAIT_TIMEOUT_MS);
+		if (ret > 0) {
+			eventfd_t val;
+			eventfd_read(shm->space_fd, &val);
+
+		} else if (ret < 0 && errno != EINTR) {
+			blog(LOG_WARNING, "ffmpeg-mux: poll failed, errno %d",
+			     errno);
+			success = false;
+			break;
+		}
+	}
+
+	__atomic_store_n(&header->writer_waiting, 0, __ATOMIC_RELAXED);
+	return success;
+}
+
+static bool ring_write(struct mux_shm *shm, const uint8_t *data, size_t size)
+{
+	while (size) {
+		size_t space = ring_space(shm);
+		size_t offset = (size_t)(shm->write_pos % FFM_SHM_RING_SIZE);
+		size_t chunk = size;
+
+		if (!space) {
+			if (!wait_for_space(shm))
+				return false;
+			continue;
+		}
+
+		if (chunk > space)
+			chunk = space;
+		if (chunk > FFM_SHM_RING_SIZE - offset)
+			chunk = FFM_SHM_RING_SIZE - offset;
+
+		memcpy(shm->ring + offset, data, chunk);
+		shm->write_pos += chunk;
+		data += chunk;
+		size -= chunk;
+	}
+
+	return true;
+}
+
+/* the packet info and data are published together, so ffmpeg-mux never sees
+ * a partial packet unless it is larger than the ring */
+bool mux_shm_write_packet(struct mux_shm *shm,
+			  const struct ffm_packet_info *info,
+			  const uint8_t *data)
+{
+	if (shm->failed)
+		return false;
+
+	/* it can exit with space left in the ring, which would otherwise
+	 * only be noticed once the ring is full.  this doesn't make a system
+	 * call while the process is running */
+	if (!reader_alive(shm)) {
+		warn_reader_gone();
+		shm->failed = true;
+		return false;
+	}
+
+	if (!ring_write(shm, (const uint8_t *)info, sizeof(*info)) ||
+	    !ring_write(shm, data, info->size)) {
+		shm->failed = true;
+		return false;
+	}
+
+	publish(shm, false);
+	return true;
+}
+
+void mux_shm_close(struct mux_shm *shm)
+{
+	struct ffm_shm_header *header = shm->header;
+
+	__atomic_store_n(&header->closed, 1, __ATOMIC_SEQ_CST);
+	eventfd_write(shm->data_fd, 1);
+}
+#endif
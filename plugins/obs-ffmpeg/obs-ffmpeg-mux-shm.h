@@ -0,0 +1,77 @@
+#pragma once
+
+#include <util/c99defs.h>
+#include <util/dstr.h>
+#include "ffmpeg-mux/ffmpeg-mux.h"
+
+/* shared memory transport to the ffmpeg-mux process, see ffmpeg-mux.h.  on
+ * platforms without it mux_shm_create returns NULL and the pipe is used */
+
+struct mux_shm;
+
+#ifdef __linux__
+extern struct mux_shm *mux_shm_create(void);
+extern void mux_shm_destroy(struct mux_shm *shm);
+
+/** Appends the command line argument that tells ffmpeg-mux to use it */
+extern void mux_shm_add_arg(struct mux_shm *shm, struct dstr *cmd);
+
+#define MUX_SHM_NUM_FDS 3
+
+/** Gets the descriptors ffmpeg-mux has to inherit, MUX_SHM_NUM_FDS of them */
+extern void mux_shm_get_fds(struct mux_shm *shm, int *fds);
+
+/** Called once ffmpeg-mux has been started with the descriptors */
+extern void mux_shm_process_started(struct mux_shm *shm);
+
+extern bool mux_shm_write_packet(struct mux_shm *shm,
+				 const struct ffm_packet_info *info,
+				 const uint8_t *data);
+
+/** Tells ffmpeg-mux that no more data will be written */
+extern void mux_shm_close(struct mux_shm *shm);
+#else
+static inline struct mux_shm *mux_shm_create(void)
+{
+	return NULL;
+}
+
+static inline void mux_shm_destroy(struct mux_shm *shm)
+{
+	UNUSED_PARAMETER(shm);
+}
+
+static inline void mux_shm_add_arg(struct mux_shm *shm, struct dstr *cmd)
+{
+	UNUSED_PARAMETER(shm);
+	UNUSED_PARAMETER(cmd);
+}
+
+#define MUX_SHM_NUM_FDS 0
+
+static inline void mux_shm_get_fds(struct mux_shm *shm, int *fds)
+{
+	UNUSED_PARAMETER(shm);
+	UNUSED_PARAMETER(fds);
+}
+
+static inline void mux_shm_process_started(struct mux_shm *shm)
+{
+	UNUSED_PARAMETER(shm);
+}
+
+static inline bool mux_shm_write_packet(struct mux_shm *shm,
+					const struct ffm_packet_info *info,
+					const uint8_t *data)
+{
+	UNUSED_PARAMETER(shm);
+	UNUSED_PARAMETER(info);
+	UNUSED_PARAMETER(data);
+	return false;
+}
+
+static inline void mux_shm_close(struct mux_shm *shm)
+{
+	UNUSED_PARAMETER(shm);
+}
+#endif
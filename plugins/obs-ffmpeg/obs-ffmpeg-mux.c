@@ -15,6 +15,10 @@
     along with this program.  If not, see <http://www.gnu.org/licenses/>.
 ******************************************************************************/
 
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
 #include <obs-module.h>
 #include <obs-hotkey.h>
 #include <obs-avc.h>
@@ -25,9 +29,15 @@
 #include <util/circlebuf.h>
 #include <util/threading.h>
 #include "ffmpeg-mux/ffmpeg-mux.h"
+#include "obs-ffmpeg-replay-spill.h"
+#include "obs-ffmpeg-mux-shm.h"
 
 #ifdef _WIN32
 #include "util/windows/win-version.h"
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
 #endif
 
 #include <libavformat/avformat.h>
@@ -39,9 +49,17 @@
 #define warn(format, ...) do_log(LOG_WARNING, format, ##__VA_ARGS__)
 #define info(format, ...) do_log(LOG_INFO, format, ##__VA_ARGS__)
 
+/* packets to be written by the replay buffer mux thread.  if segment is set,
+ * data points into a spill segment rather than being a packet reference */
+struct replay_packet {
+	struct encoder_packet packet;
+	struct spill_segment *segment;
+};
+
 struct ffmpeg_muxer {
 	obs_output_t *output;
 	os_process_pipe_t *pipe;
+	struct mux_shm *shm;
 	int64_t stop_ts;
 	uint64_t total_bytes;
 	struct dstr path;
@@ -50,6 +68,22 @@ struct ffmpeg_muxer {
 	volatile bool stopping;
 	volatile bool capturing;
 
+	/* recording is split into a new file at the first keyframe past
+	 * split_time, or before split_size would be exceeded going by the size
+	 * of the last keyframe interval.  ffmpeg-mux offsets the timestamps of
+	 * each new file to start at zero, and reports on status_fd whether it
+	 * could open it.  path is only changed to pending_path then */
+	int64_t split_time;
+	int64_t split_size;
+	int64_t file_start_time;
+	int64_t file_size;
+	int64_t gop_size;
+	int64_t last_gop_size;
+	int file_index;
+	struct dstr first_path;
+	struct dstr pending_path;
+	int status_fd;
+
 	/* replay buffer */
 	struct circlebuf packets;
 	int64_t cur_size;
@@ -60,7 +94,25 @@ struct ffmpeg_muxer {
 	int keyframes;
 	obs_hotkey_id hotkey;
 
-	DARRAY(struct encoder_packet) mux_packets;
+	/* packets older than max_ram_time have their data moved to disk.  the
+	 * first spilled_packets packets in the buffer have no data, it's
+	 * described by the spill_refs entries */
+	int64_t max_ram_time;
+	size_t spilled_packets;
+	struct circlebuf spill_refs;
+	struct replay_spill spill;
+	bool spill_failed;
+
+	/* while saving, the mux thread takes references to the first
+	 * save_packets packets and nothing is purged or spilled until it's
+	 * done.  packets_mutex protects pushing to packets meanwhile, and
+	 * cur_size and spill.disk_size from get_buffer_usage */
+	pthread_mutex_t packets_mutex;
+	os_event_t *collected_event;
+	volatile bool collecting;
+	size_t save_packets;
+
+	DARRAY(struct replay_packet) mux_packets;
 	pthread_t mux_thread;
 	bool mux_thread_joinable;
 	volatile bool muxing;
@@ -74,6 +126,13 @@ static const char *ffmpeg_mux_getname(void *type)
 
 static inline void replay_buffer_clear(struct ffmpeg_muxer *stream)
 {
+	if (os_atomic_load_bool(&stream->collecting))
+		os_event_wait(stream->collected_event);
+
+	/* only the replay buffer has packets_mutex */
+	if (stream->collected_event)
+		pthread_mutex_lock(&stream->packets_mutex);
+
 	while (stream->packets.size > 0) {
 		struct encoder_packet pkt;
 		circlebuf_pop_front(&stream->packets, &pkt, sizeof(pkt));
@@ -81,12 +140,75 @@ static inline void replay_buffer_clear(struct ffmpeg_muxer *stream)
 	}
 
 	circlebuf_free(&stream->packets);
+	circlebuf_free(&stream->spill_refs);
+	replay_spill_free(&stream->spill);
+	stream->spilled_packets = 0;
+	stream->spill_failed = false;
+	stream->max_ram_time = 0;
 	stream->cur_size = 0;
 	stream->cur_time = 0;
 	stream->max_size = 0;
 	stream->max_time = 0;
 	stream->save_ts = 0;
 	stream->keyframes = 0;
+
+	if (stream->collected_event)
+		pthread_mutex_unlock(&stream->packets_mutex);
+}
+
+static void close_status_pipe(struct ffmpeg_muxer *stream)
+{
+#ifndef _WIN32
+	if (stream->status_fd != -1)
+		close(stream->status_fd);
+#endif
+	stream->status_fd = -1;
+}
+
+/* the results of changes of file, in the order they were requested */
+static void read_status(struct ffmpeg_muxer *stream)
+{
+#ifndef _WIN32
+	uint8_t status;
+
+	if (stream->status_fd == -1)
+		return;
+
+	while (read(stream->status_fd, &status, 1) == 1) {
+		if (status == FFM_STATUS_FILE_CHANGED) {
+			info("Changed to file '%s'",
+			     stream->pending_path.array);
+			dstr_copy_dstr(&stream->path, &stream->pending_path);
+		} else {
+			warn("Couldn't change to file '%s', still writing "
+			     "'%s'",
+			     stream->pending_path.array, stream->path.array);
+		}
+
+		dstr_free(&stream->pending_path);
+	}
+#else
+	UNUSED_PARAMETER(stream);
+#endif
+}
+
+static int close_pipe(struct ffmpeg_muxer *stream)
+{
+	int ret;
+
+	if (stream->shm)
+		mux_shm_close(stream->shm);
+
+	ret = os_process_pipe_destroy(stream->pipe);
+	stream->pipe = NULL;
+
+	read_status(stream);
+	close_status_pipe(stream);
+	dstr_free(&stream->pending_path);
+
+	mux_shm_destroy(stream->shm);
+	stream->shm = NULL;
+	return ret;
 }
 
 static void ffmpeg_mux_destroy(void *data)
@@ -98,8 +220,14 @@ static void ffmpeg_mux_destroy(void *data)
 		pthread_join(stream->mux_thread, NULL);
 	da_free(stream->mux_packets);
 
-	os_process_pipe_destroy(stream->pipe);
+	if (stream->collected_event) {
+		pthread_mutex_destroy(&stream->packets_mutex);
+		os_event_destroy(stream->collected_event);
+	}
+
+	close_pipe(stream);
 	dstr_free(&stream->path);
+	dstr_free(&stream->first_path);
 	bfree(stream);
 }
 
@@ -256,12 +384,83 @@ static void build_command_line(struct ffmpeg_muxer *stream, struct dstr *cmd,
 	add_muxer_params(cmd, stream);
 }
 
+#ifndef _WIN32
+/* ffmpeg-mux writes a status byte for each change of file to the write end,
+ * OBS reads them without blocking whenever it gets a packet */
+static int create_status_pipe(struct ffmpeg_muxer *stream)
+{
+	int fds[2];
+
+#ifdef __linux__
+	if (pipe2(fds, O_CLOEXEC) != 0)
+		goto fail;
+#else
+	if (pipe(fds) != 0)
+		goto fail;
+	fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+	fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+#endif
+
+	fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+	stream->status_fd = fds[0];
+	return fds[1];
+
+fail:
+	warn("Failed to create status pipe (errno %d), split files won't be "
+	     "checked",
+	     errno);
+	return -1;
+}
+#endif
+
+/* packets go through shared memory where it's available.  the pipe to
+ * ffmpeg-mux's stdin is still opened, so that it can tell if OBS has gone
+ * away, and closing it returns its exit code.  ffmpeg-mux reports errors on
+ * stderr, not through the pipe */
 static inline void start_pipe(struct ffmpeg_muxer *stream, const char *path)
 {
 	struct dstr cmd;
 	build_command_line(stream, &cmd, path);
+
+	stream->status_fd = -1;
+	stream->shm = mux_shm_create();
+
+#ifdef _WIN32
 	stream->pipe = os_process_pipe_create(cmd.array, "w");
+#else
+	int fds[MUX_SHM_NUM_FDS + 1];
+	size_t num_fds = 0;
+	int status_write_fd = -1;
+
+	if (stream->split_time || stream->split_size)
+		status_write_fd = create_status_pipe(stream);
+	if (status_write_fd != -1) {
+		dstr_catf(&cmd, FFM_STATUS_PREFIX "%d ", status_write_fd);
+		fds[num_fds++] = status_write_fd;
+	}
+
+	if (stream->shm) {
+		mux_shm_add_arg(stream->shm, &cmd);
+		mux_shm_get_fds(stream->shm, fds + num_fds);
+		num_fds += MUX_SHM_NUM_FDS;
+	}
+
+	stream->pipe = os_process_pipe_create_inherit(cmd.array, "w", fds,
+						      num_fds);
+
+	if (status_write_fd != -1)
+		close(status_write_fd);
+#endif
+
 	dstr_free(&cmd);
+
+	if (!stream->pipe) {
+		close_status_pipe(stream);
+		mux_shm_destroy(stream->shm);
+		stream->shm = NULL;
+	} else if (stream->shm) {
+		mux_shm_process_started(stream->shm);
+	}
 }
 
 static bool ffmpeg_mux_start(void *data)
@@ -305,6 +504,16 @@ static bool ffmpeg_mux_start(void *data)
 	fclose(test_file);
 	os_unlink(path);
 
+	stream->split_time = obs_data_get_int(settings, "max_time_sec") *
+			     1000000LL;
+	stream->split_size = obs_data_get_int(settings, "max_size_mb") *
+			     (1024 * 1024);
+	stream->file_size = 0;
+	stream->gop_size = 0;
+	stream->last_gop_size = 0;
+	stream->file_index = 0;
+	dstr_copy(&stream->first_path, path);
+
 	start_pipe(stream, path);
 	obs_data_release(settings);
 
@@ -330,8 +539,7 @@ static int deactivate(struct ffmpeg_muxer *stream, int code)
 	int ret = -1;
 
 	if (active(stream)) {
-		ret = os_process_pipe_destroy(stream->pipe);
-		stream->pipe = NULL;
+		ret = close_pipe(stream);
 
 		os_atomic_set_bool(&stream->active, false);
 		os_atomic_set_bool(&stream->sent_headers, false);
@@ -391,11 +599,43 @@ static void signal_failure(struct ffmpeg_muxer *stream)
 	os_atomic_set_bool(&stream->capturing, false);
 }
 
+static bool write_data(struct ffmpeg_muxer *stream,
+		       struct ffm_packet_info *info, const uint8_t *data)
+{
+	size_t ret;
+
+	if (stream->shm) {
+		if (!mux_shm_write_packet(stream->shm, info, data)) {
+			warn("mux_shm_write_packet failed");
+			signal_failure(stream);
+			return false;
+		}
+
+		return true;
+	}
+
+	ret = os_process_pipe_write(stream->pipe, (const uint8_t *)info,
+				    sizeof(*info));
+	if (ret != sizeof(*info)) {
+		warn("os_process_pipe_write for info structure failed");
+		signal_failure(stream);
+		return false;
+	}
+
+	ret = os_process_pipe_write(stream->pipe, data, info->size);
+	if (ret != info->size) {
+		warn("os_process_pipe_write for packet data failed");
+		signal_failure(stream);
+		return false;
+	}
+
+	return true;
+}
+
 static bool write_packet(struct ffmpeg_muxer *stream,
 			 struct encoder_packet *packet)
 {
 	bool is_video = packet->type == OBS_ENCODER_VIDEO;
-	size_t ret;
 
 	struct ffm_packet_info info = {.pts = packet->pts,
 				       .dts = packet->dts,
@@ -405,20 +645,8 @@ static bool write_packet(struct ffmpeg_muxer *stream,
 							: FFM_PACKET_AUDIO,
 				       .keyframe = packet->keyframe};
 
-	ret = os_process_pipe_write(stream->pipe, (const uint8_t *)&info,
-				    sizeof(info));
-	if (ret != sizeof(info)) {
-		warn("os_process_pipe_write for info structure failed");
-		signal_failure(stream);
+	if (!write_data(stream, &info, packet->data))
 		return false;
-	}
-
-	ret = os_process_pipe_write(stream->pipe, packet->data, packet->size);
-	if (ret != packet->size) {
-		warn("os_process_pipe_write for packet data failed");
-		signal_failure(stream);
-		return false;
-	}
 
 	stream->total_bytes += packet->size;
 	return true;
@@ -466,6 +694,87 @@ static bool send_headers(struct ffmpeg_muxer *stream)
 	return true;
 }
 
+static bool should_split(struct ffmpeg_muxer *stream,
+			 struct encoder_packet *packet)
+{
+	if (packet->type != OBS_ENCODER_VIDEO || !packet->keyframe)
+		return false;
+
+	stream->last_gop_size = stream->gop_size;
+	stream->gop_size = 0;
+
+	if (stream->split_time &&
+	    packet->dts_usec - stream->file_start_time >= stream->split_time)
+		return true;
+	if (stream->split_size &&
+	    stream->file_size + stream->last_gop_size > stream->split_size)
+		return true;
+
+	return false;
+}
+
+/* "name.ext" becomes "name_001.ext", skipping names that already exist */
+static void generate_split_path(struct ffmpeg_muxer *stream, struct dstr *dst)
+{
+	const char *path = stream->first_path.array;
+	const char *slash = strrchr(path, '/');
+	const char *ext = strrchr(path, '.');
+#ifdef _WIN32
+	const char *backslash = strrchr(path, '\\');
+	if (backslash > slash)
+		slash = backslash;
+#endif
+
+	if (!ext || (slash && ext < slash))
+		ext = path + stream->first_path.len;
+
+	do {
+		dstr_ncopy(dst, path, ext - path);
+		dstr_catf(dst, "_%03d%s", ++stream->file_index, ext);
+	} while (os_file_exists(dst->array));
+}
+
+/* ffmpeg-mux opens the new file before finishing the current one, and the
+ * keyframe is the first packet written to it.  if it can't open the file it
+ * keeps writing the current one, so the path is only changed once it says
+ * so.  without a status pipe (on windows) it's assumed to have worked */
+static bool change_file(struct ffmpeg_muxer *stream,
+			struct encoder_packet *packet)
+{
+	struct dstr path = {0};
+	struct ffm_packet_info info = {.type = FFM_PACKET_CHANGE_FILE};
+	bool success;
+
+	generate_split_path(stream, &path);
+
+	info.size = (uint32_t)path.len + 1;
+	success = write_data(stream, &info, (const uint8_t *)path.array);
+
+	if (success) {
+		stream->file_start_time = packet->dts_usec;
+		stream->file_size = 0;
+
+		if (stream->status_fd != -1) {
+			dstr_move(&stream->pending_path, &path);
+		} else {
+			info("Changed to file '%s'", path.array);
+			dstr_move(&stream->path, &path);
+		}
+	}
+
+	dstr_free(&path);
+	return success;
+}
+
+static void write_split_packet(struct ffmpeg_muxer *stream,
+			       struct encoder_packet *packet)
+{
+	if (write_packet(stream, packet)) {
+		stream->file_size += (int64_t)packet->size;
+		stream->gop_size += (int64_t)packet->size;
+	}
+}
+
 static void ffmpeg_mux_data(void *data, struct encoder_packet *packet)
 {
 	struct ffmpeg_muxer *stream = data;
@@ -484,6 +793,7 @@ static void ffmpeg_mux_data(void *data, struct encoder_packet *packet)
 			return;
 
 		stream->sent_headers = true;
+		stream->file_start_time = packet->dts_usec;
 	}
 
 	if (stopping(stream)) {
@@ -493,7 +803,14 @@ static void ffmpeg_mux_data(void *data, struct encoder_packet *packet)
 		}
 	}
 
-	write_packet(stream, packet);
+	read_status(stream);
+
+	/* only one change of file is waited on at a time */
+	if (should_split(stream, packet) && !stream->pending_path.array &&
+	    !change_file(stream, packet))
+		return;
+
+	write_split_packet(stream, packet);
 }
 
 static obs_properties_t *ffmpeg_mux_properties(void *unused)
@@ -559,12 +876,38 @@ static void get_last_replay(void *data, calldata_t *cd)
 		calldata_set_string(cd, "path", stream->path.array);
 }
 
+static void get_buffer_usage(void *data, calldata_t *cd)
+{
+	struct ffmpeg_muxer *stream = data;
+	int64_t disk_size;
+	int64_t size;
+
+	pthread_mutex_lock(&stream->packets_mutex);
+	disk_size = (int64_t)stream->spill.disk_size;
+	size = stream->cur_size;
+	pthread_mutex_unlock(&stream->packets_mutex);
+
+	calldata_set_int(cd, "ram_bytes", size - disk_size);
+	calldata_set_int(cd, "disk_bytes", disk_size);
+}
+
 static void *replay_buffer_create(obs_data_t *settings, obs_output_t *output)
 {
 	UNUSED_PARAMETER(settings);
 	struct ffmpeg_muxer *stream = bzalloc(sizeof(*stream));
 	stream->output = output;
 
+	if (pthread_mutex_init(&stream->packets_mutex, NULL) != 0) {
+		bfree(stream);
+		return NULL;
+	}
+	if (os_event_init(&stream->collected_event, OS_EVENT_TYPE_MANUAL) !=
+	    0) {
+		pthread_mutex_destroy(&stream->packets_mutex);
+		bfree(stream);
+		return NULL;
+	}
+
 	stream->hotkey =
 		obs_hotkey_register_output(output, "ReplayBuffer.Save",
 					   obs_module_text("ReplayBuffer.Save"),
@@ -574,6 +917,10 @@ static void *replay_buffer_create(obs_data_t *settings, obs_output_t *output)
 	proc_handler_add(ph, "void save()", save_replay_proc, stream);
 	proc_handler_add(ph, "void get_last_replay(out string path)",
 			 get_last_replay, stream);
+	proc_handler_add(ph,
+			 "void get_buffer_usage(out int ram_bytes, "
+			 "out int disk_bytes)",
+			 get_buffer_usage, stream);
 
 	return stream;
 }
@@ -598,6 +945,10 @@ static bool replay_buffer_start(void *data)
 	obs_data_t *s = obs_output_get_settings(stream->output);
 	stream->max_time = obs_data_get_int(s, "max_time_sec") * 1000000LL;
 	stream->max_size = obs_data_get_int(s, "max_size_mb") * (1024 * 1024);
+	stream->max_ram_time =
+		obs_data_get_int(s, "max_ram_time_sec") * 1000000LL;
+	replay_spill_init(&stream->spill, obs_data_get_string(s, "directory"),
+			  stream);
 	obs_data_release(s);
 
 	os_atomic_set_bool(&stream->active, true);
@@ -615,6 +966,13 @@ static bool purge_front(struct ffmpeg_muxer *stream)
 
 	circlebuf_pop_front(&stream->packets, &pkt, sizeof(pkt));
 
+	if (stream->spilled_packets) {
+		struct spill_ref ref;
+		circlebuf_pop_front(&stream->spill_refs, &ref, sizeof(ref));
+		replay_spill_release(&stream->spill, &ref, pkt.size);
+		stream->spilled_packets--;
+	}
+
 	keyframe = pkt.type == OBS_ENCODER_VIDEO && pkt.keyframe;
 
 	if (keyframe)
@@ -653,6 +1011,9 @@ static inline void purge(struct ffmpeg_muxer *stream)
 static inline void replay_buffer_purge(struct ffmpeg_muxer *stream,
 				       struct encoder_packet *pkt)
 {
+	if (os_atomic_load_bool(&stream->collecting))
+		return;
+
 	if (stream->max_size) {
 		if (!stream->packets.size || stream->keyframes <= 2)
 			return;
@@ -669,41 +1030,199 @@ static inline void replay_buffer_purge(struct ffmpeg_muxer *stream,
 		purge(stream);
 }
 
-static void insert_packet(struct darray *array, struct encoder_packet *packet,
-			  int64_t video_offset, int64_t *audio_offsets,
-			  int64_t video_dts_offset, int64_t *audio_dts_offsets)
+/* moves the data of packets older than max_ram_time to disk */
+static void replay_buffer_spill(struct ffmpeg_muxer *stream, int64_t cur_dts)
 {
-	struct encoder_packet pkt;
-	DARRAY(struct encoder_packet) packets;
-	packets.da = *array;
-	size_t idx;
+	const size_t size = sizeof(struct encoder_packet);
+	size_t num_packets = stream->packets.size / size;
 
-	obs_encoder_packet_ref(&pkt, packet);
+	if (!stream->max_ram_time || stream->spill_failed)
+		return;
+	if (os_atomic_load_bool(&stream->collecting))
+		return;
 
-	if (pkt.type == OBS_ENCODER_VIDEO) {
-		pkt.dts_usec -= video_offset;
-		pkt.dts -= video_dts_offset;
-		pkt.pts -= video_dts_offset;
-	} else {
-		pkt.dts_usec -= audio_offsets[pkt.track_idx];
-		pkt.dts -= audio_dts_offsets[pkt.track_idx];
-		pkt.pts -= audio_dts_offsets[pkt.track_idx];
-	}
+	while (stream->spilled_packets < num_packets) {
+		struct encoder_packet *pkt;
+		struct encoder_packet ram_pkt;
+		struct spill_ref ref;
 
-	for (idx = packets.num; idx > 0; idx--) {
-		struct encoder_packet *p = packets.array + (idx - 1);
-		if (p->dts_usec < pkt.dts_usec)
+		pkt = circlebuf_data(&stream->packets,
+				     stream->spilled_packets * size);
+		if ((cur_dts - pkt->dts_usec) <= stream->max_ram_time)
 			break;
+
+		if (!replay_spill_write(&stream->spill, pkt->data, pkt->size,
+					&ref)) {
+			warn("Failed to move replay buffer data to disk, "
+			     "keeping it in memory instead");
+			stream->spill_failed = true;
+			break;
+		}
+
+		ram_pkt = *pkt;
+		obs_encoder_packet_release(&ram_pkt);
+		pkt->data = NULL;
+
+		circlebuf_push_back(&stream->spill_refs, &ref, sizeof(ref));
+		stream->spilled_packets++;
+	}
+}
+
+/* ------------------------------------------------------------------------ */
+
+/* mux_packets holds the packets in the order they were buffered, which is in
+ * order for each track.  each track's timestamps are offset to start at zero,
+ * so on the mux thread the tracks are merged back into one ordered stream */
+struct replay_track {
+	size_t next;
+	int64_t offset;
+	int64_t dts_offset;
+};
+
+#define REPLAY_TRACKS (MAX_AUDIO_MIXES + 1)
+
+static inline size_t replay_track_idx(const struct encoder_packet *pkt)
+{
+	return pkt->type == OBS_ENCODER_VIDEO ? 0 : pkt->track_idx + 1;
+}
+
+static void replay_track_seek(struct ffmpeg_muxer *stream,
+			      struct replay_track *track, size_t idx,
+			      size_t from)
+{
+	size_t num = stream->mux_packets.num;
+
+	while (from < num &&
+	       replay_track_idx(&stream->mux_packets.array[from].packet) != idx)
+		from++;
+
+	track->next = from;
+}
+
+static inline int64_t replay_track_dts(struct ffmpeg_muxer *stream,
+				       struct replay_track *track)
+{
+	struct encoder_packet *pkt =
+		&stream->mux_packets.array[track->next].packet;
+	return pkt->dts_usec - track->offset;
+}
+
+static void init_replay_tracks(struct ffmpeg_muxer *stream,
+			       struct replay_track *tracks)
+{
+	for (size_t i = 0; i < REPLAY_TRACKS; i++) {
+		struct replay_track *track = &tracks[i];
+		replay_track_seek(stream, track, i, 0);
+
+		if (track->next < stream->mux_packets.num) {
+			struct encoder_packet *pkt =
+				&stream->mux_packets.array[track->next].packet;
+			track->offset = pkt->dts_usec;
+			track->dts_offset = pkt->dts;
+		}
+	}
+}
+
+/* returns the track whose next packet comes first, or NULL when all of them
+ * have been written.  on equal timestamps the packet buffered first goes
+ * first, so the merge is stable: each track is written in the order it was
+ * buffered, and so are packets with the same timestamp on different tracks */
+static struct replay_track *next_replay_track(struct ffmpeg_muxer *stream,
+					      struct replay_track *tracks)
+{
+	struct replay_track *best = NULL;
+	int64_t best_dts = 0;
+
+	for (size_t i = 0; i < REPLAY_TRACKS; i++) {
+		struct replay_track *track = &tracks[i];
+		int64_t dts;
+
+		if (track->next >= stream->mux_packets.num)
+			continue;
+
+		dts = replay_track_dts(stream, track);
+		if (!best || dts < best_dts ||
+		    (dts == best_dts && track->next < best->next)) {
+			best = track;
+			best_dts = dts;
+		}
 	}
 
-	da_insert(packets, idx, &pkt);
-	*array = packets.da;
+	return best;
+}
+
+static void write_replay_packets(struct ffmpeg_muxer *stream)
+{
+	struct replay_track tracks[REPLAY_TRACKS] = {0};
+	struct replay_track *track;
+
+	init_replay_tracks(stream, tracks);
+
+	while ((track = next_replay_track(stream, tracks)) != NULL) {
+		size_t idx = track - tracks;
+		struct encoder_packet pkt =
+			stream->mux_packets.array[track->next].packet;
+
+		pkt.dts_usec -= track->offset;
+		pkt.dts -= track->dts_offset;
+		pkt.pts -= track->dts_offset;
+		write_packet(stream, &pkt);
+
+		replay_track_seek(stream, track, idx, track->next + 1);
+	}
+}
+
+#define COLLECT_CHUNK_PACKETS 1024
+
+/* takes references to the packets being saved a chunk at a time, so that the
+ * packet callback is never held up for long */
+static void collect_replay_packets(struct ffmpeg_muxer *stream)
+{
+	const size_t size = sizeof(struct encoder_packet);
+	size_t num_packets = stream->save_packets;
+	size_t i = 0;
+
+	da_resize(stream->mux_packets, num_packets);
+
+	while (i < num_packets) {
+		size_t end = i + COLLECT_CHUNK_PACKETS;
+		if (end > num_packets)
+			end = num_packets;
+
+		pthread_mutex_lock(&stream->packets_mutex);
+
+		for (; i < end; i++) {
+			struct replay_packet *rp = &stream->mux_packets.array[i];
+			struct encoder_packet *pkt;
+			pkt = circlebuf_data(&stream->packets, i * size);
+
+			if (i < stream->spilled_packets) {
+				struct spill_ref *ref = circlebuf_data(
+					&stream->spill_refs, i * sizeof(*ref));
+
+				rp->packet = *pkt;
+				rp->packet.data =
+					(uint8_t *)spill_ref_data(ref);
+				rp->segment = ref->segment;
+				spill_segment_addref(ref->segment);
+			} else {
+				obs_encoder_packet_ref(&rp->packet, pkt);
+				rp->segment = NULL;
+			}
+		}
+
+		pthread_mutex_unlock(&stream->packets_mutex);
+	}
+
+	os_atomic_set_bool(&stream->collecting, false);
+	os_event_signal(stream->collected_event);
 }
 
 static void *replay_buffer_mux_thread(void *data)
 {
 	struct ffmpeg_muxer *stream = data;
 
+	collect_replay_packets(stream);
 	start_pipe(stream, stream->path.array);
 
 	if (!stream->pipe) {
@@ -717,17 +1236,20 @@ static void *replay_buffer_mux_thread(void *data)
 		goto error;
 	}
 
-	for (size_t i = 0; i < stream->mux_packets.num; i++) {
-		struct encoder_packet *pkt = &stream->mux_packets.array[i];
-		write_packet(stream, pkt);
-		obs_encoder_packet_release(pkt);
-	}
+	write_replay_packets(stream);
 
 	info("Wrote replay buffer to '%s'", stream->path.array);
 
 error:
-	os_process_pipe_destroy(stream->pipe);
-	stream->pipe = NULL;
+	for (size_t i = 0; i < stream->mux_packets.num; i++) {
+		struct replay_packet *rp = &stream->mux_packets.array[i];
+		if (rp->segment)
+			spill_segment_release(rp->segment);
+		else
+			obs_encoder_packet_release(&rp->packet);
+	}
+
+	close_pipe(stream);
 	da_free(stream->mux_packets);
 	os_atomic_set_bool(&stream->muxing, false);
 	return NULL;
@@ -736,42 +1258,11 @@ error:
 static void replay_buffer_save(struct ffmpeg_muxer *stream)
 {
 	const size_t size = sizeof(struct encoder_packet);
-	size_t num_packets = stream->packets.size / size;
 
-	da_reserve(stream->mux_packets, num_packets);
-
-	/* ---------------------------- */
-	/* reorder packets */
-
-	bool found_video = false;
-	bool found_audio[MAX_AUDIO_MIXES] = {0};
-	int64_t video_offset = 0;
-	int64_t video_dts_offset = 0;
-	int64_t audio_offsets[MAX_AUDIO_MIXES] = {0};
-	int64_t audio_dts_offsets[MAX_AUDIO_MIXES] = {0};
-
-	for (size_t i = 0; i < num_packets; i++) {
-		struct encoder_packet *pkt;
-		pkt = circlebuf_data(&stream->packets, i * size);
-
-		if (pkt->type == OBS_ENCODER_VIDEO) {
-			if (!found_video) {
-				video_offset = pkt->dts_usec;
-				video_dts_offset = pkt->dts;
-				found_video = true;
-			}
-		} else {
-			if (!found_audio[pkt->track_idx]) {
-				found_audio[pkt->track_idx] = true;
-				audio_offsets[pkt->track_idx] = pkt->dts_usec;
-				audio_dts_offsets[pkt->track_idx] = pkt->dts;
-			}
-		}
-
-		insert_packet(&stream->mux_packets.da, pkt, video_offset,
-			      audio_offsets, video_dts_offset,
-			      audio_dts_offsets);
-	}
+	/* references are taken on the mux thread */
+	stream->save_packets = stream->packets.size / size;
+	os_event_reset(stream->collected_event);
+	os_atomic_set_bool(&stream->collecting, true);
 
 	/* ---------------------------- */
 	/* generate filename */
@@ -799,6 +1290,13 @@ static void replay_buffer_save(struct ffmpeg_muxer *stream)
 	stream->mux_thread_joinable = pthread_create(&stream->mux_thread, NULL,
 						     replay_buffer_mux_thread,
 						     stream) == 0;
+
+	if (!stream->mux_thread_joinable) {
+		warn("Failed to create replay buffer mux thread");
+		os_atomic_set_bool(&stream->collecting, false);
+		os_event_signal(stream->collected_event);
+		os_atomic_set_bool(&stream->muxing, false);
+	}
 }
 
 static void deactivate_replay_buffer(struct ffmpeg_muxer *stream, int code)
@@ -837,6 +1335,10 @@ static void replay_buffer_data(void *data, struct encoder_packet *packet)
 	}
 
 	obs_encoder_packet_ref(&pkt, packet);
+
+	/* purging and spilling are skipped while the mux thread is
+	 * collecting, so this only holds it up for the push */
+	pthread_mutex_lock(&stream->packets_mutex);
 	replay_buffer_purge(stream, &pkt);
 
 	if (!stream->packets.size)
@@ -848,6 +1350,9 @@ static void replay_buffer_data(void *data, struct encoder_packet *packet)
 	if (packet->type == OBS_ENCODER_VIDEO && packet->keyframe)
 		stream->keyframes++;
 
+	replay_buffer_spill(stream, packet->dts_usec);
+	pthread_mutex_unlock(&stream->packets_mutex);
+
 	if (stream->save_ts && packet->sys_dts_usec >= stream->save_ts) {
 		if (os_atomic_load_bool(&stream->muxing))
 			return;
@@ -866,6 +1371,7 @@ static void replay_buffer_defaults(obs_data_t *s)
 {
 	obs_data_set_default_int(s, "max_time_sec", 15);
 	obs_data_set_default_int(s, "max_size_mb", 500);
+	obs_data_set_default_int(s, "max_ram_time_sec", 0);
 	obs_data_set_default_string(s, "format", "%CCYY-%MM-%DD %hh-%mm-%ss");
 	obs_data_set_default_string(s, "extension", "mp4");
 	obs_data_set_default_bool(s, "allow_spaces", true);
@@ -0,0 +1,263 @@
+#include <inttypes.h>
+#include <util/base.h>
+#include <util/bmem.h>
+#include <util/platform.h>
+#include <util/threading.h>
+#include "obs-ffmpeg-replay-spill.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+
+#define SPILL_SEGMENT_SIZE (64 * 1024 * 1024)
+
+struct spill_segment {
+	volatile long refs;
+	uint8_t *map;
+	size_t size;
+	size_t used;
+	size_t packets;
+
+#ifdef _WIN32
+	HANDLE file;
+	HANDLE mapping;
+#else
+	int fd;
+#endif
+};
+
+/* ------------------------------------------------------------------------ */
+/* segment files                                                            */
+
+#ifdef _WIN32
+
+/* the whole segment is allocated up front, so a full disk is reported here
+ * rather than when writing to the mapping */
+static bool open_segment(struct spill_segment *segment, const char *path)
+{
+	DWORD size_hi = (DWORD)((uint64_t)segment->size >> 32);
+	DWORD size_lo = (DWORD)segment->size;
+	wchar_t *wpath = NULL;
+
+	os_utf8_to_wcs_ptr(path, 0, &wpath);
+	if (!wpath)
+		return false;
+
+	segment->file = CreateFileW(wpath, GENERIC_READ | GENERIC_WRITE, 0,
+				    NULL, CREATE_ALWAYS,
+				    FILE_ATTRIBUTE_TEMPORARY |
+					    FILE_FLAG_DELETE_ON_CLOSE,
+				    NULL);
+	bfree(wpath);
+
+	if (segment->file == INVALID_HANDLE_VALUE)
+		return false;
+
+	segment->mapping = CreateFileMappingW(segment->file, NULL,
+					      PAGE_READWRITE, size_hi, size_lo,
+					      NULL);
+	if (!segment->mapping)
+		return false;
+
+	segment->map = MapViewOfFile(segment->mapping, FILE_MAP_ALL_ACCESS, 0,
+				     0, segment->size);
+	return segment->map != NULL;
+}
+
+static void close_segment(struct spill_segment *segment)
+{
+	if (segment->map)
+		UnmapViewOfFile(segment->map);
+	if (segment->mapping)
+		CloseHandle(segment->mapping);
+	if (segment->file != INVALID_HANDLE_VALUE)
+		CloseHandle(segment->file);
+}
+
+static bool write_segment(struct spill_segment *segment, const uint8_t *data,
+			  size_t size)
+{
+	memcpy(segment->map + segment->used, data, size);
+	return true;
+}
+
+#else
+
+/* the file is unlinked right away so nothing is left behind if the program
+ * exits without cleaning up.  data is written with pwrite so that running
+ * out of disk space is an error rather than a SIGBUS, and only read back
+ * through the mapping */
+static bool open_segment(struct spill_segment *segment, const char *path)
+{
+	void *map;
+
+	segment->fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+	if (segment->fd == -1)
+		return false;
+
+	unlink(path);
+
+	map = mmap(NULL, segment->size, PROT_READ, MAP_SHARED, segment->fd, 0);
+	if (map == MAP_FAILED)
+		return false;
+
+	segment->map = map;
+	return true;
+}
+
+static void close_segment(struct spill_segment *segment)
+{
+	if (segment->map)
+		munmap(segment->map, segment->size);
+	if (segment->fd != -1)
+		close(segment->fd);
+}
+
+static bool write_segment(struct spill_segment *segment, const uint8_t *data,
+			  size_t size)
+{
+	off_t offset = (off_t)segment->used;
+
+	while (size) {
+		ssize_t ret = pwrite(segment->fd, data, size, offset);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return false;
+
+		data += ret;
+		size -= (size_t)ret;
+		offset += ret;
+	}
+
+	return true;
+}
+
+#endif
+
+static struct spill_segment *create_segment(struct replay_spill *spill,
+					    size_t min_size)
+{
+	struct spill_segment *segment = bzalloc(sizeof(*segment));
+	struct dstr path = {0};
+
+	segment->refs = 1;
+	segment->size = min_size > SPILL_SEGMENT_SIZE ? min_size
+						      : SPILL_SEGMENT_SIZE;
+#ifdef _WIN32
+	segment->file = INVALID_HANDLE_VALUE;
+#else
+	segment->fd = -1;
+#endif
+
+	dstr_printf(&path, "%s%" PRIu64 ".tmp", spill->path_prefix.array,
+		    spill->next_id++);
+
+	if (!open_segment(segment, path.array)) {
+		blog(LOG_WARNING, "replay spill: Failed to create '%s'",
+		     path.array);
+		spill_segment_release(segment);
+		segment = NULL;
+	}
+
+	dstr_free(&path);
+	return segment;
+}
+
+void spill_segment_addref(struct spill_segment *segment)
+{
+	os_atomic_inc_long(&segment->refs);
+}
+
+void spill_segment_release(struct spill_segment *segment)
+{
+	if (segment && os_atomic_dec_long(&segment->refs) == 0) {
+		close_segment(segment);
+		bfree(segment);
+	}
+}
+
+const uint8_t *spill_ref_data(const struct spill_ref *ref)
+{
+	return ref->segment->map + ref->offset;
+}
+
+/* ------------------------------------------------------------------------ */
+
+void replay_spill_init(struct replay_spill *spill, const char *dir,
+		       const void *owner)
+{
+	memset(spill, 0, sizeof(*spill));
+
+	dstr_copy(&spill->path_prefix, dir);
+	dstr_replace(&spill->path_prefix, "\\", "/");
+	if (dstr_end(&spill->path_prefix) != '/')
+		dstr_cat_ch(&spill->path_prefix, '/');
+	dstr_catf(&spill->path_prefix, ".obs-replay-spill-%p-", owner);
+}
+
+void replay_spill_free(struct replay_spill *spill)
+{
+	for (size_t i = 0; i < spill->segments.num; i++)
+		spill_segment_release(spill->segments.array[i]);
+
+	da_free(spill->segments);
+	dstr_free(&spill->path_prefix);
+	spill->disk_size = 0;
+}
+
+/* packets are purged oldest first, so only the oldest segments ever become
+ * empty.  the newest segment is kept around to be written to */
+static void trim_segments(struct replay_spill *spill)
+{
+	while (spill->segments.num > 1 && !spill->segments.array[0]->packets) {
+		spill_segment_release(spill->segments.array[0]);
+		da_erase(spill->segments, 0);
+	}
+}
+
+bool replay_spill_write(struct replay_spill *spill, const uint8_t *data,
+			size_t size, struct spill_ref *ref)
+{
+	struct spill_segment *segment = NULL;
+
+	if (spill->segments.num)
+		segment = spill->segments.array[spill->segments.num - 1];
+
+	if (!segment || segment->used + size > segment->size) {
+		segment = create_segment(spill, size);
+		if (!segment)
+			return false;
+
+		da_push_back(spill->segments, &segment);
+		trim_segments(spill);
+	}
+
+	if (!write_segment(segment, data, size)) {
+		blog(LOG_WARNING, "replay spill: Failed to write %zu bytes",
+		     size);
+		return false;
+	}
+
+	ref->segment = segment;
+	ref->offset = segment->used;
+
+	segment->used += size;
+	segment->packets++;
+	spill->disk_size += size;
+	return true;
+}
+
+void replay_spill_release(struct replay_spill *spill,
+			  const struct spill_ref *ref, size_t size)
+{
+	ref->segment->packets--;
+	spill->disk_size -= size;
+	trim_segments(spill);
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <util/c99defs.h>
+#include <util/darray.h>
+#include <util/dstr.h>
+
+/*
+ * Disk storage for replay buffer packet data that has been moved out of RAM.
+ *
+ * Packet data is appended to memory-mapped segment files.  A segment is
+ * deleted once no packet refers to it anymore and nothing else holds a
+ * reference to it, so a replay can be saved from a segment while newer
+ * packets keep being spilled and older ones keep being purged.
+ */
+
+struct spill_segment;
+
+struct spill_ref {
+	struct spill_segment *segment;
+	size_t offset;
+};
+
+struct replay_spill {
+	struct dstr path_prefix;
+	uint64_t next_id;
+	DARRAY(struct spill_segment *) segments;
+	uint64_t disk_size;
+};
+
+extern void replay_spill_init(struct replay_spill *spill, const char *dir,
+			      const void *owner);
+extern void replay_spill_free(struct replay_spill *spill);
+
+/** Appends data to the newest segment, creating a segment if needed */
+extern bool replay_spill_write(struct replay_spill *spill, const uint8_t *data,
+			       size_t size, struct spill_ref *ref);
+
+/** Called when the packet the data belongs to has been purged */
+extern void replay_spill_release(struct replay_spill *spill,
+				 const struct spill_ref *ref, size_t size);
+
+extern const uint8_t *spill_ref_data(const struct spill_ref *ref);
+
+/* keeps a segment mapped after the packets in it have been purged */
+extern void spill_segment_addref(struct spill_segment *segment);
+extern void spill_segment_release(struct spill_segment *segment);
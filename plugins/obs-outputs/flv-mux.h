@@ -21,6 +21,9 @@
 
 #define MILLISECOND_DEN 1000
 
+/* largest audio/video tag body prefix, see flv_tag_body_prefix */
+#define FLV_TAG_BODY_PREFIX_MAX 5
+
 static int32_t get_ms_time(struct encoder_packet *packet, int64_t val)
 {
 	return (int32_t)(val * MILLISECOND_DEN / packet->timebase_den);
@@ -30,5 +33,9 @@ extern void write_file_info(FILE *file, int64_t duration_ms, int64_t size);
 
 extern bool flv_meta_data(obs_output_t *context, uint8_t **output, size_t *size,
 			  bool write_header, size_t audio_idx);
+/* writes the bytes that precede the encoded data in an audio/video tag body
+ * (and RTMP message), returns how many were written */
+extern size_t flv_tag_body_prefix(struct encoder_packet *packet, bool is_header,
+				  uint8_t *prefix);
 extern void flv_packet_mux(struct encoder_packet *packet, int32_t dts_offset,
 			   uint8_t **output, size_t *size, bool is_header);
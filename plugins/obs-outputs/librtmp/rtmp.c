@@ -38,6 +38,13 @@
 #define MSG_NOSIGNAL 0
 #endif
 
+#ifndef _WIN32
+#include <sys/uio.h>
+#endif
+
+/* max buffers handed to the socket per call by RTMPSockBuf_SendV */
+#define RTMP_MAX_IOV 64
+
 #ifdef CRYPTO
 
 #ifdef __APPLE__
@@ -165,6 +172,7 @@ static void HandleClientBW(RTMP *r, const RTMPPacket *packet);
 
 static int ReadN(RTMP *r, char *buffer, int n);
 static int WriteN(RTMP *r, const char *buffer, int n);
+static int WriteV(RTMP *r, const RTMPIOVec *iov, int iovcnt);
 
 static void DecodeTEA(AVal *key, AVal *text);
 
@@ -1711,6 +1719,68 @@ WriteN(RTMP *r, const char *buffer, int n)
     return n == 0;
 }
 
+/* only called by RTMP_SendPacketV, which falls back to WriteN whenever the
+ * data has to be encrypted or wrapped in HTTP */
+static int
+WriteV(RTMP *r, const RTMPIOVec *iov, int iovcnt)
+{
+    if (r->m_bCustomSend)
+    {
+        if (r->m_customSendvFunc)
+            return r->m_customSendvFunc(&r->m_sb, iov, iovcnt, r->m_customSendParam) > 0;
+
+        /* no vectored custom send, so hand the buffers to the custom send
+         * function one at a time through WriteN */
+        for (; iovcnt > 0; iov++, iovcnt--)
+        {
+            if (!WriteN(r, iov->buf, iov->len))
+                return FALSE;
+        }
+        return TRUE;
+    }
+
+    while (iovcnt > 0)
+    {
+        int nBytes = RTMPSockBuf_SendV(&r->m_sb, iov, iovcnt);
+
+        if (nBytes < 0)
+        {
+            int sockerr = GetSockError();
+            RTMP_Log(RTMP_LOGERROR, "%s, RTMP send error %d", __FUNCTION__,
+                     sockerr);
+
+            if (sockerr == EINTR && !RTMP_ctrlC)
+                continue;
+
+            r->last_error_code = sockerr;
+
+            RTMP_Close(r);
+            return FALSE;
+        }
+
+        if (nBytes == 0)
+            return FALSE;
+
+        while (iovcnt > 0 && nBytes >= iov->len)
+        {
+            nBytes -= iov->len;
+            iov++;
+            iovcnt--;
+        }
+
+        /* finish off a partially sent buffer */
+        if (nBytes > 0)
+        {
+            if (!WriteN(r, iov->buf + nBytes, iov->len - nBytes))
+                return FALSE;
+            iov++;
+            iovcnt--;
+        }
+    }
+
+    return TRUE;
+}
+
 #define SAVC(x)	static const AVal av_##x = AVC(#x)
 
 SAVC(app);
@@ -4204,22 +4274,12 @@ RTMP_SendChunk(RTMP *r, RTMPChunk *chunk)
     return wrote;
 }
 
-int
-RTMP_SendPacket(RTMP *r, RTMPPacket *packet, int queue)
+static int
+AllocChannelOut(RTMP *r, int channel)
 {
-    const RTMPPacket *prevPacket;
-    uint32_t last = 0;
-    int nSize;
-    int hSize, cSize;
-    char *header, *hptr, *hend, hbuf[RTMP_MAX_HEADER_SIZE], c;
-    uint32_t t;
-    char *buffer, *tbuf = NULL, *toff = NULL;
-    int nChunkSize;
-    int tlen;
-
-    if (packet->m_nChannel >= r->m_channelsAllocatedOut)
+    if (channel >= r->m_channelsAllocatedOut)
     {
-        int n = packet->m_nChannel + 10;
+        int n = channel + 10;
         RTMPPacket **packets = realloc(r->m_vecChannelsOut, sizeof(RTMPPacket*) * n);
         if (!packets)
         {
@@ -4232,6 +4292,24 @@ RTMP_SendPacket(RTMP *r, RTMPPacket *packet, int queue)
         memset(r->m_vecChannelsOut + r->m_channelsAllocatedOut, 0, sizeof(RTMPPacket*) * (n - r->m_channelsAllocatedOut));
         r->m_channelsAllocatedOut = n;
     }
+    return TRUE;
+}
+
+int
+RTMP_SendPacket(RTMP *r, RTMPPacket *packet, int queue)
+{
+    const RTMPPacket *prevPacket;
+    uint32_t last = 0;
+    int nSize;
+    int hSize, cSize;
+    char *header, *hptr, *hend, hbuf[RTMP_MAX_HEADER_SIZE], c;
+    uint32_t t;
+    char *buffer, *tbuf = NULL, *toff = NULL;
+    int nChunkSize;
+    int tlen;
+
+    if (!AllocChannelOut(r, packet->m_nChannel))
+        return FALSE;
 
     prevPacket = r->m_vecChannelsOut[packet->m_nChannel];
     if (prevPacket && packet->m_headerType != RTMP_PACKET_SIZE_LARGE)
@@ -4421,6 +4499,195 @@ RTMP_SendPacket(RTMP *r, RTMPPacket *packet, int queue)
     return TRUE;
 }
 
+static int
+SendPacketCopy(RTMP *r, RTMPPacket *packet, const RTMPIOVec *body, int nbody)
+{
+    char *ptr;
+    int ret;
+
+    if (!RTMPPacket_Alloc(packet, packet->m_nBodySize))
+        return FALSE;
+
+    ptr = packet->m_body;
+    for (int i = 0; i < nbody; i++)
+    {
+        memcpy(ptr, body[i].buf, body[i].len);
+        ptr += body[i].len;
+    }
+
+    ret = RTMP_SendPacket(r, packet, FALSE);
+    RTMPPacket_Free(packet);
+    return ret;
+}
+
+/* Sends a packet whose body is split across several buffers without copying
+ * it: the chunk headers are kept in small local buffers and sent in between
+ * the body buffers with RTMPSockBuf_SendV (or m_customSendvFunc).  Encrypted
+ * and HTTP connections fall back to RTMP_SendPacket.  Not for invokes, the
+ * method call queue is not updated. */
+int
+RTMP_SendPacketV(RTMP *r, RTMPPacket *packet, const RTMPIOVec *body, int nbody)
+{
+    const RTMPPacket *prevPacket;
+    RTMPIOVec iov[RTMP_MAX_IOV];
+    char hbuf[RTMP_MAX_HEADER_SIZE], cbuf[3];
+    char *hptr, *hend = hbuf + sizeof(hbuf), c;
+    int iovcnt = 0, nSize, cSize = 0, chunkLeft, part = 0, partOffset = 0;
+    uint32_t last = 0, t, total = 0;
+
+    for (int i = 0; i < nbody; i++)
+        total += body[i].len;
+
+    if (total != packet->m_nBodySize)
+    {
+        RTMP_Log(RTMP_LOGERROR, "%s, body size mismatch: %u != %u",
+                 __FUNCTION__, total, packet->m_nBodySize);
+        return FALSE;
+    }
+
+    if ((r->Link.protocol & RTMP_FEATURE_HTTP) ||
+            (r->m_sb.sb_ssl && !(r->m_bCustomSend && r->m_customSendvFunc)))
+        return SendPacketCopy(r, packet, body, nbody);
+#ifdef CRYPTO
+    if (r->Link.rc4keyOut)
+        return SendPacketCopy(r, packet, body, nbody);
+#endif
+
+    if (!AllocChannelOut(r, packet->m_nChannel))
+        return FALSE;
+
+    prevPacket = r->m_vecChannelsOut[packet->m_nChannel];
+    if (prevPacket && packet->m_headerType != RTMP_PACKET_SIZE_LARGE)
+    {
+        /* compress a bit by using the prev packet's attributes */
+        if (prevPacket->m_nBodySize == packet->m_nBodySize
+                && prevPacket->m_packetType == packet->m_packetType
+                && packet->m_headerType == RTMP_PACKET_SIZE_MEDIUM)
+            packet->m_headerType = RTMP_PACKET_SIZE_SMALL;
+
+        if (prevPacket->m_nTimeStamp == packet->m_nTimeStamp
+                && packet->m_headerType == RTMP_PACKET_SIZE_SMALL)
+            packet->m_headerType = RTMP_PACKET_SIZE_MINIMUM;
+        last = prevPacket->m_nTimeStamp;
+    }
+
+    if (packet->m_headerType > 3)	/* sanity */
+    {
+        RTMP_Log(RTMP_LOGERROR, "sanity failed!! trying to send header of type: 0x%02x.",
+                 (unsigned char)packet->m_headerType);
+        return FALSE;
+    }
+
+    nSize = packetSize[packet->m_headerType];
+    t = packet->m_nTimeStamp - last;
+
+    if (packet->m_nChannel > 319)
+        cSize = 2;
+    else if (packet->m_nChannel > 63)
+        cSize = 1;
+
+    /* basic header, same layout as in RTMP_SendPacket */
+    hptr = hbuf;
+    c = packet->m_headerType << 6;
+    switch (cSize)
+    {
+    case 0:
+        c |= packet->m_nChannel;
+        break;
+    case 1:
+        break;
+    case 2:
+        c |= 1;
+        break;
+    }
+    *hptr++ = c;
+    if (cSize)
+    {
+        int tmp = packet->m_nChannel - 64;
+        *hptr++ = tmp & 0xff;
+        if (cSize == 2)
+            *hptr++ = tmp >> 8;
+    }
+
+    if (nSize > 1)
+        hptr = AMF_EncodeInt24(hptr, hend, t > 0xffffff ? 0xffffff : t);
+
+    if (nSize > 4)
+    {
+        hptr = AMF_EncodeInt24(hptr, hend, packet->m_nBodySize);
+        *hptr++ = packet->m_packetType;
+    }
+
+    if (nSize > 8)
+        hptr += EncodeInt32LE(hptr, packet->m_nInfoField2);
+
+    if (nSize > 1 && t >= 0xffffff)
+        hptr = AMF_EncodeInt32(hptr, hend, t);
+
+    /* every continuation chunk uses the same header */
+    cbuf[0] = (0xc0 | c);
+    if (cSize)
+    {
+        int tmp = packet->m_nChannel - 64;
+        cbuf[1] = tmp & 0xff;
+        if (cSize == 2)
+            cbuf[2] = tmp >> 8;
+    }
+
+    iov[iovcnt].buf = hbuf;
+    iov[iovcnt++].len = (int)(hptr - hbuf);
+
+    nSize = packet->m_nBodySize;
+    chunkLeft = r->m_outChunkSize;
+
+    while (nSize > 0)
+    {
+        int len;
+
+        if (iovcnt > RTMP_MAX_IOV - 2)
+        {
+            if (!WriteV(r, iov, iovcnt))
+                return FALSE;
+            iovcnt = 0;
+        }
+
+        if (!chunkLeft)
+        {
+            iov[iovcnt].buf = cbuf;
+            iov[iovcnt++].len = 1 + cSize;
+            chunkLeft = r->m_outChunkSize;
+        }
+
+        len = body[part].len - partOffset;
+        if (len > chunkLeft)
+            len = chunkLeft;
+
+        if (len)
+        {
+            iov[iovcnt].buf = body[part].buf + partOffset;
+            iov[iovcnt++].len = len;
+        }
+
+        partOffset += len;
+        chunkLeft -= len;
+        nSize -= len;
+
+        if (partOffset == body[part].len)
+        {
+            part++;
+            partOffset = 0;
+        }
+    }
+
+    if (iovcnt && !WriteV(r, iov, iovcnt))
+        return FALSE;
+
+    if (!r->m_vecChannelsOut[packet->m_nChannel])
+        r->m_vecChannelsOut[packet->m_nChannel] = malloc(sizeof(RTMPPacket));
+    memcpy(r->m_vecChannelsOut[packet->m_nChannel], packet, sizeof(RTMPPacket));
+    return TRUE;
+}
+
 int
 RTMP_Serve(RTMP *r)
 {
@@ -4527,6 +4794,7 @@ RTMP_Close(RTMP *r)
     memset (&r->m_bindIP, 0, sizeof(r->m_bindIP));
     r->m_bCustomSend = 0;
     r->m_customSendFunc = NULL;
+    r->m_customSendvFunc = NULL;
     r->m_customSendParam = NULL;
 
 #if defined(CRYPTO) || defined(USE_ONLY_MD5)
@@ -4656,6 +4924,48 @@ RTMPSockBuf_Send(RTMPSockBuf *sb, const char *buf, int len)
     return rc;
 }
 
+/* plain sockets only, returns the number of bytes sent, which may end in
+ * the middle of a buffer */
+int
+RTMPSockBuf_SendV(RTMPSockBuf *sb, const RTMPIOVec *iov, int iovcnt)
+{
+#ifdef _WIN32
+    WSABUF vec[RTMP_MAX_IOV];
+    DWORD sent = 0;
+#else
+    struct iovec vec[RTMP_MAX_IOV];
+    struct msghdr msg;
+#endif
+
+    if (iovcnt > RTMP_MAX_IOV)
+        iovcnt = RTMP_MAX_IOV;
+
+    for (int i = 0; i < iovcnt; i++)
+    {
+#if defined(RTMP_NETSTACK_DUMP)
+        fwrite(iov[i].buf, 1, iov[i].len, netstackdump);
+#endif
+#ifdef _WIN32
+        vec[i].buf = (CHAR *)iov[i].buf;
+        vec[i].len = (ULONG)iov[i].len;
+#else
+        vec[i].iov_base = (void *)iov[i].buf;
+        vec[i].iov_len = (size_t)iov[i].len;
+#endif
+    }
+
+#ifdef _WIN32
+    if (WSASend(sb->sb_socket, vec, (DWORD)iovcnt, &sent, 0, NULL, NULL) != 0)
+        return -1;
+    return (int)sent;
+#else
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = vec;
+    msg.msg_iovlen = iovcnt;
+    return (int)sendmsg(sb->sb_socket, &msg, MSG_NOSIGNAL);
+#endif
+}
+
 int
 RTMPSockBuf_Close(RTMPSockBuf *sb)
 {
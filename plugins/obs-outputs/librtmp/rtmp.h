@@ -269,6 +269,14 @@ extern "C"
 
     typedef int (*CUSTOMSEND)(RTMPSockBuf*, const char *, int, void*);
 
+    typedef struct RTMPIOVec
+    {
+        const char *buf;
+        int len;
+    } RTMPIOVec;
+
+    typedef int (*CUSTOMSENDV)(RTMPSockBuf*, const RTMPIOVec *, int, void*);
+
     typedef struct RTMP
     {
         int m_inChunkSize;
@@ -293,6 +301,7 @@ extern "C"
         uint8_t m_bCustomSend;
         void*   m_customSendParam;
         CUSTOMSEND m_customSendFunc;
+        CUSTOMSENDV m_customSendvFunc;
 
         RTMP_BINDINFO m_bindIP;
 
@@ -365,6 +374,8 @@ extern "C"
 
     int RTMP_ReadPacket(RTMP *r, RTMPPacket *packet);
     int RTMP_SendPacket(RTMP *r, RTMPPacket *packet, int queue);
+    int RTMP_SendPacketV(RTMP *r, RTMPPacket *packet, const RTMPIOVec *body,
+                         int nbody);
     int RTMP_SendChunk(RTMP *r, RTMPChunk *chunk);
     int RTMP_IsConnected(RTMP *r);
     SOCKET RTMP_Socket(RTMP *r);
@@ -405,6 +416,7 @@ extern "C"
 
     int RTMPSockBuf_Fill(RTMPSockBuf *sb);
     int RTMPSockBuf_Send(RTMPSockBuf *sb, const char *buf, int len);
+    int RTMPSockBuf_SendV(RTMPSockBuf *sb, const RTMPIOVec *iov, int iovcnt);
     int RTMPSockBuf_Close(RTMPSockBuf *sb);
 
     int RTMP_SendCreateStream(RTMP *r);
@@ -0,0 +1,343 @@
+#ifdef __linux__
+#include "rtmp-stream.h"
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <linux/sockios.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <unistd.h>
+
+/* how often the kernel send queue is checked for congestion */
+#define CONGESTION_INTERVAL_NS 100000000ULL
+
+static void fatal_sock_shutdown(struct rtmp_stream *stream)
+{
+	close(stream->rtmp.m_sb.sb_socket);
+	stream->rtmp.m_sb.sb_socket = -1;
+	stream->write_buf_len = 0;
+	os_event_signal(stream->buffer_space_available_event);
+}
+
+/* congestion is the fill level of our write buffer plus the kernel's send
+ * queue, or full congestion while the kernel is retransmitting */
+static void update_congestion(struct rtmp_stream *stream)
+{
+	int sock = stream->rtmp.m_sb.sb_socket;
+	struct tcp_info tcp_info;
+	socklen_t size;
+	int sndbuf = 0;
+	int outq = 0;
+	float congestion;
+
+	if (ioctl(sock, SIOCOUTQ, &outq) != 0)
+		return;
+
+	size = sizeof(sndbuf);
+	if (getsockopt(sock, SOL_SOCKET, SO_SNDBUF, &sndbuf, &size) != 0 ||
+	    sndbuf <= 0)
+		return;
+
+	pthread_mutex_lock(&stream->write_buf_mutex);
+	congestion = (float)(stream->write_buf_len + (size_t)outq) /
+		     (float)(stream->write_buf_size + (size_t)sndbuf);
+	pthread_mutex_unlock(&stream->write_buf_mutex);
+
+	size = sizeof(tcp_info);
+	if (getsockopt(sock, IPPROTO_TCP, TCP_INFO, &tcp_info, &size) == 0 &&
+	    tcp_info.tcpi_retransmits > 0)
+		congestion = 1.0f;
+
+	if (congestion > 1.0f)
+		congestion = 1.0f;
+
+	os_atomic_set_long(&stream->socket_congestion,
+			   (long)(congestion * SOCKET_CONGESTION_SCALE));
+}
+
+static void log_tcp_info(struct rtmp_stream *stream)
+{
+	struct tcp_info tcp_info;
+	socklen_t size = sizeof(tcp_info);
+
+	if (getsockopt(stream->rtmp.m_sb.sb_socket, IPPROTO_TCP, TCP_INFO,
+		       &tcp_info, &size) != 0)
+		return;
+
+	blog(LOG_INFO,
+	     "socket_thread_linux: rtt %u us (var %u us), "
+	     "cwnd %u, %u total retransmits",
+	     tcp_info.tcpi_rtt, tcp_info.tcpi_rttvar, tcp_info.tcpi_snd_cwnd,
+	     tcp_info.tcpi_total_retrans);
+}
+
+static bool socket_event(struct rtmp_stream *stream, uint32_t events,
+			 bool *can_write, uint64_t last_send_time)
+{
+	if (events & EPOLLOUT)
+		*can_write = true;
+
+	/* incoming data is of no use to us, but with TLS it can't be read off
+	 * the socket from under the TLS layer without breaking the stream.
+	 * it's left queued then, EPOLLET keeps it from waking us again and
+	 * EPOLLRDHUP still reports the connection closing */
+	if ((events & EPOLLIN) && !stream->rtmp.m_sb.sb_ssl) {
+		char discard[16384];
+
+		for (;;) {
+			ssize_t ret = recv(stream->rtmp.m_sb.sb_socket,
+					   discard, sizeof(discard), 0);
+			if (ret > 0)
+				continue;
+			if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+				break;
+
+			/* a closed connection is handled below */
+			if (ret == 0) {
+				events |= EPOLLHUP;
+				break;
+			}
+
+			blog(LOG_ERROR,
+			     "socket_thread_linux: Socket error, recv() "
+			     "returned %d, errno %d",
+			     (int)ret, errno);
+			stream->rtmp.last_error_code = errno;
+			fatal_sock_shutdown(stream);
+			return false;
+		}
+	}
+
+	if (events & (EPOLLERR | EPOLLHUP | EPOLLRDHUP)) {
+		int err_code = 0;
+		socklen_t size = sizeof(err_code);
+
+		getsockopt(stream->rtmp.m_sb.sb_socket, SOL_SOCKET, SO_ERROR,
+			   &err_code, &size);
+
+		if (last_send_time) {
+			uint32_t diff =
+				(os_gettime_ns() / 1000000) - last_send_time;
+
+			blog(LOG_ERROR,
+			     "socket_thread_linux: Received "
+			     "hangup, %u ms since last send "
+			     "(buffer: %d / %d)",
+			     diff, (int)stream->write_buf_len,
+			     (int)stream->write_buf_size);
+		}
+
+		if (os_event_try(stream->stop_event) != EAGAIN)
+			blog(LOG_ERROR,
+			     "socket_thread_linux: Aborting due "
+			     "to hangup during shutdown, "
+			     "%d bytes lost, error %d",
+			     (int)stream->write_buf_len, err_code);
+		else
+			blog(LOG_ERROR,
+			     "socket_thread_linux: Aborting due "
+			     "to hangup, error %d",
+			     err_code);
+
+		stream->rtmp.last_error_code = err_code;
+		fatal_sock_shutdown(stream);
+		return false;
+	}
+
+	return true;
+}
+
+enum data_ret { RET_BREAK, RET_FATAL, RET_CONTINUE };
+
+static enum data_ret write_data(struct rtmp_stream *stream, bool *can_write,
+				uint64_t *last_send_time,
+				size_t latency_packet_size, int delay_time)
+{
+	bool exit_loop = false;
+
+	pthread_mutex_lock(&stream->write_buf_mutex);
+
+	if (!stream->write_buf_len) {
+		pthread_mutex_unlock(&stream->write_buf_mutex);
+		return RET_BREAK;
+	}
+
+	size_t send_len = stream->write_buf_len;
+	if (stream->low_latency_mode && send_len > latency_packet_size)
+		send_len = latency_packet_size;
+
+	int ret = RTMPSockBuf_Send(&stream->rtmp.m_sb,
+				   (const char *)stream->write_buf,
+				   (int)send_len);
+
+	if (ret > 0) {
+		if (stream->write_buf_len - ret)
+			memmove(stream->write_buf, stream->write_buf + ret,
+				stream->write_buf_len - ret);
+		stream->write_buf_len -= ret;
+
+		*last_send_time = os_gettime_ns() / 1000000;
+
+		os_event_signal(stream->buffer_space_available_event);
+
+	} else if (ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+		*can_write = false;
+		pthread_mutex_unlock(&stream->write_buf_mutex);
+		return RET_BREAK;
+
+	} else if (ret < -1) {
+		/* TLS wants to wait for the socket */
+		*can_write = false;
+		pthread_mutex_unlock(&stream->write_buf_mutex);
+		return RET_BREAK;
+
+	} else {
+		int err_code = ret == 0 ? 0 : errno;
+
+		/* connection closed, or connection was aborted /
+		 * socket closed / etc, that's a fatal error. */
+		blog(LOG_ERROR,
+		     "socket_thread_linux: "
+		     "Socket error, send() returned %d, "
+		     "errno %d",
+		     ret, err_code);
+
+		pthread_mutex_unlock(&stream->write_buf_mutex);
+		stream->rtmp.last_error_code = err_code;
+		fatal_sock_shutdown(stream);
+		return RET_FATAL;
+	}
+
+	/* finish writing for now */
+	if (stream->write_buf_len <= 1000)
+		exit_loop = true;
+
+	pthread_mutex_unlock(&stream->write_buf_mutex);
+
+	if (delay_time)
+		os_sleep_ms(delay_time);
+
+	return exit_loop ? RET_BREAK : RET_CONTINUE;
+}
+
+#define LATENCY_FACTOR 20
+
+static inline void socket_thread_linux_internal(struct rtmp_stream *stream)
+{
+	bool can_write = true;
+
+	int delay_time;
+	size_t latency_packet_size;
+	uint64_t last_send_time = 0;
+	uint64_t last_congestion_check = 0;
+
+	struct epoll_event ev;
+	int sock = stream->rtmp.m_sb.sb_socket;
+	int epfd;
+
+	os_set_thread_name("rtmp-stream: socket_thread_linux");
+
+	epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (epfd == -1) {
+		blog(LOG_ERROR,
+		     "socket_thread_linux: Aborting due to "
+		     "epoll_create1 failure, errno %d",
+		     errno);
+		fatal_sock_shutdown(stream);
+		return;
+	}
+
+	/* edge triggered, so EPOLLOUT is only reported again once the socket
+	 * becomes writable after send() returned EAGAIN */
+	ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+	ev.data.fd = sock;
+	epoll_ctl(epfd, EPOLL_CTL_ADD, sock, &ev);
+
+	ev.events = EPOLLIN;
+	ev.data.fd = stream->socket_event_fd;
+	epoll_ctl(epfd, EPOLL_CTL_ADD, stream->socket_event_fd, &ev);
+
+	if (stream->low_latency_mode) {
+		delay_time = 1000 / LATENCY_FACTOR;
+		latency_packet_size =
+			stream->write_buf_size / (LATENCY_FACTOR - 2);
+	} else {
+		latency_packet_size = stream->write_buf_size;
+		delay_time = 0;
+	}
+
+	for (;;) {
+		struct epoll_event events[2];
+		int count;
+
+		if (os_event_try(stream->send_thread_signaled_exit) != EAGAIN) {
+			pthread_mutex_lock(&stream->write_buf_mutex);
+			if (stream->write_buf_len == 0) {
+				pthread_mutex_unlock(&stream->write_buf_mutex);
+				os_event_reset(
+					stream->send_thread_signaled_exit);
+				break;
+			}
+
+			pthread_mutex_unlock(&stream->write_buf_mutex);
+		}
+
+		if (can_write) {
+			for (;;) {
+				enum data_ret ret = write_data(
+					stream, &can_write, &last_send_time,
+					latency_packet_size, delay_time);
+
+				switch (ret) {
+				case RET_BREAK:
+					goto exit_write_loop;
+				case RET_FATAL:
+					goto exit;
+				case RET_CONTINUE:;
+				}
+			}
+		}
+	exit_write_loop:;
+
+		uint64_t now = os_gettime_ns();
+		if (now - last_congestion_check >= CONGESTION_INTERVAL_NS) {
+			update_congestion(stream);
+			last_congestion_check = now;
+		}
+
+		count = epoll_wait(epfd, events, 2,
+				   (int)(CONGESTION_INTERVAL_NS / 1000000));
+		if (count == -1 && errno != EINTR) {
+			blog(LOG_ERROR,
+			     "socket_thread_linux: Aborting due to "
+			     "epoll_wait failure, errno %d",
+			     errno);
+			fatal_sock_shutdown(stream);
+			goto exit;
+		}
+
+		for (int i = 0; i < count; i++) {
+			if (events[i].data.fd == stream->socket_event_fd) {
+				eventfd_t val;
+				eventfd_read(stream->socket_event_fd, &val);
+
+			} else if (!socket_event(stream, events[i].events,
+						 &can_write, last_send_time)) {
+				goto exit;
+			}
+		}
+	}
+
+	log_tcp_info(stream);
+	blog(LOG_INFO, "socket_thread_linux: Normal exit");
+
+exit:
+	close(epfd);
+}
+
+void *socket_thread_linux(void *data)
+{
+	struct rtmp_stream *stream = data;
+	socket_thread_linux_internal(stream);
+	return NULL;
+}
+#endif
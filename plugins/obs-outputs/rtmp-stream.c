@@ -32,6 +32,8 @@ static void log_rtmp(int level, const char *format, va_list args)
 }
 
 static inline size_t num_buffered_packets(struct rtmp_stream *stream);
+static inline bool pop_packet(struct rtmp_stream *stream,
+			      struct encoder_packet *packet);
 
 static inline void free_packets(struct rtmp_stream *stream)
 {
@@ -43,11 +45,10 @@ static inline void free_packets(struct rtmp_stream *stream)
 	if (num_packets)
 		info("Freeing %d remaining packets", (int)num_packets);
 
-	while (stream->packets.size) {
-		struct encoder_packet packet;
-		circlebuf_pop_front(&stream->packets, &packet, sizeof(packet));
+	struct encoder_packet packet;
+	while (pop_packet(stream, &packet))
 		obs_encoder_packet_release(&packet);
-	}
+
 	pthread_mutex_unlock(&stream->packets_mutex);
 }
 
@@ -103,7 +104,13 @@ static void rtmp_stream_destroy(void *data)
 	os_event_destroy(stream->stop_event);
 	os_sem_destroy(stream->send_sem);
 	pthread_mutex_destroy(&stream->packets_mutex);
+	pthread_mutex_destroy(&stream->dbr_mutex);
+	pthread_mutex_destroy(&stream->dbr_update_mutex);
 	circlebuf_free(&stream->packets);
+	circlebuf_free(&stream->dbr_frames);
+	circlebuf_free(&stream->video_idx);
+	for (size_t i = 0; i < OBS_NAL_PRIORITY_HIGHEST; i++)
+		circlebuf_free(&stream->drop_idx[i]);
 #ifdef TEST_FRAMEDROPS
 	circlebuf_free(&stream->droptest_info);
 #endif
@@ -113,6 +120,10 @@ static void rtmp_stream_destroy(void *data)
 	os_event_destroy(stream->socket_available_event);
 	os_event_destroy(stream->send_thread_signaled_exit);
 	pthread_mutex_destroy(&stream->write_buf_mutex);
+#ifdef __linux__
+	if (stream->socket_event_fd != -1)
+		close(stream->socket_event_fd);
+#endif
 
 	if (stream->write_buf)
 		bfree(stream->write_buf);
@@ -124,6 +135,11 @@ static void *rtmp_stream_create(obs_data_t *settings, obs_output_t *output)
 	struct rtmp_stream *stream = bzalloc(sizeof(struct rtmp_stream));
 	stream->output = output;
 	pthread_mutex_init_value(&stream->packets_mutex);
+	pthread_mutex_init_value(&stream->dbr_mutex);
+	pthread_mutex_init_value(&stream->dbr_update_mutex);
+#ifdef __linux__
+	stream->socket_event_fd = -1;
+#endif
 
 	RTMP_Init(&stream->rtmp);
 	RTMP_LogSetCallback(log_rtmp);
@@ -131,6 +147,10 @@ static void *rtmp_stream_create(obs_data_t *settings, obs_output_t *output)
 
 	if (pthread_mutex_init(&stream->packets_mutex, NULL) != 0)
 		goto fail;
+	if (pthread_mutex_init(&stream->dbr_mutex, NULL) != 0)
+		goto fail;
+	if (pthread_mutex_init(&stream->dbr_update_mutex, NULL) != 0)
+		goto fail;
 	if (os_event_init(&stream->stop_event, OS_EVENT_TYPE_MANUAL) != 0)
 		goto fail;
 
@@ -159,6 +179,13 @@ static void *rtmp_stream_create(obs_data_t *settings, obs_output_t *output)
 		warn("Failed to initialize socket exit event");
 		goto fail;
 	}
+#ifdef __linux__
+	stream->socket_event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (stream->socket_event_fd == -1) {
+		warn("Failed to initialize socket thread eventfd");
+		goto fail;
+	}
+#endif
 
 	UNUSED_PARAMETER(settings);
 	return stream;
@@ -214,11 +241,7 @@ static inline bool get_next_packet(struct rtmp_stream *stream,
 	bool new_packet = false;
 
 	pthread_mutex_lock(&stream->packets_mutex);
-	if (stream->packets.size) {
-		circlebuf_pop_front(&stream->packets, packet,
-				    sizeof(struct encoder_packet));
-		new_packet = true;
-	}
+	new_packet = pop_packet(stream, packet);
 	pthread_mutex_unlock(&stream->packets_mutex);
 
 	return new_packet;
@@ -295,6 +318,14 @@ static void droptest_cap_data_rate(struct rtmp_stream *stream, size_t size)
 }
 #endif
 
+static inline void signal_buffer_has_data(struct rtmp_stream *stream)
+{
+	os_event_signal(stream->buffer_has_data_event);
+#ifdef __linux__
+	eventfd_write(stream->socket_event_fd, 1);
+#endif
+}
+
 static int socket_queue_data(RTMPSockBuf *sb, const char *data, int len,
 			     void *arg)
 {
@@ -325,16 +356,379 @@ retry_send:
 
 	pthread_mutex_unlock(&stream->write_buf_mutex);
 
-	os_event_signal(stream->buffer_has_data_event);
+	signal_buffer_has_data(stream);
 
 	return len;
 }
 
+/* ------------------------------------------------------------------------- */
+/* dynamic bitrate                                                           */
+
+/* how far back sent data is counted when estimating the send rate */
+#define DBR_WINDOW_NS 1000000000ULL
+/* packets buffered for this long lower the bitrate to the send rate */
+#define DBR_TRIGGER_USEC 200000LL
+/* time to let the encoder and the queue settle before lowering again */
+#define DBR_LOWER_INTERVAL_NS 2000000000ULL
+/* time without congestion before each step back up */
+#define DBR_RAISE_INTERVAL_NS 30000000000ULL
+#define DBR_MIN_BITRATE 100
+
+struct dbr_frame {
+	uint64_t send_end;
+	size_t size;
+};
+
+static long get_encoder_bitrate(obs_encoder_t *encoder)
+{
+	obs_data_t *settings = obs_encoder_get_settings(encoder);
+	long bitrate = (long)obs_data_get_int(settings, "bitrate");
+	obs_data_release(settings);
+	return bitrate;
+}
+
+/* dynamic bitrate only works if the encoder can change its bitrate while
+ * running and has one to change in the first place */
+static bool dbr_supported(obs_encoder_t *vencoder)
+{
+	obs_data_t *settings;
+	const char *rc;
+	bool supported;
+
+	if ((obs_encoder_get_caps(vencoder) & OBS_ENCODER_CAP_DYN_BITRATE) == 0)
+		return false;
+
+	settings = obs_encoder_get_settings(vencoder);
+	rc = obs_data_get_string(settings, "rate_control");
+	supported = (!*rc || astrcmpi(rc, "CBR") == 0 ||
+		     astrcmpi(rc, "VBR") == 0 || astrcmpi(rc, "ABR") == 0) &&
+		    obs_data_get_int(settings, "bitrate") > 0;
+	obs_data_release(settings);
+	return supported;
+}
+
+static void dbr_init(struct rtmp_stream *stream, obs_data_t *settings)
+{
+	obs_encoder_t *vencoder = obs_output_get_video_encoder(stream->output);
+
+	circlebuf_free(&stream->dbr_frames);
+	stream->dbr_data_size = 0;
+	stream->dbr_last_change = os_gettime_ns();
+	stream->dbr_pending_bitrate = 0;
+	stream->dbr_written_bitrate = 0;
+	memset(&stream->dbr, 0, sizeof(stream->dbr));
+
+	stream->dbr_enabled = obs_data_get_bool(settings, OPT_DYN_BITRATE);
+	if (!stream->dbr_enabled)
+		return;
+
+	if (!vencoder || !dbr_supported(vencoder)) {
+		info("Dynamic bitrate disabled, the video encoder does not "
+		     "support changing its bitrate");
+		stream->dbr_enabled = false;
+		return;
+	}
+
+	stream->dbr_audio_bitrate = 0;
+	for (size_t idx = 0;; idx++) {
+		obs_encoder_t *aencoder =
+			obs_output_get_audio_encoder(stream->output, idx);
+		if (!aencoder)
+			break;
+		stream->dbr_audio_bitrate += get_encoder_bitrate(aencoder);
+	}
+
+	stream->dbr.orig_bitrate = get_encoder_bitrate(vencoder);
+	stream->dbr.cur_bitrate = stream->dbr.orig_bitrate;
+	stream->dbr_written_bitrate = stream->dbr.orig_bitrate;
+	info("Dynamic bitrate enabled, video bitrate: %ld kbps",
+	     stream->dbr.orig_bitrate);
+}
+
+static void dbr_add_frame(struct rtmp_stream *stream, size_t size)
+{
+	struct dbr_frame frame = {os_gettime_ns(), size};
+
+	pthread_mutex_lock(&stream->dbr_mutex);
+
+	circlebuf_push_back(&stream->dbr_frames, &frame, sizeof(frame));
+	stream->dbr_data_size += size;
+
+	for (;;) {
+		struct dbr_frame front;
+		circlebuf_peek_front(&stream->dbr_frames, &front,
+				     sizeof(front));
+		if (frame.send_end - front.send_end <= DBR_WINDOW_NS)
+			break;
+
+		circlebuf_pop_front(&stream->dbr_frames, NULL, sizeof(front));
+		stream->dbr_data_size -= front.size;
+	}
+
+	pthread_mutex_unlock(&stream->dbr_mutex);
+}
+
+/* returns the send rate in kbps, or 0 if less than a full window of data
+ * has been sent */
+static long dbr_get_send_rate(struct rtmp_stream *stream)
+{
+	struct dbr_frame front;
+	long rate = 0;
+
+	pthread_mutex_lock(&stream->dbr_mutex);
+
+	if (stream->dbr_frames.size) {
+		circlebuf_peek_front(&stream->dbr_frames, &front,
+				     sizeof(front));
+		if (os_gettime_ns() - front.send_end >= DBR_WINDOW_NS / 2)
+			rate = (long)(stream->dbr_data_size * 8 /
+				      (DBR_WINDOW_NS / 1000000));
+	}
+
+	pthread_mutex_unlock(&stream->dbr_mutex);
+	return rate;
+}
+
+/* called with packets_mutex locked, the encoder gets the new bitrate from
+ * dbr_apply_bitrate once it's unlocked */
+static void dbr_set_bitrate(struct rtmp_stream *stream, long bitrate)
+{
+	stream->dbr.cur_bitrate = bitrate;
+	stream->dbr_pending_bitrate = bitrate;
+	stream->dbr_last_change = os_gettime_ns();
+}
+
+/* called with dbr_update_mutex locked */
+static void dbr_write_bitrate(struct rtmp_stream *stream, long bitrate)
+{
+	obs_encoder_t *vencoder = obs_output_get_video_encoder(stream->output);
+	obs_data_t *settings = obs_data_create();
+
+	obs_data_set_int(settings, "bitrate", bitrate);
+	obs_encoder_update(vencoder, settings);
+	obs_data_release(settings);
+
+	stream->dbr_written_bitrate = bitrate;
+}
+
+/* obs_encoder_update locks the encoder's init_mutex, so it must not be called
+ * with packets_mutex locked */
+static void dbr_apply_bitrate(struct rtmp_stream *stream)
+{
+	long bitrate;
+
+	pthread_mutex_lock(&stream->dbr_update_mutex);
+
+	pthread_mutex_lock(&stream->packets_mutex);
+	bitrate = stream->dbr_pending_bitrate;
+	stream->dbr_pending_bitrate = 0;
+	pthread_mutex_unlock(&stream->packets_mutex);
+
+	if (bitrate)
+		dbr_write_bitrate(stream, bitrate);
+
+	pthread_mutex_unlock(&stream->dbr_update_mutex);
+}
+
+static void dbr_lower(struct rtmp_stream *stream)
+{
+	long est = dbr_get_send_rate(stream);
+	long bitrate;
+
+	if (!est)
+		return;
+
+	stream->dbr.est_bitrate = est;
+
+	/* aim a bit below the send rate so the backlog drains, and always
+	 * step down while packets keep backing up even if the estimate says
+	 * the current bitrate should fit */
+	bitrate = (est - stream->dbr_audio_bitrate) * 9 / 10;
+	if (bitrate >= stream->dbr.cur_bitrate)
+		bitrate = stream->dbr.cur_bitrate * 9 / 10;
+	bitrate -= bitrate % 50;
+	if (bitrate < DBR_MIN_BITRATE)
+		bitrate = DBR_MIN_BITRATE;
+	if (bitrate >= stream->dbr.cur_bitrate)
+		return;
+
+	info("Congested, lowering video bitrate from %ld to %ld kbps "
+	     "(sending at %ld kbps)",
+	     stream->dbr.cur_bitrate, bitrate, est);
+	dbr_set_bitrate(stream, bitrate);
+	stream->dbr.num_lowered++;
+}
+
+static void dbr_raise(struct rtmp_stream *stream)
+{
+	long bitrate = stream->dbr.cur_bitrate + stream->dbr.orig_bitrate / 10;
+	if (bitrate > stream->dbr.orig_bitrate)
+		bitrate = stream->dbr.orig_bitrate;
+
+	info("Raising video bitrate from %ld to %ld kbps",
+	     stream->dbr.cur_bitrate, bitrate);
+	dbr_set_bitrate(stream, bitrate);
+	stream->dbr.num_raised++;
+}
+
+static bool find_first_video_packet(struct rtmp_stream *stream,
+				    struct encoder_packet *first);
+
+/* called with packets_mutex locked for every video packet.  the encoder
+ * applies bitrate changes on its own thread, between frames, after they've
+ * been given to it by dbr_apply_bitrate */
+static void dbr_update(struct rtmp_stream *stream)
+{
+	struct encoder_packet first;
+	int64_t buffer_duration_usec = 0;
+	uint64_t since_change = os_gettime_ns() - stream->dbr_last_change;
+
+	if (num_buffered_packets(stream) >= 5 &&
+	    find_first_video_packet(stream, &first))
+		buffer_duration_usec = stream->last_dts_usec - first.dts_usec;
+
+	if (buffer_duration_usec >= DBR_TRIGGER_USEC) {
+		if (since_change >= DBR_LOWER_INTERVAL_NS)
+			dbr_lower(stream);
+
+	} else if (buffer_duration_usec < DBR_TRIGGER_USEC / 2 &&
+		   stream->dbr.cur_bitrate < stream->dbr.orig_bitrate &&
+		   since_change >= DBR_RAISE_INTERVAL_NS) {
+		stream->dbr.est_bitrate = dbr_get_send_rate(stream);
+		dbr_raise(stream);
+	}
+}
+
+/* puts the original bitrate back so it isn't lowered for the next stream,
+ * unless the bitrate was changed since dynamic bitrate last set it */
+static void dbr_stop(struct rtmp_stream *stream)
+{
+	obs_encoder_t *vencoder = obs_output_get_video_encoder(stream->output);
+	long orig_bitrate = stream->dbr.orig_bitrate;
+
+	pthread_mutex_lock(&stream->dbr_update_mutex);
+
+	pthread_mutex_lock(&stream->packets_mutex);
+	stream->dbr_enabled = false;
+	stream->dbr_pending_bitrate = 0;
+	pthread_mutex_unlock(&stream->packets_mutex);
+
+	if (stream->dbr_written_bitrate != orig_bitrate) {
+		long bitrate = get_encoder_bitrate(vencoder);
+
+		if (bitrate == stream->dbr_written_bitrate) {
+			info("Restoring video bitrate to %ld kbps",
+			     orig_bitrate);
+			dbr_write_bitrate(stream, orig_bitrate);
+		} else {
+			info("Video bitrate was changed to %ld kbps while "
+			     "streaming, not restoring it",
+			     bitrate);
+		}
+	}
+
+	pthread_mutex_unlock(&stream->dbr_update_mutex);
+}
+
+/* ------------------------------------------------------------------------- */
+
+/* copies as much of the buffers as fits into the write buffer at a time,
+ * waiting for the socket thread to make room for the rest */
+static int socket_queue_datav(RTMPSockBuf *sb, const RTMPIOVec *iov,
+			      int iovcnt, void *arg)
+{
+	UNUSED_PARAMETER(sb);
+
+	struct rtmp_stream *stream = arg;
+	size_t offset = 0;
+	int total = 0;
+	int i = 0;
+
+	while (i < iovcnt) {
+		if (!RTMP_IsConnected(&stream->rtmp))
+			return 0;
+
+		pthread_mutex_lock(&stream->write_buf_mutex);
+
+		while (i < iovcnt &&
+		       stream->write_buf_len < stream->write_buf_size) {
+			size_t space =
+				stream->write_buf_size - stream->write_buf_len;
+			size_t len = (size_t)iov[i].len - offset;
+			if (len > space)
+				len = space;
+
+			memcpy(stream->write_buf + stream->write_buf_len,
+			       iov[i].buf + offset, len);
+			stream->write_buf_len += len;
+			offset += len;
+			total += (int)len;
+
+			if (offset == (size_t)iov[i].len) {
+				offset = 0;
+				i++;
+			}
+		}
+
+		pthread_mutex_unlock(&stream->write_buf_mutex);
+
+		signal_buffer_has_data(stream);
+
+		if (i < iovcnt &&
+		    os_event_wait(stream->buffer_space_available_event))
+			return 0;
+	}
+
+	return total;
+}
+
+/* the RTMP message body is the FLV tag body, so instead of muxing an FLV tag
+ * for RTMP_Write to parse and copy, the tag body prefix and the encoded data
+ * are handed to librtmp as separate buffers and chunked without copying */
+static bool send_packet_body(struct rtmp_stream *stream,
+			     struct encoder_packet *packet, bool is_header,
+			     size_t idx, size_t *size)
+{
+	uint8_t prefix[FLV_TAG_BODY_PREFIX_MAX];
+	RTMPPacket rtmp_packet = {0};
+	RTMPIOVec body[2];
+	int32_t time_ms;
+
+	*size = 0;
+	if (!packet->data || !packet->size)
+		return true;
+
+	time_ms = get_ms_time(packet, packet->dts);
+	if (!is_header)
+		time_ms -= stream->start_dts_offset;
+
+	body[0].buf = (const char *)prefix;
+	body[0].len = (int)flv_tag_body_prefix(packet, is_header, prefix);
+	body[1].buf = (const char *)packet->data;
+	body[1].len = (int)packet->size;
+
+	/* same header choice RTMP_Write makes for FLV tags */
+	rtmp_packet.m_nChannel = 0x04;
+	rtmp_packet.m_nInfoField2 = stream->rtmp.Link.streams[idx].id;
+	rtmp_packet.m_packetType = packet->type == OBS_ENCODER_VIDEO
+					   ? RTMP_PACKET_TYPE_VIDEO
+					   : RTMP_PACKET_TYPE_AUDIO;
+	rtmp_packet.m_nTimeStamp = (uint32_t)time_ms & 0x7FFFFFFF;
+	rtmp_packet.m_headerType = rtmp_packet.m_nTimeStamp
+					   ? RTMP_PACKET_SIZE_MEDIUM
+					   : RTMP_PACKET_SIZE_LARGE;
+	rtmp_packet.m_nBodySize = (uint32_t)(body[0].len + body[1].len);
+
+	/* counted as FLV tag size like before: header + body + tag size */
+	*size = 11 + rtmp_packet.m_nBodySize + 4;
+
+	return !!RTMP_SendPacketV(&stream->rtmp, &rtmp_packet, body, 2);
+}
+
 static int send_packet(struct rtmp_stream *stream,
 		       struct encoder_packet *packet, bool is_header,
 		       size_t idx)
 {
-	uint8_t *data;
 	size_t size;
 	int recv_size = 0;
 	int ret = 0;
@@ -353,16 +747,15 @@ static int send_packet(struct rtmp_stream *stream,
 		}
 	}
 
-	flv_packet_mux(packet, is_header ? 0 : stream->start_dts_offset, &data,
-		       &size, is_header);
+	ret = send_packet_body(stream, packet, is_header, idx, &size) ? 0 : -1;
+
+	if (ret == 0 && !is_header && stream->dbr_enabled)
+		dbr_add_frame(stream, size);
 
 #ifdef TEST_FRAMEDROPS
 	droptest_cap_data_rate(stream, size);
 #endif
 
-	ret = RTMP_Write(&stream->rtmp, (char *)data, (int)size, (int)idx);
-	bfree(data);
-
 	if (is_header)
 		bfree(packet->data);
 	else
@@ -488,6 +881,9 @@ static void *send_thread(void *data)
 		}
 	}
 
+	if (stream->dbr_enabled)
+		dbr_stop(stream);
+
 	bool encode_error = os_atomic_load_bool(&stream->encode_error);
 
 	if (disconnected(stream)) {
@@ -500,7 +896,7 @@ static void *send_thread(void *data)
 
 	if (stream->new_socket_loop) {
 		os_event_signal(stream->send_thread_signaled_exit);
-		os_event_signal(stream->buffer_has_data_event);
+		signal_buffer_has_data(stream);
 		pthread_join(stream->socket_thread, NULL);
 		stream->socket_thread_active = false;
 		stream->rtmp.m_bCustomSend = false;
@@ -710,9 +1106,16 @@ static int init_send(struct rtmp_stream *stream)
 		stream->write_buf_size = ideal_buffer_size;
 		stream->write_buf = bmalloc(ideal_buffer_size);
 
+#ifdef __linux__
+		os_atomic_set_long(&stream->socket_congestion, 0);
+#endif
+
 #ifdef _WIN32
 		ret = pthread_create(&stream->socket_thread, NULL,
 				     socket_thread_windows, stream);
+#elif defined(__linux__)
+		ret = pthread_create(&stream->socket_thread, NULL,
+				     socket_thread_linux, stream);
 #else
 		warn("New socket loop not supported on this platform");
 		return OBS_OUTPUT_ERROR;
@@ -727,6 +1130,7 @@ static int init_send(struct rtmp_stream *stream)
 		stream->socket_thread_active = true;
 		stream->rtmp.m_bCustomSend = true;
 		stream->rtmp.m_customSendFunc = socket_queue_data;
+		stream->rtmp.m_customSendvFunc = socket_queue_datav;
 		stream->rtmp.m_customSendParam = stream;
 	}
 
@@ -924,6 +1328,8 @@ static bool init_connect(struct rtmp_stream *stream)
 	stream->low_latency_mode =
 		obs_data_get_bool(settings, OPT_LOWLATENCY_ENABLED);
 
+	dbr_init(stream, settings);
+
 	obs_data_release(settings);
 	return true;
 }
@@ -968,17 +1374,79 @@ static bool rtmp_stream_start(void *data)
 			      stream) == 0;
 }
 
+static inline struct encoder_packet *
+queued_packet(struct rtmp_stream *stream, uint64_t idx)
+{
+	size_t pos = (size_t)(idx - stream->packets_front_idx);
+	return circlebuf_data(&stream->packets,
+			      pos * sizeof(struct encoder_packet));
+}
+
+static inline void push_idx(struct circlebuf *cb, uint64_t idx)
+{
+	circlebuf_push_back(cb, &idx, sizeof(idx));
+}
+
+static inline void pop_idx_through(struct circlebuf *cb, uint64_t idx)
+{
+	uint64_t front;
+
+	while (cb->size) {
+		circlebuf_peek_front(cb, &front, sizeof(front));
+		if (front > idx)
+			break;
+		circlebuf_pop_front(cb, NULL, sizeof(front));
+	}
+}
+
 static inline bool add_packet(struct rtmp_stream *stream,
 			      struct encoder_packet *packet)
 {
+	uint64_t idx = stream->packets_front_idx +
+		       stream->packets.size / sizeof(struct encoder_packet);
+
 	circlebuf_push_back(&stream->packets, packet,
 			    sizeof(struct encoder_packet));
+
+	if (packet->type == OBS_ENCODER_VIDEO) {
+		int priority = packet->drop_priority;
+
+		if (!packet->keyframe)
+			push_idx(&stream->video_idx, idx);
+		if (priority < OBS_NAL_PRIORITY_HIGHEST)
+			push_idx(&stream->drop_idx[priority < 0 ? 0 : priority],
+				 idx);
+	}
 	return true;
 }
 
+/* skips packets that were dropped while queued */
+static inline bool pop_packet(struct rtmp_stream *stream,
+			      struct encoder_packet *packet)
+{
+	while (stream->packets.size) {
+		uint64_t idx = stream->packets_front_idx++;
+
+		circlebuf_pop_front(&stream->packets, packet,
+				    sizeof(struct encoder_packet));
+
+		pop_idx_through(&stream->video_idx, idx);
+		for (size_t i = 0; i < OBS_NAL_PRIORITY_HIGHEST; i++)
+			pop_idx_through(&stream->drop_idx[i], idx);
+
+		if (packet->data)
+			return true;
+
+		stream->packets_dropped--;
+	}
+
+	return false;
+}
+
 static inline size_t num_buffered_packets(struct rtmp_stream *stream)
 {
-	return stream->packets.size / sizeof(struct encoder_packet);
+	return stream->packets.size / sizeof(struct encoder_packet) -
+	       stream->packets_dropped;
 }
 
 static void drop_frames(struct rtmp_stream *stream, const char *name,
@@ -986,7 +1454,6 @@ static void drop_frames(struct rtmp_stream *stream, const char *name,
 {
 	UNUSED_PARAMETER(pframes);
 
-	struct circlebuf new_buf = {0};
 	int num_frames_dropped = 0;
 
 #ifdef _DEBUG
@@ -995,26 +1462,22 @@ static void drop_frames(struct rtmp_stream *stream, const char *name,
 	UNUSED_PARAMETER(name);
 #endif
 
-	circlebuf_reserve(&new_buf, sizeof(struct encoder_packet) * 8);
+	/* do not drop audio data or video keyframes, only video packets are
+	 * indexed by drop priority */
+	for (int i = 0; i < highest_priority && i < OBS_NAL_PRIORITY_HIGHEST;
+	     i++) {
+		struct circlebuf *lane = &stream->drop_idx[i];
 
-	while (stream->packets.size) {
-		struct encoder_packet packet;
-		circlebuf_pop_front(&stream->packets, &packet, sizeof(packet));
+		while (lane->size) {
+			uint64_t idx;
+			circlebuf_pop_front(lane, &idx, sizeof(idx));
 
-		/* do not drop audio data or video keyframes */
-		if (packet.type == OBS_ENCODER_AUDIO ||
-		    packet.drop_priority >= highest_priority) {
-			circlebuf_push_back(&new_buf, &packet, sizeof(packet));
-
-		} else {
+			obs_encoder_packet_release(queued_packet(stream, idx));
+			stream->packets_dropped++;
 			num_frames_dropped++;
-			obs_encoder_packet_release(&packet);
 		}
 	}
 
-	circlebuf_free(&stream->packets);
-	stream->packets = new_buf;
-
 	if (stream->min_priority < highest_priority)
 		stream->min_priority = highest_priority;
 	if (!num_frames_dropped)
@@ -1030,15 +1493,19 @@ static void drop_frames(struct rtmp_stream *stream, const char *name,
 static bool find_first_video_packet(struct rtmp_stream *stream,
 				    struct encoder_packet *first)
 {
-	size_t count = stream->packets.size / sizeof(*first);
+	while (stream->video_idx.size) {
+		struct encoder_packet *cur;
+		uint64_t idx;
 
-	for (size_t i = 0; i < count; i++) {
-		struct encoder_packet *cur =
-			circlebuf_data(&stream->packets, i * sizeof(*first));
-		if (cur->type == OBS_ENCODER_VIDEO && !cur->keyframe) {
+		circlebuf_peek_front(&stream->video_idx, &idx, sizeof(idx));
+		cur = queued_packet(stream, idx);
+		if (cur->data) {
 			*first = *cur;
 			return true;
 		}
+
+		/* dropped */
+		circlebuf_pop_front(&stream->video_idx, NULL, sizeof(idx));
 	}
 
 	return false;
@@ -1082,6 +1549,9 @@ static void check_to_drop_frames(struct rtmp_stream *stream, bool pframes)
 static bool add_video_packet(struct rtmp_stream *stream,
 			     struct encoder_packet *packet)
 {
+	if (stream->dbr_enabled)
+		dbr_update(stream);
+
 	check_to_drop_frames(stream, false);
 	check_to_drop_frames(stream, true);
 
@@ -1103,6 +1573,7 @@ static void rtmp_stream_data(void *data, struct encoder_packet *packet)
 	struct rtmp_stream *stream = data;
 	struct encoder_packet new_packet;
 	bool added_packet = false;
+	bool dbr_pending;
 
 	if (disconnected(stream) || !active(stream))
 		return;
@@ -1134,8 +1605,12 @@ static void rtmp_stream_data(void *data, struct encoder_packet *packet)
 				       : add_packet(stream, &new_packet);
 	}
 
+	dbr_pending = stream->dbr_pending_bitrate != 0;
 	pthread_mutex_unlock(&stream->packets_mutex);
 
+	if (dbr_pending)
+		dbr_apply_bitrate(stream);
+
 	if (added_packet)
 		os_sem_post(stream->send_sem);
 	else
@@ -1150,6 +1625,7 @@ static void rtmp_stream_defaults(obs_data_t *defaults)
 	obs_data_set_default_string(defaults, OPT_BIND_IP, "default");
 	obs_data_set_default_bool(defaults, OPT_NEWSOCKETLOOP_ENABLED, false);
 	obs_data_set_default_bool(defaults, OPT_LOWLATENCY_ENABLED, false);
+	obs_data_set_default_bool(defaults, OPT_DYN_BITRATE, false);
 }
 
 static obs_properties_t *rtmp_stream_properties(void *unused)
@@ -1182,6 +1658,8 @@ static obs_properties_t *rtmp_stream_properties(void *unused)
 				obs_module_text("RTMPStream.NewSocketLoop"));
 	obs_properties_add_bool(props, OPT_LOWLATENCY_ENABLED,
 				obs_module_text("RTMPStream.LowLatencyMode"));
+	obs_properties_add_bool(props, OPT_DYN_BITRATE,
+				obs_module_text("RTMPStream.DynamicBitrate"));
 
 	return props;
 }
@@ -1202,11 +1680,37 @@ static float rtmp_stream_congestion(void *data)
 {
 	struct rtmp_stream *stream = data;
 
-	if (stream->new_socket_loop)
-		return (float)stream->write_buf_len /
-		       (float)stream->write_buf_size;
-	else
+	if (stream->new_socket_loop) {
+#ifdef __linux__
+		return (float)os_atomic_load_long(&stream->socket_congestion) /
+		       (float)SOCKET_CONGESTION_SCALE;
+#else
+		float congestion;
+
+		pthread_mutex_lock(&stream->write_buf_mutex);
+		congestion = (float)stream->write_buf_len /
+			     (float)stream->write_buf_size;
+		pthread_mutex_unlock(&stream->write_buf_mutex);
+		return congestion;
+#endif
+	} else {
 		return stream->min_priority > 0 ? 1.0f : stream->congestion;
+	}
+}
+
+static bool rtmp_stream_dyn_bitrate(void *data,
+				    struct obs_output_dyn_bitrate *state)
+{
+	struct rtmp_stream *stream = data;
+	bool enabled;
+
+	pthread_mutex_lock(&stream->packets_mutex);
+	enabled = stream->dbr_enabled;
+	if (enabled)
+		*state = stream->dbr;
+	pthread_mutex_unlock(&stream->packets_mutex);
+
+	return enabled;
 }
 
 static int rtmp_stream_connect_time(void *data)
@@ -1233,4 +1737,5 @@ struct obs_output_info rtmp_output_info = {
 	.get_congestion = rtmp_stream_congestion,
 	.get_connect_time_ms = rtmp_stream_connect_time,
 	.get_dropped_frames = rtmp_stream_dropped_frames,
+	.get_dyn_bitrate = rtmp_stream_dyn_bitrate,
 };
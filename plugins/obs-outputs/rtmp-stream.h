@@ -16,6 +16,11 @@
 #include <sys/ioctl.h>
 #endif
 
+#ifdef __linux__
+#include <sys/eventfd.h>
+#include <unistd.h>
+#endif
+
 #define do_log(level, format, ...)                 \
 	blog(level, "[rtmp stream: '%s'] " format, \
 	     obs_output_get_name(stream->output), ##__VA_ARGS__)
@@ -30,6 +35,9 @@
 #define OPT_BIND_IP "bind_ip"
 #define OPT_NEWSOCKETLOOP_ENABLED "new_socket_loop_enabled"
 #define OPT_LOWLATENCY_ENABLED "low_latency_mode_enabled"
+#define OPT_DYN_BITRATE "dyn_bitrate"
+
+#define SOCKET_CONGESTION_SCALE 10000
 
 //#define TEST_FRAMEDROPS
 
@@ -49,6 +57,15 @@ struct rtmp_stream {
 
 	pthread_mutex_t packets_mutex;
 	struct circlebuf packets;
+
+	/* packets are numbered in queue order, and the numbers of buffered
+	 * video packets are kept in order per drop priority, so congestion
+	 * checks and frame drops don't have to walk the queue.  dropped
+	 * packets are released in place and skipped when sent. */
+	uint64_t packets_front_idx;
+	size_t packets_dropped;
+	struct circlebuf video_idx;
+	struct circlebuf drop_idx[OBS_NAL_PRIORITY_HIGHEST];
 	bool sent_headers;
 
 	bool got_first_video;
@@ -85,6 +102,25 @@ struct rtmp_stream {
 	uint64_t total_bytes_sent;
 	int dropped_frames;
 
+	/* dynamic bitrate: the send thread records what it sent in
+	 * dbr_frames, and the video bitrate is lowered to the measured send
+	 * rate when packets back up, then raised again in steps */
+	bool dbr_enabled;
+	pthread_mutex_t dbr_mutex;
+	struct circlebuf dbr_frames;
+	size_t dbr_data_size;
+	uint64_t dbr_last_change;
+	long dbr_audio_bitrate;
+	struct obs_output_dyn_bitrate dbr;
+
+	/* bitrates are decided on with packets_mutex locked, and given to
+	 * the encoder after it's unlocked.  dbr_update_mutex keeps the
+	 * encoder updates in order, dbr_written_bitrate is the last bitrate
+	 * given to the encoder */
+	pthread_mutex_t dbr_update_mutex;
+	long dbr_pending_bitrate;
+	long dbr_written_bitrate;
+
 #ifdef TEST_FRAMEDROPS
 	struct circlebuf droptest_info;
 	size_t droptest_size;
@@ -105,8 +141,17 @@ struct rtmp_stream {
 	os_event_t *buffer_has_data_event;
 	os_event_t *socket_available_event;
 	os_event_t *send_thread_signaled_exit;
+
+#ifdef __linux__
+	int socket_event_fd;
+
+	/* written by the socket thread, in SOCKET_CONGESTION_SCALE units */
+	volatile long socket_congestion;
+#endif
 };
 
 #ifdef _WIN32
 void *socket_thread_windows(void *data);
+#elif defined(__linux__)
+void *socket_thread_linux(void *data);
 #endif
@@ -0,0 +1,354 @@
+/*
+ * Compares the vectorized audio mixing kernels against plain loops, and
+ * optionally times them.
+ *
+ * Every SIMD version the CPU supports is run on the same input as the plain
+ * loops the mixer used before, for a range of lengths (to cover the tails the
+ * vector loops leave to the public functions) and unaligned starting points.
+ * The input includes NaN, infinities, denormals and negative zero.  Results
+ * have to be bit for bit the same, except that a NaN only has to stay NaN,
+ * and clamping has to pass NaN through.  Usage:
+ *
+ *   test-audio-mix [bench]
+ *
+ * With "bench", every kernel is also timed on 1024 sample buffers, the size
+ * the mixer works with, and the average time per buffer is printed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+
+#include <util/bmem.h>
+#include <util/platform.h>
+#include <media-io/audio-io.h>
+
+#include <media-io/audio-mix.c>
+
+#define MAX_COUNT 67
+#define MAX_OFFSET 3
+#define BUFFER_SIZE (AUDIO_OUTPUT_FRAMES + MAX_OFFSET)
+
+#define BENCH_RUNS 200000
+
+typedef size_t (*add_func_t)(float *dst, const float *src, size_t count);
+typedef size_t (*gain_func_t)(float *data, float gain, size_t count);
+typedef size_t (*mul_func_t)(float *data, const float *gains, size_t count);
+typedef size_t (*clamp_func_t)(float *data, size_t count);
+
+/* the vector loops return how many floats they did, the plain loops below
+ * do the rest, like the public functions */
+struct variant {
+	const char *name;
+	bool avx;
+	add_func_t add;
+	gain_func_t gain;
+	mul_func_t mul;
+	clamp_func_t clamp;
+};
+
+static size_t add_c(float *dst, const float *src, size_t count)
+{
+	UNUSED_PARAMETER(dst);
+	UNUSED_PARAMETER(src);
+	UNUSED_PARAMETER(count);
+	return 0;
+}
+
+static size_t gain_c(float *data, float gain, size_t count)
+{
+	UNUSED_PARAMETER(data);
+	UNUSED_PARAMETER(gain);
+	UNUSED_PARAMETER(count);
+	return 0;
+}
+
+static size_t mul_c(float *data, const float *gains, size_t count)
+{
+	UNUSED_PARAMETER(data);
+	UNUSED_PARAMETER(gains);
+	UNUSED_PARAMETER(count);
+	return 0;
+}
+
+static size_t clamp_c(float *data, size_t count)
+{
+	UNUSED_PARAMETER(data);
+	UNUSED_PARAMETER(count);
+	return 0;
+}
+
+static const struct variant variants[] = {
+	{"c", false, add_c, gain_c, mul_c, clamp_c},
+#if AUDIO_MIX_X86
+	{"sse", false, mix_add_sse, mix_gain_sse, mix_mul_sse, mix_clamp_sse},
+	{"avx", true, mix_add_avx, mix_gain_avx, mix_mul_avx, mix_clamp_avx},
+#elif AUDIO_MIX_NEON
+	{"neon", false, mix_add_simd, mix_gain_simd, mix_mul_simd,
+	 mix_clamp_simd},
+#endif
+};
+
+#define NUM_VARIANTS (sizeof(variants) / sizeof(variants[0]))
+
+static bool variant_supported(const struct variant *v)
+{
+#if AUDIO_MIX_X86
+	return !v->avx || os_cpu_has_avx();
+#else
+	return !v->avx;
+#endif
+}
+
+enum op { OP_ADD, OP_GAIN, OP_MUL, OP_CLAMP, OP_COUNT };
+
+static const char *op_names[OP_COUNT] = {"add", "gain", "mul", "clamp"};
+
+static void run_op(const struct variant *v, enum op op, float *data,
+		   const float *src, float gain, size_t count)
+{
+	size_t i;
+
+	switch (op) {
+	case OP_ADD:
+		for (i = v->add(data, src, count); i < count; i++)
+			data[i] += src[i];
+		break;
+	case OP_GAIN:
+		for (i = v->gain(data, gain, count); i < count; i++)
+			data[i] *= gain;
+		break;
+	case OP_MUL:
+		for (i = v->mul(data, src, count); i < count; i++)
+			data[i] *= src[i];
+		break;
+	case OP_CLAMP:
+		for (i = v->clamp(data, count); i < count; i++) {
+			float val = data[i];
+			val = (val > 1.0f) ? 1.0f : val;
+			val = (val < -1.0f) ? -1.0f : val;
+			data[i] = val;
+		}
+		break;
+	case OP_COUNT:
+		break;
+	}
+}
+
+/* ------------------------------------------------------------------------- */
+
+static uint32_t rand_state = 0x12345678;
+
+static inline uint32_t next_rand(void)
+{
+	rand_state = rand_state * 1664525 + 1013904223;
+	return rand_state >> 8;
+}
+
+static void fill_random(float *data, size_t count)
+{
+	static const float specials[] = {
+		NAN,   INFINITY, -INFINITY, -0.0f,   0.0f,
+		1.0f,  -1.0f,    FLT_MAX,   FLT_MIN, FLT_MIN / 4.0f,
+	};
+	const size_t num_specials = sizeof(specials) / sizeof(specials[0]);
+
+	for (size_t i = 0; i < count; i++) {
+		uint32_t r = next_rand();
+
+		if (r % 8 == 0)
+			data[i] = specials[(r / 8) % num_specials];
+		else
+			data[i] = (float)r / (float)(1 << 24) * 8.0f - 4.0f;
+	}
+}
+
+static bool same_float(float a, float b)
+{
+	if (isnan(a) || isnan(b))
+		return isnan(a) && isnan(b);
+
+	return memcmp(&a, &b, sizeof(a)) == 0;
+}
+
+/* the floats around the range that was processed must not be touched
+ * either, so whole buffers are compared */
+static bool compare(const struct variant *v, enum op op, const float *out,
+		    const float *ref, size_t count, size_t offset)
+{
+	for (size_t i = 0; i < BUFFER_SIZE; i++) {
+		if (!same_float(out[i], ref[i])) {
+			fprintf(stderr,
+				"%s %s: %d floats at offset %d, float %d: "
+				"got %g, expected %g\n",
+				v->name, op_names[op], (int)count, (int)offset,
+				(int)i, out[i], ref[i]);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static bool test_size(size_t count, size_t offset)
+{
+	float data[BUFFER_SIZE];
+	float src[BUFFER_SIZE];
+	float ref[BUFFER_SIZE];
+	float out[BUFFER_SIZE];
+	float gain = (float)next_rand() / (float)(1 << 24) * 2.0f;
+	bool success = true;
+
+	fill_random(data, BUFFER_SIZE);
+	fill_random(src, BUFFER_SIZE);
+
+	for (int op = 0; op < OP_COUNT; op++) {
+		memcpy(ref, data, sizeof(ref));
+		run_op(&variants[0], op, ref + offset, src + offset, gain,
+		       count);
+
+		for (size_t i = 1; i < NUM_VARIANTS; i++) {
+			const struct variant *v = &variants[i];
+
+			if (!variant_supported(v))
+				continue;
+
+			memcpy(out, data, sizeof(out));
+			run_op(v, op, out + offset, src + offset, gain, count);
+
+			success &= compare(v, op, out, ref, count, offset);
+		}
+	}
+
+	return success;
+}
+
+/* what 517d75a fixed: the vector clamps turned NaN into 1.0 */
+static bool test_clamp_nan(void)
+{
+	float data[AUDIO_OUTPUT_FRAMES];
+	bool success = true;
+
+	for (size_t i = 0; i < NUM_VARIANTS; i++) {
+		const struct variant *v = &variants[i];
+
+		if (!variant_supported(v))
+			continue;
+
+		for (size_t j = 0; j < AUDIO_OUTPUT_FRAMES; j++)
+			data[j] = j % 3 == 0 ? NAN
+					     : (j % 3 == 1 ? INFINITY
+							   : -INFINITY);
+
+		run_op(v, OP_CLAMP, data, NULL, 0.0f, AUDIO_OUTPUT_FRAMES);
+
+		for (size_t j = 0; j < AUDIO_OUTPUT_FRAMES; j++) {
+			float expected = j % 3 == 0 ? NAN
+						    : (j % 3 == 1 ? 1.0f
+								  : -1.0f);
+
+			if (!same_float(data[j], expected)) {
+				fprintf(stderr,
+					"%s clamp: float %d is %g, expected "
+					"%g\n",
+					v->name, (int)j, data[j], expected);
+				success = false;
+				break;
+			}
+		}
+	}
+
+	return success;
+}
+
+/* ------------------------------------------------------------------------- */
+
+static double bench_op(const struct variant *v, enum op op, float *data,
+		       const float *src)
+{
+	uint64_t start = os_gettime_ns();
+
+	for (int i = 0; i < BENCH_RUNS; i++)
+		run_op(v, op, data, src, 1.0f, AUDIO_OUTPUT_FRAMES);
+
+	return (double)(os_gettime_ns() - start) / BENCH_RUNS;
+}
+
+static void bench(void)
+{
+	float *data = bmalloc(AUDIO_OUTPUT_FRAMES * sizeof(float));
+	float *src = bmalloc(AUDIO_OUTPUT_FRAMES * sizeof(float));
+	float check = 0.0f;
+
+	printf("%-6s %-5s %12s %8s\n", "kernel", "isa", "ns/1024", "speedup");
+
+	for (int op = 0; op < OP_COUNT; op++) {
+		double c_ns = 0.0;
+
+		for (size_t i = 0; i < NUM_VARIANTS; i++) {
+			const struct variant *v = &variants[i];
+			double ns;
+
+			if (!variant_supported(v))
+				continue;
+
+			/* values that stay in range however often the kernels
+			 * are run over them */
+			for (size_t j = 0; j < AUDIO_OUTPUT_FRAMES; j++) {
+				data[j] = (float)j / AUDIO_OUTPUT_FRAMES;
+				src[j] = op == OP_MUL ? 1.0f : 0.0f;
+			}
+
+			ns = bench_op(v, op, data, src);
+			if (i == 0)
+				c_ns = ns;
+
+			check += data[AUDIO_OUTPUT_FRAMES - 1];
+			printf("%-6s %-5s %12.1f %7.2fx\n", op_names[op],
+			       v->name, ns, c_ns / ns);
+		}
+	}
+
+	/* keeps the loops from being optimized away */
+	if (check < 0.0f)
+		printf("%f\n", check);
+
+	bfree(data);
+	bfree(src);
+}
+
+/* ------------------------------------------------------------------------- */
+
+int main(int argc, char *argv[])
+{
+	bool success = true;
+	int tests = 0;
+
+	for (size_t count = 0; count <= MAX_COUNT; count++) {
+		for (size_t offset = 0; offset <= MAX_OFFSET; offset++) {
+			success &= test_size(count, offset);
+			tests++;
+		}
+	}
+
+	success &= test_size(AUDIO_OUTPUT_FRAMES, 0);
+	success &= test_size(AUDIO_OUTPUT_FRAMES, 1);
+	success &= test_clamp_nan();
+	tests += 2;
+
+	for (size_t i = 1; i < NUM_VARIANTS; i++) {
+		if (!variant_supported(&variants[i]))
+			printf("CPU does not support %s, not tested\n",
+			       variants[i].name);
+	}
+
+	printf("%d sizes tested, %s\n", tests,
+	       success ? "all outputs match" : "OUTPUTS DIFFER");
+
+	if (success && argc > 1 && strcmp(argv[1], "bench") == 0)
+		bench();
+
+	return success ? 0 : 1;
+}
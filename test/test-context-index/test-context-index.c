@@ -0,0 +1,273 @@
+/*
+ * Stress test for the index that sources, outputs, encoders and services are
+ * looked up by name with.
+ *
+ * 10,000 contexts are put in one list, every 50th of them private, and are
+ * renamed from several threads at once to names out of a small set, so that
+ * many of them have the same name at any time.  Meanwhile more contexts are
+ * added and removed again, which grows the index, and contexts are looked up
+ * by name.  Every lookup has to find the same context as walking the list
+ * does, which is the first one in the list that isn't private and has the
+ * name, and so does looking up every name once everything has stopped.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <obs.c>
+
+#define NUM_CONTEXTS 10000
+#define NUM_EXTRA 8000
+#define NUM_NAMES 2000
+#define PRIVATE_INTERVAL 50
+
+#define RENAME_THREADS 4
+#define RENAMES 20000
+#define LOOKUP_THREADS 2
+
+struct context_list {
+	struct obs_context_data *first;
+	struct obs_context_index index;
+	pthread_mutex_t mutex;
+};
+
+static struct context_list list;
+static struct obs_context_data contexts[NUM_CONTEXTS];
+static struct obs_context_data extra[NUM_EXTRA];
+
+static volatile bool stop;
+static volatile long lookups;
+static volatile long mismatches;
+
+static void init_context(struct obs_context_data *context, const char *name,
+			 bool private)
+{
+	pthread_mutex_init(&context->rename_cache_mutex, NULL);
+	context->private = private;
+	context->name = dup_name(name, private);
+	obs_context_data_insert(context, &list.mutex, &list.first,
+				&list.index);
+}
+
+static void free_context(struct obs_context_data *context)
+{
+	obs_context_data_remove(context);
+
+	for (size_t i = 0; i < context->rename_cache.num; i++)
+		bfree(context->rename_cache.array[i]);
+	da_free(context->rename_cache);
+
+	pthread_mutex_destroy(&context->rename_cache_mutex);
+	bfree(context->name);
+}
+
+/* what looking up a context by name did before there was an index */
+static struct obs_context_data *find_in_list(const char *name)
+{
+	struct obs_context_data *context;
+
+	pthread_mutex_lock(&list.mutex);
+
+	for (context = list.first; context; context = context->next) {
+		if (!context->private && strcmp(context->name, name) == 0)
+			break;
+	}
+
+	pthread_mutex_unlock(&list.mutex);
+	return context;
+}
+
+/* the mutex is recursive, so the index and the list are compared with both
+ * lookups seeing the same contexts */
+static bool check_lookup(const char *name)
+{
+	struct obs_context_data *context;
+	bool match;
+
+	pthread_mutex_lock(&list.mutex);
+	context = get_context_by_name(&list.index, name, &list.mutex, obs_id_);
+	match = context == find_in_list(name);
+	pthread_mutex_unlock(&list.mutex);
+
+	if (!match && os_atomic_inc_long(&mismatches) == 1)
+		fprintf(stderr, "lookup of '%s' found %p instead of %p\n",
+			name, context, find_in_list(name));
+	return match;
+}
+
+static inline void random_name(char *name, size_t size, unsigned int *seed)
+{
+	snprintf(name, size, "name %d", rand_r(seed) % NUM_NAMES);
+}
+
+static void *rename_thread(void *param)
+{
+	unsigned int seed = (unsigned int)(uintptr_t)param;
+	char name[64];
+
+	for (int i = 0; i < RENAMES; i++) {
+		struct obs_context_data *context =
+			&contexts[rand_r(&seed) % NUM_CONTEXTS];
+
+		random_name(name, sizeof(name), &seed);
+		obs_context_data_setname(context, name);
+	}
+
+	return NULL;
+}
+
+static void *lookup_thread(void *param)
+{
+	unsigned int seed = (unsigned int)(uintptr_t)param;
+	char name[64];
+
+	while (!os_atomic_load_bool(&stop)) {
+		random_name(name, sizeof(name), &seed);
+		check_lookup(name);
+		os_atomic_inc_long(&lookups);
+	}
+
+	return NULL;
+}
+
+/* grows the index while contexts are being renamed */
+static void *grow_thread(void *param)
+{
+	char name[64];
+
+	for (int i = 0; i < NUM_EXTRA; i++) {
+		snprintf(name, sizeof(name), "extra %d", i);
+		init_context(&extra[i], name, false);
+	}
+	for (int i = 0; i < NUM_EXTRA; i++)
+		free_context(&extra[i]);
+
+	UNUSED_PARAMETER(param);
+	return NULL;
+}
+
+/* a renamed context mustn't take the name from one that comes before it in
+ * the list, and has to take it from one that comes after it.  the list is
+ * newest first */
+static bool check_renamed_duplicates(struct obs_context_data *newest)
+{
+	struct obs_context_data *found;
+
+	obs_context_data_setname(&contexts[1], "source 2");
+	found = get_context_by_name(&list.index, "source 2", &list.mutex,
+				    obs_id_);
+	if (found != &contexts[2]) {
+		fprintf(stderr, "the renamed context took the name of one "
+				"that comes before it\n");
+		return false;
+	}
+
+	obs_context_data_setname(newest, "source 2");
+	found = get_context_by_name(&list.index, "source 2", &list.mutex,
+				    obs_id_);
+	if (found != newest) {
+		fprintf(stderr, "the renamed context didn't take the name of "
+				"one that comes after it\n");
+		return false;
+	}
+
+	return true;
+}
+
+static bool check_all_names(void)
+{
+	size_t indexed = 0;
+	bool success = true;
+	char name[64];
+
+	for (size_t i = 0; i < NUM_CONTEXTS; i++) {
+		if (!contexts[i].private)
+			indexed++;
+
+		snprintf(name, sizeof(name), "source %d", (int)i);
+		if (!check_lookup(name) || !check_lookup(contexts[i].name))
+			success = false;
+	}
+
+	for (size_t i = 0; i < NUM_NAMES; i++) {
+		snprintf(name, sizeof(name), "name %d", (int)i);
+		if (!check_lookup(name))
+			success = false;
+	}
+
+	if (list.index.count != indexed) {
+		fprintf(stderr, "%d contexts indexed, expected %d\n",
+			(int)list.index.count, (int)indexed);
+		success = false;
+	}
+
+	return success;
+}
+
+int main(void)
+{
+	pthread_t rename_threads[RENAME_THREADS];
+	pthread_t lookup_threads[LOOKUP_THREADS];
+	pthread_t grower;
+	pthread_mutexattr_t attr;
+	bool success = true;
+	char name[64];
+
+	if (pthread_mutexattr_init(&attr) != 0 ||
+	    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE) != 0 ||
+	    pthread_mutex_init(&list.mutex, &attr) != 0)
+		return 1;
+
+	for (int i = 0; i < NUM_CONTEXTS; i++) {
+		snprintf(name, sizeof(name), "source %d", i);
+		init_context(&contexts[i], name, i % PRIVATE_INTERVAL == 0);
+
+		/* checked while the index is still small, so that it has to
+		 * grow afterwards */
+		if (i == PRIVATE_INTERVAL + 1 &&
+		    !check_renamed_duplicates(&contexts[i]))
+			success = false;
+	}
+
+	if (!check_all_names())
+		success = false;
+
+	for (size_t i = 0; i < LOOKUP_THREADS; i++)
+		pthread_create(&lookup_threads[i], NULL, lookup_thread,
+			       (void *)(uintptr_t)(i + 100));
+	for (size_t i = 0; i < RENAME_THREADS; i++)
+		pthread_create(&rename_threads[i], NULL, rename_thread,
+			       (void *)(uintptr_t)(i + 1));
+	pthread_create(&grower, NULL, grow_thread, NULL);
+
+	for (size_t i = 0; i < RENAME_THREADS; i++)
+		pthread_join(rename_threads[i], NULL);
+	pthread_join(grower, NULL);
+
+	os_atomic_set_bool(&stop, true);
+	for (size_t i = 0; i < LOOKUP_THREADS; i++)
+		pthread_join(lookup_threads[i], NULL);
+
+	if (!check_all_names())
+		success = false;
+
+	printf("%d renames, %ld lookups during renames, %ld didn't match "
+	       "the list\n",
+	       RENAME_THREADS * RENAMES, lookups, mismatches);
+
+	if (mismatches)
+		success = false;
+
+	for (size_t i = 0; i < NUM_CONTEXTS; i++)
+		free_context(&contexts[i]);
+
+	if (list.index.count) {
+		fprintf(stderr, "%d contexts still indexed\n",
+			(int)list.index.count);
+		success = false;
+	}
+
+	bfree(list.index.buckets);
+	pthread_mutex_destroy(&list.mutex);
+	return success ? 0 : 1;
+}
@@ -0,0 +1,620 @@
+/*
+ * Checks obs_data's binary format, and optionally compares loading it with
+ * loading json.
+ *
+ * Random objects are parsed from json, saved as binary and loaded back,
+ * which has to give the same json again, and saving what was loaded has to
+ * give the same file.  Loading has to be lazy: opening a file decodes
+ * nothing, reading one object only decodes it and the objects it's in, and
+ * objects that are loaded have to keep their values when the file is
+ * replaced.  Every truncated copy of a file has to be rejected, and copies
+ * with flipped bits have to be either rejected or loaded as something that
+ * can be read and saved.  Usage:
+ *
+ *   test-data-binary [bench]
+ *
+ * With "bench", a synthetic scene collection of 5,000 sources is also saved
+ * as json and as binary, and both are loaded the way a scene collection is
+ * loaded at startup, once reading only the name of each source and once
+ * reading everything.  The best of a few runs is printed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <obs-data.h>
+#include <util/base.h>
+#include <util/bmem.h>
+#include <util/platform.h>
+
+#define TEST_FILE "test-data-binary.bin"
+#define BENCH_JSON_FILE "test-data-binary.json"
+
+#define ROUND_TRIPS 500
+#define MAX_DEPTH 4
+#define CORRUPT_COPIES 2000
+
+#define LAZY_SOURCES 1000
+#define LAZY_SETTINGS 8
+#define MAX_OPEN_ALLOCS 4
+#define MAX_SOURCE_ALLOCS (LAZY_SOURCES + 4 * LAZY_SETTINGS)
+
+#define BENCH_SOURCES 5000
+#define BENCH_SCENE_INTERVAL 10
+#define BENCH_SCENE_ITEMS 100
+#define BENCH_SETTINGS 24
+#define BENCH_RUNS 3
+
+static unsigned int seed = 1;
+
+static inline int random_int(int max)
+{
+	seed = seed * 1103515245 + 12345;
+	return (int)((seed >> 16) % (unsigned int)max);
+}
+
+static inline long long random_int_value(void)
+{
+	long long val = random_int(1 << 30);
+	return val * (random_int(1 << 30) - (1 << 29));
+}
+
+/* json can't hold infinity, so it's left out of both */
+static inline double random_double_value(void)
+{
+	if (random_int(16) == 0)
+		return 1.0 / 0.0;
+
+	return random_int(1 << 20) / 7.0;
+}
+
+/* ------------------------------------------------------------------------- */
+
+static void set_random_values(obs_data_t *data, int depth);
+
+static void set_random_string(obs_data_t *data, const char *name)
+{
+	static const char *special[] = {
+		"",
+		"\"quoted\" \\ / \x01\x1f",
+		"\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80",
+		/* json can't hold these, so they're left out of both */
+		"\xc3\x28",
+	};
+	char str[16];
+	int len = random_int(sizeof(str));
+
+	if (random_int(8) == 0) {
+		obs_data_set_string(data, name, special[random_int(4)]);
+		return;
+	}
+
+	for (int i = 0; i < len; i++)
+		str[i] = (char)('a' + random_int(26));
+	str[len] = 0;
+
+	obs_data_set_string(data, name, str);
+}
+
+static void set_random_array(obs_data_t *data, const char *name, int depth)
+{
+	obs_data_array_t *array = obs_data_array_create();
+	int count = random_int(4);
+
+	for (int i = 0; i < count; i++) {
+		obs_data_t *item = obs_data_create();
+
+		set_random_values(item, depth + 1);
+		obs_data_array_push_back(array, item);
+		obs_data_release(item);
+	}
+
+	obs_data_set_array(data, name, array);
+	obs_data_array_release(array);
+}
+
+static void set_random_values(obs_data_t *data, int depth)
+{
+	int count = random_int(depth ? 8 : 24);
+	char name[32];
+
+	for (int i = 0; i < count; i++) {
+		int type = random_int(depth < MAX_DEPTH ? 6 : 4);
+
+		snprintf(name, sizeof(name), "key %d", random_int(32));
+		obs_data_erase(data, name);
+
+		switch (type) {
+		case 0:
+			set_random_string(data, name);
+			break;
+		case 1:
+			obs_data_set_int(data, name, random_int_value());
+			break;
+		case 2:
+			obs_data_set_double(data, name, random_double_value());
+			break;
+		case 3:
+			obs_data_set_bool(data, name, random_int(2));
+			break;
+		case 4: {
+			obs_data_t *obj = obs_data_create();
+			set_random_values(obj, depth + 1);
+			obs_data_set_obj(data, name, obj);
+			obs_data_release(obj);
+			break;
+		}
+		case 5:
+			set_random_array(data, name, depth);
+		}
+	}
+
+	/* only user values are saved */
+	if (random_int(4) == 0)
+		obs_data_set_default_int(data, "default", 1);
+}
+
+/* ------------------------------------------------------------------------- */
+
+static uint8_t *read_file(const char *file, size_t *size)
+{
+	uint8_t *buf = NULL;
+	FILE *f = os_fopen(file, "rb");
+	int64_t len;
+
+	if (!f)
+		return NULL;
+
+	len = os_fgetsize(f);
+	if (len > 0) {
+		buf = bmalloc((size_t)len);
+		*size = fread(buf, 1, (size_t)len, f);
+	}
+
+	fclose(f);
+	return buf;
+}
+
+static bool write_file(const char *file, const uint8_t *buf, size_t size)
+{
+	FILE *f = os_fopen(file, "wb");
+	bool success;
+
+	if (!f)
+		return false;
+
+	success = fwrite(buf, 1, size, f) == size;
+	fclose(f);
+	return success;
+}
+
+static void read_all(obs_data_t *data)
+{
+	for (obs_data_item_t *item = obs_data_first(data); item;
+	     obs_data_item_next(&item)) {
+		enum obs_data_type type = obs_data_item_gettype(item);
+
+		if (type == OBS_DATA_OBJECT) {
+			obs_data_t *obj = obs_data_item_get_obj(item);
+			read_all(obj);
+			obs_data_release(obj);
+
+		} else if (type == OBS_DATA_ARRAY) {
+			obs_data_array_t *array = obs_data_item_get_array(item);
+			size_t count = obs_data_array_count(array);
+
+			for (size_t i = 0; i < count; i++) {
+				obs_data_t *obj = obs_data_array_item(array, i);
+				read_all(obj);
+				obs_data_release(obj);
+			}
+
+			obs_data_array_release(array);
+
+		} else if (type == OBS_DATA_STRING) {
+			obs_data_item_get_string(item);
+		}
+	}
+}
+
+/* ------------------------------------------------------------------------- */
+
+/* json -> binary -> json, and binary -> binary */
+static bool test_round_trip(void)
+{
+	for (int i = 0; i < ROUND_TRIPS; i++) {
+		obs_data_t *data = obs_data_create();
+		obs_data_t *json_data;
+		obs_data_t *loaded;
+		uint8_t *saved = NULL;
+		uint8_t *resaved = NULL;
+		size_t saved_size = 0;
+		size_t resaved_size = 0;
+		bool success = false;
+
+		set_random_values(data, 0);
+		json_data = obs_data_create_from_json(obs_data_get_json(data));
+
+		if (!obs_data_save_binary(json_data, TEST_FILE)) {
+			fprintf(stderr, "round trip %d: couldn't save\n", i);
+			obs_data_release(json_data);
+			obs_data_release(data);
+			return false;
+		}
+
+		saved = read_file(TEST_FILE, &saved_size);
+		loaded = obs_data_create_from_binary_file(TEST_FILE);
+
+		if (!loaded) {
+			fprintf(stderr, "round trip %d: couldn't load\n", i);
+
+		} else if (strcmp(obs_data_get_json(loaded),
+				  obs_data_get_json(json_data)) != 0) {
+			fprintf(stderr,
+				"round trip %d: got\n%s\nexpected\n%s\n", i,
+				obs_data_get_json(loaded),
+				obs_data_get_json(json_data));
+
+		} else if (!obs_data_save_binary(loaded, TEST_FILE) ||
+			   !(resaved = read_file(TEST_FILE, &resaved_size)) ||
+			   resaved_size != saved_size ||
+			   memcmp(resaved, saved, saved_size) != 0) {
+			fprintf(stderr, "round trip %d: saving what was loaded "
+					"gave a different file\n",
+				i);
+
+		} else {
+			success = true;
+		}
+
+		bfree(resaved);
+		bfree(saved);
+		obs_data_release(loaded);
+		obs_data_release(json_data);
+		obs_data_release(data);
+
+		if (!success)
+			return false;
+	}
+
+	return true;
+}
+
+/* ------------------------------------------------------------------------- */
+
+static obs_data_t *create_sources(int count, const char *prefix)
+{
+	obs_data_t *data = obs_data_create();
+	obs_data_array_t *sources = obs_data_array_create();
+	char name[64];
+
+	for (int i = 0; i < count; i++) {
+		obs_data_t *source = obs_data_create();
+		obs_data_t *settings = obs_data_create();
+
+		snprintf(name, sizeof(name), "%s %d", prefix, i);
+		obs_data_set_string(source, "name", name);
+		obs_data_set_string(settings, "file", name);
+
+		for (int j = 0; j < LAZY_SETTINGS; j++) {
+			snprintf(name, sizeof(name), "setting %d", j);
+			obs_data_set_int(settings, name, j);
+		}
+
+		obs_data_set_obj(source, "settings", settings);
+		obs_data_array_push_back(sources, source);
+
+		obs_data_release(settings);
+		obs_data_release(source);
+	}
+
+	obs_data_set_array(data, "sources", sources);
+	obs_data_array_release(sources);
+	return data;
+}
+
+static bool check_source(obs_data_t *data, size_t idx, const char *prefix)
+{
+	obs_data_array_t *sources = obs_data_get_array(data, "sources");
+	obs_data_t *source = obs_data_array_item(sources, idx);
+	obs_data_t *settings = obs_data_get_obj(source, "settings");
+	char name[64];
+	bool success;
+
+	snprintf(name, sizeof(name), "%s %d", prefix, (int)idx);
+	success = strcmp(obs_data_get_string(source, "name"), name) == 0 &&
+		  strcmp(obs_data_get_string(settings, "file"), name) == 0;
+
+	obs_data_release(settings);
+	obs_data_release(source);
+	obs_data_array_release(sources);
+	return success;
+}
+
+static bool test_lazy(void)
+{
+	obs_data_t *data = create_sources(LAZY_SOURCES, "old");
+	obs_data_t *loaded;
+	long allocs;
+	long open_allocs;
+	long source_allocs;
+	bool success = true;
+
+	obs_data_save_binary(data, TEST_FILE);
+	obs_data_release(data);
+
+	allocs = bnum_allocs();
+	loaded = obs_data_create_from_binary_file(TEST_FILE);
+	open_allocs = bnum_allocs() - allocs;
+
+	if (!loaded) {
+		fprintf(stderr, "lazy: couldn't load\n");
+		return false;
+	}
+
+	/* the file is replaced, not rewritten, so what's loaded stays.  the
+	 * array of sources is decoded to an undecoded object per source, so
+	 * reading one source allocates a little more than one per source */
+	data = create_sources(LAZY_SOURCES, "new");
+	obs_data_save_binary(data, TEST_FILE);
+	obs_data_release(data);
+
+	allocs = bnum_allocs();
+	if (!check_source(loaded, LAZY_SOURCES / 2, "old")) {
+		fprintf(stderr, "lazy: the source changed with the file\n");
+		success = false;
+	}
+	source_allocs = bnum_allocs() - allocs;
+
+	if (open_allocs > MAX_OPEN_ALLOCS ||
+	    source_allocs > MAX_SOURCE_ALLOCS) {
+		fprintf(stderr,
+			"lazy: %ld allocations kept from opening the file, "
+			"%ld from reading one of %d sources\n",
+			open_allocs, source_allocs, LAZY_SOURCES);
+		success = false;
+	}
+
+	for (size_t i = 0; i < LAZY_SOURCES; i++) {
+		if (!check_source(loaded, i, "old")) {
+			fprintf(stderr, "lazy: source %d is wrong\n", (int)i);
+			success = false;
+			break;
+		}
+	}
+
+	obs_data_release(loaded);
+	return success;
+}
+
+/* ------------------------------------------------------------------------- */
+
+static void quiet_log_handler(int lvl, const char *msg, va_list args,
+			      void *param)
+{
+	UNUSED_PARAMETER(lvl);
+	UNUSED_PARAMETER(msg);
+	UNUSED_PARAMETER(args);
+	UNUSED_PARAMETER(param);
+}
+
+static bool test_corrupt(void)
+{
+	obs_data_t *data = obs_data_create();
+	uint8_t *file;
+	uint8_t *copy;
+	size_t size = 0;
+	int rejected = 0;
+	bool success = true;
+
+	set_random_values(data, 0);
+	obs_data_save_binary(data, TEST_FILE);
+	obs_data_release(data);
+
+	file = read_file(TEST_FILE, &size);
+	if (!file) {
+		fprintf(stderr, "corrupt: couldn't read the file\n");
+		return false;
+	}
+
+	copy = bmalloc(size);
+
+	/* every file that's rejected is logged */
+	base_set_log_handler(quiet_log_handler, NULL);
+
+	for (size_t len = 0; len < size; len++) {
+		write_file(TEST_FILE, file, len);
+		data = obs_data_create_from_binary_file(TEST_FILE);
+
+		if (data) {
+			fprintf(stderr, "corrupt: loaded the first %d of %d "
+					"bytes\n",
+				(int)len, (int)size);
+			obs_data_release(data);
+			success = false;
+			break;
+		}
+	}
+
+	for (int i = 0; i < CORRUPT_COPIES; i++) {
+		int flips = 1 + random_int(3);
+
+		memcpy(copy, file, size);
+		for (int j = 0; j < flips; j++)
+			copy[random_int((int)size)] ^= 1 << random_int(8);
+
+		write_file(TEST_FILE, copy, size);
+		data = obs_data_create_from_binary_file(TEST_FILE);
+
+		if (data) {
+			read_all(data);
+			obs_data_get_json(data);
+			obs_data_save_binary(data, TEST_FILE);
+			obs_data_release(data);
+		} else {
+			rejected++;
+		}
+	}
+
+	base_set_log_handler(NULL, NULL);
+
+	printf("corrupt: %d truncated copies rejected, %d of %d copies with "
+	       "flipped bits rejected\n",
+	       (int)size, rejected, CORRUPT_COPIES);
+
+	bfree(copy);
+	bfree(file);
+	return success;
+}
+
+/* ------------------------------------------------------------------------- */
+
+/* what saving a scene collection writes for each source, with every tenth
+ * source being a scene */
+static obs_data_t *create_bench_source(int idx)
+{
+	obs_data_t *source = obs_data_create();
+	obs_data_t *settings = obs_data_create();
+	bool scene = idx % BENCH_SCENE_INTERVAL == 0;
+	char name[64];
+
+	snprintf(name, sizeof(name), "Source %d", idx);
+	obs_data_set_string(source, "name", name);
+	obs_data_set_string(source, "id", scene ? "scene" : "image_source");
+	obs_data_set_double(source, "volume", 1.0);
+	obs_data_set_bool(source, "enabled", true);
+
+	for (int i = 0; i < BENCH_SETTINGS; i++) {
+		snprintf(name, sizeof(name), "setting_%02d", i);
+		obs_data_set_string(settings, name, "value");
+	}
+
+	if (scene) {
+		obs_data_array_t *items = obs_data_array_create();
+
+		for (int i = 0; i < BENCH_SCENE_ITEMS; i++) {
+			obs_data_t *item = obs_data_create();
+
+			snprintf(name, sizeof(name), "Source %d",
+				 (idx + i) % BENCH_SOURCES);
+			obs_data_set_string(item, "name", name);
+			obs_data_set_int(item, "align", 5);
+			obs_data_set_bool(item, "visible", true);
+			obs_data_array_push_back(items, item);
+			obs_data_release(item);
+		}
+
+		obs_data_set_array(settings, "items", items);
+		obs_data_array_release(items);
+	}
+
+	obs_data_set_obj(source, "settings", settings);
+	obs_data_release(settings);
+	return source;
+}
+
+static bool save_bench_files(void)
+{
+	obs_data_t *data = obs_data_create();
+	obs_data_array_t *sources = obs_data_array_create();
+	bool success;
+
+	for (int i = 0; i < BENCH_SOURCES; i++) {
+		obs_data_t *source = create_bench_source(i);
+		obs_data_array_push_back(sources, source);
+		obs_data_release(source);
+	}
+
+	obs_data_set_array(data, "sources", sources);
+	obs_data_set_string(data, "current_scene", "Source 0");
+
+	success = obs_data_save_json(data, BENCH_JSON_FILE) &&
+		  obs_data_save_binary(data, TEST_FILE);
+
+	obs_data_array_release(sources);
+	obs_data_release(data);
+	return success;
+}
+
+static void read_names(obs_data_t *data)
+{
+	obs_data_array_t *sources = obs_data_get_array(data, "sources");
+	size_t count = obs_data_array_count(sources);
+
+	for (size_t i = 0; i < count; i++) {
+		obs_data_t *source = obs_data_array_item(sources, i);
+		obs_data_get_string(source, "name");
+		obs_data_release(source);
+	}
+
+	obs_data_array_release(sources);
+}
+
+static double bench_load(bool binary, bool everything)
+{
+	double best = 0.0;
+
+	for (int i = 0; i < BENCH_RUNS; i++) {
+		uint64_t start = os_gettime_ns();
+		obs_data_t *data;
+		double ms;
+
+		if (binary)
+			data = obs_data_create_from_binary_file(TEST_FILE);
+		else
+			data = obs_data_create_from_json_file(BENCH_JSON_FILE);
+
+		if (everything)
+			read_all(data);
+		else
+			read_names(data);
+
+		obs_data_release(data);
+
+		ms = (double)(os_gettime_ns() - start) / 1000000.0;
+		if (best == 0.0 || ms < best)
+			best = ms;
+	}
+
+	return best;
+}
+
+static void bench(void)
+{
+	if (!save_bench_files()) {
+		fprintf(stderr, "bench: couldn't save the scene collection\n");
+		return;
+	}
+
+	printf("%d sources, %.1f MB of json, %.1f MB of binary:\n"
+	       "  names       json %8.1f ms, binary %8.1f ms\n"
+	       "  everything  json %8.1f ms, binary %8.1f ms\n",
+	       BENCH_SOURCES,
+	       (double)os_get_file_size(BENCH_JSON_FILE) / (1024.0 * 1024.0),
+	       (double)os_get_file_size(TEST_FILE) / (1024.0 * 1024.0),
+	       bench_load(false, false), bench_load(true, false),
+	       bench_load(false, true), bench_load(true, true));
+
+	os_unlink(BENCH_JSON_FILE);
+	os_unlink(TEST_FILE);
+}
+
+int main(int argc, char *argv[])
+{
+	bool success = test_round_trip();
+	success = test_lazy() && success;
+	success = test_corrupt() && success;
+
+	os_unlink(TEST_FILE);
+
+	if (bnum_allocs() != 0) {
+		fprintf(stderr, "%ld allocations leaked\n", bnum_allocs());
+		success = false;
+	}
+
+	if (success && argc > 1 && strcmp(argv[1], "bench") == 0)
+		bench();
+
+	return success ? 0 : 1;
+}
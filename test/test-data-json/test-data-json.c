@@ -0,0 +1,560 @@
+/*
+ * Checks that obs_data reads and writes json byte for byte the way it did
+ * when it went through jansson.
+ *
+ * The conversions between obs_data and jansson trees below are the ones
+ * libobs used before it parsed and wrote json itself.  obs_data_get_json has
+ * to give what dumping the converted tree gives, for objects that are built
+ * with the obs_data api and for text that is parsed both ways.  Reading
+ * obs_data's output back has to give the same text again.  Usage:
+ *
+ *   test-data-json [bench]
+ *
+ * With "bench", a synthetic scene collection of 5,000 sources is also loaded
+ * and saved, both by obs_data and the jansson way, along with reading what
+ * loading the sources reads, and the best of a few runs is printed.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <jansson.h>
+
+#include <obs-data.h>
+#include <util/bmem.h>
+#include <util/platform.h>
+
+#define JSON_FLAGS (JSON_PRESERVE_ORDER | JSON_INDENT(4))
+#define TEST_FILE "test-data-json.json"
+
+#define BENCH_SOURCES 5000
+#define BENCH_SCENE_INTERVAL 10
+#define BENCH_SCENE_ITEMS 100
+#define BENCH_SETTINGS 24
+#define BENCH_RUNS 3
+
+static const char *test_input =
+	"{\"name\": \"scene \\\"1\\\"\", "
+	"\"escapes\": \"\\\\ \\/ \\b\\f\\n\\r\\t\\u0001\\u001f\\u007f\", "
+	"\"unicode\": \"\\u00e9 \\ud83d\\ude00 \xe6\x97\xa5\xe6\x9c\xac\", "
+	"\"ints\": [{\"v\": 0}, {\"v\": -1}, {\"v\": 9007199254740993}, "
+	"{\"v\": 9223372036854775807}, {\"v\": -9223372036854775808}], "
+	"\"reals\": {\"a\": 0.1, \"b\": 3.0, \"c\": -2.5e-8, \"d\": 1e300, "
+	"\"e\": -0.0, \"f\": 123456789.125}, "
+	"\"flags\": {\"on\": true, \"off\": false}, \"empty\": {}, "
+	"\"none\": [], \"null\": null, "
+	"\"mixed\": [1, {\"a\": null}, \"b\", [{}], {\"c\": [true]}], "
+	"\"nested\": {\"a\": {\"b\": {\"c\": [{\"d\": []}]}}}}";
+
+/* ------------------------------------------------------------------------- */
+/* the jansson based conversions libobs used before                          */
+
+static json_t *obs_data_to_json(obs_data_t *data);
+
+static void set_json_array(json_t *json, const char *name,
+			   obs_data_item_t *item)
+{
+	json_t *jarray = json_array();
+	obs_data_array_t *array = obs_data_item_get_array(item);
+	size_t count = obs_data_array_count(array);
+
+	for (size_t idx = 0; idx < count; idx++) {
+		obs_data_t *sub_item = obs_data_array_item(array, idx);
+		json_array_append_new(jarray, obs_data_to_json(sub_item));
+		obs_data_release(sub_item);
+	}
+
+	json_object_set_new(json, name, jarray);
+	obs_data_array_release(array);
+}
+
+static json_t *obs_data_to_json(obs_data_t *data)
+{
+	json_t *json = json_object();
+	obs_data_item_t *item;
+
+	for (item = obs_data_first(data); item; obs_data_item_next(&item)) {
+		enum obs_data_type type = obs_data_item_gettype(item);
+		const char *name = obs_data_item_get_name(item);
+		obs_data_t *obj;
+		json_t *val;
+
+		if (!obs_data_item_has_user_value(item))
+			continue;
+
+		switch (type) {
+		case OBS_DATA_STRING:
+			json_object_set_new(
+				json, name,
+				json_string(obs_data_item_get_string(item)));
+			break;
+		case OBS_DATA_NUMBER:
+			if (obs_data_item_numtype(item) == OBS_DATA_NUM_INT)
+				val = json_integer(obs_data_item_get_int(item));
+			else
+				val = json_real(obs_data_item_get_double(item));
+			json_object_set_new(json, name, val);
+			break;
+		case OBS_DATA_BOOLEAN:
+			json_object_set_new(
+				json, name,
+				json_boolean(obs_data_item_get_bool(item)));
+			break;
+		case OBS_DATA_OBJECT:
+			obj = obs_data_item_get_obj(item);
+			json_object_set_new(json, name, obs_data_to_json(obj));
+			obs_data_release(obj);
+			break;
+		case OBS_DATA_ARRAY:
+			set_json_array(json, name, item);
+			break;
+		case OBS_DATA_NULL:
+			break;
+		}
+	}
+
+	return json;
+}
+
+static void add_json_item(obs_data_t *data, const char *key, json_t *json);
+
+static void add_json_object_data(obs_data_t *data, json_t *jobj)
+{
+	const char *key;
+	json_t *jitem;
+
+	json_object_foreach (jobj, key, jitem)
+		add_json_item(data, key, jitem);
+}
+
+static void add_json_item(obs_data_t *data, const char *key, json_t *json)
+{
+	if (json_is_object(json)) {
+		obs_data_t *obj = obs_data_create();
+
+		add_json_object_data(obj, json);
+		obs_data_set_obj(data, key, obj);
+		obs_data_release(obj);
+
+	} else if (json_is_array(json)) {
+		obs_data_array_t *array = obs_data_array_create();
+		size_t idx;
+		json_t *jitem;
+
+		json_array_foreach (json, idx, jitem) {
+			obs_data_t *item;
+
+			if (!json_is_object(jitem))
+				continue;
+
+			item = obs_data_create();
+			add_json_object_data(item, jitem);
+			obs_data_array_push_back(array, item);
+			obs_data_release(item);
+		}
+
+		obs_data_set_array(data, key, array);
+		obs_data_array_release(array);
+
+	} else if (json_is_string(json)) {
+		obs_data_set_string(data, key, json_string_value(json));
+	} else if (json_is_integer(json)) {
+		obs_data_set_int(data, key, json_integer_value(json));
+	} else if (json_is_real(json)) {
+		obs_data_set_double(data, key, json_real_value(json));
+	} else if (json_is_boolean(json)) {
+		obs_data_set_bool(data, key, json_is_true(json));
+	}
+}
+
+static char *jansson_get_json(obs_data_t *data)
+{
+	json_t *root = obs_data_to_json(data);
+	char *json = json_dumps(root, JSON_FLAGS);
+
+	json_decref(root);
+	return json;
+}
+
+static obs_data_t *jansson_create_from_json(const char *text)
+{
+	json_t *root = json_loads(text, JSON_REJECT_DUPLICATES, NULL);
+	obs_data_t *data = NULL;
+
+	if (root) {
+		data = obs_data_create();
+		add_json_object_data(data, root);
+		json_decref(root);
+	}
+
+	return data;
+}
+
+/* ------------------------------------------------------------------------- */
+
+static void set_values(obs_data_t *data, int depth)
+{
+	char control[32];
+
+	for (int i = 0; i < 31; i++)
+		control[i] = (char)(i + 1);
+	control[31] = 0;
+
+	obs_data_set_string(data, "empty string", "");
+	obs_data_set_string(data, "control", control);
+	obs_data_set_string(data, "quotes", "\"quoted\" \\ / 'single'");
+	obs_data_set_string(data, "utf-8",
+			    "\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80");
+	/* jansson refused these, so they have to be left out */
+	obs_data_set_string(data, "invalid utf-8", "\xc3\x28");
+	obs_data_set_double(data, "nan", NAN);
+	obs_data_set_double(data, "inf", INFINITY);
+
+	obs_data_set_int(data, "zero", 0);
+	obs_data_set_int(data, "min", -9223372036854775807LL - 1);
+	obs_data_set_int(data, "max", 9223372036854775807LL);
+	obs_data_set_double(data, "tenth", 0.1);
+	obs_data_set_double(data, "whole", 42.0);
+	obs_data_set_double(data, "small", 5e-324);
+	obs_data_set_double(data, "large", 1.7976931348623157e308);
+	obs_data_set_double(data, "negative zero", -0.0);
+	obs_data_set_bool(data, "true", true);
+	obs_data_set_bool(data, "false", false);
+
+	/* only user values are written */
+	obs_data_set_default_int(data, "default", 1);
+	obs_data_set_default_string(data, "empty string", "default");
+
+	obs_data_t *empty = obs_data_create();
+	obs_data_set_obj(data, "empty object", empty);
+	obs_data_release(empty);
+
+	obs_data_array_t *array = obs_data_array_create();
+
+	for (int i = 0; depth < 2 && i < 3; i++) {
+		obs_data_t *item = obs_data_create();
+
+		set_values(item, depth + 1);
+		obs_data_array_push_back(array, item);
+		obs_data_release(item);
+	}
+
+	obs_data_set_array(data, "array", array);
+	obs_data_array_release(array);
+
+	if (depth < 2) {
+		obs_data_t *child = obs_data_create();
+
+		set_values(child, depth + 1);
+		obs_data_set_obj(data, "child", child);
+		obs_data_release(child);
+	}
+}
+
+static bool compare(const char *test, const char *actual, const char *expected)
+{
+	if (actual && expected && strcmp(actual, expected) == 0)
+		return true;
+
+	fprintf(stderr, "%s: got\n%s\nexpected\n%s\n", test,
+		actual ? actual : "(null)", expected ? expected : "(null)");
+	return false;
+}
+
+/* obs_data's own output has to read back and write out the same */
+static bool check_round_trip(const char *test, const char *json)
+{
+	obs_data_t *data = obs_data_create_from_json(json);
+	bool success = compare(test, obs_data_get_json(data), json);
+
+	obs_data_release(data);
+	return success;
+}
+
+static bool test_write(void)
+{
+	obs_data_t *data = obs_data_create();
+	char *expected;
+	bool success;
+
+	set_values(data, 0);
+	expected = jansson_get_json(data);
+
+	success = compare("write", obs_data_get_json(data), expected) &&
+		  check_round_trip("write round trip", expected);
+
+	free(expected);
+	obs_data_release(data);
+	return success;
+}
+
+static bool test_read(void)
+{
+	obs_data_t *data = obs_data_create_from_json(test_input);
+	obs_data_t *jansson_data = jansson_create_from_json(test_input);
+	char *expected = jansson_data ? jansson_get_json(jansson_data) : NULL;
+	bool success;
+
+	success = compare("read", obs_data_get_json(data), expected) &&
+		  check_round_trip("read round trip", expected);
+
+	free(expected);
+	obs_data_release(jansson_data);
+	obs_data_release(data);
+	return success;
+}
+
+static bool test_save(void)
+{
+	obs_data_t *data = obs_data_create_from_json(test_input);
+	char *saved = NULL;
+	bool success = false;
+
+	if (obs_data_save_json(data, TEST_FILE)) {
+		saved = os_quick_read_utf8_file(TEST_FILE);
+		success = compare("save", saved, obs_data_get_json(data));
+	} else {
+		fprintf(stderr, "save: couldn't write %s\n", TEST_FILE);
+	}
+
+	os_unlink(TEST_FILE);
+	bfree(saved);
+	obs_data_release(data);
+	return success;
+}
+
+/* ------------------------------------------------------------------------- */
+
+static const char *source_keys[] = {
+	"balance",
+	"deinterlace_field_order",
+	"deinterlace_mode",
+	"enabled",
+	"flags",
+	"monitoring_type",
+	"muted",
+	"prev_ver",
+	"push-to-mute",
+	"push-to-mute-delay",
+	"push-to-talk",
+	"push-to-talk-delay",
+	"sync",
+	"volume",
+	"mixers",
+};
+
+static const char *scene_item_keys[] = {
+	"align",
+	"bounds_align",
+	"bounds_type",
+	"crop_bottom",
+	"crop_left",
+	"crop_right",
+	"crop_top",
+	"id",
+	"locked",
+	"rot",
+	"scale_filter",
+	"visible",
+};
+
+#define NUM_SOURCE_KEYS (sizeof(source_keys) / sizeof(source_keys[0]))
+#define NUM_SCENE_ITEM_KEYS \
+	(sizeof(scene_item_keys) / sizeof(scene_item_keys[0]))
+
+static obs_data_t *create_scene_item(int source)
+{
+	obs_data_t *item = obs_data_create();
+	char name[64];
+
+	for (size_t i = 0; i < NUM_SCENE_ITEM_KEYS; i++)
+		obs_data_set_int(item, scene_item_keys[i], (long long)i);
+
+	snprintf(name, sizeof(name), "Source %d", source % BENCH_SOURCES);
+	obs_data_set_string(item, "name", name);
+	return item;
+}
+
+/* what saving a scene collection writes for each source, with every tenth
+ * source being a scene */
+static obs_data_t *create_source(int idx)
+{
+	obs_data_t *source = obs_data_create();
+	obs_data_t *settings = obs_data_create();
+	obs_data_t *hotkeys = obs_data_create();
+	obs_data_array_t *filters = obs_data_array_create();
+	bool scene = idx % BENCH_SCENE_INTERVAL == 0;
+	char name[64];
+
+	for (size_t i = 0; i < NUM_SOURCE_KEYS; i++)
+		obs_data_set_int(source, source_keys[i], (long long)i);
+
+	snprintf(name, sizeof(name), "Source %d", idx);
+	obs_data_set_string(source, "name", name);
+	obs_data_set_string(source, "id", scene ? "scene" : "image_source");
+
+	for (int i = 0; i < BENCH_SETTINGS; i++) {
+		snprintf(name, sizeof(name), "setting_%02d", i);
+		obs_data_set_string(settings, name, "value");
+	}
+
+	if (scene) {
+		obs_data_array_t *items = obs_data_array_create();
+
+		for (int i = 0; i < BENCH_SCENE_ITEMS; i++) {
+			obs_data_t *item = create_scene_item(idx + i);
+			obs_data_array_push_back(items, item);
+			obs_data_release(item);
+		}
+
+		obs_data_set_array(settings, "items", items);
+		obs_data_array_release(items);
+	}
+
+	obs_data_set_int(hotkeys, "libobs.mute", 0);
+	obs_data_set_int(hotkeys, "libobs.unmute", 0);
+
+	obs_data_set_obj(source, "settings", settings);
+	obs_data_set_obj(source, "hotkeys", hotkeys);
+	obs_data_set_array(source, "filters", filters);
+
+	obs_data_array_release(filters);
+	obs_data_release(hotkeys);
+	obs_data_release(settings);
+	return source;
+}
+
+static char *create_scene_collection(void)
+{
+	obs_data_t *root = obs_data_create();
+	obs_data_array_t *sources = obs_data_array_create();
+	char *json;
+
+	for (int i = 0; i < BENCH_SOURCES; i++) {
+		obs_data_t *source = create_source(i);
+		obs_data_array_push_back(sources, source);
+		obs_data_release(source);
+	}
+
+	obs_data_set_array(root, "sources", sources);
+	obs_data_set_string(root, "current_scene", "Source 0");
+	obs_data_set_string(root, "name", "Benchmark");
+
+	json = bstrdup(obs_data_get_json(root));
+
+	obs_data_array_release(sources);
+	obs_data_release(root);
+	return json;
+}
+
+/* roughly what loading the sources of a scene collection reads */
+static void read_sources(obs_data_t *root)
+{
+	obs_data_array_t *sources = obs_data_get_array(root, "sources");
+	size_t count = obs_data_array_count(sources);
+	char name[64];
+
+	for (size_t i = 0; i < count; i++) {
+		obs_data_t *source = obs_data_array_item(sources, i);
+		obs_data_t *settings = obs_data_get_obj(source, "settings");
+		obs_data_array_t *items = obs_data_get_array(settings, "items");
+		size_t num_items = obs_data_array_count(items);
+
+		for (size_t j = 0; j < NUM_SOURCE_KEYS; j++)
+			obs_data_get_int(source, source_keys[j]);
+		obs_data_get_string(source, "name");
+
+		for (int j = 0; j < BENCH_SETTINGS; j++) {
+			snprintf(name, sizeof(name), "setting_%02d", j);
+			obs_data_get_string(settings, name);
+		}
+
+		for (size_t j = 0; j < num_items; j++) {
+			obs_data_t *item = obs_data_array_item(items, j);
+
+			for (size_t k = 0; k < NUM_SCENE_ITEM_KEYS; k++)
+				obs_data_get_int(item, scene_item_keys[k]);
+			obs_data_release(item);
+		}
+
+		obs_data_array_release(items);
+		obs_data_release(settings);
+		obs_data_release(source);
+	}
+
+	obs_data_array_release(sources);
+}
+
+static inline double ms_since(uint64_t start)
+{
+	return (double)(os_gettime_ns() - start) / 1000000.0;
+}
+
+static inline void keep_best(double *best, double ms)
+{
+	if (*best == 0.0 || ms < *best)
+		*best = ms;
+}
+
+static void bench(void)
+{
+	char *json = create_scene_collection();
+	double load = 0.0, jansson_load = 0.0;
+	double read = 0.0;
+	double save = 0.0, jansson_save = 0.0;
+
+	for (int i = 0; i < BENCH_RUNS; i++) {
+		uint64_t start = os_gettime_ns();
+		obs_data_t *data = obs_data_create_from_json(json);
+		char *saved;
+
+		keep_best(&load, ms_since(start));
+
+		start = os_gettime_ns();
+		read_sources(data);
+		keep_best(&read, ms_since(start));
+
+		start = os_gettime_ns();
+		obs_data_get_json(data);
+		keep_best(&save, ms_since(start));
+
+		start = os_gettime_ns();
+		saved = jansson_get_json(data);
+		keep_best(&jansson_save, ms_since(start));
+
+		free(saved);
+		obs_data_release(data);
+
+		start = os_gettime_ns();
+		data = jansson_create_from_json(json);
+		keep_best(&jansson_load, ms_since(start));
+
+		obs_data_release(data);
+	}
+
+	printf("%d sources, %.1f MB of json:\n"
+	       "  load  %8.1f ms, %8.1f ms the jansson way\n"
+	       "  read  %8.1f ms\n"
+	       "  save  %8.1f ms, %8.1f ms the jansson way\n",
+	       BENCH_SOURCES, (double)strlen(json) / (1024.0 * 1024.0),
+	       load, jansson_load, read, save, jansson_save);
+
+	bfree(json);
+}
+
+int main(int argc, char *argv[])
+{
+	bool success = test_write();
+	success = test_read() && success;
+	success = test_save() && success;
+
+	if (bnum_allocs() != 0) {
+		fprintf(stderr, "%ld allocations leaked\n", bnum_allocs());
+		success = false;
+	}
+
+	if (success && argc > 1 && strcmp(argv[1], "bench") == 0)
+		bench();
+
+	return success ? 0 : 1;
+}
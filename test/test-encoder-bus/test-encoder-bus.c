@@ -0,0 +1,232 @@
+/*
+ * Tests what the encoder's packet bus does when an output stops reading.
+ *
+ * Video packets are pushed to two outputs, one of which stalls on the first
+ * packet it gets until well after the stalled output has fallen more than
+ * MAX_BUS_BACKLOG packets behind.  Pushing must never wait for it, and the
+ * other output has to get every packet in order.  The stalled output has to
+ * get the first packet and then nothing that isn't preceded by a keyframe,
+ * and every packet it doesn't get has to be reported to it as dropped, on its
+ * own callback thread, while the other output is never told of any.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+/* the outputs here are only stand-ins, what's reported to them is recorded
+ * instead */
+#define obs_output_packets_dropped test_packets_dropped
+#include <obs-encoder.c>
+#undef obs_output_packets_dropped
+
+#define PACKETS (MAX_BUS_BACKLOG * 3)
+/* paced so the output that isn't stalled can keep up */
+#define PACKET_INTERVAL_NS 250000ULL
+#define KEYFRAME_INTERVAL 120
+#define PACKET_SIZE 64
+
+#define MAX_PUSH_MS 50
+#define DRAIN_TIMEOUT_MS 5000
+
+struct test_output {
+	volatile bool stall;
+	bool stalled;
+
+	long received;
+	long reported;
+	long errors;
+	int64_t last_pts;
+	bool need_keyframe;
+	pthread_t thread;
+};
+
+void test_packets_dropped(struct obs_output *output,
+			  struct obs_encoder *encoder, uint64_t packets)
+{
+	struct test_output *out = (struct test_output *)output;
+
+	if (!pthread_equal(pthread_self(), out->thread))
+		out->errors++;
+
+	out->reported += (long)packets;
+	out->need_keyframe = true;
+
+	UNUSED_PARAMETER(encoder);
+}
+
+static void new_packet(void *param, struct encoder_packet *packet)
+{
+	struct test_output *out = param;
+
+	out->thread = pthread_self();
+
+	if (packet->pts <= out->last_pts ||
+	    (out->need_keyframe && !packet->keyframe)) {
+		if (out->errors++ == 0)
+			fprintf(stderr,
+				"output %p: got packet %lld after %lld\n",
+				param, (long long)packet->pts,
+				(long long)out->last_pts);
+	}
+
+	out->last_pts = packet->pts;
+	out->need_keyframe = false;
+	out->received++;
+
+	while (os_atomic_load_bool(&out->stall)) {
+		out->stalled = true;
+		os_sleep_ms(1);
+	}
+}
+
+static bool setup_encoder(struct obs_encoder *encoder)
+{
+	pthread_mutexattr_t attr;
+
+	memset(encoder, 0, sizeof(*encoder));
+	encoder->context.name = "test";
+	encoder->info.type = OBS_ENCODER_VIDEO;
+
+	if (pthread_mutexattr_init(&attr) != 0 ||
+	    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE) != 0)
+		return false;
+
+	return pthread_mutex_init(&encoder->callbacks_mutex, &attr) == 0 &&
+	       pthread_mutex_init(&encoder->init_mutex, &attr) == 0;
+}
+
+/* what obs_encoder_start does, without starting the encoder itself */
+static bool start_output(struct obs_encoder *encoder, struct test_output *out)
+{
+	struct encoder_callback *cb;
+
+	out->last_pts = -1;
+
+	pthread_mutex_lock(&encoder->callbacks_mutex);
+	cb = create_encoder_callback(encoder, new_packet, out);
+	if (cb)
+		da_push_back(encoder->callbacks, &cb);
+	pthread_mutex_unlock(&encoder->callbacks_mutex);
+
+	return cb != NULL;
+}
+
+static void push_packets(struct obs_encoder *encoder, uint64_t *max_push_ns)
+{
+	uint8_t data[PACKET_SIZE] = {0};
+	uint64_t next_push = os_gettime_ns();
+
+	*max_push_ns = 0;
+
+	for (int i = 0; i < PACKETS; i++) {
+		struct encoder_packet packet = {0};
+		uint64_t start;
+		uint64_t push_ns;
+
+		os_sleepto_ns(next_push);
+		next_push += PACKET_INTERVAL_NS;
+		start = os_gettime_ns();
+
+		packet.data = data;
+		packet.size = sizeof(data);
+		packet.type = OBS_ENCODER_VIDEO;
+		packet.pts = packet.dts = i;
+		packet.timebase_num = 1;
+		packet.timebase_den = 60;
+		packet.keyframe = i % KEYFRAME_INTERVAL == 0;
+		packet.encoder = encoder;
+
+		push_bus_packet(encoder, &packet);
+
+		push_ns = os_gettime_ns() - start;
+		if (push_ns > *max_push_ns)
+			*max_push_ns = push_ns;
+	}
+}
+
+static bool wait_for_output(struct obs_encoder *encoder,
+			    struct test_output *out)
+{
+	uint64_t timeout = os_gettime_ns() + DRAIN_TIMEOUT_MS * 1000000ULL;
+
+	for (;;) {
+		uint64_t packets = 0;
+		uint64_t bytes = 0;
+
+		obs_encoder_get_backlog(encoder, out, &packets, &bytes);
+		if (!packets)
+			break;
+		if (os_gettime_ns() > timeout)
+			return false;
+
+		os_sleep_ms(1);
+	}
+
+	/* the last packet may still be being handed over */
+	os_sleep_ms(50);
+	return true;
+}
+
+int main(void)
+{
+	struct obs_encoder encoder;
+	struct test_output outputs[2] = {0};
+	struct test_output *out = &outputs[0];
+	struct test_output *stalled = &outputs[1];
+	uint64_t max_push_ns;
+	bool success = true;
+
+	if (!setup_encoder(&encoder) || !start_output(&encoder, out) ||
+	    !start_output(&encoder, stalled)) {
+		fprintf(stderr, "couldn't start the outputs\n");
+		return 1;
+	}
+
+	os_atomic_set_bool(&stalled->stall, true);
+	push_packets(&encoder, &max_push_ns);
+
+	if (!wait_for_output(&encoder, out)) {
+		fprintf(stderr, "output timed out\n");
+		success = false;
+	}
+
+	os_atomic_set_bool(&stalled->stall, false);
+
+	if (!wait_for_output(&encoder, stalled)) {
+		fprintf(stderr, "stalled output timed out\n");
+		success = false;
+	}
+
+	printf("%d packets pushed, longest push %.3f ms, output got %ld, "
+	       "stalled output got %ld and was told %ld were dropped\n",
+	       PACKETS, (double)max_push_ns / 1000000.0, out->received,
+	       stalled->received, stalled->reported);
+
+	if (max_push_ns > MAX_PUSH_MS * 1000000ULL) {
+		fprintf(stderr, "pushing a packet took %.1f ms\n",
+			(double)max_push_ns / 1000000.0);
+		success = false;
+	}
+	if (out->received != PACKETS || out->reported || out->errors) {
+		fprintf(stderr,
+			"output got %ld packets, expected %d, %ld reported "
+			"dropped, %ld errors\n",
+			out->received, PACKETS, out->reported, out->errors);
+		success = false;
+	}
+	if (!stalled->stalled || stalled->received < 2 ||
+	    stalled->received + stalled->reported != PACKETS ||
+	    stalled->errors) {
+		fprintf(stderr,
+			"stalled output got %ld packets and %ld reported "
+			"dropped, expected %d in total, %ld errors\n",
+			stalled->received, stalled->reported, PACKETS,
+			stalled->errors);
+		success = false;
+	}
+
+	destroy_encoder_callbacks(&encoder);
+	pthread_mutex_destroy(&encoder.init_mutex);
+	pthread_mutex_destroy(&encoder.callbacks_mutex);
+	return success ? 0 : 1;
+}
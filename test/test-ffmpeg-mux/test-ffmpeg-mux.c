@@ -0,0 +1,272 @@
+/*
+ * Tests changing file in ffmpeg-mux, the way a split recording does.
+ *
+ * The muxer is given the headers on stdin like OBS gives them, and a status
+ * pipe.  Packets are then fed to it directly.  Changing to a file that can't
+ * be opened has to be reported as a failure and leave the current file being
+ * written, changing to one that can has to be reported as done.  The files
+ * are read back afterwards, and the second one has to start at the same
+ * timestamps as the first.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#define main ffmpeg_mux_main
+#include "ffmpeg-mux.c"
+#undef main
+
+#define FPS 30
+#define SAMPLE_RATE 48000
+#define AUDIO_FRAMES 1152
+
+#define FIRST_FILE "test-ffmpeg-mux.nut"
+#define SECOND_FILE "test-ffmpeg-mux_001.nut"
+#define BAD_FILE "test-ffmpeg-mux-missing/test-ffmpeg-mux_001.nut"
+
+/* frames at which the file is changed, the first change fails */
+#define BAD_CHANGE_FRAME 30
+#define CHANGE_FRAME 60
+#define FRAMES 90
+
+static const uint8_t packet_data[] = {0x00, 0x00, 0x01, 0xb3, 0x12, 0x34};
+
+static void write_header(FILE *file, enum ffm_packet_type type, uint32_t idx)
+{
+	struct ffm_packet_info info = {0};
+
+	info.type = type;
+	info.index = idx;
+	info.size = sizeof(packet_data);
+
+	fwrite(&info, sizeof(info), 1, file);
+	fwrite(packet_data, 1, sizeof(packet_data), file);
+}
+
+/* ffmpeg-mux reads the headers from stdin when it starts */
+static bool set_headers(void)
+{
+	int fds[2];
+	FILE *file;
+
+	if (pipe(fds) != 0)
+		return false;
+
+	file = fdopen(fds[1], "wb");
+	write_header(file, FFM_PACKET_VIDEO, 0);
+	write_header(file, FFM_PACKET_AUDIO, 0);
+	fclose(file);
+
+	dup2(fds[0], STDIN_FILENO);
+	close(fds[0]);
+	return true;
+}
+
+static bool send_packet(struct ffmpeg_mux *ffm, enum ffm_packet_type type,
+			int64_t ts, bool keyframe)
+{
+	struct ffm_packet_info info = {0};
+	uint8_t data[sizeof(packet_data)];
+
+	memcpy(data, packet_data, sizeof(data));
+
+	info.type = type;
+	info.pts = info.dts = ts;
+	info.size = sizeof(data);
+	info.keyframe = keyframe;
+	return ffmpeg_mux_packet(ffm, data, &info);
+}
+
+static bool change_file(struct ffmpeg_mux *ffm, const char *path)
+{
+	struct ffm_packet_info info = {0};
+
+	info.type = FFM_PACKET_CHANGE_FILE;
+	info.size = (uint32_t)strlen(path) + 1;
+	return ffmpeg_mux_packet(ffm, (uint8_t *)path, &info);
+}
+
+static bool check_status(int fd, enum ffm_status expected)
+{
+	uint8_t status = 0;
+
+	if (read(fd, &status, 1) != 1) {
+		fprintf(stderr, "no status reported\n");
+		return false;
+	}
+	if (status != expected) {
+		fprintf(stderr, "status %d reported, expected %d\n",
+			(int)status, (int)expected);
+		return false;
+	}
+
+	return true;
+}
+
+/* a frame's worth of audio follows each frame of video */
+static bool send_frame(struct ffmpeg_mux *ffm, int frame, int64_t *samples)
+{
+	int64_t end = (int64_t)(frame + 1) * SAMPLE_RATE / FPS;
+
+	if (!send_packet(ffm, FFM_PACKET_VIDEO, frame, frame % FPS == 0))
+		return false;
+
+	for (; *samples < end; *samples += AUDIO_FRAMES) {
+		if (!send_packet(ffm, FFM_PACKET_AUDIO, *samples, false))
+			return false;
+	}
+
+	return true;
+}
+
+static bool write_files(int status_fd, char *status_arg)
+{
+	/* file, video and audio tracks, video codec, bitrate, size and fps,
+	 * audio codec, name, bitrate, sample rate and channels, muxer
+	 * settings */
+	char *argv[] = {"ffmpeg-mux", FIRST_FILE, "1", "1", "mpeg2video",
+			"1000", "64", "64", "30", "1", "mp2", "audio", "128",
+			"48000", "2", "", status_arg};
+	struct ffmpeg_mux ffm = {0};
+	int64_t samples = 0;
+	bool success = false;
+
+	if (ffmpeg_mux_init(&ffm, sizeof(argv) / sizeof(argv[0]), argv) !=
+	    FFM_SUCCESS) {
+		fprintf(stderr, "couldn't initialize the muxer\n");
+		return false;
+	}
+
+	for (int frame = 0; frame < FRAMES; frame++) {
+		if (frame == BAD_CHANGE_FRAME) {
+			if (change_file(&ffm, BAD_FILE)) {
+				fprintf(stderr, "changed to %s\n", BAD_FILE);
+				goto fail;
+			}
+			if (!check_status(status_fd,
+					  FFM_STATUS_FILE_CHANGE_FAILED))
+				goto fail;
+		}
+
+		if (frame == CHANGE_FRAME) {
+			if (!change_file(&ffm, SECOND_FILE)) {
+				fprintf(stderr, "couldn't change to %s\n",
+					SECOND_FILE);
+				goto fail;
+			}
+			if (!check_status(status_fd, FFM_STATUS_FILE_CHANGED))
+				goto fail;
+		}
+
+		if (!send_frame(&ffm, frame, &samples)) {
+			fprintf(stderr, "couldn't write frame %d\n", frame);
+			goto fail;
+		}
+	}
+
+	success = true;
+
+fail:
+	ffmpeg_mux_free(&ffm);
+	return success;
+}
+
+struct file_info {
+	int video_packets;
+	int64_t first_video_dts;
+	int64_t first_audio_dts;
+};
+
+static bool read_file(const char *path, struct file_info *fi)
+{
+	AVFormatContext *context = NULL;
+	AVPacket packet;
+
+	fi->video_packets = 0;
+	fi->first_video_dts = AV_NOPTS_VALUE;
+	fi->first_audio_dts = AV_NOPTS_VALUE;
+
+	if (avformat_open_input(&context, path, NULL, NULL) < 0) {
+		fprintf(stderr, "couldn't open %s\n", path);
+		return false;
+	}
+
+	while (av_read_frame(context, &packet) >= 0) {
+		AVStream *stream = context->streams[packet.stream_index];
+
+		if (stream->codecpar->codec_type == AVMEDIA_TYPE_VIDEO) {
+			if (!fi->video_packets++)
+				fi->first_video_dts = packet.dts;
+		} else if (fi->first_audio_dts == AV_NOPTS_VALUE) {
+			fi->first_audio_dts = packet.dts;
+		}
+
+		av_packet_unref(&packet);
+	}
+
+	avformat_close_input(&context);
+	return true;
+}
+
+static bool check_files(void)
+{
+	struct file_info first;
+	struct file_info second;
+
+	if (!read_file(FIRST_FILE, &first) || !read_file(SECOND_FILE, &second))
+		return false;
+
+	if (first.video_packets != CHANGE_FRAME ||
+	    second.video_packets != FRAMES - CHANGE_FRAME) {
+		fprintf(stderr,
+			"files have %d and %d frames, expected %d and %d\n",
+			first.video_packets, second.video_packets,
+			CHANGE_FRAME, FRAMES - CHANGE_FRAME);
+		return false;
+	}
+
+	if (second.first_video_dts != first.first_video_dts ||
+	    second.first_audio_dts < first.first_audio_dts) {
+		fprintf(stderr,
+			"second file starts at %lld/%lld, first at %lld/%lld\n",
+			(long long)second.first_video_dts,
+			(long long)second.first_audio_dts,
+			(long long)first.first_video_dts,
+			(long long)first.first_audio_dts);
+		return false;
+	}
+
+	return true;
+}
+
+int main(void)
+{
+	char status_arg[32];
+	int status_fds[2];
+	bool success;
+
+	if (!set_headers() || pipe(status_fds) != 0) {
+		fprintf(stderr, "couldn't create pipes\n");
+		return 1;
+	}
+
+	/* the status is written before the muxer returns from the change */
+	fcntl(status_fds[0], F_SETFL, O_NONBLOCK);
+
+	snprintf(status_arg, sizeof(status_arg), FFM_STATUS_PREFIX "%d",
+		 status_fds[1]);
+
+	/* the muxer closes the write end when it's freed */
+	success = write_files(status_fds[0], status_arg) && check_files();
+
+	close(status_fds[0]);
+	remove(FIRST_FILE);
+	remove(SECOND_FILE);
+
+	if (success)
+		printf("changed file\n");
+	return success ? 0 : 1;
+}
@@ -0,0 +1,433 @@
+/*
+ * Compares the AVX2 format conversion functions against the SSE2/C versions
+ * they replace at runtime.  Both are run on the same random input with a
+ * range of widths (to cover the scalar tails of the AVX2 loops) and starting
+ * lines (to cover the way video-io splits frames between threads), and the
+ * output has to match byte for byte, padding included.
+ *
+ * Exits with 77 (skipped) when the CPU doesn't support AVX2.  Usage:
+ *
+ *   test-format-conversion [bench]
+ *
+ * With "bench", every function is also timed with both versions on whole
+ * 720p, 1080p and 4K frames after the outputs have been compared, and the
+ * average time per frame is printed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <util/bmem.h>
+#include <util/platform.h>
+
+#include <media-io/format-conversion.c>
+
+#if FORMAT_CONVERSION_HAS_AVX2
+
+#define MAX_PLANES 3
+
+struct buffers {
+	uint8_t *in[MAX_PLANES];
+	uint8_t *out[MAX_PLANES];
+	uint8_t *ref[MAX_PLANES];
+	size_t in_size[MAX_PLANES];
+	size_t out_size[MAX_PLANES];
+};
+
+static uint32_t rand_state = 0x12345678;
+
+static inline uint8_t next_rand(void)
+{
+	rand_state = rand_state * 1664525 + 1013904223;
+	return (uint8_t)(rand_state >> 24);
+}
+
+/* linesizes are not always in the units the functions expect (decompress_422
+ * treats its linesizes as a pixel count), so every buffer gets far more
+ * space than it needs rather than trying to reproduce that here */
+static void buffers_init(struct buffers *b, size_t size)
+{
+	memset(b, 0, sizeof(*b));
+
+	for (size_t i = 0; i < MAX_PLANES; i++) {
+		b->in_size[i] = size;
+		b->out_size[i] = size;
+		b->in[i] = bmalloc(size);
+		b->out[i] = bmalloc(size);
+		b->ref[i] = bmalloc(size);
+
+		for (size_t j = 0; j < size; j++)
+			b->in[i][j] = next_rand();
+	}
+}
+
+static void buffers_reset_output(struct buffers *b)
+{
+	for (size_t i = 0; i < MAX_PLANES; i++) {
+		memset(b->out[i], 0xCD, b->out_size[i]);
+		memset(b->ref[i], 0xCD, b->out_size[i]);
+	}
+}
+
+static void buffers_free(struct buffers *b)
+{
+	for (size_t i = 0; i < MAX_PLANES; i++) {
+		bfree(b->in[i]);
+		bfree(b->out[i]);
+		bfree(b->ref[i]);
+	}
+}
+
+static bool compare(const struct buffers *b, const char *name, uint32_t width,
+		    uint32_t height, uint32_t start_y)
+{
+	for (size_t i = 0; i < MAX_PLANES; i++) {
+		for (size_t j = 0; j < b->out_size[i]; j++) {
+			if (b->out[i][j] != b->ref[i][j]) {
+				fprintf(stderr,
+					"%s: %ux%u (start_y %u), plane %d "
+					"byte %d: avx2 0x%02X, reference "
+					"0x%02X\n",
+					name, width, height, start_y, (int)i,
+					(int)j, b->out[i][j], b->ref[i][j]);
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+typedef void (*compress_func_t)(const uint8_t *input, uint32_t in_linesize,
+				uint32_t start_y, uint32_t end_y,
+				uint8_t *output[],
+				const uint32_t out_linesize[]);
+
+static bool test_compress(struct buffers *b, const char *name,
+			  compress_func_t avx2, compress_func_t ref,
+			  uint32_t width, uint32_t height, uint32_t start_y,
+			  bool full_chroma)
+{
+	uint32_t in_linesize = width * 4;
+	uint32_t out_linesize[MAX_PLANES] = {width, width, width};
+
+	if (!full_chroma) {
+		out_linesize[1] = width / 2;
+		out_linesize[2] = width / 2;
+	}
+
+	buffers_reset_output(b);
+	avx2(b->in[0], in_linesize, start_y, height, b->out, out_linesize);
+	ref(b->in[0], in_linesize, start_y, height, b->ref, out_linesize);
+	return compare(b, name, width, height, start_y);
+}
+
+static bool test_nv12(struct buffers *b, const char *name, uint32_t width,
+		      uint32_t height, uint32_t start_y)
+{
+	uint32_t in_linesize = width * 4;
+	uint32_t out_linesize[MAX_PLANES] = {width, width, 0};
+
+	buffers_reset_output(b);
+	compress_uyvx_to_nv12_avx2(b->in[0], in_linesize, start_y, height,
+				   b->out, out_linesize);
+	compress_uyvx_to_nv12_sse2(b->in[0], in_linesize, start_y, height,
+				   b->ref, out_linesize);
+	return compare(b, name, width, height, start_y);
+}
+
+typedef void (*decompress_func_t)(const uint8_t *const input[],
+				  const uint32_t in_linesize[],
+				  uint32_t start_y, uint32_t end_y,
+				  uint8_t *output, uint32_t out_linesize);
+
+static bool test_decompress(struct buffers *b, const char *name,
+			    decompress_func_t avx2, decompress_func_t ref,
+			    uint32_t width, uint32_t height, uint32_t start_y,
+			    bool nv12)
+{
+	const uint8_t *const input[MAX_PLANES] = {b->in[0], b->in[1],
+						  b->in[2]};
+	uint32_t in_linesize[MAX_PLANES] = {width, width / 2, width / 2};
+	uint32_t out_linesize = width * 4;
+
+	if (nv12)
+		in_linesize[1] = width;
+
+	buffers_reset_output(b);
+	avx2(input, in_linesize, start_y, height, b->out[0], out_linesize);
+	ref(input, in_linesize, start_y, height, b->ref[0], out_linesize);
+	return compare(b, name, width, height, start_y);
+}
+
+static bool test_422(struct buffers *b, uint32_t width, uint32_t height,
+		     uint32_t start_y, bool leading_lum)
+{
+	uint32_t in_linesize = width * 2;
+	uint32_t out_linesize = width * 4;
+	const char *name = leading_lum ? "decompress_422 (yuy2)"
+				       : "decompress_422 (uyvy)";
+
+	buffers_reset_output(b);
+	decompress_422_avx2(b->in[0], in_linesize, start_y, height, b->out[0],
+			    out_linesize, leading_lum);
+	decompress_422_c(b->in[0], in_linesize, start_y, height, b->ref[0],
+			 out_linesize, leading_lum);
+	return compare(b, name, width, height, start_y);
+}
+
+static bool test_size(struct buffers *b, uint32_t width, uint32_t height,
+		      uint32_t start_y)
+{
+	bool success = true;
+
+	success &= test_compress(b, "compress_uyvx_to_i420",
+				 compress_uyvx_to_i420_avx2,
+				 compress_uyvx_to_i420_sse2, width, height,
+				 start_y, false);
+	success &= test_nv12(b, "compress_uyvx_to_nv12", width, height,
+			     start_y);
+	success &= test_compress(b, "convert_uyvx_to_i444",
+				 convert_uyvx_to_i444_avx2,
+				 convert_uyvx_to_i444_sse2, width, height,
+				 start_y, true);
+	success &= test_decompress(b, "decompress_420", decompress_420_avx2,
+				   decompress_420_c, width, height, start_y,
+				   false);
+	success &= test_decompress(b, "decompress_nv12", decompress_nv12_avx2,
+				   decompress_nv12_c, width, height, start_y,
+				   true);
+	success &= test_422(b, width, height, start_y, true);
+	success &= test_422(b, width, height, start_y, false);
+	return success;
+}
+
+/* ------------------------------------------------------------------------- */
+/* benchmark                                                                 */
+
+enum bench_func {
+	BENCH_I420,
+	BENCH_NV12,
+	BENCH_I444,
+	BENCH_DECOMPRESS_420,
+	BENCH_DECOMPRESS_NV12,
+	BENCH_DECOMPRESS_422,
+	BENCH_COUNT
+};
+
+static const char *bench_names[BENCH_COUNT] = {
+	"compress_uyvx_to_i420", "compress_uyvx_to_nv12",
+	"convert_uyvx_to_i444",  "decompress_420",
+	"decompress_nv12",       "decompress_422",
+};
+
+struct bench_frame {
+	uint32_t width;
+	uint32_t height;
+	uint8_t *in[MAX_PLANES];
+	uint8_t *out[MAX_PLANES];
+};
+
+/* packed planes get room for 8 bytes per pixel and the planar ones for 4,
+ * with a couple of lines to spare, for the same reason as buffers_init */
+static void bench_frame_init(struct bench_frame *f, uint32_t width,
+			     uint32_t height)
+{
+	size_t packed_size = (size_t)width * (height + 2) * 8;
+	size_t planar_size = (size_t)width * (height + 2) * 4;
+
+	f->width = width;
+	f->height = height;
+
+	for (size_t i = 0; i < MAX_PLANES; i++) {
+		size_t size = i == 0 ? packed_size : planar_size;
+
+		f->in[i] = bmalloc(size);
+		f->out[i] = bzalloc(size);
+
+		for (size_t j = 0; j < size; j++)
+			f->in[i][j] = next_rand();
+	}
+}
+
+static void bench_frame_free(struct bench_frame *f)
+{
+	for (size_t i = 0; i < MAX_PLANES; i++) {
+		bfree(f->in[i]);
+		bfree(f->out[i]);
+	}
+}
+
+static void bench_run(struct bench_frame *f, enum bench_func func, bool avx2)
+{
+	const uint8_t *const input[MAX_PLANES] = {f->in[0], f->in[1],
+						  f->in[2]};
+	uint32_t width = f->width;
+	uint32_t height = f->height;
+	uint32_t packed_linesize = width * 4;
+	uint32_t linesize[MAX_PLANES] = {width, width / 2, width / 2};
+	compress_func_t compress = NULL;
+	decompress_func_t decompress = NULL;
+
+	switch (func) {
+	case BENCH_I420:
+		compress = avx2 ? compress_uyvx_to_i420_avx2
+				: compress_uyvx_to_i420_sse2;
+		break;
+	case BENCH_NV12:
+		linesize[1] = width;
+		compress = avx2 ? compress_uyvx_to_nv12_avx2
+				: compress_uyvx_to_nv12_sse2;
+		break;
+	case BENCH_I444:
+		linesize[1] = linesize[2] = width;
+		compress = avx2 ? convert_uyvx_to_i444_avx2
+				: convert_uyvx_to_i444_sse2;
+		break;
+	case BENCH_DECOMPRESS_420:
+		decompress = avx2 ? decompress_420_avx2 : decompress_420_c;
+		break;
+	case BENCH_DECOMPRESS_NV12:
+		linesize[1] = width;
+		decompress = avx2 ? decompress_nv12_avx2 : decompress_nv12_c;
+		break;
+	case BENCH_DECOMPRESS_422:
+		if (avx2)
+			decompress_422_avx2(f->in[0], width * 2, 0, height,
+					    f->out[0], packed_linesize, true);
+		else
+			decompress_422_c(f->in[0], width * 2, 0, height,
+					 f->out[0], packed_linesize, true);
+		break;
+	case BENCH_COUNT:
+		break;
+	}
+
+	if (compress)
+		compress(f->in[0], packed_linesize, 0, height, f->out,
+			 linesize);
+	else if (decompress)
+		decompress(input, linesize, 0, height, f->out[0],
+			   packed_linesize);
+}
+
+static double bench_time_ms(struct bench_frame *f, enum bench_func func,
+			    bool avx2, int frames)
+{
+	uint64_t start;
+
+	/* once untimed so both versions start with the buffers paged in */
+	bench_run(f, func, avx2);
+
+	start = os_gettime_ns();
+	for (int i = 0; i < frames; i++)
+		bench_run(f, func, avx2);
+
+	return (double)(os_gettime_ns() - start) / 1000000.0 / frames;
+}
+
+static void bench(void)
+{
+	static const struct {
+		const char *name;
+		uint32_t width;
+		uint32_t height;
+	} sizes[] = {
+		{"720p", 1280, 720},
+		{"1080p", 1920, 1080},
+		{"4K", 3840, 2160},
+	};
+
+	printf("%-24s %6s %10s %10s %8s\n", "function", "size", "sse2/c ms",
+	       "avx2 ms", "speedup");
+
+	for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		struct bench_frame f;
+
+		/* about two seconds of 1080p60 worth of pixels per run */
+		int frames = (int)(1920ULL * 1080 * 120 /
+				   ((uint64_t)sizes[i].width * sizes[i].height));
+
+		bench_frame_init(&f, sizes[i].width, sizes[i].height);
+
+		for (int func = 0; func < BENCH_COUNT; func++) {
+			double ref_ms = bench_time_ms(&f, func, false, frames);
+			double avx2_ms = bench_time_ms(&f, func, true, frames);
+
+			printf("%-24s %6s %10.3f %10.3f %7.2fx\n",
+			       bench_names[func], sizes[i].name, ref_ms,
+			       avx2_ms, ref_ms / avx2_ms);
+		}
+
+		bench_frame_free(&f);
+	}
+}
+
+/* ------------------------------------------------------------------------- */
+
+int main(int argc, char *argv[])
+{
+	static const uint32_t large_widths[] = {640, 1276, 1280, 1916, 1920};
+	struct buffers b;
+	bool success = true;
+	int tests = 0;
+
+	if (!os_cpu_has_avx2()) {
+		printf("CPU does not support AVX2, skipping\n");
+		return 77;
+	}
+
+	/* the largest case is 1920 pixels * 8 bytes * 8 lines */
+	buffers_init(&b, 1920 * 8 * 8 * 2);
+
+	/* every width up to a few full AVX2 iterations, the compress functions
+	 * (like their SSE2 counterparts) work four pixels at a time */
+	for (uint32_t width = 4; width <= 96; width += 4) {
+		for (uint32_t start_y = 0; start_y < 4; start_y += 2) {
+			success &= test_size(&b, width, 8, start_y);
+			tests++;
+		}
+	}
+
+	for (size_t i = 0; i < sizeof(large_widths) / sizeof(uint32_t); i++) {
+		success &= test_size(&b, large_widths[i], 8, 2);
+		tests++;
+	}
+
+	/* the decompress functions handle any even width */
+	for (uint32_t width = 2; width <= 64; width += 2) {
+		success &= test_decompress(&b, "decompress_420",
+					   decompress_420_avx2,
+					   decompress_420_c, width, 6, 0,
+					   false);
+		success &= test_decompress(&b, "decompress_nv12",
+					   decompress_nv12_avx2,
+					   decompress_nv12_c, width, 6, 0,
+					   true);
+		success &= test_422(&b, width, 6, 0, true);
+		success &= test_422(&b, width, 6, 0, false);
+		tests++;
+	}
+
+	buffers_free(&b);
+
+	printf("%d sizes tested, %s\n", tests,
+	       success ? "all outputs match" : "OUTPUTS DIFFER");
+
+	if (success && argc > 1 && strcmp(argv[1], "bench") == 0)
+		bench();
+
+	return success ? 0 : 1;
+}
+
+#else
+
+int main(void)
+{
+	printf("AVX2 conversions are not built for this architecture, "
+	       "skipping\n");
+	return 77;
+}
+
+#endif
@@ -0,0 +1,199 @@
+#include <inttypes.h>
+#include <string.h>
+#include <util/threading.h>
+#include <util/platform.h>
+#include <obs.h>
+
+/* Outputs 3840x2160 NV12 frames at 60fps, either copied with
+ * obs_source_output_video or handed over with
+ * obs_source_output_video_external, and logs how long the output call takes
+ * so the two paths can be compared. */
+
+#define ASYNC_4K_WIDTH 3840
+#define ASYNC_4K_HEIGHT 2160
+#define ASYNC_4K_BUFFERS 8
+#define ASYNC_4K_LOG_INTERVAL 300
+
+struct async_4k_buffer {
+	struct obs_source_frame *frame;
+	volatile bool in_use;
+};
+
+struct async_4k {
+	obs_source_t *source;
+	os_event_t *stop_signal;
+	pthread_t thread;
+	bool initialized;
+
+	volatile bool zero_copy;
+	struct async_4k_buffer buffers[ASYNC_4K_BUFFERS];
+
+	uint64_t output_time;
+	uint32_t output_count;
+	uint32_t dropped_count;
+};
+
+static const char *async_4k_getname(void *unused)
+{
+	UNUSED_PARAMETER(unused);
+	return "4K Async Frame Source (Test)";
+}
+
+static void async_4k_release(void *param)
+{
+	struct async_4k_buffer *buf = param;
+	os_atomic_set_bool(&buf->in_use, false);
+}
+
+static void async_4k_destroy(void *data)
+{
+	struct async_4k *s = data;
+
+	if (s) {
+		if (s->initialized) {
+			os_event_signal(s->stop_signal);
+			pthread_join(s->thread, NULL);
+		}
+
+		for (size_t i = 0; i < ASYNC_4K_BUFFERS; i++)
+			obs_source_frame_destroy(s->buffers[i].frame);
+
+		os_event_destroy(s->stop_signal);
+		bfree(s);
+	}
+}
+
+static struct async_4k_buffer *get_free_buffer(struct async_4k *s)
+{
+	for (size_t i = 0; i < ASYNC_4K_BUFFERS; i++) {
+		struct async_4k_buffer *buf = &s->buffers[i];
+		if (!os_atomic_load_bool(&buf->in_use))
+			return buf;
+	}
+
+	return NULL;
+}
+
+static void fill_frame(struct obs_source_frame *frame, uint32_t count)
+{
+	uint32_t bar = (count * 16) % frame->height;
+
+	memset(frame->data[0], 16, frame->linesize[0] * frame->height);
+	memset(frame->data[1], 128, frame->linesize[1] * frame->height / 2);
+
+	for (uint32_t y = bar; y < bar + 16 && y < frame->height; y++)
+		memset(frame->data[0] + y * frame->linesize[0], 235,
+		       frame->linesize[0]);
+}
+
+static void output_frame(struct async_4k *s, struct async_4k_buffer *buf)
+{
+	bool zero_copy = os_atomic_load_bool(&s->zero_copy);
+	uint64_t start = os_gettime_ns();
+
+	if (zero_copy) {
+		os_atomic_set_bool(&buf->in_use, true);
+		obs_source_output_video_external(s->source, buf->frame,
+						 async_4k_release, buf);
+	} else {
+		obs_source_output_video(s->source, buf->frame);
+	}
+
+	s->output_time += os_gettime_ns() - start;
+
+	if (++s->output_count == ASYNC_4K_LOG_INTERVAL) {
+		blog(LOG_INFO,
+		     "[4K async test] %s: %.3f ms per frame output, "
+		     "%" PRIu32 " frames dropped",
+		     zero_copy ? "zero-copy" : "copy",
+		     (double)s->output_time / (double)s->output_count /
+			     1000000.0,
+		     s->dropped_count);
+		s->output_time = 0;
+		s->output_count = 0;
+		s->dropped_count = 0;
+	}
+}
+
+static void *async_4k_thread(void *data)
+{
+	struct async_4k *s = data;
+	uint64_t cur_time = os_gettime_ns();
+	uint32_t count = 0;
+
+	while (os_event_try(s->stop_signal) == EAGAIN) {
+		struct async_4k_buffer *buf = get_free_buffer(s);
+
+		if (buf) {
+			fill_frame(buf->frame, count);
+			buf->frame->timestamp = cur_time;
+			output_frame(s, buf);
+		} else {
+			s->dropped_count++;
+		}
+
+		count++;
+		os_sleepto_ns(cur_time += 16666667);
+	}
+
+	return NULL;
+}
+
+static void async_4k_update(void *data, obs_data_t *settings)
+{
+	struct async_4k *s = data;
+	os_atomic_set_bool(&s->zero_copy,
+			   obs_data_get_bool(settings, "zero_copy"));
+}
+
+static void *async_4k_create(obs_data_t *settings, obs_source_t *source)
+{
+	struct async_4k *s = bzalloc(sizeof(struct async_4k));
+	s->source = source;
+
+	for (size_t i = 0; i < ASYNC_4K_BUFFERS; i++) {
+		struct obs_source_frame *frame = obs_source_frame_create(
+			VIDEO_FORMAT_NV12, ASYNC_4K_WIDTH, ASYNC_4K_HEIGHT);
+		video_format_get_parameters(VIDEO_CS_709, VIDEO_RANGE_PARTIAL,
+					    frame->color_matrix,
+					    frame->color_range_min,
+					    frame->color_range_max);
+
+		s->buffers[i].frame = frame;
+	}
+
+	async_4k_update(s, settings);
+
+	if (os_event_init(&s->stop_signal, OS_EVENT_TYPE_MANUAL) != 0) {
+		async_4k_destroy(s);
+		return NULL;
+	}
+
+	if (pthread_create(&s->thread, NULL, async_4k_thread, s) != 0) {
+		async_4k_destroy(s);
+		return NULL;
+	}
+
+	s->initialized = true;
+	return s;
+}
+
+static obs_properties_t *async_4k_properties(void *unused)
+{
+	obs_properties_t *props = obs_properties_create();
+	obs_properties_add_bool(props, "zero_copy", "Zero-copy output");
+
+	UNUSED_PARAMETER(unused);
+	return props;
+}
+
+struct obs_source_info test_async_4k = {
+	.id = "test_async_4k",
+	.type = OBS_SOURCE_TYPE_INPUT,
+	.output_flags = OBS_SOURCE_ASYNC_VIDEO,
+	.get_name = async_4k_getname,
+	.create = async_4k_create,
+	.destroy = async_4k_destroy,
+	.update = async_4k_update,
+	.get_properties = async_4k_properties,
+};
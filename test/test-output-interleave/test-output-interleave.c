@@ -0,0 +1,315 @@
+/*
+ * Regression test for the order in which outputs send interleaved packets.
+ *
+ * Packets are fed to obs-output.c's interleave_packets for an output with one
+ * video and two audio tracks, and the order they come out in is checked:
+ *
+ *   - against a fixed sequence with equal timestamps across all tracks and
+ *     with one run of audio arriving after video has gone ahead of it, where
+ *     video goes before audio at the same timestamp and audio tracks keep
+ *     the order they arrived in
+ *   - against the linear insertion the interleave buffer used before it was
+ *     a heap, for random sequences with many equal timestamps and late
+ *     audio on either track
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <obs-output.c>
+
+#define RANDOM_RUNS 500
+#define RANDOM_PACKETS 600
+
+/* --------------------------------------------------------------------- */
+/* test output                                                           */
+
+static DARRAY(int) sent;
+
+static void encoded_packet(void *data, struct encoder_packet *packet)
+{
+	int id = *(int *)packet->data;
+	da_push_back(sent, &id);
+
+	UNUSED_PARAMETER(data);
+}
+
+static struct obs_encoder video_encoder;
+static struct obs_encoder audio_encoders[2];
+
+static void output_init(struct obs_output *output)
+{
+	memset(output, 0, sizeof(*output));
+	output->info.flags = OBS_OUTPUT_AV | OBS_OUTPUT_ENCODED |
+			     OBS_OUTPUT_MULTI_TRACK;
+	output->info.encoded_packet = encoded_packet;
+	output->video_encoder = &video_encoder;
+	output->audio_encoders[0] = &audio_encoders[0];
+	output->audio_encoders[1] = &audio_encoders[1];
+	output->active = true;
+	pthread_mutex_init(&output->interleaved_mutex, NULL);
+#if BUILD_CAPTIONS
+	pthread_mutex_init(&output->caption_mutex, NULL);
+#endif
+
+	da_resize(sent, 0);
+}
+
+static void output_free(struct obs_output *output)
+{
+	free_packets(output);
+	pthread_mutex_destroy(&output->interleaved_mutex);
+#if BUILD_CAPTIONS
+	pthread_mutex_destroy(&output->caption_mutex);
+#endif
+}
+
+/* track -1 is video */
+static void feed(struct obs_output *output, int id, int track, int64_t dts)
+{
+	/* packet data is reference counted like encoder output, the packet's
+	 * id is stored in it */
+	long *refs = bmalloc(sizeof(long) + sizeof(int));
+	struct encoder_packet packet = {0};
+
+	*refs = 1;
+	*(int *)(refs + 1) = id;
+
+	packet.data = (uint8_t *)(refs + 1);
+	packet.size = sizeof(int);
+	packet.type = track < 0 ? OBS_ENCODER_VIDEO : OBS_ENCODER_AUDIO;
+	packet.encoder = track < 0 ? &video_encoder : &audio_encoders[track];
+	packet.keyframe = track < 0;
+	packet.timebase_num = 1;
+	packet.timebase_den = 1000000;
+	packet.dts = packet.pts = packet.dts_usec = dts;
+
+	interleave_packets(output, &packet);
+	obs_encoder_packet_release(&packet);
+}
+
+/* --------------------------------------------------------------------- */
+/* reference: the interleave buffer as it was before it became a heap     */
+
+struct ref_packet {
+	int id;
+	bool video;
+	int64_t dts;
+};
+
+struct ref_output {
+	DARRAY(struct ref_packet) packets;
+	int64_t highest_video_ts;
+	int64_t highest_audio_ts;
+	bool started;
+	DARRAY(int) sent;
+};
+
+static void ref_insert(struct ref_output *ref, struct ref_packet *packet)
+{
+	size_t idx;
+
+	for (idx = 0; idx < ref->packets.num; idx++) {
+		struct ref_packet *cur = &ref->packets.array[idx];
+
+		if (packet->dts == cur->dts && packet->video)
+			break;
+		else if (packet->dts < cur->dts)
+			break;
+	}
+
+	da_insert(ref->packets, idx, packet);
+}
+
+static void ref_send(struct ref_output *ref)
+{
+	struct ref_packet *first = &ref->packets.array[0];
+	int64_t opposing = first->video ? ref->highest_audio_ts
+					: ref->highest_video_ts;
+
+	if (opposing <= first->dts)
+		return;
+
+	da_push_back(ref->sent, &first->id);
+	da_erase(ref->packets, 0);
+}
+
+/* only valid for sequences that start with one packet per track at 0, so
+ * that nothing is pruned and there are no offsets */
+static void ref_feed(struct ref_output *ref, int id, int track, int64_t dts,
+		     bool start)
+{
+	struct ref_packet packet = {id, track < 0, dts};
+
+	ref_insert(ref, &packet);
+
+	if (packet.video && ref->highest_video_ts < dts)
+		ref->highest_video_ts = dts;
+	else if (!packet.video && ref->highest_audio_ts < dts)
+		ref->highest_audio_ts = dts;
+
+	if (start) {
+		DARRAY(struct ref_packet) old;
+
+		/* the old resort reinserted every packet in order */
+		old.da = ref->packets.da;
+		memset(&ref->packets, 0, sizeof(ref->packets));
+		for (size_t i = 0; i < old.num; i++)
+			ref_insert(ref, &old.array[i]);
+		da_free(old);
+
+		ref->started = true;
+	}
+
+	if (ref->started)
+		ref_send(ref);
+}
+
+/* --------------------------------------------------------------------- */
+
+static bool check_sent(const char *name, const int *expected, size_t num,
+		       const int *actual, size_t actual_num)
+{
+	size_t i = 0;
+
+	while (i < num && i < actual_num && expected[i] == actual[i])
+		i++;
+
+	if (i == num && i == actual_num)
+		return true;
+
+	fprintf(stderr, "%s: send order differs at packet %d:\n  expected",
+		name, (int)i);
+	for (size_t j = 0; j < num; j++)
+		fprintf(stderr, " %d", expected[j]);
+	fprintf(stderr, "\n  actual  ");
+	for (size_t j = 0; j < actual_num; j++)
+		fprintf(stderr, " %d", actual[j]);
+	fprintf(stderr, "\n");
+	return false;
+}
+
+#define V -1
+
+static bool test_fixed_sequence(void)
+{
+	/* id, track, dts, in the order they arrive */
+	static const struct {
+		int id;
+		int track;
+		int64_t dts;
+	} packets[] = {
+		{0, V, 0},     {1, 0, 0},     {2, 1, 0},
+		/* equal timestamps on all tracks, arriving in any order */
+		{3, 1, 10},    {4, 0, 10},    {5, V, 10},    {6, V, 20},
+		{7, 0, 20},    {8, 1, 20},    {9, V, 30},
+		/* video gets ahead, then the audio catches up */
+		{10, V, 40},   {11, V, 50},   {12, 0, 40},   {13, 1, 40},
+		{14, 0, 50},   {15, 1, 50},
+		/* pushes out everything above */
+		{16, V, 1000}, {17, 0, 1000}, {18, 1, 1000}, {19, V, 2000},
+		{20, 0, 2000}, {21, 1, 2000},
+	};
+	static const int expected[] = {0, 1,  2,  5,  3,  4,  6,  7,
+				       8, 9, 10, 12, 13, 11, 14, 15};
+
+	struct obs_output output;
+	bool success;
+
+	output_init(&output);
+	for (size_t i = 0; i < sizeof(packets) / sizeof(packets[0]); i++)
+		feed(&output, packets[i].id, packets[i].track, packets[i].dts);
+
+	success = check_sent("fixed sequence", expected,
+			     sizeof(expected) / sizeof(expected[0]),
+			     sent.array, sent.num);
+	output_free(&output);
+	return success;
+}
+
+static uint32_t rand_state = 0x12345678;
+
+static inline uint32_t next_rand(void)
+{
+	rand_state = rand_state * 1664525 + 1013904223;
+	return rand_state >> 8;
+}
+
+struct held_packet {
+	int id;
+	int64_t dts;
+};
+
+static bool test_random_sequence(int run)
+{
+	struct obs_output output;
+	struct ref_output ref = {0};
+	DARRAY(struct held_packet) held[3] = {0};
+	int64_t dts[3] = {0};
+	int hold[3] = {0};
+	char name[64];
+	bool success;
+	int id = 0;
+
+	output_init(&output);
+
+	/* one packet per track at 0 to start */
+	for (int track = V; track < 2; track++) {
+		feed(&output, id, track, 0);
+		ref_feed(&ref, id, track, 0, track == 1);
+		id++;
+	}
+
+	while (id < RANDOM_PACKETS) {
+		int track = (int)(next_rand() % 3) - 1;
+		struct held_packet packet;
+		size_t t = (size_t)(track + 1);
+
+		/* each track only moves forward, by steps small enough that
+		 * tracks often land on the same timestamp */
+		dts[t] += (int64_t)(next_rand() % 3 + 1) * 10;
+		packet.id = id++;
+		packet.dts = dts[t];
+		da_push_back(held[t], &packet);
+
+		/* now and then a track's packets are held back for a while,
+		 * and arrive late all at once */
+		if (!hold[t] && next_rand() % 16 == 0)
+			hold[t] = (int)(next_rand() % 8) + 1;
+		if (hold[t] && --hold[t])
+			continue;
+
+		for (size_t i = 0; i < held[t].num; i++) {
+			struct held_packet *p = &held[t].array[i];
+			feed(&output, p->id, track, p->dts);
+			ref_feed(&ref, p->id, track, p->dts, false);
+		}
+		da_resize(held[t], 0);
+	}
+
+	snprintf(name, sizeof(name), "random sequence %d", run);
+	success = check_sent(name, ref.sent.array, ref.sent.num, sent.array,
+			     sent.num);
+
+	for (size_t t = 0; t < 3; t++)
+		da_free(held[t]);
+	da_free(ref.packets);
+	da_free(ref.sent);
+	output_free(&output);
+	return success;
+}
+
+#undef V
+
+int main(void)
+{
+	bool success = test_fixed_sequence();
+
+	for (int run = 0; run < RANDOM_RUNS && success; run++)
+		success = test_random_sequence(run);
+
+	da_free(sent);
+
+	printf("%s\n", success ? "send order matches" : "SEND ORDER DIFFERS");
+	return success ? 0 : 1;
+}
@@ -0,0 +1,284 @@
+/*
+ * Benchmark and ordering test for saving the replay buffer.
+ *
+ * Fills a replay buffer with five minutes of 60fps video and six audio
+ * tracks, in the order an output receives them, then saves it the way the
+ * mux thread does: the references are collected in chunks and the tracks
+ * are merged as they are written.  The packets are written through a pipe to
+ * a file, read back, and have to come out ordered by their offset timestamps,
+ * with packets that have the same timestamp (on one track or across tracks)
+ * in the order they were buffered.
+ *
+ * The time taken to collect and to write the packets is printed, along with
+ * the time the ordered insert that saving used before took to sort the same
+ * buffer.  Usage:
+ *
+ *   test-replay-save [seconds]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "obs-ffmpeg-mux.c"
+
+#define FPS 60
+#define AUDIO_TRACKS 6
+#define SAMPLE_RATE 48000
+#define AUDIO_FRAMES 1024
+
+/* every so often an audio packet is followed by one with the same
+ * timestamp, to check that equal timestamps in a track keep their order */
+#define DUPLICATE_INTERVAL 997
+
+#define OUTPUT_FILE "test-replay-save.out"
+
+/* obs-ffmpeg-mux.c is normally built in to obs-ffmpeg, which defines this */
+const char *obs_module_text(const char *val)
+{
+	return val;
+}
+
+static void push_packet(struct ffmpeg_muxer *stream,
+			enum obs_encoder_type type, size_t track, int64_t dts,
+			int32_t timebase_den, uint32_t id, bool keyframe)
+{
+	/* packet data is reference counted like encoder output, the packet's
+	 * id is stored in it */
+	long *refs = bmalloc(sizeof(long) + sizeof(id));
+	struct encoder_packet packet = {0};
+
+	*refs = 1;
+	memcpy(refs + 1, &id, sizeof(id));
+
+	packet.data = (uint8_t *)(refs + 1);
+	packet.size = sizeof(id);
+	packet.type = type;
+	packet.track_idx = track;
+	packet.keyframe = keyframe;
+	packet.timebase_num = 1;
+	packet.timebase_den = timebase_den;
+	packet.dts = packet.pts = dts;
+	packet.dts_usec = dts * 1000000 / timebase_den;
+
+	circlebuf_push_back(&stream->packets, &packet, sizeof(packet));
+}
+
+/* video arrives after the audio that goes with it.  each audio track starts
+ * a little later than the last, which the per-track offsets take out again,
+ * so the audio tracks have the same offset timestamps throughout */
+static size_t fill_buffer(struct ffmpeg_muxer *stream, int seconds)
+{
+	int64_t frames = (int64_t)seconds * FPS;
+	int64_t audio_packets[AUDIO_TRACKS] = {0};
+	uint32_t id = 0;
+
+	for (int64_t frame = 0; frame < frames; frame++) {
+		int64_t frame_usec = (frame + 1) * 1000000 / FPS;
+
+		for (size_t t = 0; t < AUDIO_TRACKS; t++) {
+			for (;;) {
+				int64_t pos = audio_packets[t] * AUDIO_FRAMES +
+					      (int64_t)t * 64;
+
+				if (pos * 1000000 / SAMPLE_RATE > frame_usec)
+					break;
+
+				push_packet(stream, OBS_ENCODER_AUDIO, t, pos,
+					    SAMPLE_RATE, id, false);
+				if (++id % DUPLICATE_INTERVAL == 0)
+					push_packet(stream, OBS_ENCODER_AUDIO,
+						    t, pos, SAMPLE_RATE, id++,
+						    false);
+
+				audio_packets[t]++;
+			}
+		}
+
+		push_packet(stream, OBS_ENCODER_VIDEO, 0, frame, FPS, id++,
+			    frame % (FPS * 2) == 0);
+	}
+
+	return id;
+}
+
+struct expected_packet {
+	int64_t dts_usec;
+	uint32_t id;
+};
+
+static int compare_expected(const void *a, const void *b)
+{
+	const struct expected_packet *pa = a;
+	const struct expected_packet *pb = b;
+
+	if (pa->dts_usec != pb->dts_usec)
+		return pa->dts_usec < pb->dts_usec ? -1 : 1;
+	return pa->id < pb->id ? -1 : (pa->id > pb->id ? 1 : 0);
+}
+
+/* ids are assigned in buffer order, so sorting by offset timestamp and then
+ * id gives the stable order */
+static struct expected_packet *expected_order(struct ffmpeg_muxer *stream,
+					      size_t num)
+{
+	struct expected_packet *expected = bmalloc(num * sizeof(*expected));
+	int64_t offsets[REPLAY_TRACKS];
+	bool found[REPLAY_TRACKS] = {0};
+
+	for (size_t i = 0; i < num; i++) {
+		struct encoder_packet *pkt = circlebuf_data(
+			&stream->packets, i * sizeof(struct encoder_packet));
+		size_t track = replay_track_idx(pkt);
+
+		if (!found[track]) {
+			offsets[track] = pkt->dts_usec;
+			found[track] = true;
+		}
+
+		expected[i].dts_usec = pkt->dts_usec - offsets[track];
+		memcpy(&expected[i].id, pkt->data, sizeof(uint32_t));
+	}
+
+	qsort(expected, num, sizeof(*expected), compare_expected);
+	return expected;
+}
+
+/* the ordered insert saving used before, for comparison */
+static uint64_t time_ordered_insert(struct ffmpeg_muxer *stream, size_t num)
+{
+	DARRAY(struct encoder_packet) sorted;
+	uint64_t start = os_gettime_ns();
+
+	da_init(sorted);
+
+	for (size_t i = 0; i < num; i++) {
+		struct encoder_packet *pkt = circlebuf_data(
+			&stream->packets, i * sizeof(struct encoder_packet));
+		struct encoder_packet ref;
+		size_t idx;
+
+		obs_encoder_packet_ref(&ref, pkt);
+
+		for (idx = sorted.num; idx > 0; idx--) {
+			if (sorted.array[idx - 1].dts_usec < ref.dts_usec)
+				break;
+		}
+
+		da_insert(sorted, idx, &ref);
+	}
+
+	start = os_gettime_ns() - start;
+
+	for (size_t i = 0; i < sorted.num; i++)
+		obs_encoder_packet_release(&sorted.array[i]);
+	da_free(sorted);
+	return start;
+}
+
+static bool check_written(const struct expected_packet *expected, size_t num)
+{
+	FILE *file = fopen(OUTPUT_FILE, "rb");
+	struct ffm_packet_info info;
+	size_t count = 0;
+	bool success = true;
+
+	if (!file) {
+		fprintf(stderr, "couldn't open %s\n", OUTPUT_FILE);
+		return false;
+	}
+
+	while (fread(&info, sizeof(info), 1, file) == 1) {
+		uint32_t id;
+
+		if (info.size != sizeof(id) ||
+		    fread(&id, sizeof(id), 1, file) != 1) {
+			fprintf(stderr, "packet %d is malformed\n", (int)count);
+			success = false;
+			break;
+		}
+
+		if (count < num && id != expected[count].id) {
+			fprintf(stderr,
+				"packet %d: got id %u, expected %u\n",
+				(int)count, id, expected[count].id);
+			success = false;
+			break;
+		}
+
+		count++;
+	}
+
+	if (success && count != num) {
+		fprintf(stderr, "wrote %d packets, expected %d\n", (int)count,
+			(int)num);
+		success = false;
+	}
+
+	fclose(file);
+	return success;
+}
+
+int main(int argc, char *argv[])
+{
+	struct ffmpeg_muxer *stream = bzalloc(sizeof(*stream));
+	int seconds = argc > 1 ? atoi(argv[1]) : 300;
+	struct expected_packet *expected;
+	uint64_t insert_ns;
+	uint64_t collect_ns;
+	uint64_t write_ns;
+	uint64_t start;
+	size_t num;
+	bool success;
+
+	if (seconds <= 0) {
+		fprintf(stderr, "usage: %s [seconds]\n", argv[0]);
+		return 2;
+	}
+
+	pthread_mutex_init(&stream->packets_mutex, NULL);
+	os_event_init(&stream->collected_event, OS_EVENT_TYPE_MANUAL);
+
+	num = fill_buffer(stream, seconds);
+	expected = expected_order(stream, num);
+	insert_ns = time_ordered_insert(stream, num);
+
+	stream->pipe = os_process_pipe_create("cat > " OUTPUT_FILE, "w");
+	if (!stream->pipe) {
+		fprintf(stderr, "couldn't start cat\n");
+		return 1;
+	}
+
+	/* what replay_buffer_save and the mux thread do */
+	start = os_gettime_ns();
+	stream->save_packets = num;
+	os_atomic_set_bool(&stream->collecting, true);
+	collect_replay_packets(stream);
+	collect_ns = os_gettime_ns() - start;
+
+	start = os_gettime_ns();
+	write_replay_packets(stream);
+	write_ns = os_gettime_ns() - start;
+
+	for (size_t i = 0; i < stream->mux_packets.num; i++) {
+		struct replay_packet *rp = &stream->mux_packets.array[i];
+		obs_encoder_packet_release(&rp->packet);
+	}
+	da_free(stream->mux_packets);
+	close_pipe(stream);
+
+	success = check_written(expected, num);
+
+	printf("%d seconds, %d packets: collected in %.1f ms, merged and "
+	       "written in %.1f ms (ordered insert: %.1f ms)\n",
+	       seconds, (int)num, (double)collect_ns / 1000000.0,
+	       (double)write_ns / 1000000.0, (double)insert_ns / 1000000.0);
+
+	os_unlink(OUTPUT_FILE);
+	bfree(expected);
+	replay_buffer_clear(stream);
+	os_event_destroy(stream->collected_event);
+	pthread_mutex_destroy(&stream->packets_mutex);
+	dstr_free(&stream->path);
+	bfree(stream);
+	return success ? 0 : 1;
+}
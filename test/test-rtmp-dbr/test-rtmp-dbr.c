@@ -0,0 +1,391 @@
+/*
+ * Slow sink test for rtmp-stream's dynamic bitrate.
+ *
+ * Streams 60fps video and 160 kbps of audio at 6000 kbps through
+ * rtmp-stream's packet queue and drains the queue at the speed of a simulated
+ * link, in virtual time:
+ *
+ *     0s -  20s   7000 kbps
+ *    20s -  80s   2500 kbps
+ *    80s -  90s   1200 kbps
+ *    90s - 420s   7000 kbps
+ *
+ * The video encoder is a stand-in that is marked as active, so every bitrate
+ * change has to wait for the encoding thread (here, the loop producing
+ * frames), which applies it before the next frame the same way do_encode
+ * does.  The test checks that the bitrate follows the link down, that the
+ * queue drains each time, that it climbs back to the original bitrate, that
+ * the original is restored when the stream stops, and that the encoder is
+ * never updated from any other point, or with the packet queue locked.  A
+ * second stream checks that a bitrate the user sets while streaming is kept
+ * when the stream stops.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <obs-internal.h>
+#include <util/platform.h>
+
+static uint64_t sim_time_ns;
+
+static inline uint64_t sim_gettime_ns(void)
+{
+	return sim_time_ns;
+}
+
+static void test_encoder_update(obs_encoder_t *encoder, obs_data_t *settings);
+
+#define os_gettime_ns sim_gettime_ns
+#define obs_encoder_update test_encoder_update
+#include "rtmp-stream.c"
+#undef obs_encoder_update
+#undef os_gettime_ns
+
+#define ORIG_BITRATE 6000
+#define AUDIO_BITRATE 160
+#define AUDIO_PACKET_MS 21
+#define FLV_OVERHEAD 15
+#define SIM_SECONDS 420
+#define USER_BITRATE 4500
+
+static struct rtmp_stream *test_stream;
+static int locked_updates;
+
+/* the encoder locks its init_mutex when it's updated, so packets_mutex must
+ * not be locked at that point */
+static void test_encoder_update(obs_encoder_t *encoder, obs_data_t *settings)
+{
+	if (pthread_mutex_trylock(&test_stream->packets_mutex) == 0)
+		pthread_mutex_unlock(&test_stream->packets_mutex);
+	else
+		locked_updates++;
+
+	obs_encoder_update(encoder, settings);
+}
+
+/* rtmp-stream.c is normally built in to obs-outputs, which defines this */
+const char *obs_module_text(const char *val)
+{
+	return val;
+}
+
+struct sim_encoder {
+	long bitrate;
+	bool encoding;
+	int updates;
+	int bad_updates;
+};
+
+static bool sim_encoder_update(void *data, obs_data_t *settings)
+{
+	struct sim_encoder *enc = data;
+
+	if (!enc->encoding)
+		enc->bad_updates++;
+
+	enc->bitrate = (long)obs_data_get_int(settings, "bitrate");
+	enc->updates++;
+	return true;
+}
+
+static void init_encoder(struct obs_encoder *encoder, void *data,
+			 long bitrate)
+{
+	encoder->context.settings = obs_data_create();
+	encoder->context.data = data;
+	encoder->orig_info.caps = OBS_ENCODER_CAP_DYN_BITRATE;
+	encoder->info.update = sim_encoder_update;
+	encoder->active = true;
+	pthread_mutex_init(&encoder->init_mutex, NULL);
+
+	obs_data_set_string(encoder->context.settings, "rate_control", "CBR");
+	obs_data_set_int(encoder->context.settings, "bitrate", bitrate);
+}
+
+static void free_encoder(struct obs_encoder *encoder)
+{
+	pthread_mutex_destroy(&encoder->init_mutex);
+	obs_data_release(encoder->context.settings);
+}
+
+/* what the encoding thread does before every frame */
+static void encode_frame(struct obs_encoder *encoder,
+			 struct sim_encoder *enc)
+{
+	enc->encoding = true;
+	apply_encoder_update(encoder);
+	enc->encoding = false;
+}
+
+static void queue_packet(struct rtmp_stream *stream, enum obs_encoder_type type,
+			 size_t size, int64_t dts_usec, int priority,
+			 bool keyframe)
+{
+	/* packet data is reference counted like encoder output */
+	long *refs = bzalloc(sizeof(long) + 1);
+	struct encoder_packet packet = {0};
+	bool added;
+
+	*refs = 1;
+	packet.data = (uint8_t *)(refs + 1);
+	packet.size = size;
+	packet.type = type;
+	packet.timebase_den = 1000000;
+	packet.dts = packet.pts = packet.dts_usec = dts_usec;
+	packet.drop_priority = priority;
+	packet.keyframe = keyframe;
+
+	pthread_mutex_lock(&stream->packets_mutex);
+	added = type == OBS_ENCODER_VIDEO ? add_video_packet(stream, &packet)
+					  : add_packet(stream, &packet);
+	pthread_mutex_unlock(&stream->packets_mutex);
+
+	if (!added)
+		obs_encoder_packet_release(&packet);
+
+	/* like rtmp_stream_data */
+	dbr_apply_bitrate(stream);
+}
+
+static void lower_bitrate(struct rtmp_stream *stream, long bitrate)
+{
+	pthread_mutex_lock(&stream->packets_mutex);
+	dbr_set_bitrate(stream, bitrate);
+	pthread_mutex_unlock(&stream->packets_mutex);
+	dbr_apply_bitrate(stream);
+}
+
+static void set_user_bitrate(struct obs_encoder *encoder, long bitrate)
+{
+	obs_data_t *settings = obs_data_create();
+
+	obs_data_set_int(settings, "bitrate", bitrate);
+	obs_encoder_update(encoder, settings);
+	obs_data_release(settings);
+}
+
+static long link_kbps(uint64_t ms)
+{
+	if (ms < 20000)
+		return 7000;
+	if (ms < 80000)
+		return 2500;
+	if (ms < 90000)
+		return 1200;
+	return 7000;
+}
+
+static int64_t queue_duration_ms(struct rtmp_stream *stream)
+{
+	struct encoder_packet first;
+
+	if (!find_first_video_packet(stream, &first))
+		return 0;
+	return (stream->last_dts_usec - first.dts_usec) / 1000;
+}
+
+struct checkpoint {
+	uint64_t ms;
+	long max_bitrate;
+	long min_bitrate;
+	int64_t max_queue_ms;
+};
+
+/* the bitrate has to fit the link minus audio, with the queue drained, a few
+ * seconds after each drop, and be back to normal by the end */
+static const struct checkpoint checkpoints[] = {
+	{19999, ORIG_BITRATE, ORIG_BITRATE, 100},
+	{30000, 2500 - AUDIO_BITRATE, DBR_MIN_BITRATE, 200},
+	{79999, 2500 - AUDIO_BITRATE, 1500, 100},
+	{89999, 1200 - AUDIO_BITRATE, DBR_MIN_BITRATE, 200},
+	{SIM_SECONDS * 1000 - 1, ORIG_BITRATE, ORIG_BITRATE, 100},
+};
+
+static bool check(struct rtmp_stream *stream, long bitrate, uint64_t ms)
+{
+	static size_t next;
+	const struct checkpoint *c = &checkpoints[next];
+	int64_t queue_ms;
+
+	if (next == sizeof(checkpoints) / sizeof(checkpoints[0]) || c->ms != ms)
+		return true;
+
+	next++;
+	queue_ms = queue_duration_ms(stream);
+
+	if (bitrate > c->max_bitrate || bitrate < c->min_bitrate ||
+	    queue_ms > c->max_queue_ms) {
+		fprintf(stderr,
+			"%llu ms: bitrate %ld kbps (expected %ld-%ld), queue "
+			"%lld ms (expected at most %lld)\n",
+			(unsigned long long)ms, bitrate, c->min_bitrate,
+			c->max_bitrate, (long long)queue_ms,
+			(long long)c->max_queue_ms);
+		return false;
+	}
+
+	return true;
+}
+
+int main(void)
+{
+	struct obs_encoder vencoder = {0};
+	struct obs_encoder aencoder = {0};
+	struct obs_output output = {0};
+	struct sim_encoder venc = {ORIG_BITRATE};
+	struct sim_encoder aenc = {AUDIO_BITRATE};
+	struct rtmp_stream *stream = bzalloc(sizeof(*stream));
+	struct encoder_packet sending = {0};
+	obs_data_t *settings = obs_data_create();
+	int64_t frame = 0;
+	int64_t audio_packet = 0;
+	double credit = 0.0;
+	bool success = true;
+
+	init_encoder(&vencoder, &venc, ORIG_BITRATE);
+	init_encoder(&aencoder, &aenc, AUDIO_BITRATE);
+	output.context.name = "test";
+	output.video_encoder = &vencoder;
+	output.audio_encoders[0] = &aencoder;
+
+	test_stream = stream;
+	stream->output = &output;
+	stream->drop_threshold_usec = 700000;
+	stream->pframe_drop_threshold_usec = 900000;
+	pthread_mutex_init(&stream->packets_mutex, NULL);
+	pthread_mutex_init(&stream->dbr_mutex, NULL);
+	pthread_mutex_init(&stream->dbr_update_mutex, NULL);
+
+	obs_data_set_bool(settings, OPT_DYN_BITRATE, true);
+	dbr_init(stream, settings);
+
+	if (!stream->dbr_enabled) {
+		fprintf(stderr, "dynamic bitrate was not enabled\n");
+		return 1;
+	}
+
+	for (uint64_t ms = 0; ms < SIM_SECONDS * 1000; ms++) {
+		sim_time_ns = (ms + 1000) * 1000000ULL;
+
+		while (frame * 1000 / 60 <= (int64_t)ms) {
+			bool keyframe = frame % 120 == 0;
+			size_t size;
+			int priority;
+
+			encode_frame(&vencoder, &venc);
+
+			size = (size_t)venc.bitrate * 1000 / 8 / 60;
+			if (keyframe)
+				size *= 4;
+
+			if (keyframe)
+				priority = OBS_NAL_PRIORITY_HIGHEST;
+			else if (frame % 2)
+				priority = OBS_NAL_PRIORITY_HIGH;
+			else
+				priority = OBS_NAL_PRIORITY_DISPOSABLE;
+
+			queue_packet(stream, OBS_ENCODER_VIDEO, size,
+				     frame * 1000000 / 60, priority, keyframe);
+			frame++;
+		}
+
+		while (audio_packet * AUDIO_PACKET_MS <= (int64_t)ms) {
+			queue_packet(stream, OBS_ENCODER_AUDIO,
+				     AUDIO_BITRATE * AUDIO_PACKET_MS / 8,
+				     audio_packet * AUDIO_PACKET_MS * 1000, 0,
+				     false);
+			audio_packet++;
+		}
+
+		/* like the send thread, take the next packet off the queue and
+		 * block until the link has had time to send all of it */
+		credit += (double)link_kbps(ms) / 8.0;
+
+		for (;;) {
+			if (!sending.data &&
+			    !get_next_packet(stream, &sending)) {
+				credit = 0.0;
+				break;
+			}
+			if (credit < (double)sending.size)
+				break;
+
+			credit -= (double)sending.size;
+			dbr_add_frame(stream, sending.size + FLV_OVERHEAD);
+			obs_encoder_packet_release(&sending);
+		}
+
+		if (ms % 10000 == 0)
+			printf("%3llus: link %4ld kbps, bitrate %4ld kbps, "
+			       "queue %4lld ms, dropped %d\n",
+			       (unsigned long long)(ms / 1000), link_kbps(ms),
+			       venc.bitrate,
+			       (long long)queue_duration_ms(stream),
+			       stream->dropped_frames);
+
+		if (!check(stream, venc.bitrate, ms))
+			success = false;
+	}
+
+	/* lower it once more so stopping has something to restore */
+	lower_bitrate(stream, ORIG_BITRATE / 2);
+	encode_frame(&vencoder, &venc);
+	dbr_stop(stream);
+	encode_frame(&vencoder, &venc);
+
+	printf("lowered %u times, raised %u times, %d encoder updates\n",
+	       stream->dbr.num_lowered, stream->dbr.num_raised, venc.updates);
+
+	if (venc.bitrate != ORIG_BITRATE) {
+		fprintf(stderr, "bitrate not restored on stop: %ld kbps\n",
+			venc.bitrate);
+		success = false;
+	}
+
+	/* the next stream is lowered, then the user changes the bitrate */
+	dbr_init(stream, settings);
+	lower_bitrate(stream, ORIG_BITRATE / 2);
+	encode_frame(&vencoder, &venc);
+	set_user_bitrate(&vencoder, USER_BITRATE);
+	encode_frame(&vencoder, &venc);
+	dbr_stop(stream);
+	encode_frame(&vencoder, &venc);
+
+	if (venc.bitrate != USER_BITRATE) {
+		fprintf(stderr,
+			"bitrate set while streaming not kept on stop: %ld "
+			"kbps\n",
+			venc.bitrate);
+		success = false;
+	}
+	if (locked_updates) {
+		fprintf(stderr,
+			"%d encoder updates with the packet queue locked\n",
+			locked_updates);
+		success = false;
+	}
+	if (venc.bad_updates || aenc.updates) {
+		fprintf(stderr,
+			"%d encoder updates outside of the encoding thread\n",
+			venc.bad_updates + aenc.updates);
+		success = false;
+	}
+
+	obs_encoder_packet_release(&sending);
+	free_packets(stream);
+	circlebuf_free(&stream->packets);
+	circlebuf_free(&stream->dbr_frames);
+	circlebuf_free(&stream->video_idx);
+	for (size_t i = 0; i < OBS_NAL_PRIORITY_HIGHEST; i++)
+		circlebuf_free(&stream->drop_idx[i]);
+	pthread_mutex_destroy(&stream->dbr_update_mutex);
+	pthread_mutex_destroy(&stream->dbr_mutex);
+	pthread_mutex_destroy(&stream->packets_mutex);
+	bfree(stream);
+	obs_data_release(settings);
+	free_encoder(&vencoder);
+	free_encoder(&aencoder);
+	return success ? 0 : 1;
+}
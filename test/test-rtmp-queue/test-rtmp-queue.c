@@ -0,0 +1,160 @@
+/*
+ * Benchmark and regression test for the rtmp-stream send queue.
+ *
+ * Simulates ten minutes of 60fps video plus two audio tracks going out over a
+ * link that alternates every minute between 60% and 150% of the stream's
+ * bitrate, so the queue keeps building up and frames keep being dropped.
+ * Packets are queued with the same functions rtmp_stream_data uses, and
+ * taken off the queue the same way the send thread does.
+ *
+ * The order in which packets are sent, the number of dropped frames and the
+ * peak queue depth are compared against the values the queue produced
+ * before it was indexed (the old one popped and re-pushed every packet on
+ * each drop), and the average time to queue a packet is printed.  Usage:
+ *
+ *   test-rtmp-queue [drop threshold ms]
+ *
+ * Known results are checked for 700 ms (the default) and 300 ms, any other
+ * threshold only prints its results.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "rtmp-stream.c"
+
+#define FPS 60
+#define FRAMES (FPS * 60 * 10)
+#define FRAME_USEC 16667
+
+struct expected_result {
+	int64_t drop_threshold_ms;
+	uint64_t sent;
+	int dropped;
+	size_t max_queue;
+	uint64_t hash;
+};
+
+/* results of the queue before the send order index was added */
+static const struct expected_result expected[] = {
+	{700, 89140, 18860, 856, 0xec8423d183d2687bULL},
+	{300, 88565, 19435, 794, 0x4fe3145b8281a159ULL},
+};
+
+/* rtmp-stream.c is normally built in to obs-outputs, which defines this */
+const char *obs_module_text(const char *val)
+{
+	return val;
+}
+
+static void make_packet(struct encoder_packet *packet, int frame, int track)
+{
+	/* packet data is reference counted like encoder output */
+	long *refs = bmalloc(sizeof(long) + 8);
+	*refs = 1;
+
+	memset(packet, 0, sizeof(*packet));
+	packet->data = (uint8_t *)(refs + 1);
+	packet->size = 8;
+	packet->timebase_den = 1000000;
+	packet->dts = (int64_t)frame * FRAME_USEC + track;
+	packet->pts = packet->dts;
+	packet->dts_usec = packet->dts;
+
+	if (track == 0) {
+		packet->type = OBS_ENCODER_VIDEO;
+		packet->keyframe = frame % (FPS * 2) == 0;
+
+		if (packet->keyframe)
+			packet->drop_priority = OBS_NAL_PRIORITY_HIGHEST;
+		else if (frame % 3 == 0)
+			packet->drop_priority = OBS_NAL_PRIORITY_HIGH;
+		else
+			packet->drop_priority = OBS_NAL_PRIORITY_DISPOSABLE;
+	} else {
+		packet->type = OBS_ENCODER_AUDIO;
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	struct rtmp_stream *stream = bzalloc(sizeof(*stream));
+	int64_t threshold_ms = argc > 1 ? atoll(argv[1]) : 700;
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	uint64_t add_ns = 0;
+	uint64_t sent = 0;
+	size_t max_queue = 0;
+	double credit = 0.0;
+	bool success = true;
+
+	stream->drop_threshold_usec = threshold_ms * 1000;
+	stream->pframe_drop_threshold_usec = (threshold_ms + 200) * 1000;
+
+	for (int frame = 0; frame < FRAMES; frame++) {
+		/* link rate in packets per frame interval, relative to the
+		 * three packets produced per frame */
+		double rate = (frame / (FPS * 60)) % 2 ? 1.5 : 0.6;
+		size_t queued;
+
+		for (int track = 0; track < 3; track++) {
+			struct encoder_packet packet;
+			uint64_t start;
+			bool added;
+
+			make_packet(&packet, frame, track);
+
+			start = os_gettime_ns();
+			added = track == 0 ? add_video_packet(stream, &packet)
+					   : add_packet(stream, &packet);
+			add_ns += os_gettime_ns() - start;
+
+			if (!added)
+				obs_encoder_packet_release(&packet);
+		}
+
+		queued = num_buffered_packets(stream);
+		if (queued > max_queue)
+			max_queue = queued;
+
+		for (credit += 3.0 * rate; credit >= 1.0; credit -= 1.0) {
+			struct encoder_packet packet;
+
+			if (!get_next_packet(stream, &packet)) {
+				credit = 0.0;
+				break;
+			}
+
+			hash ^= (uint64_t)packet.dts_usec;
+			hash *= 0x100000001b3ULL;
+			sent++;
+			obs_encoder_packet_release(&packet);
+		}
+	}
+
+	printf("threshold %lld ms: sent %llu, dropped %d, max queue %zu, "
+	       "hash %016llx, %.1f ns per queued packet\n",
+	       (long long)threshold_ms, (unsigned long long)sent,
+	       stream->dropped_frames, max_queue, (unsigned long long)hash,
+	       (double)add_ns / (FRAMES * 3));
+
+	for (size_t i = 0; i < sizeof(expected) / sizeof(expected[0]); i++) {
+		const struct expected_result *e = &expected[i];
+
+		if (e->drop_threshold_ms != threshold_ms)
+			continue;
+
+		if (e->sent != sent || e->dropped != stream->dropped_frames ||
+		    e->max_queue != max_queue || e->hash != hash) {
+			fprintf(stderr,
+				"expected: sent %llu, dropped %d, max queue "
+				"%zu, hash %016llx\n",
+				(unsigned long long)e->sent, e->dropped,
+				e->max_queue, (unsigned long long)e->hash);
+			success = false;
+		}
+	}
+
+	free_packets(stream);
+	bfree(stream);
+	return success ? 0 : 1;
+}
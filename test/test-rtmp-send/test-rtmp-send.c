@@ -0,0 +1,299 @@
+/*
+ * Loopback benchmark for the librtmp send paths used by rtmp-stream.
+ *
+ * The same sequence of audio/video messages is sent over a loopback TCP
+ * connection three ways:
+ *
+ *   copy     the body is copied into an RTMPPacket and sent with
+ *            RTMP_SendPacket, which is what the FLV mux + RTMP_Write path
+ *            used to do
+ *   vector   the body is sent as separate buffers with RTMP_SendPacketV
+ *            through sendmsg()
+ *   custom   RTMP_SendPacketV with a custom send function but no vectored
+ *            one, so every buffer goes through the custom function
+ *
+ * For the first few hundred packets the receiving end hashes everything it
+ * reads, and all three paths have to produce the same bytes.  Then all of
+ * the packets are sent again without hashing, and the throughput of each path
+ * is printed.  Usage:
+ *
+ *   test-rtmp-send [packets] [max packet size]
+ *
+ * The defaults (2000 packets of up to 64 KiB) are small enough to run as a
+ * test, pass a larger count for steadier numbers.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <util/platform.h>
+
+#include "librtmp/rtmp.h"
+
+#define CHUNK_SIZE 4096
+#define PREFIX_SIZE 5
+
+#define VERIFY_PACKETS 500
+
+struct receiver {
+	int sock;
+	bool verify;
+	uint64_t hash;
+	uint64_t bytes;
+};
+
+struct run_result {
+	uint64_t hash;
+	uint64_t bytes;
+	uint64_t time_ns;
+	bool success;
+};
+
+enum send_mode {
+	SEND_COPY,
+	SEND_VECTOR,
+	SEND_CUSTOM,
+};
+
+static const char *mode_names[] = {"copy", "vector", "custom"};
+
+static void *receive_thread(void *data)
+{
+	struct receiver *recv_info = data;
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	uint8_t buf[65536];
+	ssize_t size;
+
+	while ((size = recv(recv_info->sock, buf, sizeof(buf), 0)) > 0) {
+		for (ssize_t i = 0; recv_info->verify && i < size; i++) {
+			hash ^= buf[i];
+			hash *= 0x100000001b3ULL;
+		}
+		recv_info->bytes += (uint64_t)size;
+	}
+
+	recv_info->hash = hash;
+	close(recv_info->sock);
+	return NULL;
+}
+
+static bool connect_loopback(int *client, int *server)
+{
+	struct sockaddr_in addr = {0};
+	socklen_t len = sizeof(addr);
+	int listener = socket(AF_INET, SOCK_STREAM, 0);
+
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	if (listener < 0)
+		return false;
+	if (bind(listener, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+	    getsockname(listener, (struct sockaddr *)&addr, &len) != 0 ||
+	    listen(listener, 1) != 0)
+		goto fail;
+
+	*client = socket(AF_INET, SOCK_STREAM, 0);
+	if (*client < 0)
+		goto fail;
+	if (connect(*client, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+		close(*client);
+		goto fail;
+	}
+
+	*server = accept(listener, NULL, NULL);
+	close(listener);
+	if (*server < 0) {
+		close(*client);
+		return false;
+	}
+	return true;
+
+fail:
+	close(listener);
+	return false;
+}
+
+static uint64_t custom_bytes;
+
+static int custom_send(RTMPSockBuf *sb, const char *buf, int len, void *param)
+{
+	int ret = (int)send(sb->sb_socket, buf, (size_t)len, 0);
+
+	if (ret > 0)
+		custom_bytes += (uint64_t)ret;
+
+	UNUSED_PARAMETER(param);
+	return ret;
+}
+
+/* deterministic so that every run sends the same messages */
+static uint32_t rand_state;
+
+static inline uint32_t next_rand(void)
+{
+	rand_state = rand_state * 1664525 + 1013904223;
+	return rand_state >> 8;
+}
+
+static bool send_message(RTMP *rtmp, enum send_mode mode, const uint8_t *data,
+			 int size, uint32_t timestamp, bool video)
+{
+	uint8_t prefix[PREFIX_SIZE] = {video ? 0x17 : 0xAF, 0x01, 0, 0, 0};
+	RTMPPacket packet = {0};
+	RTMPIOVec body[2] = {{(const char *)prefix, PREFIX_SIZE},
+			     {(const char *)data, size}};
+	int ret;
+
+	packet.m_nChannel = 0x04;
+	packet.m_nInfoField2 = 1;
+	packet.m_packetType = video ? RTMP_PACKET_TYPE_VIDEO
+				    : RTMP_PACKET_TYPE_AUDIO;
+	packet.m_nTimeStamp = timestamp;
+	packet.m_headerType = timestamp ? RTMP_PACKET_SIZE_MEDIUM
+					: RTMP_PACKET_SIZE_LARGE;
+	packet.m_nBodySize = PREFIX_SIZE + (uint32_t)size;
+
+	if (mode != SEND_COPY)
+		return !!RTMP_SendPacketV(rtmp, &packet, body, 2);
+
+	if (!RTMPPacket_Alloc(&packet, packet.m_nBodySize))
+		return false;
+
+	memcpy(packet.m_body, prefix, PREFIX_SIZE);
+	memcpy(packet.m_body + PREFIX_SIZE, data, (size_t)size);
+
+	ret = RTMP_SendPacket(rtmp, &packet, false);
+	RTMPPacket_Free(&packet);
+	return !!ret;
+}
+
+static struct run_result run(enum send_mode mode, const uint8_t *data,
+			     int packets, int max_size, bool verify)
+{
+	struct run_result result = {0};
+	struct receiver recv_info = {.verify = verify};
+	pthread_t thread;
+	RTMP rtmp;
+	int client;
+	uint64_t start;
+
+	if (!connect_loopback(&client, &recv_info.sock))
+		return result;
+	if (pthread_create(&thread, NULL, receive_thread, &recv_info) != 0) {
+		close(client);
+		close(recv_info.sock);
+		return result;
+	}
+
+	RTMP_Init(&rtmp);
+	rtmp.m_sb.sb_socket = client;
+	rtmp.m_outChunkSize = CHUNK_SIZE;
+
+	if (mode == SEND_CUSTOM) {
+		rtmp.m_bCustomSend = true;
+		rtmp.m_customSendFunc = custom_send;
+	}
+
+	rand_state = 0x12345678;
+	custom_bytes = 0;
+	result.success = true;
+	start = os_gettime_ns();
+
+	for (int i = 0; i < packets; i++) {
+		bool video = (i % 3) != 0;
+		int size = video ? (int)(next_rand() % (uint32_t)max_size) + 1
+				 : (int)(next_rand() % 512) + 1;
+		int offset = (int)(next_rand() % (uint32_t)max_size);
+
+		if (!send_message(&rtmp, mode, data + offset, size,
+				  (uint32_t)i * 16, video)) {
+			result.success = false;
+			break;
+		}
+	}
+
+	RTMP_Close(&rtmp);
+	pthread_join(thread, NULL);
+
+	result.time_ns = os_gettime_ns() - start;
+	result.hash = recv_info.hash;
+	result.bytes = recv_info.bytes;
+
+	if (mode == SEND_CUSTOM && custom_bytes != result.bytes) {
+		fprintf(stderr, "custom: only %llu of %llu bytes went through "
+				"the custom send function\n",
+			(unsigned long long)custom_bytes,
+			(unsigned long long)result.bytes);
+		result.success = false;
+	}
+	return result;
+}
+
+int main(int argc, char *argv[])
+{
+	int packets = argc > 1 ? atoi(argv[1]) : 2000;
+	int max_size = argc > 2 ? atoi(argv[2]) : 65536;
+	int verify_packets = packets < VERIFY_PACKETS ? packets
+						     : VERIFY_PACKETS;
+	struct run_result verify[3];
+	uint8_t *data;
+	bool success = true;
+
+	if (packets <= 0 || max_size <= 0) {
+		fprintf(stderr, "usage: %s [packets] [max packet size]\n",
+			argv[0]);
+		return 2;
+	}
+
+	data = malloc((size_t)max_size * 2);
+	for (int i = 0; i < max_size * 2; i++)
+		data[i] = (uint8_t)(i * 7 + (i >> 8));
+
+	for (int mode = 0; mode < 3; mode++) {
+		verify[mode] = run((enum send_mode)mode, data, verify_packets,
+				   max_size, true);
+		if (!verify[mode].success) {
+			fprintf(stderr, "%s: sending failed\n",
+				mode_names[mode]);
+			success = false;
+		}
+	}
+
+	for (int mode = 1; mode < 3 && success; mode++) {
+		if (verify[mode].bytes != verify[0].bytes ||
+		    verify[mode].hash != verify[0].hash) {
+			fprintf(stderr, "%s: output differs from copy\n",
+				mode_names[mode]);
+			success = false;
+		}
+	}
+
+	for (int mode = 0; mode < 3 && success; mode++) {
+		struct run_result result =
+			run((enum send_mode)mode, data, packets, max_size,
+			    false);
+
+		if (!result.success) {
+			fprintf(stderr, "%s: sending failed\n",
+				mode_names[mode]);
+			success = false;
+			break;
+		}
+
+		printf("%-6s %10llu bytes in %8.2f ms, %8.1f MB/s\n",
+		       mode_names[mode], (unsigned long long)result.bytes,
+		       (double)result.time_ns / 1000000.0,
+		       (double)result.bytes * 1000.0 /
+			       (double)result.time_ns);
+	}
+
+	free(data);
+	return success ? 0 : 1;
+}
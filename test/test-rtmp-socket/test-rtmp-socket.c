@@ -0,0 +1,338 @@
+/*
+ * Loopback test for rtmp-stream's epoll socket loop.
+ *
+ * Data is queued with rtmp-stream's own queueing function at a steady rate
+ * and sent by socket_thread_linux over a loopback TCP connection to a sink
+ * that emulates a slow link:
+ *
+ *     0s - 1s     reads as fast as it can
+ *     1s - 2s     reads at a quarter of the rate data is queued at
+ *     2s - 3.5s   reads as fast as it can, data stops being queued at 3s
+ *
+ * Until 2.5s the sink also sends a few bytes back every 50 ms, the way a
+ * server sends acknowledgements.  Everything has to arrive in order, the
+ * congestion has to go up while the sink is slow and back down once it has
+ * caught up, and the bytes sent back have to be read and thrown away.
+ *
+ * This is then run again as if the connection used TLS.  The bytes sent back
+ * have to be left alone then, because they can only be read through the TLS
+ * layer.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "rtmp-stream.c"
+
+#define QUEUE_RATE (2 * 1024 * 1024)
+#define SLOW_RATE (QUEUE_RATE / 4)
+#define CHUNK_SIZE 8192
+#define WRITE_BUF_SIZE 131072
+#define SOCKET_BUF_SIZE 65536
+
+#define SLOW_START_MS 1000
+#define SLOW_END_MS 2000
+#define QUEUE_END_MS 3000
+#define SINK_END_MS 3500
+#define DRAIN_MS 300
+
+#define REPLY_SIZE 16
+#define REPLY_INTERVAL_MS 50
+#define REPLY_END_MS 2500
+
+#define MIN_SLOW_CONGESTION 0.75f
+#define MAX_END_CONGESTION 0.25f
+
+/* rtmp-stream.c is normally built in to obs-outputs, which defines this */
+const char *obs_module_text(const char *val)
+{
+	return val;
+}
+
+static inline uint8_t pattern_byte(uint64_t offset)
+{
+	return (uint8_t)(offset % 251);
+}
+
+struct sink {
+	int sock;
+	uint64_t start;
+	uint64_t bytes;
+	uint64_t replied;
+	bool corrupt;
+};
+
+static void *sink_thread(void *param)
+{
+	struct sink *sink = param;
+	uint64_t slow_start_bytes = 0;
+	uint64_t next_reply = 0;
+	uint8_t reply[REPLY_SIZE] = {0};
+	uint8_t buf[CHUNK_SIZE];
+
+	for (;;) {
+		uint64_t ms = (os_gettime_ns() - sink->start) / 1000000;
+		ssize_t ret;
+
+		if (ms >= SINK_END_MS)
+			break;
+
+		/* stay below the slow rate since the slow part began */
+		if (ms < SLOW_START_MS) {
+			slow_start_bytes = sink->bytes;
+
+		} else if (ms < SLOW_END_MS &&
+			   sink->bytes - slow_start_bytes >
+				   (uint64_t)SLOW_RATE * (ms - SLOW_START_MS) /
+					   1000) {
+			os_sleep_ms(1);
+			continue;
+		}
+
+		if (ms >= next_reply && ms < REPLY_END_MS) {
+			if (send(sink->sock, reply, sizeof(reply),
+				 MSG_NOSIGNAL) == sizeof(reply))
+				sink->replied += sizeof(reply);
+			next_reply = ms + REPLY_INTERVAL_MS;
+		}
+
+		ret = recv(sink->sock, buf, sizeof(buf), MSG_DONTWAIT);
+		if (ret == 0)
+			break;
+		if (ret < 0) {
+			os_sleep_ms(1);
+			continue;
+		}
+
+		for (ssize_t i = 0; i < ret; i++) {
+			if (buf[i] != pattern_byte(sink->bytes + i))
+				sink->corrupt = true;
+		}
+
+		sink->bytes += (uint64_t)ret;
+	}
+
+	return NULL;
+}
+
+static bool connect_loopback(int *client, int *server)
+{
+	struct sockaddr_in addr = {0};
+	socklen_t len = sizeof(addr);
+	int size = SOCKET_BUF_SIZE;
+	int listener;
+
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	listener = socket(AF_INET, SOCK_STREAM, 0);
+	if (listener == -1)
+		return false;
+
+	/* small buffers on both ends, so a slow sink backs up quickly */
+	setsockopt(listener, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+
+	if (bind(listener, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+	    getsockname(listener, (struct sockaddr *)&addr, &len) != 0 ||
+	    listen(listener, 1) != 0)
+		goto fail;
+
+	*client = socket(AF_INET, SOCK_STREAM, 0);
+	setsockopt(*client, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+
+	if (connect(*client, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+		close(*client);
+		goto fail;
+	}
+
+	*server = accept(listener, NULL, NULL);
+	close(listener);
+	return *server != -1;
+
+fail:
+	close(listener);
+	return false;
+}
+
+static bool init_stream(struct rtmp_stream *stream, int sock, bool tls)
+{
+	int one = 1;
+
+	memset(stream, 0, sizeof(*stream));
+	RTMP_Init(&stream->rtmp);
+	stream->rtmp.m_sb.sb_socket = sock;
+
+	/* only checked by the socket loop, sending doesn't go through TLS
+	 * when it's built without it */
+	if (tls)
+		stream->rtmp.m_sb.sb_ssl = stream;
+
+	stream->write_buf_size = WRITE_BUF_SIZE;
+	stream->write_buf = bmalloc(WRITE_BUF_SIZE);
+	stream->socket_event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+	return ioctl(sock, FIONBIO, &one) == 0 &&
+	       stream->socket_event_fd != -1 &&
+	       pthread_mutex_init(&stream->write_buf_mutex, NULL) == 0 &&
+	       os_event_init(&stream->buffer_space_available_event,
+			     OS_EVENT_TYPE_AUTO) == 0 &&
+	       os_event_init(&stream->buffer_has_data_event,
+			     OS_EVENT_TYPE_AUTO) == 0 &&
+	       os_event_init(&stream->stop_event, OS_EVENT_TYPE_MANUAL) == 0 &&
+	       os_event_init(&stream->send_thread_signaled_exit,
+			     OS_EVENT_TYPE_MANUAL) == 0;
+}
+
+static void free_stream(struct rtmp_stream *stream)
+{
+	if (stream->rtmp.m_sb.sb_socket != -1)
+		close(stream->rtmp.m_sb.sb_socket);
+	if (stream->socket_event_fd != -1)
+		close(stream->socket_event_fd);
+
+	os_event_destroy(stream->send_thread_signaled_exit);
+	os_event_destroy(stream->stop_event);
+	os_event_destroy(stream->buffer_has_data_event);
+	os_event_destroy(stream->buffer_space_available_event);
+	pthread_mutex_destroy(&stream->write_buf_mutex);
+	bfree(stream->write_buf);
+}
+
+static inline float get_congestion(struct rtmp_stream *stream)
+{
+	return (float)os_atomic_load_long(&stream->socket_congestion) /
+	       (float)SOCKET_CONGESTION_SCALE;
+}
+
+/* queues data at QUEUE_RATE like the send thread does, and samples the
+ * congestion along the way */
+static uint64_t queue_data(struct rtmp_stream *stream, uint64_t start,
+			   float *slow_congestion)
+{
+	uint8_t chunk[CHUNK_SIZE];
+	uint64_t queued = 0;
+
+	*slow_congestion = 0.0f;
+
+	for (;;) {
+		uint64_t ms = (os_gettime_ns() - start) / 1000000;
+		RTMPIOVec iov = {(const char *)chunk, CHUNK_SIZE};
+		float congestion = get_congestion(stream);
+
+		if (ms >= SLOW_START_MS && ms < SLOW_END_MS &&
+		    congestion > *slow_congestion)
+			*slow_congestion = congestion;
+
+		if (ms >= QUEUE_END_MS)
+			break;
+
+		if (queued > (uint64_t)QUEUE_RATE * ms / 1000) {
+			os_sleep_ms(1);
+			continue;
+		}
+
+		for (size_t i = 0; i < CHUNK_SIZE; i++)
+			chunk[i] = pattern_byte(queued + i);
+
+		if (socket_queue_datav(&stream->rtmp.m_sb, &iov, 1, stream) !=
+		    CHUNK_SIZE)
+			break;
+
+		queued += CHUNK_SIZE;
+	}
+
+	return queued;
+}
+
+static bool test_socket_loop(bool tls)
+{
+	const char *name = tls ? "tls" : "plain";
+	struct rtmp_stream stream;
+	struct sink sink = {0};
+	pthread_t thread;
+	pthread_t socket_thread;
+	float slow_congestion;
+	float end_congestion;
+	uint64_t queued;
+	int unread = 0;
+	int client;
+	bool success = true;
+
+	if (!connect_loopback(&client, &sink.sock)) {
+		fprintf(stderr, "%s: couldn't connect over loopback\n", name);
+		return false;
+	}
+
+	if (!init_stream(&stream, client, tls)) {
+		fprintf(stderr, "%s: couldn't initialize the stream\n", name);
+		free_stream(&stream);
+		close(sink.sock);
+		return false;
+	}
+
+	sink.start = os_gettime_ns();
+	pthread_create(&thread, NULL, sink_thread, &sink);
+	pthread_create(&socket_thread, NULL, socket_thread_linux, &stream);
+
+	queued = queue_data(&stream, sink.start, &slow_congestion);
+
+	/* give the socket loop time to send the rest and check again */
+	os_sleep_ms(DRAIN_MS);
+	end_congestion = get_congestion(&stream);
+
+	/* what the send thread does when it's done */
+	os_event_signal(stream.send_thread_signaled_exit);
+	signal_buffer_has_data(&stream);
+	pthread_join(socket_thread, NULL);
+	pthread_join(thread, NULL);
+
+	if (stream.rtmp.m_sb.sb_socket != -1)
+		ioctl(stream.rtmp.m_sb.sb_socket, FIONREAD, &unread);
+
+	printf("%s: %llu bytes queued, %llu received, congestion %.2f while "
+	       "slow, %.2f at the end, %d of %llu bytes sent back left "
+	       "unread\n",
+	       name, (unsigned long long)queued,
+	       (unsigned long long)sink.bytes, slow_congestion, end_congestion,
+	       unread, (unsigned long long)sink.replied);
+
+	if (stream.rtmp.m_sb.sb_socket == -1 || stream.write_buf_len) {
+		fprintf(stderr, "%s: the socket loop failed, %d bytes left\n",
+			name, (int)stream.write_buf_len);
+		success = false;
+	}
+	if (sink.corrupt || sink.bytes != queued) {
+		fprintf(stderr, "%s: data didn't arrive intact\n", name);
+		success = false;
+	}
+	if (slow_congestion < MIN_SLOW_CONGESTION ||
+	    end_congestion > MAX_END_CONGESTION) {
+		fprintf(stderr,
+			"%s: congestion %.2f while slow (expected at least "
+			"%.2f), %.2f at the end (expected at most %.2f)\n",
+			name, slow_congestion, MIN_SLOW_CONGESTION,
+			end_congestion, MAX_END_CONGESTION);
+		success = false;
+	}
+	if (tls ? (uint64_t)unread != sink.replied : unread != 0) {
+		fprintf(stderr, "%s: %d of %llu bytes sent back unread\n", name,
+			unread, (unsigned long long)sink.replied);
+		success = false;
+	}
+
+	close(sink.sock);
+	free_stream(&stream);
+	return success;
+}
+
+int main(void)
+{
+	bool success = test_socket_loop(false);
+	success = test_socket_loop(true) && success;
+	return success ? 0 : 1;
+}
@@ -0,0 +1,380 @@
+/*
+ * Tests connecting and disconnecting signal callbacks while the signal is
+ * being emitted, and optionally times emitting.
+ *
+ * Emitting doesn't lock the signal, so a callback can be connected,
+ * disconnected or removed by the callback itself in the middle of an
+ * emission, on the same thread or on another one.  Callbacks disconnected
+ * during an emission must not be called afterwards, callbacks connected
+ * during one only from the next emission on, and two threads that each
+ * disconnect the callback the other one is in must both return.  Usage:
+ *
+ *   test-signal [bench]
+ *
+ * With "bench", emitting a signal with 0, 1 and 16 callbacks connected is
+ * also timed on one and on several threads, and the average time per
+ * emission is printed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <callback/signal.h>
+#include <util/bmem.h>
+#include <util/platform.h>
+#include <util/threading.h>
+
+#define TIMEOUT_MS 5000
+#define SLOW_CALL_MS 100
+#define STRESS_CHANGES 2000
+#define STRESS_EMITTERS 3
+
+#define BENCH_SIGNALS 24
+#define BENCH_EMITS 2000000
+#define BENCH_MAX_THREADS 4
+
+static signal_handler_t *handler;
+static int failures;
+
+#define CHECK(cond)                                                     \
+	do {                                                            \
+		if (!(cond)) {                                          \
+			fprintf(stderr, "%s:%d: check failed: %s\n",    \
+				__func__, __LINE__, #cond);             \
+			failures++;                                     \
+		}                                                       \
+	} while (false)
+
+/* ------------------------------------------------------------------------- */
+
+static long calls[8];
+
+static void count(void *data, calldata_t *params)
+{
+	calls[(intptr_t)data]++;
+	UNUSED_PARAMETER(params);
+}
+
+static void remove_self(void *data, calldata_t *params)
+{
+	count(data, params);
+	signal_handler_remove_current();
+}
+
+static void disconnect_next(void *data, calldata_t *params)
+{
+	count(data, params);
+	signal_handler_disconnect(handler, "test", count, (void *)3);
+}
+
+static void connect_next(void *data, calldata_t *params)
+{
+	count(data, params);
+	signal_handler_connect(handler, "test", count, (void *)5);
+}
+
+static void disconnect_during_emit(void)
+{
+	calldata_t params = {0};
+
+	memset(calls, 0, sizeof(calls));
+
+	signal_handler_connect(handler, "test", count, (void *)1);
+	signal_handler_connect(handler, "test", remove_self, (void *)2);
+	signal_handler_connect(handler, "test", disconnect_next, (void *)4);
+	signal_handler_connect(handler, "test", count, (void *)3);
+
+	signal_handler_signal(handler, "test", &params);
+	CHECK(calls[1] == 1 && calls[2] == 1 && calls[4] == 1);
+	CHECK(calls[3] == 0);
+
+	signal_handler_signal(handler, "test", &params);
+	CHECK(calls[1] == 2 && calls[2] == 1 && calls[4] == 2);
+	CHECK(calls[3] == 0);
+
+	signal_handler_disconnect(handler, "test", disconnect_next, (void *)4);
+	signal_handler_disconnect(handler, "test", count, (void *)1);
+	signal_handler_signal(handler, "test", &params);
+	CHECK(calls[1] == 2 && calls[4] == 2);
+
+	calldata_free(&params);
+}
+
+static void connect_during_emit(void)
+{
+	calldata_t params = {0};
+
+	memset(calls, 0, sizeof(calls));
+
+	signal_handler_connect(handler, "test", connect_next, (void *)4);
+	signal_handler_signal(handler, "test", &params);
+	CHECK(calls[4] == 1 && calls[5] == 0);
+
+	signal_handler_disconnect(handler, "test", connect_next, (void *)4);
+	signal_handler_signal(handler, "test", &params);
+	CHECK(calls[4] == 1 && calls[5] == 1);
+
+	signal_handler_disconnect(handler, "test", count, (void *)5);
+	signal_handler_signal(handler, "test", &params);
+	CHECK(calls[5] == 1);
+
+	calldata_free(&params);
+}
+
+/* ------------------------------------------------------------------------- */
+
+struct slow_call {
+	volatile bool started;
+	volatile bool finished;
+};
+
+static void slow(void *data, calldata_t *params)
+{
+	struct slow_call *call = data;
+
+	os_atomic_set_bool(&call->started, true);
+	os_sleep_ms(SLOW_CALL_MS);
+	os_atomic_set_bool(&call->finished, true);
+
+	UNUSED_PARAMETER(params);
+}
+
+static void *emit_thread(void *param)
+{
+	calldata_t params = {0};
+
+	signal_handler_signal(handler, "test", &params);
+	calldata_free(&params);
+
+	UNUSED_PARAMETER(param);
+	return NULL;
+}
+
+/* disconnecting from outside of an emission waits for calls on other
+ * threads to return */
+static void disconnect_waits(void)
+{
+	struct slow_call call = {0};
+	pthread_t thread;
+
+	signal_handler_connect(handler, "test", slow, &call);
+	pthread_create(&thread, NULL, emit_thread, NULL);
+
+	while (!os_atomic_load_bool(&call.started))
+		os_sleep_ms(1);
+
+	signal_handler_disconnect(handler, "test", slow, &call);
+	CHECK(os_atomic_load_bool(&call.finished));
+
+	pthread_join(thread, NULL);
+}
+
+/* ------------------------------------------------------------------------- */
+
+static volatile long crossed_inside;
+static THREAD_LOCAL intptr_t crossed_id;
+
+static void crossed(void *data, calldata_t *params)
+{
+	intptr_t id = (intptr_t)data;
+
+	if (id != crossed_id)
+		return;
+
+	/* wait until the other thread is in its callback too */
+	os_atomic_inc_long(&crossed_inside);
+	while (os_atomic_load_long(&crossed_inside) < 2)
+		os_sleep_ms(1);
+
+	signal_handler_disconnect(handler, "test", crossed, (void *)(3 - id));
+
+	UNUSED_PARAMETER(params);
+}
+
+static void *crossed_thread(void *param)
+{
+	crossed_id = (intptr_t)param;
+	return emit_thread(NULL);
+}
+
+struct crossed_threads {
+	pthread_t threads[2];
+	volatile bool done;
+};
+
+static void *join_crossed_threads(void *param)
+{
+	struct crossed_threads *ct = param;
+
+	pthread_join(ct->threads[0], NULL);
+	pthread_join(ct->threads[1], NULL);
+	os_atomic_set_bool(&ct->done, true);
+	return NULL;
+}
+
+/* two threads emitting the same signal, each disconnecting the callback the
+ * other one is in the middle of */
+static void crossed_disconnects(void)
+{
+	struct crossed_threads ct = {0};
+	uint64_t timeout = os_gettime_ns() + TIMEOUT_MS * 1000000ULL;
+	pthread_t joiner;
+
+	signal_handler_connect(handler, "test", crossed, (void *)1);
+	signal_handler_connect(handler, "test", crossed, (void *)2);
+
+	pthread_create(&ct.threads[0], NULL, crossed_thread, (void *)1);
+	pthread_create(&ct.threads[1], NULL, crossed_thread, (void *)2);
+	pthread_create(&joiner, NULL, join_crossed_threads, &ct);
+
+	while (!os_atomic_load_bool(&ct.done)) {
+		if (os_gettime_ns() > timeout) {
+			fprintf(stderr, "crossed disconnects never returned\n");
+			exit(1);
+		}
+		os_sleep_ms(1);
+	}
+
+	pthread_join(joiner, NULL);
+}
+
+/* ------------------------------------------------------------------------- */
+
+struct live_data {
+	volatile bool alive;
+};
+
+static volatile bool stop_emitting;
+static volatile bool called_after_disconnect;
+
+static void check_alive(void *data, calldata_t *params)
+{
+	struct live_data *live = data;
+
+	if (!os_atomic_load_bool(&live->alive))
+		os_atomic_set_bool(&called_after_disconnect, true);
+
+	UNUSED_PARAMETER(params);
+}
+
+static void *stress_emit_thread(void *param)
+{
+	calldata_t params = {0};
+
+	while (!os_atomic_load_bool(&stop_emitting))
+		signal_handler_signal(handler, "stress", &params);
+
+	calldata_free(&params);
+	UNUSED_PARAMETER(param);
+	return NULL;
+}
+
+/* callback data is freed right after disconnecting, while other threads
+ * keep emitting */
+static void stress(void)
+{
+	pthread_t threads[STRESS_EMITTERS];
+
+	for (size_t i = 0; i < STRESS_EMITTERS; i++)
+		pthread_create(&threads[i], NULL, stress_emit_thread, NULL);
+
+	for (int i = 0; i < STRESS_CHANGES; i++) {
+		struct live_data *live = bzalloc(sizeof(*live));
+		live->alive = true;
+
+		signal_handler_connect(handler, "stress", check_alive, live);
+		os_sleep_ms(0);
+		signal_handler_disconnect(handler, "stress", check_alive, live);
+
+		os_atomic_set_bool(&live->alive, false);
+		bfree(live);
+	}
+
+	os_atomic_set_bool(&stop_emitting, true);
+	for (size_t i = 0; i < STRESS_EMITTERS; i++)
+		pthread_join(threads[i], NULL);
+
+	CHECK(!os_atomic_load_bool(&called_after_disconnect));
+}
+
+/* ------------------------------------------------------------------------- */
+
+static void nothing(void *data, calldata_t *params)
+{
+	UNUSED_PARAMETER(data);
+	UNUSED_PARAMETER(params);
+}
+
+static void *bench_thread(void *param)
+{
+	calldata_t params = {0};
+
+	for (int i = 0; i < BENCH_EMITS; i++)
+		signal_handler_signal(param, "volume", &params);
+
+	calldata_free(&params);
+	return NULL;
+}
+
+static void bench(void)
+{
+	static const int callbacks[] = {0, 1, 16};
+	signal_handler_t *bench_handler = signal_handler_create();
+	pthread_t threads[BENCH_MAX_THREADS];
+	intptr_t connected = 0;
+	char decl[64];
+
+	/* roughly what a source declares, with the signal emitted the most
+	 * declared last */
+	for (int i = 0; i < BENCH_SIGNALS; i++) {
+		snprintf(decl, sizeof(decl), "void signal_%d(ptr source)", i);
+		signal_handler_add(bench_handler, decl);
+	}
+	signal_handler_add(bench_handler, "void volume(in out float volume)");
+
+	for (size_t i = 0; i < sizeof(callbacks) / sizeof(callbacks[0]); i++) {
+		while (connected < callbacks[i])
+			signal_handler_connect(bench_handler, "volume", nothing,
+					       (void *)connected++);
+
+		for (int num = 1; num <= BENCH_MAX_THREADS; num *= 4) {
+			uint64_t start = os_gettime_ns();
+			double ns;
+
+			for (int j = 0; j < num; j++)
+				pthread_create(&threads[j], NULL, bench_thread,
+					       bench_handler);
+			for (int j = 0; j < num; j++)
+				pthread_join(threads[j], NULL);
+
+			ns = (double)(os_gettime_ns() - start) /
+			     ((double)BENCH_EMITS * num);
+			printf("%2d callbacks, %d thread(s): %6.1f ns per "
+			       "emission\n",
+			       callbacks[i], num, ns);
+		}
+	}
+
+	signal_handler_destroy(bench_handler);
+}
+
+int main(int argc, char *argv[])
+{
+	handler = signal_handler_create();
+	signal_handler_add(handler, "void test()");
+	signal_handler_add(handler, "void stress()");
+
+	disconnect_during_emit();
+	connect_during_emit();
+	disconnect_waits();
+	crossed_disconnects();
+	stress();
+
+	signal_handler_destroy(handler);
+
+	if (!failures && argc > 1 && strcmp(argv[1], "bench") == 0)
+		bench();
+
+	return failures ? 1 : 0;
+}
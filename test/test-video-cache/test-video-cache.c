@@ -0,0 +1,386 @@
+/*
+ * Stress test for the frame cache between the graphics thread and video-io.
+ *
+ * Frames are locked and unlocked at 240 fps the way the graphics thread does
+ * it, with several inputs connected, once with the inputs called on the video
+ * thread and once with each input on its own thread.  One of the inputs takes
+ * half a frame interval per frame.  No frame may be skipped, and every input
+ * has to get every frame exactly once and in order, with the contents that
+ * were written to it.  An input on its own thread may only miss the frames it
+ * reports as dropped, which happens when that thread isn't scheduled for a
+ * couple of frame intervals.
+ *
+ * Then inputs are stalled one after the other until they hold every spare
+ * buffer, and are only released well after the last frame has been locked.
+ * Locking a frame must still never wait for them.  The frames that can't be
+ * cached have to be counted as skipped, and the input that isn't stalled must
+ * keep getting frames in order.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <util/profiler.h>
+
+/* video-io gets its profiler names from the obs core, which isn't started
+ * here */
+#define obs_get_profiler_name_store test_name_store
+#include <media-io/video-io.c>
+#undef obs_get_profiler_name_store
+
+#define FPS 240
+#define WIDTH 64
+#define HEIGHT 64
+#define CACHE_SIZE 6
+
+#define INPUTS 4
+#define FRAMES (FPS * 2)
+#define SLOW_INPUT_MS 2
+
+/* each stalled input holds on to a different frame, one more than there are
+ * spare buffers */
+#define STALLED_INPUTS (MAX_SPARE_FRAMES + 2)
+#define STALL_FRAMES (FPS / 2)
+#define STALL_MS 1500
+#define MAX_LOCK_MS 500
+
+#define DRAIN_TIMEOUT_MS 5000
+
+static profiler_name_store_t *name_store;
+static volatile bool stall_released;
+
+profiler_name_store_t *test_name_store(void)
+{
+	return name_store;
+}
+
+struct test_input {
+	video_t *video;
+	int delay_ms;
+
+	/* frames may be missing, or repeated with the contents of the frame
+	 * before them */
+	bool gaps;
+	bool repeats;
+
+	/* the input stalls once it gets this frame or a later one, until the
+	 * stalled inputs are released */
+	bool stall;
+	uint32_t stall_frame;
+
+	uint64_t next_timestamp;
+	volatile long frames;
+	volatile long errors;
+};
+
+static void input_callback(void *param, struct video_data *frame)
+{
+	struct test_input *input = param;
+	uint64_t frame_time = video_output_get_frame_time(input->video);
+	uint32_t frame_idx = *(uint32_t *)frame->data[0];
+	bool valid = input->gaps ? frame->timestamp >= input->next_timestamp
+				 : frame->timestamp == input->next_timestamp;
+
+	if (!input->repeats &&
+	    (uint64_t)frame_idx * frame_time != frame->timestamp)
+		valid = false;
+
+	if (!valid) {
+		if (os_atomic_inc_long(&input->errors) == 1)
+			fprintf(stderr,
+				"input %p: got frame %u at %llu, expected "
+				"%llu\n",
+				param, frame_idx,
+				(unsigned long long)frame->timestamp,
+				(unsigned long long)input->next_timestamp);
+	}
+
+	input->next_timestamp = frame->timestamp + frame_time;
+	os_atomic_inc_long(&input->frames);
+
+	if (input->delay_ms)
+		os_sleep_ms(input->delay_ms);
+	/* os_event only wakes one waiter */
+	while (input->stall && frame_idx >= input->stall_frame &&
+	       !os_atomic_load_bool(&stall_released))
+		os_sleep_ms(1);
+}
+
+static video_t *open_video(bool threaded_inputs)
+{
+	struct video_output_info info = {0};
+	video_t *video;
+
+	info.name = "test";
+	info.format = VIDEO_FORMAT_I420;
+	info.fps_num = FPS;
+	info.fps_den = 1;
+	info.width = WIDTH;
+	info.height = HEIGHT;
+	info.cache_size = CACHE_SIZE;
+	info.threaded_inputs = threaded_inputs;
+
+	if (video_output_open(&video, &info) != VIDEO_OUTPUT_SUCCESS) {
+		fprintf(stderr, "couldn't open the video output\n");
+		return NULL;
+	}
+
+	return video;
+}
+
+static bool connect_inputs(video_t *video, struct test_input *inputs,
+			   size_t num)
+{
+	for (size_t i = 0; i < num; i++) {
+		inputs[i].video = video;
+
+		if (!video_output_connect(video, NULL, input_callback,
+					  &inputs[i])) {
+			fprintf(stderr, "couldn't connect input %d\n", (int)i);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static void disconnect_inputs(video_t *video, struct test_input *inputs,
+			      size_t num)
+{
+	for (size_t i = 0; i < num; i++)
+		video_output_disconnect(video, input_callback, &inputs[i]);
+}
+
+/* what the graphics thread does for each frame, the frame index is written
+ * to the first pixel.  returns the number of frames that were cached */
+static int output_frames(video_t *video, int frames, uint64_t *max_lock_ns)
+{
+	uint64_t frame_time = video_output_get_frame_time(video);
+	uint64_t start = os_gettime_ns();
+	int cached = 0;
+
+	*max_lock_ns = 0;
+
+	for (int i = 0; i < frames; i++) {
+		struct video_frame frame;
+		uint64_t timestamp = (uint64_t)i * frame_time;
+		uint64_t lock_start = os_gettime_ns();
+		uint64_t lock_ns;
+		bool locked;
+
+		locked = video_output_lock_frame(video, &frame, 1, timestamp);
+
+		lock_ns = os_gettime_ns() - lock_start;
+		if (lock_ns > *max_lock_ns)
+			*max_lock_ns = lock_ns;
+
+		if (locked) {
+			*(uint32_t *)frame.data[0] = (uint32_t)i;
+			video_output_unlock_frame(video);
+			cached++;
+		}
+
+		os_sleepto_ns(start + timestamp + frame_time);
+	}
+
+	return cached;
+}
+
+static long get_dropped_frames(video_t *video, struct test_input *input)
+{
+	struct video_input_stats stats;
+
+	if (!video_output_get_input_stats(video, input_callback, input,
+					  &stats))
+		return 0;
+
+	return (long)stats.dropped_frames;
+}
+
+/* waits until every frame has been output or dropped by every input */
+static bool wait_for_frames(video_t *video, struct test_input *inputs,
+			    size_t num, long frames)
+{
+	uint64_t timeout = os_gettime_ns() + DRAIN_TIMEOUT_MS * 1000000ULL;
+
+	for (size_t i = 0; i < num; i++) {
+		while (os_atomic_load_long(&inputs[i].frames) +
+			       get_dropped_frames(video, &inputs[i]) <
+		       frames) {
+			if (os_gettime_ns() > timeout)
+				return false;
+			os_sleep_ms(1);
+		}
+	}
+
+	return true;
+}
+
+static bool test_frames(bool threaded_inputs)
+{
+	const char *name = threaded_inputs ? "threaded inputs" : "inputs";
+	struct test_input inputs[INPUTS] = {0};
+	video_t *video = open_video(threaded_inputs);
+	uint64_t max_lock_ns;
+	bool success = false;
+	long total_dropped = 0;
+	uint32_t skipped;
+
+	if (!video)
+		return false;
+
+	for (size_t i = 0; i < INPUTS; i++)
+		inputs[i].gaps = threaded_inputs;
+	inputs[INPUTS - 1].delay_ms = SLOW_INPUT_MS;
+
+	if (!connect_inputs(video, inputs, INPUTS))
+		goto fail;
+
+	output_frames(video, FRAMES, &max_lock_ns);
+
+	if (!wait_for_frames(video, inputs, INPUTS, FRAMES)) {
+		fprintf(stderr, "%s: timed out waiting for frames\n", name);
+		goto fail;
+	}
+
+	/* anything that shows up late would be a duplicate */
+	os_sleep_ms(50);
+
+	success = true;
+
+	skipped = video_output_get_skipped_frames(video);
+	if (skipped) {
+		fprintf(stderr, "%s: %u frames skipped\n", name, skipped);
+		success = false;
+	}
+
+	for (size_t i = 0; i < INPUTS; i++) {
+		long frames = os_atomic_load_long(&inputs[i].frames);
+		long dropped = get_dropped_frames(video, &inputs[i]);
+
+		if (frames + dropped != FRAMES || inputs[i].errors) {
+			fprintf(stderr,
+				"%s: input %d got %ld frames and dropped %ld, "
+				"expected %d, %ld out of order\n",
+				name, (int)i, frames, dropped, FRAMES,
+				inputs[i].errors);
+			success = false;
+		}
+
+		total_dropped += dropped;
+	}
+
+	printf("%s: %d frames at %d fps to %d inputs, %ld dropped by the "
+	       "inputs, longest lock %.3f ms\n",
+	       name, FRAMES, FPS, INPUTS, total_dropped,
+	       (double)max_lock_ns / 1000000.0);
+
+fail:
+	disconnect_inputs(video, inputs, INPUTS);
+	video_output_close(video);
+	return success;
+}
+
+static void *release_thread(void *param)
+{
+	os_sleep_ms(STALL_MS);
+	os_atomic_set_bool(&stall_released, true);
+
+	UNUSED_PARAMETER(param);
+	return NULL;
+}
+
+static bool test_stalled_inputs(void)
+{
+	struct test_input inputs[STALLED_INPUTS + 1] = {0};
+	struct test_input *free_input = &inputs[STALLED_INPUTS];
+	video_t *video = open_video(true);
+	pthread_t thread;
+	uint64_t max_lock_ns;
+	bool thread_created = false;
+	bool success = false;
+	uint32_t skipped;
+	long dropped;
+	long frames;
+	int cached;
+
+	if (!video)
+		return false;
+
+	for (size_t i = 0; i <= STALLED_INPUTS; i++) {
+		inputs[i].gaps = true;
+		inputs[i].repeats = true;
+	}
+
+	for (size_t i = 0; i < STALLED_INPUTS; i++) {
+		inputs[i].stall = true;
+		inputs[i].stall_frame = (uint32_t)i * 2;
+	}
+
+	if (!connect_inputs(video, inputs, STALLED_INPUTS + 1))
+		goto fail;
+	if (pthread_create(&thread, NULL, release_thread, NULL) != 0)
+		goto fail;
+
+	thread_created = true;
+	cached = output_frames(video, STALL_FRAMES, &max_lock_ns);
+
+	pthread_join(thread, NULL);
+	thread_created = false;
+	os_sleep_ms(50);
+
+	success = true;
+	skipped = video_output_get_skipped_frames(video);
+	frames = os_atomic_load_long(&free_input->frames);
+	dropped = get_dropped_frames(video, free_input);
+
+	if (max_lock_ns > MAX_LOCK_MS * 1000000ULL) {
+		fprintf(stderr,
+			"stalled inputs: locking a frame took %.1f ms\n",
+			(double)max_lock_ns / 1000000.0);
+		success = false;
+	}
+	if (!skipped || cached + (int)skipped != STALL_FRAMES) {
+		fprintf(stderr,
+			"stalled inputs: %d frames cached and %u skipped, "
+			"expected %d in total with some skipped\n",
+			cached, skipped, STALL_FRAMES);
+		success = false;
+	}
+	if (frames + dropped < cached || frames > STALL_FRAMES ||
+	    free_input->errors) {
+		fprintf(stderr,
+			"stalled inputs: input got %ld frames and dropped %ld "
+			"for %d cached, %ld out of order\n",
+			frames, dropped, cached, free_input->errors);
+		success = false;
+	}
+
+	printf("stalled inputs: %d frames cached, %u skipped, longest lock "
+	       "%.3f ms\n",
+	       cached, skipped, (double)max_lock_ns / 1000000.0);
+
+fail:
+	os_atomic_set_bool(&stall_released, true);
+	if (thread_created)
+		pthread_join(thread, NULL);
+
+	disconnect_inputs(video, inputs, STALLED_INPUTS + 1);
+	video_output_close(video);
+	return success;
+}
+
+int main(void)
+{
+	bool success;
+
+	name_store = profiler_name_store_create();
+
+	success = test_frames(false);
+	success = test_frames(true) && success;
+	success = test_stalled_inputs() && success;
+
+	profiler_name_store_free(name_store);
+	return success ? 0 : 1;
+}